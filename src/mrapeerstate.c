@@ -36,6 +36,160 @@
 #include "mrtools.h"
 #include "mrapeerstate.h"
 #include "mraheader.h"
+#include "mrpgp.h"
+
+
+/*******************************************************************************
+ * Cache
+ ******************************************************************************/
+
+
+/* Peerstates are read for every recipient of an outgoing message and for the
+sender of every incoming message.  To avoid reading the same rows again and
+again, recently used peerstates - and addresses without a peerstate - are kept
+in a small LRU cache.  mrapeerstate_save_to_db__() writes through the cache, so
+it is always in sync with the table as long as the table is not modified
+otherwise; in this case, call mrmailbox_uncache_e2ee__().
+
+All functions require the sql-lock to be held, there is no extra mutex. */
+
+
+typedef struct mrapeerstatecacheentry_t
+{
+	char*           m_key;       /* the normalized, lowercased address */
+	mrapeerstate_t* m_peerstate; /* NULL if there is no peerstate for the address */
+	unsigned long   m_last_used;
+} mrapeerstatecacheentry_t;
+
+
+typedef struct mrapeerstatecache_t
+{
+	mrapeerstatecacheentry_t m_entries[MR_PEERSTATE_CACHE_SIZE];
+	unsigned long            m_clock;
+} mrapeerstatecache_t;
+
+
+static char* normalize_addr(const char* addr)
+{
+	/* COLLATE NOCASE only folds ASCII characters, so do we */
+	char* ret = safe_strdup(addr), *p;
+	for( p = ret; *p; p++ ) {
+		if( *p >= 'A' && *p <= 'Z' ) {
+			*p += 'a'-'A';
+		}
+	}
+	return ret;
+}
+
+
+static mrapeerstatecacheentry_t* lookup_cache_entry__(mrmailbox_t* mailbox, const char* key)
+{
+	mrapeerstatecache_t* cache = mailbox->m_peerstate_cache;
+	int                  i;
+
+	if( cache == NULL ) {
+		return NULL;
+	}
+
+	for( i = 0; i < MR_PEERSTATE_CACHE_SIZE; i++ ) {
+		if( cache->m_entries[i].m_key && strcmp(cache->m_entries[i].m_key, key)==0 ) {
+			cache->m_entries[i].m_last_used = ++cache->m_clock;
+			return &cache->m_entries[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+static void copy_peerstate(mrapeerstate_t* dst, const mrapeerstate_t* src)
+{
+	free(dst->m_addr);
+	dst->m_addr                = safe_strdup(src->m_addr);
+	dst->m_last_seen           = src->m_last_seen;
+	dst->m_last_seen_autocrypt = src->m_last_seen_autocrypt;
+	dst->m_prefer_encrypt      = src->m_prefer_encrypt;
+	dst->m_to_save             = 0;
+	mrkey_set_from_key(dst->m_public_key, src->m_public_key); /* a copy as the caller may modify the key */
+}
+
+
+static void add_cache_entry__(mrmailbox_t* mailbox, const char* addr, const mrapeerstate_t* peerstate /*may be NULL*/)
+{
+	mrapeerstatecache_t*      cache;
+	mrapeerstatecacheentry_t* entry;
+	char*                     key = normalize_addr(addr);
+	int                       i;
+
+	if( mailbox->m_peerstate_cache == NULL ) {
+		if( (mailbox->m_peerstate_cache=calloc(1, sizeof(mrapeerstatecache_t)))==NULL ) {
+			exit(57);
+		}
+	}
+	cache = mailbox->m_peerstate_cache;
+
+	if( (entry=lookup_cache_entry__(mailbox, key))==NULL ) {
+		entry = &cache->m_entries[0];
+		for( i = 1; i < MR_PEERSTATE_CACHE_SIZE && entry->m_key; i++ ) {
+			if( cache->m_entries[i].m_key==NULL || cache->m_entries[i].m_last_used < entry->m_last_used ) {
+				entry = &cache->m_entries[i]; /* an unused or the least recently used entry so far */
+			}
+		}
+		free(entry->m_key);
+		entry->m_key = key;
+		key = NULL;
+		entry->m_last_used = ++cache->m_clock;
+	}
+
+	if( peerstate ) {
+		if( entry->m_peerstate == NULL ) {
+			entry->m_peerstate = mrapeerstate_new();
+		}
+		copy_peerstate(entry->m_peerstate, peerstate);
+	}
+	else {
+		mrapeerstate_unref(entry->m_peerstate);
+		entry->m_peerstate = NULL;
+	}
+
+	free(key);
+}
+
+
+static void remove_cache_entry__(mrmailbox_t* mailbox, const char* addr)
+{
+	mrapeerstatecacheentry_t* entry;
+	char*                     key = normalize_addr(addr);
+
+	if( (entry=lookup_cache_entry__(mailbox, key))!=NULL ) {
+		free(entry->m_key);
+		entry->m_key = NULL;
+		mrapeerstate_unref(entry->m_peerstate);
+		entry->m_peerstate = NULL;
+		entry->m_last_used = 0;
+	}
+
+	free(key);
+}
+
+
+void mrapeerstate_uncache_all__(mrmailbox_t* mailbox)
+{
+	mrapeerstatecache_t* cache;
+	int                  i;
+
+	if( mailbox==NULL || (cache=mailbox->m_peerstate_cache)==NULL ) {
+		return;
+	}
+
+	for( i = 0; i < MR_PEERSTATE_CACHE_SIZE; i++ ) {
+		free(cache->m_entries[i].m_key);
+		mrapeerstate_unref(cache->m_entries[i].m_peerstate);
+	}
+
+	free(cache);
+	mailbox->m_peerstate_cache = NULL;
+}
 
 
 /*******************************************************************************
@@ -66,8 +220,10 @@ static void mrapeerstate_empty(mrapeerstate_t* ths)
 
 int mrapeerstate_load_from_db__(mrapeerstate_t* ths, mrsqlite3_t* sql, const char* addr)
 {
-	int           success = 0;
-	sqlite3_stmt* stmt;
+	int                       success = 0;
+	sqlite3_stmt*             stmt;
+	char*                     key = NULL;
+	mrapeerstatecacheentry_t* entry;
 
 	if( ths==NULL || sql == NULL || addr == NULL ) {
 		return 0;
@@ -75,21 +231,35 @@ int mrapeerstate_load_from_db__(mrapeerstate_t* ths, mrsqlite3_t* sql, const cha
 
 	mrapeerstate_empty(ths);
 
+	if( sql->m_mailbox && sql==sql->m_mailbox->m_sql ) {
+		key = normalize_addr(addr);
+		if( (entry=lookup_cache_entry__(sql->m_mailbox, key))!=NULL ) {
+			if( entry->m_peerstate ) {
+				copy_peerstate(ths, entry->m_peerstate);
+				success = 1;
+			}
+			goto cleanup;
+		}
+	}
+
 	stmt = mrsqlite3_predefine__(sql, SELECT_aclpp_FROM_acpeerstates_WHERE_a,
 		"SELECT addr, last_seen, last_seen_autocrypt, prefer_encrypted, public_key FROM acpeerstates WHERE addr=? COLLATE NOCASE;");
 	sqlite3_bind_text(stmt, 1, addr, -1, SQLITE_STATIC);
-	if( sqlite3_step(stmt) != SQLITE_ROW ) {
-		goto cleanup;
+	if( sqlite3_step(stmt) == SQLITE_ROW ) {
+		ths->m_addr                = safe_strdup((char*)sqlite3_column_text  (stmt, 0));
+		ths->m_last_seen           =                    sqlite3_column_int64 (stmt, 1);
+		ths->m_last_seen_autocrypt =                    sqlite3_column_int64 (stmt, 2);
+		ths->m_prefer_encrypt      =                    sqlite3_column_int   (stmt, 3);
+		mrkey_set_from_stmt        (ths->m_public_key,                        stmt, 4, MR_PUBLIC);
+		success = 1;
 	}
-	ths->m_addr                = safe_strdup((char*)sqlite3_column_text  (stmt, 0));
-	ths->m_last_seen           =                    sqlite3_column_int64 (stmt, 1);
-	ths->m_last_seen_autocrypt =                    sqlite3_column_int64 (stmt, 2);
-	ths->m_prefer_encrypt      =                    sqlite3_column_int   (stmt, 3);
-	mrkey_set_from_stmt        (ths->m_public_key,                        stmt, 4, MR_PUBLIC);
 
-	success = 1;
+	if( key ) {
+		add_cache_entry__(sql->m_mailbox, addr, success? ths : NULL); /* also remember missing peerstates */
+	}
 
 cleanup:
+	free(key);
 	return success;
 }
 
@@ -122,6 +292,8 @@ int mrapeerstate_save_to_db__(const mrapeerstate_t* ths, mrsqlite3_t* sql, int c
 		if( sqlite3_step(stmt) != SQLITE_DONE ) {
 			goto cleanup;
 		}
+
+		mrpgp_cache_key(sql->m_mailbox, ths->m_public_key); /* replace outdated keys with the same fingerprint */
 	}
 	else if( ths->m_to_save&MRA_SAVE_LAST_SEEN )
 	{
@@ -134,10 +306,22 @@ int mrapeerstate_save_to_db__(const mrapeerstate_t* ths, mrsqlite3_t* sql, int c
 			goto cleanup;
 		}
 	}
+	else
+	{
+		success = 1;
+		goto cleanup; /* nothing written, the cache is still valid */
+	}
+
+	if( sql->m_mailbox && sql==sql->m_mailbox->m_sql ) {
+		add_cache_entry__(sql->m_mailbox, ths->m_addr, ths); /* write through */
+	}
 
 	success = 1;
 
 cleanup:
+	if( !success && sql->m_mailbox && sql==sql->m_mailbox->m_sql ) {
+		remove_cache_entry__(sql->m_mailbox, ths->m_addr); /* the row may be modified partly, read it again next time */
+	}
 	return success;
 }
 
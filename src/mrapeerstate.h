@@ -71,6 +71,9 @@ int             mrapeerstate_apply_header      (mrapeerstate_t*, const mraheader
 int             mrapeerstate_load_from_db__  (mrapeerstate_t*, mrsqlite3_t*, const char* addr);
 int             mrapeerstate_save_to_db__    (const mrapeerstate_t*, mrsqlite3_t*, int create);
 
+#define         MR_PEERSTATE_CACHE_SIZE 256
+void            mrapeerstate_uncache_all__   (mrmailbox_t*);
+
 
 #ifdef __cplusplus
 } /* /extern "C" */
@@ -0,0 +1,596 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ *******************************************************************************
+ *
+ * File:    mrblob.c
+ *
+ ******************************************************************************/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+#include "mrmailbox.h"
+#include "mrblob.h"
+#include "mrtools.h"
+
+#define MR_BLOB_READ_BYTES     (64*1024)
+#define MR_BLOB_MIGRATE_BATCH  50         /* number of files moved to the store per transaction, see mrblob_migrate__() */
+
+
+/*******************************************************************************
+ * Store files
+ ******************************************************************************/
+
+
+static int is_hex_str(const char* p, int len)
+{
+	int i;
+	for( i = 0; i < len; i++ ) {
+		if( !((p[i]>='0' && p[i]<='9') || (p[i]>='a' && p[i]<='f')) ) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+static char* hash_file(const char* pathNfilename, mrmailbox_t* log)
+{
+	/* the file is read in chunks, so big files do not need to be mapped at once */
+	char*         ret = NULL;
+	int           fd = -1, i;
+	ssize_t       read_bytes;
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned char* buf = NULL;
+	EVP_MD_CTX*   ctx = NULL;
+
+	if( (fd=open(pathNfilename, O_RDONLY))<0 ) {
+		mrmailbox_log_warning(log, 0, "Cannot open \"%s\" for hashing.", pathNfilename);
+		goto cleanup;
+	}
+
+	if( (buf=malloc(MR_BLOB_READ_BYTES))==NULL ) {
+		exit(61);
+	}
+
+	if( (ctx=EVP_MD_CTX_create())==NULL ) {
+		exit(62);
+	}
+
+	EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+	while( (read_bytes=read(fd, buf, MR_BLOB_READ_BYTES)) != 0 ) {
+		if( read_bytes < 0 ) {
+			if( errno==EINTR ) {
+				continue;
+			}
+			mrmailbox_log_warning(log, 0, "Cannot read \"%s\" for hashing.", pathNfilename);
+			goto cleanup;
+		}
+		EVP_DigestUpdate(ctx, buf, read_bytes);
+	}
+	EVP_DigestFinal_ex(ctx, digest, NULL);
+
+	if( (ret=malloc(MR_BLOB_HASH_BYTES*2+1))==NULL ) {
+		exit(63);
+	}
+	for( i = 0; i < MR_BLOB_HASH_BYTES; i++ ) {
+		sprintf(&ret[i*2], "%02x", (int)digest[i]);
+	}
+
+cleanup:
+	if( fd >= 0 ) { close(fd); }
+	if( ctx ) { EVP_MD_CTX_destroy(ctx); }
+	free(buf);
+	return ret;
+}
+
+
+char* mrblob_get_temp_pathNfilename(const char* blobdir, mrmailbox_t* log)
+{
+	/* mkstemp() creates the file atomically, so this is safe to be called from several threads at the same time */
+	char* ret = NULL;
+	int   fd;
+
+	if( blobdir == NULL ) {
+		return NULL;
+	}
+
+	ret = mr_mprintf("%s/tmp-XXXXXX", blobdir);
+	if( (fd=mkstemp(ret))<0 ) {
+		mrmailbox_log_warning(log, 0, "Cannot create temporary file in \"%s\".", blobdir);
+		free(ret);
+		return NULL;
+	}
+	close(fd);
+
+	return ret;
+}
+
+
+static void pin__(mrmailbox_t* mailbox, const char* pathNfilename) /* the caller must hold m_blobstore_critical */
+{
+	chashdatum key, value;
+	uintptr_t  cnt = 0;
+
+	key.data = (void*)pathNfilename;
+	key.len  = strlen(pathNfilename);
+	if( chash_get(mailbox->m_blob_pins, &key, &value)==0 ) {
+		cnt = (uintptr_t)value.data;
+	}
+
+	value.data = (void*)(cnt+1); /* the same file may be stored for several messages at the same time */
+	value.len  = 0;
+	chash_set(mailbox->m_blob_pins, &key, &value, NULL);
+}
+
+
+static int is_pinned__(mrmailbox_t* mailbox, const char* pathNfilename) /* the caller must hold m_blobstore_critical */
+{
+	chashdatum key, value;
+
+	key.data = (void*)pathNfilename;
+	key.len  = strlen(pathNfilename);
+	return chash_get(mailbox->m_blob_pins, &key, &value)==0;
+}
+
+
+void mrblob_unpin(mrmailbox_t* mailbox, const char* pathNfilename)
+{
+	chashdatum key, value;
+	uintptr_t  cnt;
+
+	if( mailbox == NULL || pathNfilename == NULL ) {
+		return;
+	}
+
+	key.data = (void*)pathNfilename;
+	key.len  = strlen(pathNfilename);
+
+	pthread_mutex_lock(&mailbox->m_blobstore_critical);
+		if( chash_get(mailbox->m_blob_pins, &key, &value)==0 ) {
+			if( (cnt=(uintptr_t)value.data) > 1 ) {
+				value.data = (void*)(cnt-1);
+				chash_set(mailbox->m_blob_pins, &key, &value, NULL);
+			}
+			else {
+				chash_delete(mailbox->m_blob_pins, &key, NULL);
+			}
+		}
+	pthread_mutex_unlock(&mailbox->m_blobstore_critical);
+}
+
+
+char* mrblob_store_file(const char* blobdir, const char* src_pathNfilename, const char* desired_filename, int pin, mrmailbox_t* mailbox)
+{
+	/* the source file must be on the same file system as the blobdir as it is renamed.  if a file with the same content
+	is already stored, the source file is just deleted (deduplication).  checking for the file and pinning it is done
+	in the same critical section as the deletion of unused files, so the file found cannot be deleted before the
+	message referencing it is added. */
+	char*       ret = NULL, *hash = NULL, *suffix = NULL, *shard = NULL, *dest = NULL;
+	struct stat st;
+	int         locked = 0;
+
+	if( blobdir == NULL || src_pathNfilename == NULL ) {
+		goto cleanup;
+	}
+
+	if( (hash=hash_file(src_pathNfilename, mailbox))==NULL ) {
+		goto cleanup;
+	}
+
+	if( (suffix=mr_get_filesuffix_lc(desired_filename))!=NULL ) {
+		mr_validate_filename(suffix);
+		if( suffix[0]==0 || strlen(suffix)>MR_BLOB_SUFFIX_MAXLEN || strchr(suffix, '.') ) {
+			free(suffix);
+			suffix = NULL;
+		}
+	}
+
+	shard = mr_mprintf("%s/%.2s", blobdir, hash);
+	dest = suffix? mr_mprintf("%s/%s.%s", shard, hash, suffix) : mr_mprintf("%s/%s", shard, hash);
+
+	if( mailbox ) {
+		pthread_mutex_lock(&mailbox->m_blobstore_critical);
+		locked = 1;
+	}
+
+	if( mkdir(shard, 0755)!=0 && errno!=EEXIST ) {
+		mrmailbox_log_warning(mailbox, 0, "Cannot create directory \"%s\".", shard);
+		goto cleanup;
+	}
+
+	if( stat(dest, &st)==0 ) {
+		mr_delete_file(src_pathNfilename, mailbox);
+	}
+	else if( rename(src_pathNfilename, dest)!=0 ) {
+		mrmailbox_log_warning(mailbox, 0, "Cannot move \"%s\" to \"%s\".", src_pathNfilename, dest);
+		goto cleanup;
+	}
+
+	if( pin && mailbox ) {
+		pin__(mailbox, dest);
+	}
+
+	ret = dest;
+	dest = NULL;
+
+cleanup:
+	if( locked ) {
+		pthread_mutex_unlock(&mailbox->m_blobstore_critical);
+	}
+	free(hash);
+	free(suffix);
+	free(shard);
+	free(dest);
+	return ret;
+}
+
+
+int mrblob_is_shard_name(const char* name)
+{
+	return (name && strlen(name)==2 && is_hex_str(name, 2));
+}
+
+
+int mrblob_is_name(const char* name)
+{
+	if( name == NULL || strlen(name) < 3+MR_BLOB_HASH_BYTES*2
+	 || !is_hex_str(name, 2) || name[2]!='/'
+	 || strncmp(name, &name[3], 2)!=0 || !is_hex_str(&name[3], MR_BLOB_HASH_BYTES*2) ) {
+		return 0;
+	}
+
+	name += 3+MR_BLOB_HASH_BYTES*2;
+	return (name[0]==0 || (name[0]=='.' && name[1]!=0 && strchr(name, '/')==NULL && strchr(&name[1], '.')==NULL));
+}
+
+
+const char* mrblob_get_name(const char* blobdir, const char* pathNfilename)
+{
+	size_t blobdir_len;
+
+	if( blobdir == NULL || pathNfilename == NULL ) {
+		return NULL;
+	}
+
+	blobdir_len = strlen(blobdir);
+	if( strncmp(pathNfilename, blobdir, blobdir_len)!=0 || pathNfilename[blobdir_len]!='/'
+	 || !mrblob_is_name(&pathNfilename[blobdir_len+1]) ) {
+		return NULL;
+	}
+
+	return &pathNfilename[blobdir_len+1];
+}
+
+
+/*******************************************************************************
+ * Reference counting
+ ******************************************************************************/
+
+
+int mrblob_delete_unused__(mrmailbox_t* mailbox, const char* name)
+{
+	/* the references are counted by the triggers on msgs.blob; blobs without references are collected first as the
+	rows are deleted meanwhile.  files are stored by mrblob_store_file() before the messages are added to the database,
+	these files are pinned and kept; they are deleted by one of the next calls if they are still unused then. */
+	int           deleted_cnt = 0, i, cnt;
+	carray*       names = carray_new(16);
+	sqlite3_stmt* stmt;
+	char*         pathNfilename;
+
+	if( name ) {
+		stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_name_FROM_blobs_WHERE_name_AND_unused,
+			"SELECT name FROM blobs WHERE name=? AND refs<=0;");
+		sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+	}
+	else {
+		stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_name_FROM_blobs_WHERE_unused,
+			"SELECT name FROM blobs WHERE refs<=0;");
+	}
+
+	while( sqlite3_step(stmt)==SQLITE_ROW ) {
+		carray_add(names, safe_strdup((const char*)sqlite3_column_text(stmt, 0)), NULL);
+	}
+
+	cnt = carray_count(names);
+	for( i = 0; i < cnt; i++ )
+	{
+		char* curr_name = (char*)carray_get(names, i);
+
+		pathNfilename = mr_mprintf("%s/%s", mailbox->m_blobdir, curr_name);
+		pthread_mutex_lock(&mailbox->m_blobstore_critical);
+			if( !is_pinned__(mailbox, pathNfilename) )
+			{
+				stmt = mrsqlite3_predefine__(mailbox->m_sql, DELETE_FROM_blobs_WHERE_name_AND_unused,
+					"DELETE FROM blobs WHERE name=? AND refs<=0;");
+				sqlite3_bind_text(stmt, 1, curr_name, -1, SQLITE_STATIC);
+				sqlite3_step(stmt);
+
+				if( mrblob_is_name(curr_name) && mr_file_exist(pathNfilename) && mr_delete_file(pathNfilename, mailbox) ) {
+					deleted_cnt++;
+				}
+			}
+		pthread_mutex_unlock(&mailbox->m_blobstore_critical);
+
+		free(pathNfilename);
+		free(curr_name);
+	}
+
+	carray_free(names);
+	return deleted_cnt;
+}
+
+
+/*******************************************************************************
+ * Migrate the flat blob-directory of former versions
+ ******************************************************************************/
+
+
+static char* link_to_temp_file(mrmailbox_t* mailbox, const char* pathNfilename)
+{
+	/* the migrated files are hard-linked (or copied, if the file system does not support links) to a temporary file
+	that is moved to the store; the original is kept until all messages are migrated, see mrblob_migrate__() */
+	char* temp_pathNfilename;
+
+	if( (temp_pathNfilename=mrblob_get_temp_pathNfilename(mailbox->m_blobdir, mailbox))==NULL ) {
+		return NULL;
+	}
+
+	unlink(temp_pathNfilename); /* link() and mr_copy_file() do not overwrite existing files */
+	if( link(pathNfilename, temp_pathNfilename)!=0 && !mr_copy_file(pathNfilename, temp_pathNfilename, mailbox) ) {
+		mr_delete_file(temp_pathNfilename, mailbox);
+		free(temp_pathNfilename);
+		return NULL;
+	}
+
+	return temp_pathNfilename;
+}
+
+
+static void link_side_file(mrmailbox_t* mailbox, const char* old_filename, const char* new_filename, const char* side_suffix)
+{
+	/* files as `<name>.waveform` are created by the UI next to the files in the blobdir, see delete_msg_from_db__() */
+	char* old_pathNfilename = mr_mprintf("%s/%s%s", mailbox->m_blobdir, old_filename, side_suffix);
+	char* new_pathNfilename = mr_mprintf("%s/%s%s", mailbox->m_blobdir, new_filename, side_suffix);
+	if( mr_file_exist(old_pathNfilename) && !mr_file_exist(new_pathNfilename) ) {
+		if( link(old_pathNfilename, new_pathNfilename)!=0 ) {
+			mr_copy_file(old_pathNfilename, new_pathNfilename, mailbox);
+		}
+	}
+	free(old_pathNfilename);
+	free(new_pathNfilename);
+}
+
+
+static void delete_migrated_file(mrmailbox_t* mailbox, const char* old_pathNfilename)
+{
+	char* side_pathNfilename;
+
+	mr_delete_file(old_pathNfilename, mailbox);
+
+	side_pathNfilename = mr_mprintf("%s.waveform", old_pathNfilename);
+	if( mr_file_exist(side_pathNfilename) ) {
+		mr_delete_file(side_pathNfilename, mailbox);
+	}
+	free(side_pathNfilename);
+
+	side_pathNfilename = mr_mprintf("%s-preview.jpg", old_pathNfilename);
+	if( mr_file_exist(side_pathNfilename) ) {
+		mr_delete_file(side_pathNfilename, mailbox);
+	}
+	free(side_pathNfilename);
+}
+
+
+static carray* get_ids__(mrmailbox_t* mailbox, const char* query)
+{
+	carray*       ids = carray_new(128);
+	sqlite3_stmt* stmt = mrsqlite3_prepare_v2_(mailbox->m_sql, query);
+	while( stmt && sqlite3_step(stmt)==SQLITE_ROW ) {
+		carray_add(ids, (void*)(uintptr_t)sqlite3_column_int(stmt, 0), NULL);
+	}
+	sqlite3_finalize(stmt);
+	return ids;
+}
+
+
+static void migrate_profile_images__(mrmailbox_t* mailbox, const char* table, chash* moved_files)
+{
+	/* group images are taken from incoming messages, so they may point to files moved to the store */
+	char*         q3 = sqlite3_mprintf("SELECT id FROM %s WHERE param LIKE '%%i=%%';", table);
+	carray*       ids = get_ids__(mailbox, q3);
+	mrparam_t*    param = mrparam_new();
+	sqlite3_stmt* stmt;
+	char*         pathNfilename;
+	chashdatum    key, value;
+	int           i, cnt = carray_count(ids);
+
+	sqlite3_free(q3);
+	for( i = 0; i < cnt; i++ )
+	{
+		int id = (int)(uintptr_t)carray_get(ids, i);
+
+		q3 = sqlite3_mprintf("SELECT param FROM %s WHERE id=%i;", table, id);
+		stmt = mrsqlite3_prepare_v2_(mailbox->m_sql, q3);
+		sqlite3_free(q3);
+		if( stmt && sqlite3_step(stmt)==SQLITE_ROW ) {
+			mrparam_set_packed(param, (const char*)sqlite3_column_text(stmt, 0));
+		}
+		else {
+			mrparam_set_packed(param, NULL);
+		}
+		sqlite3_finalize(stmt);
+
+		if( (pathNfilename=mrparam_get(param, MRP_PROFILE_IMAGE, NULL))!=NULL ) {
+			key.data = pathNfilename;
+			key.len  = strlen(pathNfilename);
+			if( chash_get(moved_files, &key, &value)==0 ) {
+				mrparam_set(param, MRP_PROFILE_IMAGE, (const char*)value.data);
+				q3 = sqlite3_mprintf("UPDATE %s SET param=%Q WHERE id=%i;", table, mrparam_get_packed(param), id);
+				mrsqlite3_execute__(mailbox->m_sql, q3);
+				sqlite3_free(q3);
+			}
+			free(pathNfilename);
+		}
+	}
+
+	mrparam_unref(param);
+	carray_free(ids);
+}
+
+
+int mrblob_migrate__(mrmailbox_t* mailbox)
+{
+	/* the files referenced by messages are moved from the root of the blobdir to the store; files referenced by several
+	messages are moved once, `moved_files` maps the old paths to the new ones.  files outside the blobdir, eg. files
+	sent from the download directory of the device, are left where they are.
+
+	the files are linked to the store and the changed messages are committed in batches; the originals are deleted only
+	after the last batch is committed.  so, if the migration is interrupted, the database never points to a missing
+	file and the next call continues with the remaining messages, the files already in the store are deduplicated. */
+	int           success = 0, transaction_pending = 0, moved_cnt = 0, batch_cnt = 0, i, cnt;
+	size_t        blobdir_len;
+	carray*       ids = NULL;
+	chash*        moved_files = NULL;
+	chashiter*    iter;
+	mrparam_t*    param = mrparam_new();
+	sqlite3_stmt* stmt;
+	char*         old_pathNfilename = NULL, *old_filename = NULL, *new_pathNfilename = NULL, *new_filename = NULL, *temp_pathNfilename = NULL;
+	chashdatum    key, value;
+
+	if( mailbox == NULL || mailbox->m_blobdir == NULL ) {
+		goto cleanup;
+	}
+
+	blobdir_len = strlen(mailbox->m_blobdir);
+	moved_files = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYALL);
+	ids = get_ids__(mailbox, "SELECT id FROM msgs WHERE blob IS NULL AND param LIKE '%f=%';");
+	cnt = carray_count(ids);
+
+	mrsqlite3_begin_transaction__(mailbox->m_sql);
+	transaction_pending = 1;
+
+		for( i = 0; i < cnt; i++ )
+		{
+			int msg_id = (int)(uintptr_t)carray_get(ids, i);
+
+			free(old_pathNfilename);  old_pathNfilename = NULL;
+			free(old_filename);       old_filename = NULL;
+			free(new_pathNfilename);  new_pathNfilename = NULL;
+			free(new_filename);       new_filename = NULL;
+			free(temp_pathNfilename); temp_pathNfilename = NULL;
+
+			if( batch_cnt >= MR_BLOB_MIGRATE_BATCH ) {
+				mrsqlite3_commit__(mailbox->m_sql);
+				mrsqlite3_begin_transaction__(mailbox->m_sql);
+				batch_cnt = 0;
+			}
+
+			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_param_FROM_msgs_WHERE_id,
+				"SELECT param FROM msgs WHERE id=?;");
+			sqlite3_bind_int(stmt, 1, msg_id);
+			if( sqlite3_step(stmt)!=SQLITE_ROW ) {
+				continue;
+			}
+			mrparam_set_packed(param, (const char*)sqlite3_column_text(stmt, 0));
+
+			if( (old_pathNfilename=mrparam_get(param, MRP_FILE, NULL))==NULL
+			 || strncmp(old_pathNfilename, mailbox->m_blobdir, blobdir_len)!=0 || old_pathNfilename[blobdir_len]!='/'
+			 || strchr(&old_pathNfilename[blobdir_len+1], '/')!=NULL ) {
+				continue; /* not in the root of the blobdir */
+			}
+			old_filename = mr_get_filename(old_pathNfilename);
+
+			key.data = old_pathNfilename;
+			key.len  = strlen(old_pathNfilename);
+			if( chash_get(moved_files, &key, &value)==0 ) {
+				new_pathNfilename = safe_strdup((const char*)value.data);
+			}
+			else {
+				if( !mr_file_exist(old_pathNfilename)
+				 || (temp_pathNfilename=link_to_temp_file(mailbox, old_pathNfilename))==NULL
+				 || (new_pathNfilename=mrblob_store_file(mailbox->m_blobdir, temp_pathNfilename, old_filename, 0/*pin, we hold the sql-lock*/, mailbox))==NULL ) {
+					if( temp_pathNfilename ) { mr_delete_file(temp_pathNfilename, mailbox); }
+					continue;
+				}
+
+				new_filename = mr_get_filename(new_pathNfilename);
+				link_side_file(mailbox, old_filename, new_filename, ".waveform");
+				link_side_file(mailbox, old_filename, new_filename, "-preview.jpg");
+
+				value.data = new_pathNfilename;
+				value.len  = strlen(new_pathNfilename)+1;
+				chash_set(moved_files, &key, &value, NULL);
+				moved_cnt++;
+				batch_cnt++;
+			}
+
+			mrparam_set(param, MRP_FILE, new_pathNfilename);
+			if( !mrparam_exists(param, MRP_FILENAME) ) {
+				mrparam_set(param, MRP_FILENAME, old_filename);
+			}
+
+			stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_msgs_SET_param_blob_WHERE_id,
+				"UPDATE msgs SET param=?, blob=? WHERE id=?;");
+			sqlite3_bind_text(stmt, 1, mrparam_get_packed(param), -1, SQLITE_STATIC);
+			sqlite3_bind_text(stmt, 2, mrblob_get_name(mailbox->m_blobdir, new_pathNfilename), -1, SQLITE_STATIC);
+			sqlite3_bind_int (stmt, 3, msg_id);
+			if( sqlite3_step(stmt)!=SQLITE_DONE ) {
+				goto cleanup;
+			}
+		}
+
+		migrate_profile_images__(mailbox, "chats", moved_files);
+		migrate_profile_images__(mailbox, "contacts", moved_files);
+
+		mrsqlite3_set_config_int__(mailbox->m_sql, "blobstore", 1);
+
+	mrsqlite3_commit__(mailbox->m_sql);
+	transaction_pending = 0;
+
+	/* only now, no message points to the originals any longer */
+	for( iter = chash_begin(moved_files); iter != NULL; iter = chash_next(moved_files, iter) ) {
+		chash_key(iter, &key);
+		free(old_pathNfilename);
+		old_pathNfilename = mr_mprintf("%.*s", (int)key.len, (const char*)key.data); /* the keys are not null-terminated */
+		delete_migrated_file(mailbox, old_pathNfilename);
+	}
+
+	mrmailbox_log_info(mailbox, 0, "%i files moved to the blob store.", moved_cnt);
+	success = 1;
+
+cleanup:
+	if( transaction_pending ) {
+		mrsqlite3_commit__(mailbox->m_sql); /* the originals are kept, so the committed messages are valid */
+	}
+	free(old_pathNfilename);
+	free(old_filename);
+	free(new_pathNfilename);
+	free(new_filename);
+	free(temp_pathNfilename);
+	mrparam_unref(param);
+	if( moved_files ) { chash_free(moved_files); }
+	if( ids ) { carray_free(ids); }
+	return success;
+}
@@ -0,0 +1,71 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ *******************************************************************************
+ *
+ * File:    mrblob.h
+ * Purpose: Content-addressed store for the files in the blob-directory
+ *
+ *******************************************************************************
+ *
+ * Files received are named after the hash of their content and are placed in
+ * one of 256 shard directories, `<blobdir>/<xx>/<hash>.<suffix>` where `xx` are
+ * the first two digits of the hash.  Identical files are stored only once.
+ * The original file name is kept in the MRP_FILENAME parameter of the message.
+ *
+ * The messages referencing a stored file have its store-relative name in
+ * msgs.blob; the references are counted by triggers in the table `blobs`, see
+ * mrsqlite3_open__(), so files are deleted when the last message is deleted.
+ *
+ * Files are stored before the messages referencing them are added to the
+ * database; until then, they are pinned in memory and are not deleted as
+ * unused.  Storing and deleting is serialized by m_blobstore_critical.
+ *
+ ******************************************************************************/
+
+
+#ifndef __MRBLOB_H__
+#define __MRBLOB_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*** library-private **********************************************************/
+
+#define MR_BLOB_HASH_BYTES     16     /* the hash is a truncated SHA-256, the names have twice as many hex digits */
+#define MR_BLOB_SUFFIX_MAXLEN  16     /* longer suffixes are not used for the file names in the store */
+
+
+char*       mrblob_get_temp_pathNfilename (const char* blobdir, mrmailbox_t* log); /* creates an empty file in the blobdir to be passed to mrblob_store_file() */
+char*       mrblob_store_file             (const char* blobdir, const char* src_pathNfilename, const char* desired_filename, int pin, mrmailbox_t*); /* moves the file to the store, returns the path in the store; if pin is set, mrblob_unpin() must be called after the message is added */
+void        mrblob_unpin                  (mrmailbox_t*, const char* pathNfilename);
+
+int         mrblob_is_name                (const char* name); /* checks for a store-relative name as `xx/<hash>.<suffix>` */
+int         mrblob_is_shard_name          (const char* name); /* checks for the name of a shard directory */
+const char* mrblob_get_name               (const char* blobdir, const char* pathNfilename); /* returns the store-relative name or NULL, points into pathNfilename */
+
+int         mrblob_delete_unused__        (mrmailbox_t*, const char* name/*NULL=all*/); /* deletes unreferenced files, returns the number of files deleted */
+int         mrblob_migrate__              (mrmailbox_t*); /* moves the files from the flat blobdir of former versions to the store */
+
+
+#ifdef __cplusplus
+} /* /extern "C" */
+#endif
+#endif /* __MRBLOB_H__ */
+
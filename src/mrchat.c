@@ -35,6 +35,7 @@
 #include "mrsmtp.h"
 #include "mrimap.h"
 #include "mrmimefactory.h"
+#include "mrblob.h"
 
 
 /*******************************************************************************
@@ -50,8 +51,8 @@ int mrmailbox_get_fresh_msg_count__(mrmailbox_t* mailbox, uint32_t chat_id)
 {
 	sqlite3_stmt* stmt = NULL;
 
-	stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_COUNT_FROM_msgs_WHERE_state_AND_chat_id,
-		"SELECT COUNT(*) FROM msgs WHERE state=" MR_STRINGIFY(MR_IN_FRESH) " AND chat_id=?;"); /* we have an index over the state-column, this should be sufficient as there are typically only few fresh messages */
+	stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_fresh_cnt_FROM_chats_WHERE_id,
+		"SELECT fresh_cnt FROM chats WHERE id=?;"); /* fresh_cnt is maintained by triggers on msgs, see mrsqlite3_open__() */
 	sqlite3_bind_int(stmt, 1, chat_id);
 
 	if( sqlite3_step(stmt) != SQLITE_ROW ) {
@@ -214,7 +215,7 @@ int mrchat_update_param__(mrchat_t* ths)
 {
 	int success = 0;
 	sqlite3_stmt* stmt = mrsqlite3_prepare_v2_(ths->m_mailbox->m_sql, "UPDATE chats SET param=? WHERE id=?");
-	sqlite3_bind_text(stmt, 1, ths->m_param->m_packed, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 1, mrparam_get_packed(ths->m_param), -1, SQLITE_STATIC);
 	sqlite3_bind_int (stmt, 2, ths->m_id);
 	success = sqlite3_step(stmt)==SQLITE_DONE? 1 : 0;
 	sqlite3_finalize(stmt);
@@ -262,16 +263,26 @@ static int mrchat_set_from_stmt__(mrchat_t* ths, sqlite3_stmt* row)
 
 
 int mrchat_load_from_db__(mrchat_t* ths, uint32_t id)
+{
+	if( ths==NULL ) {
+		return 0;
+	}
+
+	return mrchat_load_from_sql__(ths, ths->m_mailbox->m_sql, id);
+}
+
+
+int mrchat_load_from_sql__(mrchat_t* ths, mrsqlite3_t* sql, uint32_t id) /* sql may be a reader, see mrsqlite3_lock_reader() */
 {
 	sqlite3_stmt* stmt;
 
-	if( ths==NULL ) {
+	if( ths==NULL || sql==NULL ) {
 		return 0;
 	}
 
 	mrchat_empty(ths);
 
-	stmt = mrsqlite3_predefine__(ths->m_mailbox->m_sql, SELECT_itndd_FROM_chats_WHERE_i,
+	stmt = mrsqlite3_predefine__(sql, SELECT_itndd_FROM_chats_WHERE_i,
 		"SELECT " MR_CHAT_FIELDS " FROM chats c WHERE c.id=?;");
 	sqlite3_bind_int(stmt, 1, id);
 
@@ -295,13 +306,12 @@ int mrchat_load_from_db__(mrchat_t* ths, uint32_t id)
 mrchatlist_t* mrmailbox_get_chatlist(mrmailbox_t* ths, const char* query)
 {
 	int success = 0;
-	int db_locked = 0;
+	mrsqlite3_t* reader = NULL;
 	mrchatlist_t* obj = mrchatlist_new(ths);
 
-	mrsqlite3_lock(ths->m_sql);
-	db_locked = 1;
+	reader = mrsqlite3_lock_reader(ths->m_sql);
 
-	if( !mrchatlist_load_from_db__(obj, query) ) {
+	if( !mrchatlist_load_from_db__(obj, reader, query) ) {
 		goto cleanup;
 	}
 
@@ -311,8 +321,8 @@ mrchatlist_t* mrmailbox_get_chatlist(mrmailbox_t* ths, const char* query)
 
 	/* cleanup */
 cleanup:
-	if( db_locked ) {
-		mrsqlite3_unlock(ths->m_sql);
+	if( reader ) {
+		mrsqlite3_unlock(reader);
 	}
 
 	if( success ) {
@@ -328,13 +338,12 @@ cleanup:
 mrchat_t* mrmailbox_get_chat(mrmailbox_t* ths, uint32_t id)
 {
 	int success = 0;
-	int db_locked = 0;
+	mrsqlite3_t* reader = NULL;
 	mrchat_t* obj = mrchat_new(ths);
 
-	mrsqlite3_lock(ths->m_sql);
-	db_locked = 1;
+	reader = mrsqlite3_lock_reader(ths->m_sql);
 
-	if( !mrchat_load_from_db__(obj, id) ) {
+	if( !mrchat_load_from_sql__(obj, reader, id) ) {
 		goto cleanup;
 	}
 
@@ -343,8 +352,8 @@ mrchat_t* mrmailbox_get_chat(mrmailbox_t* ths, uint32_t id)
 
 	/* cleanup */
 cleanup:
-	if( db_locked ) {
-		mrsqlite3_unlock(ths->m_sql);
+	if( reader ) {
+		mrsqlite3_unlock(reader);
 	}
 
 	if( success ) {
@@ -620,7 +629,8 @@ void mrchat_empty(mrchat_t* ths)
 
 carray* mrmailbox_get_fresh_msgs(mrmailbox_t* mailbox)
 {
-	int           show_deaddrop, success = 0, locked = 0;
+	int           show_deaddrop, success = 0;
+	mrsqlite3_t*  reader = NULL;
 	carray*       ret = carray_new(128);
 	sqlite3_stmt* stmt = NULL;
 
@@ -628,12 +638,11 @@ carray* mrmailbox_get_fresh_msgs(mrmailbox_t* mailbox)
 		goto cleanup;
 	}
 
-	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
+	reader = mrsqlite3_lock_reader(mailbox->m_sql);
 
-		show_deaddrop = mrsqlite3_get_config_int__(mailbox->m_sql, "show_deaddrop", 0);
+		show_deaddrop = mrsqlite3_get_config_int__(reader, "show_deaddrop", 0);
 
-		stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_fresh,
+		stmt = mrsqlite3_predefine__(reader, SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_fresh,
 			"SELECT m.id"
 				" FROM msgs m"
 				" LEFT JOIN contacts ct ON m.from_id=ct.id"
@@ -645,14 +654,14 @@ carray* mrmailbox_get_fresh_msgs(mrmailbox_t* mailbox)
 			carray_add(ret, (void*)(uintptr_t)sqlite3_column_int(stmt, 0), NULL);
 		}
 
-	mrsqlite3_unlock(mailbox->m_sql);
-	locked = 0;
+	mrsqlite3_unlock(reader);
+	reader = NULL;
 
 	success = 1;
 
 cleanup:
-	if( locked ) {
-		mrsqlite3_unlock(mailbox->m_sql);
+	if( reader ) {
+		mrsqlite3_unlock(reader);
 	}
 
 	if( success ) {
@@ -667,9 +676,13 @@ cleanup:
 }
 
 
+#define SECONDS_PER_DAY 86400
+
+
 carray* mrmailbox_get_chat_msgs(mrmailbox_t* mailbox, uint32_t chat_id, uint32_t flags, uint32_t marker1before)
 {
-	int           success = 0, locked = 0;
+	int           success = 0;
+	mrsqlite3_t*  reader = NULL;
 	carray*       ret = carray_new(512);
 	sqlite3_stmt* stmt = NULL;
 
@@ -677,16 +690,14 @@ carray* mrmailbox_get_chat_msgs(mrmailbox_t* mailbox, uint32_t chat_id, uint32_t
 	time_t        curr_local_timestamp;
 	int           curr_day, last_day = 0;
 	long          cnv_to_local = mr_gm2local_offset();
-	#define       SECONDS_PER_DAY 86400
 
 	if( mailbox==NULL || ret == NULL ) {
 		goto cleanup;
 	}
 
-	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
+	reader = mrsqlite3_lock_reader(mailbox->m_sql);
 
-		stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_c,
+		stmt = mrsqlite3_predefine__(reader, SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_c,
 			"SELECT m.id, m.timestamp"
 				" FROM msgs m"
 				" LEFT JOIN contacts ct ON m.from_id=ct.id"
@@ -716,16 +727,175 @@ carray* mrmailbox_get_chat_msgs(mrmailbox_t* mailbox, uint32_t chat_id, uint32_t
 			carray_add(ret, (void*)(uintptr_t)curr_id, NULL);
 		}
 
-	mrsqlite3_unlock(mailbox->m_sql);
-	locked = 0;
+	mrsqlite3_unlock(reader);
+	reader = NULL;
 
 	success = 1;
 
 cleanup:
-	if( locked ) {
-		mrsqlite3_unlock(mailbox->m_sql);
+	if( reader ) {
+		mrsqlite3_unlock(reader);
+	}
+
+	if( success ) {
+		return ret;
+	}
+	else {
+		if( ret ) {
+			carray_free(ret);
+		}
+		return NULL;
+	}
+}
+
+
+/*******************************************************************************
+ * Keyset pagination
+ *
+ * Instead of materializing all message IDs of a chat, the following functions
+ * return only the messages before or after an anchor given by (timestamp,id);
+ * the queries are backed by msgs_index6 on (chat_id,timestamp,id), so the
+ * costs depend on the size of the page and not on the size of the chat.
+ ******************************************************************************/
+
+
+typedef struct mrkeysetrow_t
+{
+	uint32_t      m_id;
+	sqlite3_int64 m_timestamp; /* not time_t, which may be 32 bit */
+} mrkeysetrow_t;
+
+
+static void add_keyset_rows__(mrsqlite3_t* reader, uint32_t chat_id, sqlite3_int64 anchor_timestamp, sqlite3_int64 anchor_id,
+                              int before, int limit, mrkeysetrow_t* rows, int* row_cnt)
+{
+	/* appends up to limit rows at rows[*row_cnt]; rows before the anchor are added newest first */
+	sqlite3_stmt* stmt;
+
+	if( before ) {
+		stmt = mrsqlite3_predefine__(reader, SELECT_it_FROM_msgs_LEFT_JOIN_contacts_WHERE_c_before,
+			"SELECT m.id, m.timestamp"
+				" FROM msgs m"
+				" LEFT JOIN contacts ct ON m.from_id=ct.id"
+				" WHERE m.chat_id=? AND ct.blocked=0 AND (m.timestamp<? OR (m.timestamp=? AND m.id<?))"
+				" ORDER BY m.timestamp DESC,m.id DESC LIMIT ?;");
+	}
+	else {
+		stmt = mrsqlite3_predefine__(reader, SELECT_it_FROM_msgs_LEFT_JOIN_contacts_WHERE_c_after,
+			"SELECT m.id, m.timestamp"
+				" FROM msgs m"
+				" LEFT JOIN contacts ct ON m.from_id=ct.id"
+				" WHERE m.chat_id=? AND ct.blocked=0 AND (m.timestamp>? OR (m.timestamp=? AND m.id>?))"
+				" ORDER BY m.timestamp,m.id LIMIT ?;");
+	}
+	sqlite3_bind_int  (stmt, 1, chat_id);
+	sqlite3_bind_int64(stmt, 2, anchor_timestamp);
+	sqlite3_bind_int64(stmt, 3, anchor_timestamp);
+	sqlite3_bind_int64(stmt, 4, anchor_id);
+	sqlite3_bind_int  (stmt, 5, limit);
+	while( limit-- > 0 && sqlite3_step(stmt) == SQLITE_ROW ) {
+		rows[*row_cnt].m_id        = sqlite3_column_int(stmt, 0);
+		rows[*row_cnt].m_timestamp = sqlite3_column_int64(stmt, 1);
+		(*row_cnt)++;
+	}
+}
+
+
+static void reverse_rows(mrkeysetrow_t* rows, int row_cnt)
+{
+	int i;
+	for( i = 0; i < row_cnt/2; i++ ) {
+		mrkeysetrow_t tmp = rows[i];
+		rows[i] = rows[row_cnt-1-i];
+		rows[row_cnt-1-i] = tmp;
+	}
+}
+
+
+static int get_day(sqlite3_int64 timestamp)
+{
+	return (int)((timestamp + mr_gm2local_offset())/SECONDS_PER_DAY);
+}
+
+
+static void rows_to_ids(const mrkeysetrow_t* rows, int first_row, int row_cnt, uint32_t flags, int last_day, carray* ret)
+{
+	/* last_day is the day of the message before the first row, 0 if unknown */
+	int i, curr_day;
+
+	for( i = first_row; i < row_cnt; i++ )
+	{
+		/* add daymarker, if needed */
+		if( flags&MR_GCM_ADDDAYMARKER ) {
+			curr_day = get_day(rows[i].m_timestamp);
+			if( curr_day != last_day ) {
+				carray_add(ret, (void*)MR_MSG_ID_DAYMARKER, NULL);
+				last_day = curr_day;
+			}
+		}
+
+		carray_add(ret, (void*)(uintptr_t)rows[i].m_id, NULL);
+	}
+}
+
+
+carray* mrmailbox_get_chat_msgs_keyset(mrmailbox_t* mailbox, uint32_t chat_id, uint32_t flags, time_t anchor_timestamp, uint32_t anchor_msg_id, int limit)
+{
+	int            success = 0, first_row = 0, last_day = 0, row_cnt = 0;
+	mrsqlite3_t*   reader = NULL;
+	carray*        ret = NULL;
+	mrkeysetrow_t* rows = NULL;
+	sqlite3_int64  ts = anchor_timestamp, id = anchor_msg_id;
+
+	if( mailbox==NULL || limit<0
+	 || (ret=carray_new(limit+32))==NULL
+	 || (rows=malloc(sizeof(mrkeysetrow_t)*(limit+1)))==NULL ) {
+		goto cleanup;
+	}
+
+	reader = mrsqlite3_lock_reader(mailbox->m_sql);
+
+		if( flags&MR_GCM_BEFORE )
+		{
+			if( anchor_msg_id==0 ) {
+				ts = INT64_MAX; /* start at the end of the chat */
+				id = INT64_MAX;
+			}
+
+			/* one more row is read to find out if the first message starts a new day */
+			add_keyset_rows__(reader, chat_id, ts, id, 1, limit+1, rows, &row_cnt);
+			reverse_rows(rows, row_cnt);
+			if( row_cnt > limit ) {
+				last_day = get_day(rows[0].m_timestamp);
+				first_row = 1;
+			}
+		}
+		else
+		{
+			if( anchor_msg_id==0 ) {
+				ts = INT64_MIN; /* start at the beginning of the chat */
+			}
+			else {
+				last_day = get_day(anchor_timestamp);
+			}
+
+			add_keyset_rows__(reader, chat_id, ts, id, 0, limit, rows, &row_cnt);
+		}
+
+	mrsqlite3_unlock(reader);
+	reader = NULL;
+
+	rows_to_ids(rows, first_row, row_cnt, flags, last_day, ret);
+
+	success = 1;
+
+cleanup:
+	if( reader ) {
+		mrsqlite3_unlock(reader);
 	}
 
+	free(rows);
+
 	if( success ) {
 		return ret;
 	}
@@ -738,11 +908,147 @@ cleanup:
 }
 
 
+carray* mrmailbox_get_chat_msgs_page(mrmailbox_t* mailbox, uint32_t chat_id, uint32_t flags, uint32_t around_msg_id, int before_cnt, int after_cnt)
+{
+	int            success = 0, first_row = 0, last_day = 0, row_cnt = 0;
+	mrsqlite3_t*   reader = NULL;
+	carray*        ret = NULL;
+	mrkeysetrow_t* rows = NULL;
+	sqlite3_stmt*  stmt = NULL;
+	sqlite3_int64  anchor_timestamp = INT64_MAX, anchor_id = INT64_MAX;
+
+	if( mailbox==NULL || before_cnt<0 || after_cnt<0
+	 || (ret=carray_new(before_cnt+after_cnt+32))==NULL
+	 || (rows=malloc(sizeof(mrkeysetrow_t)*(before_cnt+after_cnt+1)))==NULL ) {
+		goto cleanup;
+	}
+
+	reader = mrsqlite3_lock_reader(mailbox->m_sql);
+
+		if( around_msg_id > MR_MSG_ID_LAST_SPECIAL ) {
+			stmt = mrsqlite3_predefine__(reader, SELECT_t_FROM_msgs_WHERE_ic,
+				"SELECT timestamp FROM msgs WHERE id=? AND chat_id=?;");
+			sqlite3_bind_int(stmt, 1, around_msg_id);
+			sqlite3_bind_int(stmt, 2, chat_id);
+			if( sqlite3_step(stmt) == SQLITE_ROW ) {
+				anchor_timestamp = sqlite3_column_int64(stmt, 0);
+				anchor_id        = around_msg_id;
+			}
+		}
+
+		/* the messages before the anchor; one more row is read to find out if the first message starts a new day */
+		add_keyset_rows__(reader, chat_id, anchor_timestamp, anchor_id, 1, before_cnt+1, rows, &row_cnt);
+		reverse_rows(rows, row_cnt);
+		if( row_cnt > before_cnt ) {
+			last_day = get_day(rows[0].m_timestamp);
+			first_row = 1;
+		}
+
+		/* the anchor itself and the messages after it */
+		if( anchor_id != INT64_MAX && after_cnt > 0 ) {
+			add_keyset_rows__(reader, chat_id, anchor_timestamp, anchor_id-1, 0, after_cnt, rows, &row_cnt);
+		}
+
+	mrsqlite3_unlock(reader);
+	reader = NULL;
+
+	rows_to_ids(rows, first_row, row_cnt, flags, last_day, ret);
+
+	success = 1;
+
+cleanup:
+	if( reader ) {
+		mrsqlite3_unlock(reader);
+	}
+
+	free(rows);
+
+	if( success ) {
+		return ret;
+	}
+	else {
+		if( ret ) {
+			carray_free(ret);
+		}
+		return NULL;
+	}
+}
+
+
+carray* mrmailbox_get_chat_msgs_since(mrmailbox_t* mailbox, uint32_t chat_id, uint32_t since_msg_id)
+{
+	/* returns the IDs of the messages added to the chat after since_msg_id, ordered as in the chat.
+	As message IDs are increasing, this is a range scan over the rowid; the unary "+" keeps SQLite from using an index
+	on chat_id, which would scan the whole chat. */
+	mrsqlite3_t*  reader = NULL;
+	carray*       ret = carray_new(16);
+	sqlite3_stmt* stmt;
+
+	if( mailbox==NULL || ret==NULL ) {
+		if( ret ) {
+			carray_free(ret);
+		}
+		return NULL;
+	}
+
+	reader = mrsqlite3_lock_reader(mailbox->m_sql);
+
+		stmt = mrsqlite3_predefine__(reader, SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_ic_since,
+			"SELECT m.id"
+				" FROM msgs m"
+				" LEFT JOIN contacts ct ON m.from_id=ct.id"
+				" WHERE m.id>? AND +m.chat_id=? AND ct.blocked=0"
+				" ORDER BY m.timestamp,m.id;");
+		sqlite3_bind_int(stmt, 1, since_msg_id);
+		sqlite3_bind_int(stmt, 2, chat_id);
+		while( sqlite3_step(stmt) == SQLITE_ROW ) {
+			carray_add(ret, (void*)(uintptr_t)sqlite3_column_int(stmt, 0), NULL);
+		}
+
+	mrsqlite3_unlock(reader);
+
+	return ret;
+}
+
+
+static char* get_fts_match(const char* query)
+{
+	/* convert the user's query to a MATCH-expression for msgs_fts: all words must match, each word is used as a prefix
+	for the incremental search; quotes are removed as they would change the meaning, other characters are handled by the tokenizer.
+	Returns NULL if there is nothing to search for. */
+	mrstrbuilder_t ret;
+	char*          words = safe_strdup(query), *word, *p1, *p2;
+	int            word_cnt = 0;
+
+	mrstrbuilder_init(&ret);
+
+	for( p1 = words, p2 = words; *p1; p1++ ) {
+		if( *p1 != '"' ) { *p2++ = *p1; }
+	}
+	*p2 = 0;
+
+	for( word = strtok(words, " \t\r\n"); word; word = strtok(NULL, " \t\r\n") ) {
+		if( word_cnt++ ) { mrstrbuilder_cat(&ret, " "); }
+		mrstrbuilder_cat(&ret, "\"");
+		mrstrbuilder_cat(&ret, word);
+		mrstrbuilder_cat(&ret, "*\"");
+	}
+
+	free(words);
+	if( word_cnt == 0 ) {
+		free(ret.m_buf);
+		return NULL;
+	}
+	return ret.m_buf;
+}
+
+
 carray* mrmailbox_search_msgs(mrmailbox_t* mailbox, uint32_t chat_id, const char* query__)
 {
-	int           success = 0, locked = 0;
+	int           success = 0;
+	mrsqlite3_t*  reader = NULL;
 	carray*       ret = carray_new(100);
-	char*         strLikeInText = NULL, *strLikeBeg=NULL, *query = NULL;
+	char*         strLikeInText = NULL, *strLikeBeg=NULL, *query = NULL, *strMatch = NULL;
 	sqlite3_stmt* stmt = NULL;
 
 	if( mailbox==NULL || ret == NULL || query__ == NULL ) {
@@ -758,31 +1064,49 @@ carray* mrmailbox_search_msgs(mrmailbox_t* mailbox, uint32_t chat_id, const char
 
 	strLikeInText = mr_mprintf("%%%s%%", query);
 	strLikeBeg = mr_mprintf("%s%%", query); /*for the name search, we use "Name%" which is fast as it can use the index ("%Name%" could not). */
+	if( mailbox->m_search_index ) {
+		strMatch = get_fts_match(query);
+	}
 
-	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
+	reader = mrsqlite3_lock_reader(mailbox->m_sql);
 
-		/* Incremental search with "LIKE %query%" cannot take advantages from any index
-		("query%" could for COLLATE NOCASE indexes, see http://www.sqlite.org/optoverview.html#like_opt )
-		An alternative may be the FULLTEXT sqlite stuff, however, this does not really help with incremental search.
-		An extra table with all words and a COLLATE NOCASE indexes may help, however,
-		this must be updated all the time and probably consumes more time than we can save in tenthousands of searches.
-		For now, we just expect the following query to be fast enough :-) */
+		/* If available, we use the full-text index msgs_fts with prefix queries, see mrsqlite3_create_search_index__().
+		Otherwise, incremental search with "LIKE %query%" cannot take advantages from any index
+		("query%" could for COLLATE NOCASE indexes, see http://www.sqlite.org/optoverview.html#like_opt ), so all messages are scanned. */
 		#define QUR1  "SELECT m.id, m.timestamp" \
 		                  " FROM msgs m" \
 		                  " LEFT JOIN contacts ct ON m.from_id=ct.id" \
 		                  " WHERE"
 		#define QUR2      " AND ct.blocked=0 AND (txt LIKE ? OR ct.name LIKE ?)"
-		if( chat_id ) {
-			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_WHERE_chat_id_AND_query,
+		#define QUR2_FTS  " AND ct.blocked=0 AND (m.id IN (SELECT docid FROM msgs_fts WHERE msgs_fts MATCH ?) OR m.from_id IN (SELECT id FROM contacts WHERE name LIKE ?))"
+		if( strMatch ) {
+			if( chat_id ) {
+				stmt = mrsqlite3_predefine__(reader, SELECT_i_FROM_msgs_WHERE_chat_id_AND_fts,
+					QUR1 " m.chat_id=? " QUR2_FTS " ORDER BY m.timestamp,m.id;");
+				sqlite3_bind_int (stmt, 1, chat_id);
+				sqlite3_bind_text(stmt, 2, strMatch, -1, SQLITE_STATIC);
+				sqlite3_bind_text(stmt, 3, strLikeBeg, -1, SQLITE_STATIC);
+			}
+			else {
+				int show_deaddrop = mrsqlite3_get_config_int__(reader, "show_deaddrop", 0);
+				stmt = mrsqlite3_predefine__(reader, SELECT_i_FROM_msgs_WHERE_fts,
+					QUR1 " (m.chat_id>? OR m.chat_id=?) " QUR2_FTS " ORDER BY m.timestamp DESC,m.id DESC;");
+				sqlite3_bind_int (stmt, 1, MR_CHAT_ID_LAST_SPECIAL);
+				sqlite3_bind_int (stmt, 2, show_deaddrop? MR_CHAT_ID_DEADDROP : MR_CHAT_ID_LAST_SPECIAL+1 /*just any ID that is already selected*/);
+				sqlite3_bind_text(stmt, 3, strMatch, -1, SQLITE_STATIC);
+				sqlite3_bind_text(stmt, 4, strLikeBeg, -1, SQLITE_STATIC);
+			}
+		}
+		else if( chat_id ) {
+			stmt = mrsqlite3_predefine__(reader, SELECT_i_FROM_msgs_WHERE_chat_id_AND_query,
 				QUR1 " m.chat_id=? " QUR2 " ORDER BY m.timestamp,m.id;"); /* chats starts with the oldest message*/
 			sqlite3_bind_int (stmt, 1, chat_id);
 			sqlite3_bind_text(stmt, 2, strLikeInText, -1, SQLITE_STATIC);
 			sqlite3_bind_text(stmt, 3, strLikeBeg, -1, SQLITE_STATIC);
 		}
 		else {
-			int show_deaddrop = mrsqlite3_get_config_int__(mailbox->m_sql, "show_deaddrop", 0);
-			stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_i_FROM_msgs_WHERE_query,
+			int show_deaddrop = mrsqlite3_get_config_int__(reader, "show_deaddrop", 0);
+			stmt = mrsqlite3_predefine__(reader, SELECT_i_FROM_msgs_WHERE_query,
 				QUR1 " (m.chat_id>? OR m.chat_id=?) " QUR2 " ORDER BY m.timestamp DESC,m.id DESC;"); /* chat overview starts with the newest message*/
 			sqlite3_bind_int (stmt, 1, MR_CHAT_ID_LAST_SPECIAL);
 			sqlite3_bind_int (stmt, 2, show_deaddrop? MR_CHAT_ID_DEADDROP : MR_CHAT_ID_LAST_SPECIAL+1 /*just any ID that is already selected*/);
@@ -794,17 +1118,18 @@ carray* mrmailbox_search_msgs(mrmailbox_t* mailbox, uint32_t chat_id, const char
 			carray_add(ret, (void*)(uintptr_t)sqlite3_column_int(stmt, 0), NULL);
 		}
 
-	mrsqlite3_unlock(mailbox->m_sql);
-	locked = 0;
+	mrsqlite3_unlock(reader);
+	reader = NULL;
 
 	success = 1;
 
 cleanup:
-	if( locked ) {
-		mrsqlite3_unlock(mailbox->m_sql);
+	if( reader ) {
+		mrsqlite3_unlock(reader);
 	}
 	free(strLikeInText);
 	free(strLikeBeg);
+	free(strMatch);
 	free(query);
 	if( success ) {
 		return ret;
@@ -1013,6 +1338,8 @@ int mrmailbox_delete_chat_part2(mrmailbox_t* mailbox, uint32_t chat_id)
 		mrsqlite3_commit__(mailbox->m_sql);
 		pending_transaction = 0;
 
+		mrblob_delete_unused__(mailbox, NULL); /* delete the files no longer referenced by any message */
+
 	mrsqlite3_unlock(mailbox->m_sql);
 	locked = 0;
 
@@ -1049,7 +1376,7 @@ int mrmailbox_delete_chat(mrmailbox_t* mailbox, uint32_t chat_id)
 		mrparam_set_int(chat->m_param, MRP_DEL_AFTER_SEND, link_msg_to_chat_deletion);
 		mrsqlite3_lock(mailbox->m_sql);
 			sqlite3_stmt* stmt = mrsqlite3_prepare_v2_(mailbox->m_sql, "UPDATE chats SET blocked=1, param=? WHERE id=?;");
-			sqlite3_bind_text (stmt, 1, chat->m_param->m_packed, -1, SQLITE_STATIC);
+			sqlite3_bind_text (stmt, 1, mrparam_get_packed(chat->m_param), -1, SQLITE_STATIC);
 			sqlite3_bind_int  (stmt, 2, chat_id);
 			sqlite3_step(stmt);
 			mrmailbox_set_group_explicitly_left__(mailbox, chat->m_grpid);
@@ -1090,6 +1417,12 @@ void mrmailbox_send_msg_to_imap(mrmailbox_t* mailbox, mrjob_t* job)
 	mrmimefactory_t  mimefactory;
 	char*            server_folder = NULL;
 	uint32_t         server_uid = 0;
+	char*            rendered_file = mrparam_get(job->m_param, MRP_FILE, NULL); /* set if mrmailbox_send_msg_to_smtp() has saved the rendered message, the file is deleted when the job ends, see finish_jobs() */
+	char*            spool_file = NULL;
+	void*            rendered = NULL;
+	size_t           rendered_bytes = 0;
+	const char*      data = NULL;
+	size_t           data_bytes = 0;
 
 	mrmimefactory_init(&mimefactory, mailbox);
 
@@ -1108,11 +1441,34 @@ void mrmailbox_send_msg_to_imap(mrmailbox_t* mailbox, mrjob_t* job)
 		goto cleanup; /* should not happen as we've send the message to the SMTP server before */
 	}
 
-	if( !mrmimefactory_render(&mimefactory, 1/*encrypt to self*/) ) {
-		goto cleanup; /* should not happen as we've send the message to the SMTP server before */
+	/* the rendered message is mapped, not read, so large attachments do not end up on the heap */
+	if( rendered_file && mr_mmap_file(rendered_file, &rendered, &rendered_bytes, mailbox) ) {
+		data       = (const char*)rendered; /* already encrypted to self, no need to render again */
+		data_bytes = rendered_bytes;
 	}
+	else {
+		if( !mrmimefactory_render(&mimefactory, 1/*encrypt to self*/) ) {
+			goto cleanup; /* should not happen as we've send the message to the SMTP server before */
+		}
 
-	if( !mrimap_append_msg(mailbox->m_imap, mimefactory.m_msg->m_timestamp, mimefactory.m_out->str, mimefactory.m_out->len, &server_folder, &server_uid) ) {
+		if( mimefactory.m_out ) {
+			data       = mimefactory.m_out->str;
+			data_bytes = mimefactory.m_out->len;
+		}
+		else {
+			/* IMAP APPEND needs the size before the data, spool the message to a file */
+			spool_file = mr_mprintf("%s/" MR_SPOOL_APPEND_FMT, mailbox->m_blobdir, (unsigned long)mimefactory.m_msg->m_id);
+			if( !mrmimefactory_write_file(&mimefactory, spool_file)
+			 || !mr_mmap_file(spool_file, &rendered, &rendered_bytes, mailbox) ) {
+				mrjob_try_again_later(job, MR_STANDARD_DELAY);
+				goto cleanup;
+			}
+			data       = (const char*)rendered;
+			data_bytes = rendered_bytes;
+		}
+	}
+
+	if( !mrimap_append_msg(mailbox->m_imap, mimefactory.m_msg->m_timestamp, data, data_bytes, &server_folder, &server_uid) ) {
 		mrjob_try_again_later(job, MR_STANDARD_DELAY);
 		goto cleanup;
 	}
@@ -1131,6 +1487,14 @@ void mrmailbox_send_msg_to_imap(mrmailbox_t* mailbox, mrjob_t* job)
 cleanup:
 	mrmimefactory_empty(&mimefactory);
 	free(server_folder);
+	free(rendered_file);
+	if( rendered ) {
+		mr_munmap_file(rendered, rendered_bytes);
+	}
+	if( spool_file ) {
+		mr_delete_file(spool_file, mailbox);
+		free(spool_file);
+	}
 }
 
 
@@ -1150,6 +1514,8 @@ static void mark_as_error(mrmailbox_t* mailbox, mrmsg_t* msg)
 void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
 {
 	mrmimefactory_t mimefactory;
+	int             imap_upload = (mailbox->m_imap->m_server_flags&MR_NO_EXTRA_IMAP_UPLOAD)==0;
+	char*           rendered_file = NULL;
 
 	mrmimefactory_init(&mimefactory, mailbox);
 
@@ -1181,9 +1547,10 @@ void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
 		goto cleanup;
 	}
 
-	/* send message - it's okay if there are not recipients, this is a group with only OURSELF; we only upload to IMAP in this case */
+	/* send message - it's okay if there are not recipients, this is a group with only OURSELF; we only upload to IMAP in this case.
+	If the message is uploaded to IMAP, we encrypt it to self, so that the IMAP job can upload exactly the same data and need not to render and encrypt again. */
 	if( clist_count(mimefactory.m_recipients_addr) > 0 ) {
-		if( !mrmimefactory_render(&mimefactory, 0/*encrypt_to_self*/) ) {
+		if( !mrmimefactory_render(&mimefactory, imap_upload/*encrypt_to_self*/) ) {
 			mark_as_error(mailbox, mimefactory.m_msg);
 			mrmailbox_log_error(mailbox, 0, "Empty message."); /* should not happen */
 			goto cleanup; /* no redo, no IMAP - there won't be more recipients next time. */
@@ -1196,11 +1563,21 @@ void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
 			goto cleanup; /* unrecoverable */
 		}
 
-		if( !mrsmtp_send_msg(mailbox->m_smtp, mimefactory.m_recipients_addr, mimefactory.m_out->str, mimefactory.m_out->len) ) {
+		if( !(mimefactory.m_out? mrsmtp_send_msg(mailbox->m_smtp, mimefactory.m_recipients_addr, mimefactory.m_out->str, mimefactory.m_out->len)
+		                       : mrsmtp_send_mime(mailbox->m_smtp, mimefactory.m_recipients_addr, mimefactory.m_out_mime)) ) {
 			mrsmtp_disconnect(mailbox->m_smtp);
 			mrjob_try_again_later(job, MR_AT_ONCE); /* MR_AT_ONCE is only the _initial_ delay, if the second try failes, the delay gets larger */
 			goto cleanup;
 		}
+
+		/* save the rendered message for mrmailbox_send_msg_to_imap(), the file is deleted when the IMAP job ends */
+		if( imap_upload ) {
+			rendered_file = mr_mprintf("%s/" MR_SPOOL_SENT_FMT, mailbox->m_blobdir, (unsigned long)mimefactory.m_msg->m_id);
+			if( !mrmimefactory_write_file(&mimefactory, rendered_file) ) {
+				free(rendered_file);
+				rendered_file = NULL; /* the IMAP job renders the message itself then */
+			}
+		}
 	}
 
 	/* done */
@@ -1210,11 +1587,7 @@ void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
 		/* debug print? */
 		if( mrsqlite3_get_config_int__(mailbox->m_sql, "save_eml", 0) ) {
 			char* emlname = mr_mprintf("%s/to-smtp-%i.eml", mailbox->m_blobdir, (int)mimefactory.m_msg->m_id);
-			FILE* emlfileob = fopen(emlname, "w");
-			if( emlfileob ) {
-				fwrite(mimefactory.m_out->str, 1, mimefactory.m_out->len, emlfileob);
-				fclose(emlfileob);
-			}
+			mrmimefactory_write_file(&mimefactory, emlname);
 			free(emlname);
 		}
 
@@ -1224,8 +1597,10 @@ void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
 			mrmsg_save_param_to_disk__(mimefactory.m_msg);
 		}
 
-		if( (mailbox->m_imap->m_server_flags&MR_NO_EXTRA_IMAP_UPLOAD)==0 ) {
-			mrjob_add__(mailbox, MRJ_SEND_MSG_TO_IMAP, mimefactory.m_msg->m_id, NULL); /* send message to IMAP in another job */
+		if( imap_upload ) {
+			char* jobparam = rendered_file? mr_mprintf("%c=%s", MRP_FILE, rendered_file) : NULL;
+				mrjob_add__(mailbox, MRJ_SEND_MSG_TO_IMAP, mimefactory.m_msg->m_id, jobparam); /* send message to IMAP in another job */
+			free(jobparam);
 		}
 
 	mrsqlite3_commit__(mailbox->m_sql);
@@ -1235,6 +1610,7 @@ void mrmailbox_send_msg_to_smtp(mrmailbox_t* mailbox, mrjob_t* job)
 
 cleanup:
 	mrmimefactory_empty(&mimefactory);
+	free(rendered_file);
 }
 
 
@@ -1308,7 +1684,7 @@ uint32_t mrchat_send_msg__(mrchat_t* ths, const mrmsg_t* msg, time_t timestamp)
 
 	/* add message to the database */
 	stmt = mrsqlite3_predefine__(ths->m_mailbox->m_sql, INSERT_INTO_msgs_mcftttstpb,
-		"INSERT INTO msgs (rfc724_mid,chat_id,from_id,to_id, timestamp,type,state, txt,param) VALUES (?,?,?,?, ?,?,?, ?,?);");
+		"INSERT INTO msgs (rfc724_mid,chat_id,from_id,to_id, timestamp,type,state, txt,param,blob) VALUES (?,?,?,?, ?,?,?, ?,?,?);");
 	sqlite3_bind_text (stmt,  1, rfc724_mid, -1, SQLITE_STATIC);
 	sqlite3_bind_int  (stmt,  2, MR_CHAT_ID_MSGS_IN_CREATION);
 	sqlite3_bind_int  (stmt,  3, MR_CONTACT_ID_SELF);
@@ -1317,7 +1693,8 @@ uint32_t mrchat_send_msg__(mrchat_t* ths, const mrmsg_t* msg, time_t timestamp)
 	sqlite3_bind_int  (stmt,  6, msg->m_type);
 	sqlite3_bind_int  (stmt,  7, MR_OUT_PENDING);
 	sqlite3_bind_text (stmt,  8, msg->m_text? msg->m_text : "",  -1, SQLITE_STATIC);
-	sqlite3_bind_text (stmt,  9, msg->m_param->m_packed, -1, SQLITE_STATIC);
+	sqlite3_bind_text (stmt,  9, mrparam_get_packed(msg->m_param), -1, SQLITE_STATIC);
+	sqlite3_bind_text (stmt, 10, mrblob_get_name(ths->m_mailbox->m_blobdir, mrparam_peek(msg->m_param, MRP_FILE, NULL)), -1, SQLITE_STATIC); /* set on forwarding */
 	if( sqlite3_step(stmt) != SQLITE_DONE ) {
 		goto cleanup;
 	}
@@ -1392,7 +1769,7 @@ uint32_t mrchat_send_msg(mrchat_t* ths, mrmsg_t* msg)
 
 			if( msg->m_text ) { free(msg->m_text); }
 			if( msg->m_type == MR_MSG_AUDIO ) {
-				char* filename = mr_get_filename(pathNfilename);
+				char* filename = mrmsg_get_filename(msg);
 				char* author = mrparam_get(msg->m_param, MRP_AUTHORNAME, "");
 				char* title = mrparam_get(msg->m_param, MRP_TRACKNAME, "");
 				msg->m_text = mr_mprintf("%s %s %s", filename, author, title); /* for outgoing messages, also add the mediainfo. For incoming messages, this is not needed as the filename is build from these information */
@@ -1401,7 +1778,7 @@ uint32_t mrchat_send_msg(mrchat_t* ths, mrmsg_t* msg)
 				free(title);
 			}
 			else if( MR_MSG_MAKE_FILENAME_SEARCHABLE(msg->m_type) ) {
-				msg->m_text = mr_get_filename(pathNfilename);
+				msg->m_text = mrmsg_get_filename(msg); /* the original name, if forwarded from the blob store */
 			}
 			else if( MR_MSG_MAKE_SUFFIX_SEARCHABLE(msg->m_type) ) {
 				msg->m_text = mr_get_filesuffix_lc(pathNfilename);
@@ -1424,7 +1801,7 @@ uint32_t mrchat_send_msg(mrchat_t* ths, mrmsg_t* msg)
 
 		ths->m_mailbox->m_smtp->m_log_connect_errors = 1;
 
-		msg->m_id = mrchat_send_msg__(ths, msg, mr_create_smeared_timestamp__());
+		msg->m_id = mrchat_send_msg__(ths, msg, mr_create_smeared_timestamp__(ths->m_mailbox));
 
 	mrsqlite3_commit__(ths->m_mailbox->m_sql);
 	mrsqlite3_unlock(ths->m_mailbox->m_sql);
@@ -35,27 +35,33 @@
  ******************************************************************************/
 
 
-int mrchatlist_load_from_db__(mrchatlist_t* ths, const char* query__)
+int mrchatlist_load_from_db__(mrchatlist_t* ths, mrsqlite3_t* sql, const char* query__) /* sql may be a reader, see mrsqlite3_lock_reader() */
 {
 	int           success = 0;
 	sqlite3_stmt* stmt = NULL;
 	int           show_deaddrop;
 	char*         strLikeCmd = NULL, *query = NULL;
+	mrchat_t*     chat = NULL;
+	mrmsg_t*      lastmsg = NULL;
+	mrcontact_t*  lastcontact = NULL;
+	mrpoortext_t* summary;
 
-	if( ths == NULL || ths->m_mailbox == NULL ) {
+	if( ths == NULL || sql == NULL ) {
 		goto cleanup;
 	}
 
 	mrchatlist_empty(ths);
 
-	show_deaddrop = mrsqlite3_get_config_int__(ths->m_mailbox->m_sql, "show_deaddrop", 0);
+	show_deaddrop = mrsqlite3_get_config_int__(sql, "show_deaddrop", 0);
 
-	/* select example with left join and minimum: http://stackoverflow.com/questions/7588142/mysql-left-join-min */
-	#define QUR1 "SELECT c.id, m.id FROM chats c " \
-	                " LEFT JOIN msgs m ON (c.id=m.chat_id AND m.timestamp=(SELECT MAX(timestamp) FROM msgs WHERE chat_id=c.id)) " \
-	                " WHERE (c.id>? OR c.id=?) AND blocked=0"
-	#define QUR2    " GROUP BY c.id " /* GROUP BY is needed as there may be several messages with the same timestamp */ \
-	                " ORDER BY MAX(c.draft_timestamp, IFNULL(m.timestamp,0)) DESC,m.id DESC;" /* the list starts with the newest chats */
+	/* the last message of each chat is cached in chats.last_msg_id (maintained by triggers, see mrsqlite3_open__()), so
+	the summaries are created from a join with the last message and its sender; the order is served by the index on
+	chats.sort_timestamp */
+	#define QUR1 "SELECT c.id, c.last_msg_id, c.type, ct.name, ct.addr, " MR_MSG_FIELDS \
+	             " FROM chats c LEFT JOIN msgs m ON m.id=c.last_msg_id LEFT JOIN contacts ct ON ct.id=m.from_id" \
+	             " WHERE (c.id>? OR c.id=?) AND c.blocked=0"
+	#define QUR2 " ORDER BY c.sort_timestamp DESC, c.last_msg_id DESC;" /* the list starts with the newest chats */
+	#define MSG_OFFSET 5
 
 	if( query__ )
 	{
@@ -66,31 +72,55 @@ int mrchatlist_load_from_db__(mrchatlist_t* ths, const char* query__)
 			goto cleanup;
 		}
 		strLikeCmd = mr_mprintf("%%%s%%", query);
-		stmt = mrsqlite3_predefine__(ths->m_mailbox->m_sql, SELECT_ii_FROM_chats_LEFT_JOIN_msgs_WHERE_query,
+		stmt = mrsqlite3_predefine__(sql, SELECT_ii_FROM_chats_LEFT_JOIN_msgs_WHERE_query,
 			QUR1 " AND c.name LIKE ? " QUR2);
 		sqlite3_bind_text(stmt, 3, strLikeCmd, -1, SQLITE_STATIC);
 	}
 	else
 	{
-		stmt = mrsqlite3_predefine__(ths->m_mailbox->m_sql, SELECT_ii_FROM_chats_LEFT_JOIN_msgs,
+		stmt = mrsqlite3_predefine__(sql, SELECT_ii_FROM_chats_LEFT_JOIN_msgs,
 			QUR1 QUR2);
 	}
 
 	sqlite3_bind_int(stmt, 1, MR_CHAT_ID_LAST_SPECIAL);
 	sqlite3_bind_int(stmt, 2, show_deaddrop? MR_CHAT_ID_DEADDROP : 0);
 
+	chat        = mrchat_new(ths->m_mailbox);
+	lastmsg     = mrmsg_new();
+	lastcontact = mrcontact_new();
 
     while( sqlite3_step(stmt) == SQLITE_ROW )
     {
 		#define IDS_PER_RESULT 2
 		carray_add(ths->m_chatNlastmsg_ids, (void*)(uintptr_t)sqlite3_column_int(stmt, 0), NULL);
 		carray_add(ths->m_chatNlastmsg_ids, (void*)(uintptr_t)sqlite3_column_int(stmt, 1), NULL);
+
+		summary = NULL;
+		if( sqlite3_column_type(stmt, MSG_OFFSET) != SQLITE_NULL )
+		{
+			mrmsg_set_from_stmt__(lastmsg, stmt, MSG_OFFSET);
+			if( lastmsg->m_from_id != 0 )
+			{
+				chat->m_type = sqlite3_column_int(stmt, 2); /* the only field used by mrpoortext_fill() */
+
+				mrcontact_empty(lastcontact);
+				lastcontact->m_name = strdup_keep_null((const char*)sqlite3_column_text(stmt, 3));
+				lastcontact->m_addr = strdup_keep_null((const char*)sqlite3_column_text(stmt, 4));
+
+				summary = mrpoortext_new();
+				mrpoortext_fill(summary, lastmsg, chat, lastcontact);
+			}
+		}
+		carray_add(ths->m_summaries, summary, NULL);
     }
 
 	ths->m_cnt = carray_count(ths->m_chatNlastmsg_ids)/IDS_PER_RESULT;
 	success = 1;
 
 cleanup:
+	mrchat_unref(chat);
+	mrmsg_unref(lastmsg);
+	mrcontact_unref(lastcontact);
 	free(query);
 	free(strLikeCmd);
 	return success;
@@ -111,7 +141,8 @@ mrchatlist_t* mrchatlist_new(mrmailbox_t* mailbox)
 	}
 
 	ths->m_mailbox = mailbox;
-	if( (ths->m_chatNlastmsg_ids=carray_new(128))==NULL ) {
+	if( (ths->m_chatNlastmsg_ids=carray_new(128))==NULL
+	 || (ths->m_summaries=carray_new(64))==NULL ) {
 		exit(32);
 	}
 
@@ -127,15 +158,22 @@ void mrchatlist_unref(mrchatlist_t* ths)
 
 	mrchatlist_empty(ths);
 	carray_free(ths->m_chatNlastmsg_ids);
+	carray_free(ths->m_summaries);
 	free(ths);
 }
 
 
 void mrchatlist_empty(mrchatlist_t* ths)
 {
+	int i;
+
 	if( ths  ) {
 		ths->m_cnt = 0;
 		carray_set_size(ths->m_chatNlastmsg_ids, 0);
+		for( i = 0; i < (int)carray_count(ths->m_summaries); i++ ) {
+			mrpoortext_unref((mrpoortext_t*)carray_get(ths->m_summaries, i));
+		}
+		carray_set_size(ths->m_summaries, 0);
 	}
 }
 
@@ -166,40 +204,23 @@ mrpoortext_t* mrchatlist_get_summary_by_index(mrchatlist_t* chatlist, size_t ind
 	This is because we may want to display drafts here or stuff as
 	"is typing".
 	Also, sth. as "No messages" would not work if the summary comes from a
-	message. */
+	message.
 
-	mrpoortext_t* ret = mrpoortext_new();
-	uint32_t      lastmsg_id = 0;
-	mrmsg_t*      lastmsg = NULL;
-	mrcontact_t*  lastcontact = NULL;
+	The summary of the last message is created by mrchatlist_load_from_db__(), so no query is needed here. */
+
+	mrpoortext_t*       ret = mrpoortext_new();
+	const mrpoortext_t* lastmsg_summary;
 
 	if( chatlist == NULL || index >= chatlist->m_cnt || chat == NULL ) {
 		ret->m_text2 = safe_strdup("ErrNoChat");
 		goto cleanup;
 	}
 
-	lastmsg_id = (uint32_t)(uintptr_t)carray_get(chatlist->m_chatNlastmsg_ids, index*IDS_PER_RESULT+1);
-
-	/* load data from database */
-	if( lastmsg_id )
-	{
-		mrsqlite3_lock(chatlist->m_mailbox->m_sql);
-
-			lastmsg = mrmsg_new();
-			mrmsg_load_from_db__(lastmsg, chatlist->m_mailbox, lastmsg_id);
-
-			if( lastmsg->m_from_id != MR_CONTACT_ID_SELF  &&  chat->m_type == MR_CHAT_GROUP )
-			{
-				lastcontact = mrcontact_new();
-				mrcontact_load_from_db__(lastcontact, chatlist->m_mailbox->m_sql, lastmsg->m_from_id);
-			}
-
-		mrsqlite3_unlock(chatlist->m_mailbox->m_sql);
-	}
+	lastmsg_summary = (const mrpoortext_t*)carray_get(chatlist->m_summaries, index);
 
 	if( chat->m_draft_timestamp
 	 && chat->m_draft_text
-	 && (lastmsg==NULL || chat->m_draft_timestamp>lastmsg->m_timestamp) )
+	 && (lastmsg_summary==NULL || chat->m_draft_timestamp>lastmsg_summary->m_timestamp) )
 	{
 		/* show the draft as the last message */
 		ret->m_text1 = mrstock_str(MR_STR_DRAFT);
@@ -210,7 +231,7 @@ mrpoortext_t* mrchatlist_get_summary_by_index(mrchatlist_t* chatlist, size_t ind
 
 		ret->m_timestamp = chat->m_draft_timestamp;
 	}
-	else if( lastmsg == NULL || lastmsg->m_from_id == 0 )
+	else if( lastmsg_summary == NULL )
 	{
 		/* no messages */
 		ret->m_text2 = mrstock_str(MR_STR_NOMESSAGES);
@@ -218,12 +239,14 @@ mrpoortext_t* mrchatlist_get_summary_by_index(mrchatlist_t* chatlist, size_t ind
 	else
 	{
 		/* show the last message */
-		mrpoortext_fill(ret, lastmsg, chat, lastcontact);
+		ret->m_text1         = strdup_keep_null(lastmsg_summary->m_text1);
+		ret->m_text1_meaning = lastmsg_summary->m_text1_meaning;
+		ret->m_text2         = strdup_keep_null(lastmsg_summary->m_text2);
+		ret->m_timestamp     = lastmsg_summary->m_timestamp;
+		ret->m_state         = lastmsg_summary->m_state;
 	}
 
 cleanup:
-	mrmsg_unref(lastmsg);
-	mrcontact_unref(lastcontact);
 	return ret;
 }
 
@@ -39,6 +39,7 @@ typedef struct mrchatlist_t
 {
 	size_t       m_cnt;
 	carray*      m_chatNlastmsg_ids;
+	carray*      m_summaries;        /* mrpoortext_t* of the last message of each chat, NULL if there is no message */
 	mrmailbox_t* m_mailbox;
 } mrchatlist_t;
 
@@ -53,7 +54,7 @@ mrpoortext_t* mrchatlist_get_summary_by_index(mrchatlist_t*, size_t index, mrcha
 
 /*** library-private **********************************************************/
 
-int           mrchatlist_load_from_db__    (mrchatlist_t*, const char* query);
+int           mrchatlist_load_from_db__    (mrchatlist_t*, mrsqlite3_t*, const char* query);
 
 
 #ifdef __cplusplus
@@ -27,27 +27,51 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include "mrmailbox.h"
 #include "mrcmdline.h"
 #include "mrapeerstate.h"
 #include "mrtools.h"
+#include "mrblob.h"
 #include "mrkey.h"
+#include "mrhost.h"
+#include "mrsimplify.h"
 
 
 static void log_msglist(mrmailbox_t* mailbox, carray* msglist)
 {
-	int i, cnt = carray_count(msglist), lines_out = 0;
+	int           i, cnt = carray_count(msglist), lines_out = 0;
+	uint32_t*     ids = calloc(cnt+1, sizeof(uint32_t));
+	uint32_t*     from_ids = calloc(cnt+1, sizeof(uint32_t));
+	mrmsg_t**     msgs = calloc(cnt+1, sizeof(mrmsg_t*));
+	mrcontact_t** contacts = calloc(cnt+1, sizeof(mrcontact_t*));
+	if( ids==NULL || from_ids==NULL || msgs==NULL || contacts==NULL ) {
+		exit(54);
+	}
+
+	/* load all messages and their senders at once */
+	for( i = 0; i < cnt; i++ ) {
+		ids[i] = (uint32_t)(uintptr_t)carray_get(msglist, i);
+	}
+	mrmailbox_get_msgs(mailbox, ids, cnt, msgs);
+	for( i = 0; i < cnt; i++ ) {
+		from_ids[i] = msgs[i]? msgs[i]->m_from_id : 0;
+	}
+	mrmailbox_get_contacts(mailbox, from_ids, cnt, contacts);
+
 	for( i = 0; i < cnt; i++ )
 	{
-		uint32_t msg_id = (uint32_t)(uintptr_t)carray_get(msglist, i);
-		if( msg_id == MR_MSG_ID_DAYMARKER ) {
+		if( ids[i] == MR_MSG_ID_DAYMARKER ) {
 			mrmailbox_log_info(mailbox, 0, "--------------------------------------------------------------------------------"); lines_out++;
 		}
-		else if( msg_id > 0 ) {
+		else if( msgs[i] ) {
 			if( lines_out==0 ) { mrmailbox_log_info(mailbox, 0, "--------------------------------------------------------------------------------"); lines_out++; }
 
-			mrmsg_t* msg = mrmailbox_get_msg(mailbox, msg_id);
-			mrcontact_t* contact = mrmailbox_get_contact(mailbox, msg->m_from_id);
+			mrmsg_t* msg = msgs[i];
+			mrcontact_t* contact = contacts[i];
 			const char* contact_name = (contact && contact->m_name)? contact->m_name : "ErrName";
 			int contact_id = contact? contact->m_id : 0;
 
@@ -66,13 +90,19 @@ static void log_msglist(mrmailbox_t* mailbox, carray* msglist)
 					statestr,
 					temp2);
 			free(temp2);
-
-			mrcontact_unref(contact);
-			mrmsg_unref(msg);
 		}
 	}
 
 	if( lines_out > 0 ) { mrmailbox_log_info(mailbox, 0, "--------------------------------------------------------------------------------"); }
+
+	for( i = 0; i < cnt; i++ ) {
+		mrcontact_unref(contacts[i]);
+		mrmsg_unref(msgs[i]);
+	}
+	free(contacts);
+	free(msgs);
+	free(from_ids);
+	free(ids);
 }
 
 
@@ -115,6 +145,621 @@ static void log_contactlist(mrmailbox_t* mailbox, carray* contacts)
 }
 
 
+/* benchmark the latency of typical UI queries while another thread writes to the database */
+#define BENCHSQL_WRITER_HOLD_MS 200
+static int s_benchsql_writer_done = 0;
+
+
+static void* benchsql_writer_entry_point(void* entry_arg)
+{
+	mrmailbox_t* mailbox = (mrmailbox_t*)entry_arg;
+	int          i = 0;
+
+	while( !s_benchsql_writer_done )
+	{
+		/* simulate eg. a large incoming message that is written inside a single transaction */
+		mrsqlite3_lock(mailbox->m_sql);
+		mrsqlite3_begin_transaction__(mailbox->m_sql);
+			mrsqlite3_set_config_int__(mailbox->m_sql, "benchsql_dummy", i++);
+			usleep(BENCHSQL_WRITER_HOLD_MS*1000);
+		mrsqlite3_commit__(mailbox->m_sql);
+		mrsqlite3_unlock(mailbox->m_sql);
+		usleep(1000);
+	}
+
+	mrsqlite3_lock(mailbox->m_sql);
+		mrsqlite3_set_config__(mailbox->m_sql, "benchsql_dummy", NULL);
+	mrsqlite3_unlock(mailbox->m_sql);
+	return NULL;
+}
+
+
+static void benchsql_round(mrmailbox_t* mailbox, int rounds, double* ret_avg_ms, double* ret_max_ms)
+{
+	int i;
+	double start, elapsed, total = 0, max = 0;
+
+	for( i = 0; i < rounds; i++ )
+	{
+		start = mr_now_ms();
+			mrchatlist_t* chatlist = mrmailbox_get_chatlist(mailbox, NULL);
+			if( chatlist && mrchatlist_get_cnt(chatlist) > 0 ) {
+				mrchat_t* chat = mrchatlist_get_chat_by_index(chatlist, 0);
+				mrpoortext_t* summary = mrchatlist_get_summary_by_index(chatlist, 0, chat);
+				carray* msglist = mrmailbox_get_chat_msgs(mailbox, chat? chat->m_id : 0, 0, 0);
+				if( msglist ) { carray_free(msglist); }
+				mrpoortext_unref(summary);
+				mrchat_unref(chat);
+			}
+			mrchatlist_unref(chatlist);
+		elapsed = mr_now_ms() - start;
+
+		total += elapsed;
+		if( elapsed > max ) { max = elapsed; }
+		usleep(5000);
+	}
+
+	*ret_avg_ms = rounds>0? total/rounds : 0;
+	*ret_max_ms = max;
+}
+
+
+static char* benchsql(mrmailbox_t* mailbox, int rounds)
+{
+	pthread_t writer_thread;
+	double    idle_avg, idle_max, busy_avg, busy_max;
+
+	benchsql_round(mailbox, rounds, &idle_avg, &idle_max);
+
+	s_benchsql_writer_done = 0;
+	pthread_create(&writer_thread, NULL, benchsql_writer_entry_point, mailbox);
+		benchsql_round(mailbox, rounds, &busy_avg, &busy_max);
+	s_benchsql_writer_done = 1;
+	pthread_join(writer_thread, NULL);
+
+	return mr_mprintf("%i rounds of get_chatlist()+get_summary()+get_chat_msgs():\n"
+		"idle database:   avg %.2f ms, max %.2f ms\n"
+		"writer active:   avg %.2f ms, max %.2f ms (the writer holds the lock for %i ms per transaction)",
+		rounds, idle_avg, idle_max, busy_avg, busy_max, BENCHSQL_WRITER_HOLD_MS);
+}
+
+
+/* benchmark message search with and without the full-text index on a temporary database with 10k, 100k, 1M messages */
+static double benchsearch_query_ms(mrsqlite3_t* sql, const char* querystr, const char* arg, int* ret_cnt)
+{
+	int           i, rounds = 5;
+	double        start = mr_now_ms();
+	sqlite3_stmt* stmt = mrsqlite3_prepare_v2_(sql, querystr);
+
+	if( stmt == NULL ) {
+		return -1;
+	}
+
+	for( i = 0; i < rounds; i++ ) {
+		sqlite3_reset(stmt);
+		sqlite3_bind_text(stmt, 1, arg, -1, SQLITE_STATIC);
+		*ret_cnt = 0;
+		while( sqlite3_step(stmt) == SQLITE_ROW ) {
+			(*ret_cnt)++;
+		}
+	}
+
+	sqlite3_finalize(stmt);
+	return (mr_now_ms()-start) / rounds;
+}
+
+
+static char* benchsearch(mrmailbox_t* mailbox, int max_msgs)
+{
+	mrstrbuilder_t ret;
+	mrsqlite3_t*   sql = mrsqlite3_new(mailbox);
+	char*          dbfile = mr_mprintf("%s/benchsearch.db", mailbox->m_blobdir);
+	char*          txt;
+	sqlite3_stmt*  stmt;
+	int            msg_cnt = 0, target, like_cnt, fts_cnt;
+	double         like_ms, fts_ms;
+
+	mrstrbuilder_init(&ret);
+	mr_delete_file(dbfile, mailbox);
+
+	if( !mrsqlite3_open__(sql, dbfile, 0) ) {
+		mrstrbuilder_cat(&ret, "ERROR: Cannot create temporary database.");
+		goto cleanup;
+	}
+
+	if( !mrsqlite3_get_config_int__(sql, "search_index", 0) ) {
+		mrstrbuilder_cat(&ret, "Full-text index not available, SQLite compiled without FTS?\n");
+	}
+
+	srand(0);
+	for( target = 10000; target <= max_msgs; target *= 10 )
+	{
+		mrsqlite3_begin_transaction__(sql);
+			stmt = mrsqlite3_prepare_v2_(sql, "INSERT INTO msgs (chat_id, from_id, timestamp, txt) VALUES (10, 10, ?, ?);");
+			while( msg_cnt < target ) {
+				txt = mr_mprintf("message %i w%i w%i w%i w%i w%i, just some words to make it look like a typical text",
+					msg_cnt, rand()%50000, rand()%50000, rand()%50000, rand()%50000, rand()%50000);
+				sqlite3_reset(stmt);
+				sqlite3_bind_int (stmt, 1, msg_cnt);
+				sqlite3_bind_text(stmt, 2, txt, -1, SQLITE_STATIC);
+				sqlite3_step(stmt);
+				free(txt);
+				msg_cnt++;
+			}
+			sqlite3_finalize(stmt);
+		mrsqlite3_commit__(sql);
+
+		like_ms = benchsearch_query_ms(sql, "SELECT id FROM msgs WHERE txt LIKE ?;", "%w1234%", &like_cnt);
+		fts_ms  = benchsearch_query_ms(sql, "SELECT docid FROM msgs_fts WHERE msgs_fts MATCH ?;", "\"w1234*\"", &fts_cnt);
+
+		txt = mr_mprintf("%7i messages: LIKE %8.2f ms (%i hits), FTS %8.2f ms (%i hits)\n", msg_cnt, like_ms, like_cnt, fts_ms, fts_cnt);
+		mrstrbuilder_cat(&ret, txt);
+		free(txt);
+	}
+
+cleanup:
+	mrsqlite3_close__(sql);
+	mrsqlite3_unref(sql);
+	mr_delete_file(dbfile, mailbox);
+	free(dbfile);
+	return ret.m_buf;
+}
+
+
+/* benchmark the peak memory used to receive messages with 1, 10, 100 MB attachments; the messages are imported into the current database */
+static long benchingest_peak_rss_kb()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss; /* high-water mark, kilobytes on Linux */
+}
+
+
+static int benchingest_write_eml(const char* pathNfilename, int attachment_mb)
+{
+	static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	char   line[80];
+	size_t i, lines = ((size_t)attachment_mb*1024*1024 + 56) / 57; /* 57 bytes are 76 base64 characters */
+	FILE*  f = fopen(pathNfilename, "wb");
+
+	if( f == NULL ) {
+		return 0;
+	}
+
+	fprintf(f, "From: Bench <bench@example.org>\r\n"
+		"To: bench@example.org\r\n"
+		"Subject: benchingest %i MB\r\n"
+		"Message-ID: <benchingest-%i-%lu@example.org>\r\n"
+		"Date: Thu, 1 Jan 2015 00:00:00 +0000\r\n"
+		"MIME-Version: 1.0\r\n"
+		"Content-Type: multipart/mixed; boundary=\"bench\"\r\n"
+		"\r\n"
+		"--bench\r\n"
+		"Content-Type: text/plain; charset=utf-8\r\n"
+		"\r\n"
+		"attachment follows\r\n"
+		"--bench\r\n"
+		"Content-Type: application/octet-stream; name=\"benchingest.bin\"\r\n"
+		"Content-Transfer-Encoding: base64\r\n"
+		"Content-Disposition: attachment; filename=\"benchingest.bin\"\r\n"
+		"\r\n", attachment_mb, attachment_mb, (unsigned long)time(NULL));
+
+	for( i = 0; i < lines; i++ ) {
+		int j;
+		for( j = 0; j < 76; j++ ) {
+			line[j] = b64[(i*7+j*13)%64];
+		}
+		line[76] = '\r';
+		line[77] = '\n';
+		fwrite(line, 1, 78, f);
+	}
+
+	fprintf(f, "--bench--\r\n");
+	fclose(f);
+	return 1;
+}
+
+
+static char* benchingest(mrmailbox_t* mailbox, int max_mb)
+{
+	mrstrbuilder_t ret;
+	char*          emlfile = mr_mprintf("%s/benchingest.eml", mailbox->m_blobdir);
+	int            mb;
+
+	mrstrbuilder_init(&ret);
+
+	for( mb = 1; mb <= max_mb; mb *= 10 )
+	{
+		long   rss_before, rss_after;
+		double start, elapsed;
+		char*  txt;
+
+		if( !benchingest_write_eml(emlfile, mb) ) {
+			mrstrbuilder_cat(&ret, "ERROR: Cannot write temporary file.");
+			break;
+		}
+
+		rss_before = benchingest_peak_rss_kb();
+		start = mr_now_ms();
+			mrmailbox_poke_eml_file(mailbox, emlfile);
+		elapsed = mr_now_ms() - start;
+		rss_after = benchingest_peak_rss_kb();
+
+		txt = mr_mprintf("%4i MB attachment: %8.2f ms, peak RSS %li KB (+%li KB)\n", mb, elapsed, rss_after, rss_after-rss_before);
+		mrstrbuilder_cat(&ret, txt);
+		free(txt);
+
+		mr_delete_file(emlfile, mailbox);
+	}
+
+	free(emlfile);
+	return ret.m_buf;
+}
+
+
+/* benchmark reading the typical parameters of a message: the former text scan (one scan and one malloc() per value)
+against mrparam_get() and the borrowed mrparam_peek() on the decoded table */
+static char* benchparam_legacy_get(const char* packed, int key)
+{
+	const char *p1 = packed, *p2;
+	while( p1 && *p1 ) {
+		if( *p1 == key && p1[1] == '=' ) {
+			p1 += 2;
+			if( (p2=strchr(p1, '\n'))==NULL ) {
+				p2 = p1 + strlen(p1);
+			}
+			char* ret = mr_null_terminate(p1, p2-p1);
+			mr_rtrim(ret);
+			return ret;
+		}
+		if( (p1=strchr(p1, '\n'))!=NULL ) {
+			p1++;
+		}
+	}
+	return NULL;
+}
+
+
+static char* benchparam(int rounds)
+{
+	static const char* packed = "f=/storage/emulated/0/Android/data/com.b44t.messenger/files/IMG_20171012_123456.jpg\n"
+	                            "m=image/jpeg\nw=1024\nh=768\nN=Author\nn=Track name\nc=1\nr=1";
+	static const int   keys[] = { MRP_FILE, MRP_MIMETYPE, MRP_WIDTH, MRP_HEIGHT, MRP_TRACKNAME, MRP_GUARANTEE_E2EE, MRP_WANTS_MDN, MRP_SYSTEM_CMD };
+	#define            BENCHPARAM_KEYS (sizeof(keys)/sizeof(keys[0]))
+	mrparam_t*         param = mrparam_new();
+	double             start, legacy_ms, get_ms, peek_ms;
+	size_t             sum = 0;
+	int                i, k;
+
+	start = mr_now_ms();
+	for( i = 0; i < rounds; i++ ) {
+		char* copy = safe_strdup(packed); /* as done by the former mrparam_set_packed() */
+		for( k = 0; k < (int)BENCHPARAM_KEYS; k++ ) {
+			char* value = benchparam_legacy_get(copy, keys[k]);
+			sum += value? strlen(value) : 0;
+			free(value);
+		}
+		free(copy);
+	}
+	legacy_ms = mr_now_ms() - start;
+
+	start = mr_now_ms();
+	for( i = 0; i < rounds; i++ ) {
+		mrparam_set_packed(param, packed); /* as done when loading a message */
+		for( k = 0; k < (int)BENCHPARAM_KEYS; k++ ) {
+			char* value = mrparam_get(param, keys[k], NULL);
+			sum += value? strlen(value) : 0;
+			free(value);
+		}
+	}
+	get_ms = mr_now_ms() - start;
+
+	start = mr_now_ms();
+	for( i = 0; i < rounds; i++ ) {
+		mrparam_set_packed(param, packed);
+		for( k = 0; k < (int)BENCHPARAM_KEYS; k++ ) {
+			const char* value = mrparam_peek(param, keys[k], NULL);
+			sum += value? strlen(value) : 0;
+		}
+	}
+	peek_ms = mr_now_ms() - start;
+
+	mrparam_unref(param);
+
+	return mr_mprintf("%i messages with %i lookups each (checksum %lu):\n"
+		"text scan:      %8.1f ns/message\n"
+		"mrparam_get():  %8.1f ns/message\n"
+		"mrparam_peek(): %8.1f ns/message",
+		rounds, (int)BENCHPARAM_KEYS, (unsigned long)sum,
+		legacy_ms*1000000.0/rounds, get_ms*1000000.0/rounds, peek_ms*1000000.0/rounds);
+}
+
+
+/* benchmark storing 1k, 10k, 100k received files named "image.jpg" (as sent by mrmimefactory) in a flat directory
+using mr_get_fine_pathNfilename() and in the blob store, see mrblob.h; every 10th file has the same content as the one before */
+static void benchblobs_delete_dir(const char* dir)
+{
+	DIR*           dir_handle;
+	struct dirent* dir_entry;
+	struct stat    st;
+	char*          pathNfilename;
+
+	if( (dir_handle=opendir(dir))==NULL ) {
+		return;
+	}
+
+	while( (dir_entry=readdir(dir_handle))!=NULL ) {
+		if( strcmp(dir_entry->d_name, ".")==0 || strcmp(dir_entry->d_name, "..")==0 ) {
+			continue;
+		}
+		pathNfilename = mr_mprintf("%s/%s", dir, dir_entry->d_name);
+		if( stat(pathNfilename, &st)==0 && S_ISDIR(st.st_mode) ) {
+			benchblobs_delete_dir(pathNfilename);
+		}
+		else {
+			remove(pathNfilename);
+		}
+		free(pathNfilename);
+	}
+
+	closedir(dir_handle);
+	rmdir(dir);
+}
+
+
+static char* benchblobs(mrmailbox_t* mailbox, int max_blobs)
+{
+	mrstrbuilder_t ret;
+	char*          flat_dir = mr_mprintf("%s/benchblobs-flat", mailbox->m_blobdir);
+	char*          store_dir = mr_mprintf("%s/benchblobs-store", mailbox->m_blobdir);
+	char*          content, *pathNfilename, *line;
+	int            blob_cnt = 0, target, last_target = 0, flat_failed = 0, store_failed = 0;
+	double         start, flat_ms = 0, store_ms = 0;
+
+	mrstrbuilder_init(&ret);
+	benchblobs_delete_dir(flat_dir);
+	benchblobs_delete_dir(store_dir);
+	if( !mr_create_folder(flat_dir, mailbox) || !mr_create_folder(store_dir, mailbox) ) {
+		mrstrbuilder_cat(&ret, "ERROR: Cannot create temporary directories.");
+		goto cleanup;
+	}
+
+	for( target = 1000; target <= max_blobs; target *= 10 )
+	{
+		flat_ms = 0;
+		store_ms = 0;
+		while( blob_cnt < target ) {
+			content = mr_mprintf("image data %i", (blob_cnt%10==9)? blob_cnt-1 : blob_cnt);
+
+			start = mr_now_ms();
+				if( (pathNfilename=mr_get_fine_pathNfilename(flat_dir, "image.jpg"))==NULL
+				 || !mr_write_file(pathNfilename, content, strlen(content), mailbox) ) {
+					flat_failed++;
+				}
+			flat_ms += mr_now_ms() - start;
+			free(pathNfilename);
+
+			start = mr_now_ms();
+				char* tmp_pathNfilename = mrblob_get_temp_pathNfilename(store_dir, mailbox);
+				if( tmp_pathNfilename==NULL
+				 || !mr_write_file(tmp_pathNfilename, content, strlen(content), mailbox)
+				 || (pathNfilename=mrblob_store_file(store_dir, tmp_pathNfilename, "image.jpg", 0/*pin*/, mailbox))==NULL ) {
+					store_failed++;
+					pathNfilename = NULL;
+				}
+			store_ms += mr_now_ms() - start;
+			free(pathNfilename);
+			free(tmp_pathNfilename);
+
+			free(content);
+			blob_cnt++;
+		}
+
+		line = mr_mprintf("%7i files: flat %8.1f us/file (%i failed), store %8.1f us/file (%i failed)\n",
+			blob_cnt, flat_ms*1000.0/(blob_cnt-last_target), flat_failed, store_ms*1000.0/(blob_cnt-last_target), store_failed);
+		mrstrbuilder_cat(&ret, line);
+		free(line);
+		last_target = target;
+	}
+
+cleanup:
+	benchblobs_delete_dir(flat_dir);
+	benchblobs_delete_dir(store_dir);
+	free(flat_dir);
+	free(store_dir);
+	return ret.m_buf;
+}
+
+
+/* benchmark the memory and the threads used by 10, 100, 1000 opened, unconfigured mailboxes created by mrmailbox_new()
+and by mrhost_new_mailbox(); configured mailboxes add the connections, but not more threads in host mode */
+static long benchhost_proc_status(const char* key)
+{
+	char  line[256];
+	long  ret = 0;
+	FILE* f = fopen("/proc/self/status", "r");
+	if( f == NULL ) {
+		return 0;
+	}
+	while( fgets(line, sizeof(line), f) ) {
+		if( strncmp(line, key, strlen(key))==0 ) {
+			ret = atol(line+strlen(key));
+			break;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+
+static char* benchhost_round(mrmailbox_t* mailbox, const char* dir, int accounts, int hosted)
+{
+	mrhost_t*     host = hosted? mrhost_new(0) : NULL;
+	mrmailbox_t** mailboxes = calloc(accounts, sizeof(mrmailbox_t*));
+	char*         dbfile, *blobdir, *ret;
+	long          rss_before, threads_before, rss_after, threads_after;
+	double        start, open_ms;
+	int           i;
+
+	if( mailboxes == NULL ) {
+		exit(67);
+	}
+
+	rss_before     = benchhost_proc_status("VmRSS:");
+	threads_before = benchhost_proc_status("Threads:");
+	start          = mr_now_ms();
+
+	for( i = 0; i < accounts; i++ ) {
+		dbfile  = mr_mprintf("%s/%i.db", dir, i);
+		blobdir = mr_mprintf("%s/%i", dir, i);
+		mr_create_folder(blobdir, mailbox);
+		mailboxes[i] = hosted? mrhost_new_mailbox(host, NULL, NULL) : mrmailbox_new(NULL, NULL);
+		mrmailbox_open(mailboxes[i], dbfile, blobdir);
+		free(dbfile);
+		free(blobdir);
+	}
+
+	open_ms       = mr_now_ms() - start;
+	rss_after     = benchhost_proc_status("VmRSS:");
+	threads_after = benchhost_proc_status("Threads:");
+
+	for( i = 0; i < accounts; i++ ) {
+		mrmailbox_unref(mailboxes[i]);
+	}
+	free(mailboxes);
+	mrhost_unref(host);
+
+	ret = mr_mprintf("%5i accounts %s: %6.1f KB and %5.2f threads per account, %6.1f ms to open\n",
+		accounts, hosted? "hosted    " : "standalone", (double)(rss_after-rss_before)/accounts, (double)(threads_after-threads_before)/accounts, open_ms/accounts);
+	benchblobs_delete_dir(dir);
+	mr_create_folder(dir, mailbox);
+	return ret;
+}
+
+
+static char* benchhost(mrmailbox_t* mailbox, int max_accounts)
+{
+	mrstrbuilder_t ret;
+	char*          dir = mr_mprintf("%s/benchhost", mailbox->m_blobdir);
+	char*          line;
+	int            accounts, hosted;
+
+	mrstrbuilder_init(&ret);
+	benchblobs_delete_dir(dir);
+	if( !mr_create_folder(dir, mailbox) ) {
+		mrstrbuilder_cat(&ret, "ERROR: Cannot create temporary directory.");
+		goto cleanup;
+	}
+
+	for( accounts = 10; accounts <= max_accounts; accounts *= 10 ) {
+		for( hosted = 0; hosted <= 1; hosted++ ) {
+			line = benchhost_round(mailbox, dir, accounts, hosted);
+			mrstrbuilder_cat(&ret, line);
+			free(line);
+		}
+	}
+
+cleanup:
+	benchblobs_delete_dir(dir);
+	free(dir);
+	return ret.m_buf;
+}
+
+
+/* benchmark the conversion of HTML mails to simplified text; the corpus is a directory with the HTML parts of real mails,
+if no directory is given, newsletters of 10 KB, 100 KB and 1 MB are generated */
+#define BENCHDEHTML_MAX_FILES 1000
+
+
+static char* benchdehtml_newsletter(size_t bytes)
+{
+	static const char* block = "<table width=\"100%\" cellpadding=\"0\" style=\"border:0\"><tr><td class=\"hl\" align=\"left\">\n"
+		"<h2 style='font-family:Arial'>News &amp; Updates &ndash; Week&nbsp;42</h2>\n"
+		"<p>Lorem ipsum dolor sit amet, <b>consectetur</b> adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore "
+		"magna aliqua. <a href=\"https://example.org/track?id=4711&amp;u=abc\">Read more &raquo;</a><br>\n"
+		"Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat.</p>\n"
+		"<!-- tracking --><img src=\"https://example.org/pixel.gif\" width=1 height=1 alt=\"\" />\n"
+		"</td></tr></table>\n";
+	mrstrbuilder_t ret;
+	mrstrbuilder_init(&ret);
+	mrstrbuilder_cat(&ret, "<!DOCTYPE html><html><head><style>td{padding:0}</style><title>Newsletter</title></head><body>\n");
+	while( (size_t)(ret.m_eos-ret.m_buf) < bytes ) {
+		mrstrbuilder_cat(&ret, block);
+	}
+	mrstrbuilder_cat(&ret, "</body></html>\n");
+	return ret.m_buf;
+}
+
+
+static char* benchdehtml(mrmailbox_t* mailbox, const char* dir)
+{
+	char*          files[BENCHDEHTML_MAX_FILES];
+	size_t         files_bytes[BENCHDEHTML_MAX_FILES], total_bytes = 0, out_bytes = 0;
+	int            files_cnt = 0, i, rounds = 0;
+	double         start, elapsed;
+	long           rss_before;
+	DIR*           dir_handle;
+	struct dirent* dir_entry;
+	mrsimplify_t*  simplify = mrsimplify_new();
+
+	if( dir ) {
+		if( (dir_handle=opendir(dir))==NULL ) {
+			return safe_strdup("ERROR: Cannot open directory.");
+		}
+		while( (dir_entry=readdir(dir_handle))!=NULL && files_cnt < BENCHDEHTML_MAX_FILES ) {
+			char* pathNfilename = mr_mprintf("%s/%s", dir, dir_entry->d_name);
+			void* buf = NULL;
+			if( dir_entry->d_name[0] != '.' && mr_read_file(pathNfilename, &buf, &files_bytes[files_cnt], mailbox) ) {
+				files[files_cnt++] = buf;
+			}
+			free(pathNfilename);
+		}
+		closedir(dir_handle);
+	}
+	else {
+		for( i = 0; i < 3; i++ ) {
+			files[files_cnt] = benchdehtml_newsletter(10*1024 * (i==0? 1 : (i==1? 10 : 100)));
+			files_bytes[files_cnt] = strlen(files[files_cnt]);
+			files_cnt++;
+		}
+	}
+
+	if( files_cnt == 0 ) {
+		mrsimplify_unref(simplify);
+		return safe_strdup("ERROR: No files found.");
+	}
+
+	for( i = 0; i < files_cnt; i++ ) {
+		total_bytes += files_bytes[i];
+	}
+
+	rss_before = benchingest_peak_rss_kb();
+	start = mr_now_ms();
+		do {
+			for( i = 0; i < files_cnt; i++ ) {
+				char* plain = mrsimplify_simplify(simplify, files[i], files_bytes[i], 1);
+				out_bytes += strlen(plain);
+				free(plain);
+			}
+			rounds++;
+		} while( mr_now_ms()-start < 1000.0 ); /* run for at least one second */
+	elapsed = mr_now_ms() - start;
+
+	for( i = 0; i < files_cnt; i++ ) {
+		free(files[i]);
+	}
+	mrsimplify_unref(simplify);
+
+	return mr_mprintf("%i HTML parts, %.1f KB, %i rounds:\n"
+		"%.1f MB/s, %.3f ms per message, %.1f%% of the HTML returned as text\n"
+		"peak memory grew by %li KB",
+		files_cnt, total_bytes/1024.0, rounds,
+		(double)total_bytes*rounds / (1024.0*1024.0) / (elapsed/1000.0), elapsed/((double)files_cnt*rounds),
+		(double)out_bytes*100.0/((double)total_bytes*rounds),
+		benchingest_peak_rss_kb()-rss_before);
+}
+
+
 static int s_is_auth = 0;
 
 
@@ -156,7 +801,7 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 			"open <file to open or create>\n"
 			"close\n"
 			"reset <flags>\n"
-			"imex export-keys|import-keys <setup-code>|export-backup|import-backup|cancel\n"
+			"imex export-keys|import-keys <setup-code>|export-backup [incremental]|import-backup|cancel\n"
 			"hasbackup\n"
 			"poke [<eml-file>|<folder>|<addr> <key-file>]\n"
 			"set <configuration-key> [<value>]\n"
@@ -201,6 +846,13 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 			"event <event-id to test>\n"
 			"fileinfo <file>\n"
 			"heartbeat\n"
+			"benchsql [<rounds>]\n"
+			"benchsearch [<max. messages>]\n"
+			"benchingest [<max. MB>]\n"
+			"benchparam [<rounds>]\n"
+			"benchblobs [<max. files>]\n"
+			"benchhost [<max. accounts>]\n"
+			"benchdehtml [<directory with HTML parts>]\n"
 			"clear -- clear screen\n" /* must be implemented by  the caller */
 			"exit" /* must be implemented by  the caller */
 		);
@@ -274,8 +926,8 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 				mrmailbox_imex(mailbox, MR_IMEX_IMPORT_SELF_KEYS, mailbox->m_blobdir, NULL);
 				ret = COMMAND_SUCCEEDED;
 			}
-			else if( strcmp(arg1, "export-backup")==0 && arg2==NULL ) {
-				mrmailbox_imex(mailbox, MR_IMEX_EXPORT_BACKUP, mailbox->m_blobdir, NULL);
+			else if( strcmp(arg1, "export-backup")==0 ) {
+				mrmailbox_imex(mailbox, (arg2&&strcmp(arg2, "incremental")==0)? MR_IMEX_EXPORT_BACKUP_INCREMENTAL : MR_IMEX_EXPORT_BACKUP, mailbox->m_blobdir, NULL);
 				ret = COMMAND_SUCCEEDED;
 			}
 			else if( strcmp(arg1, "import-backup")==0 && arg2!=NULL ) {
@@ -793,6 +1445,40 @@ char* mrmailbox_cmdline(mrmailbox_t* mailbox, const char* cmdline)
 		mrmailbox_heartbeat(mailbox);
 		ret = COMMAND_SUCCEEDED;
 	}
+	else if( strcmp(cmd, "benchsql")==0 )
+	{
+		int rounds = arg1? atoi(arg1) : 100;
+		ret = benchsql(mailbox, rounds>0? rounds : 100);
+	}
+	else if( strcmp(cmd, "benchsearch")==0 )
+	{
+		int max_msgs = arg1? atoi(arg1) : 1000000;
+		ret = benchsearch(mailbox, max_msgs>=10000? max_msgs : 10000);
+	}
+	else if( strcmp(cmd, "benchingest")==0 )
+	{
+		int max_mb = arg1? atoi(arg1) : 100;
+		ret = benchingest(mailbox, max_mb>=1? max_mb : 1);
+	}
+	else if( strcmp(cmd, "benchparam")==0 )
+	{
+		int rounds = arg1? atoi(arg1) : 1000000;
+		ret = benchparam(rounds>0? rounds : 1000000);
+	}
+	else if( strcmp(cmd, "benchblobs")==0 )
+	{
+		int max_blobs = arg1? atoi(arg1) : 100000;
+		ret = benchblobs(mailbox, max_blobs>=1000? max_blobs : 1000);
+	}
+	else if( strcmp(cmd, "benchhost")==0 )
+	{
+		int max_accounts = arg1? atoi(arg1) : 100;
+		ret = benchhost(mailbox, max_accounts>=10? max_accounts : 10);
+	}
+	else if( strcmp(cmd, "benchdehtml")==0 )
+	{
+		ret = benchdehtml(mailbox, arg1);
+	}
 	else
 	{
 		ret = COMMAND_UNKNOWN;
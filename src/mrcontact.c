@@ -314,6 +314,18 @@ cleanup:
 }
 
 
+#define MR_CONTACT_FIELDS " id, name, addr, origin, blocked, authname "
+static void set_from_stmt(mrcontact_t* ths, sqlite3_stmt* row) /* field order must be MR_CONTACT_FIELDS */
+{
+	ths->m_id               =         (uint32_t)sqlite3_column_int  (row, 0);
+	ths->m_name             = safe_strdup((char*)sqlite3_column_text (row, 1));
+	ths->m_addr             = safe_strdup((char*)sqlite3_column_text (row, 2));
+	ths->m_origin           =                    sqlite3_column_int  (row, 3);
+	ths->m_blocked          =                    sqlite3_column_int  (row, 4);
+	ths->m_authname         = safe_strdup((char*)sqlite3_column_text (row, 5));
+}
+
+
 int mrcontact_load_from_db__(mrcontact_t* ths, mrsqlite3_t* sql, uint32_t contact_id)
 {
 	int           success = 0;
@@ -326,18 +338,13 @@ int mrcontact_load_from_db__(mrcontact_t* ths, mrsqlite3_t* sql, uint32_t contac
 	mrcontact_empty(ths);
 
 	stmt = mrsqlite3_predefine__(sql, SELECT_naob_FROM_contacts_i,
-		"SELECT name, addr, origin, blocked, authname FROM contacts WHERE id=?;");
+		"SELECT " MR_CONTACT_FIELDS " FROM contacts WHERE id=?;");
 	sqlite3_bind_int(stmt, 1, contact_id);
 	if( sqlite3_step(stmt) != SQLITE_ROW ) {
 		goto cleanup;
 	}
 
-	ths->m_id               = contact_id;
-	ths->m_name             = safe_strdup((char*)sqlite3_column_text (stmt, 0));
-	ths->m_addr             = safe_strdup((char*)sqlite3_column_text (stmt, 1));
-	ths->m_origin           =                    sqlite3_column_int  (stmt, 2);
-	ths->m_blocked          =                    sqlite3_column_int  (stmt, 3);
-	ths->m_authname         = safe_strdup((char*)sqlite3_column_text (stmt, 4));
+	set_from_stmt(ths, stmt);
 
 	/* success */
 	success = 1;
@@ -548,6 +555,95 @@ mrcontact_t* mrmailbox_get_contact(mrmailbox_t* ths, uint32_t contact_id)
 }
 
 
+int mrmailbox_get_contacts(mrmailbox_t* ths, const uint32_t* contact_ids, int contact_cnt, mrcontact_t** ret_contacts)
+{
+	/* load the contacts for a window of IDs using one lock and one statement per MR_BULK_LOAD_CHUNK IDs,
+	instead of calling mrmailbox_get_contact() for each ID */
+	int           loaded_cnt = 0, first, last, i;
+	mrsqlite3_t*  reader = NULL;
+	mridpos_t*    sorted = NULL;
+	char*         idsstr = NULL, *q3 = NULL, *self_addr = NULL;
+	sqlite3_stmt* stmt = NULL;
+	uint32_t      id;
+
+	if( ths==NULL || contact_ids==NULL || contact_cnt<=0 || ret_contacts==NULL ) {
+		return 0;
+	}
+
+	memset(ret_contacts, 0, sizeof(mrcontact_t*)*contact_cnt);
+
+	sorted = mr_sort_ids(contact_ids, contact_cnt);
+
+	reader = mrsqlite3_lock_reader(ths->m_sql);
+
+		for( first = 0; first < contact_cnt && sorted[first].m_id <= MR_CONTACT_ID_LAST_SPECIAL; first++ )
+		{
+			if( sorted[first].m_id == MR_CONTACT_ID_SELF )
+			{
+				if( self_addr == NULL ) {
+					self_addr = mrsqlite3_get_config__(reader, "configured_addr", NULL);
+				}
+				mrcontact_t* contact = mrcontact_new();
+				contact->m_id   = MR_CONTACT_ID_SELF;
+				contact->m_name = mrstock_str(MR_STR_SELF);
+				contact->m_addr = strdup_keep_null(self_addr);
+				ret_contacts[sorted[first].m_pos] = contact;
+				loaded_cnt++;
+			}
+		}
+
+		for( ; first < contact_cnt; first = last )
+		{
+			last = first+MR_BULK_LOAD_CHUNK < contact_cnt? first+MR_BULK_LOAD_CHUNK : contact_cnt;
+
+			idsstr = mr_idpos_to_string(&sorted[first], last-first);
+			q3 = sqlite3_mprintf("SELECT " MR_CONTACT_FIELDS " FROM contacts WHERE id IN(%s) ORDER BY id;", idsstr);
+			stmt = mrsqlite3_prepare_v2_(reader, q3);
+			if( stmt==NULL ) {
+				goto cleanup;
+			}
+
+			i = first;
+			while( sqlite3_step(stmt)==SQLITE_ROW )
+			{
+				id = (uint32_t)sqlite3_column_int(stmt, 0);
+				while( i < last && sorted[i].m_id < id ) {
+					i++;
+				}
+				while( i < last && sorted[i].m_id == id ) { /* the same ID may be requested several times */
+					mrcontact_t* contact = mrcontact_new();
+					set_from_stmt(contact, stmt);
+					ret_contacts[sorted[i].m_pos] = contact;
+					loaded_cnt++;
+					i++;
+				}
+			}
+
+			sqlite3_finalize(stmt);
+			stmt = NULL;
+			sqlite3_free(q3);
+			q3 = NULL;
+			free(idsstr);
+			idsstr = NULL;
+		}
+
+cleanup:
+	if( reader ) {
+		mrsqlite3_unlock(reader);
+	}
+	if( stmt ) {
+		sqlite3_finalize(stmt);
+	}
+	if( q3 ) {
+		sqlite3_free(q3);
+	}
+	free(idsstr);
+	free(self_addr);
+	free(sorted);
+	return loaded_cnt;
+}
+
+
 int mrmailbox_block_contact(mrmailbox_t* mailbox, uint32_t contact_id, int new_blocking)
 {
 	int success = 0, locked = 0, send_event = 0, transaction_pending = 0;
@@ -27,6 +27,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include "mrmailbox.h"
 #include "mrdehtml.h"
 #include "mrsaxparser.h"
@@ -42,11 +43,44 @@ typedef struct dehtml_t
     #define DO_ADD_REMOVE_LINEENDS   1
     #define DO_ADD_PRESERVE_LINEENDS 2
     int     m_add_text;
-    char*   m_last_href;
+    mrstrbuilder_t m_last_href; /* the buffer is reused for all links */
+    int     m_has_last_href;
 
 } dehtml_t;
 
 
+static void dehtml_cat(dehtml_t* dehtml, const char* text, int remove_lineends)
+{
+	/* `\r` is not added; if lineends are removed, `\n` is converted to a space or is not added directly after another lineend -
+	this avoids converting `text1<br>\ntext2` to `text1\n text2`.  The text is compacted in the output buffer, so there is no additional pass */
+	char* start, *p, *q;
+
+	if( (p=q=mrstrbuilder_cat(&dehtml->m_strbuilder, text)) == NULL ) {
+		return;
+	}
+	start = dehtml->m_strbuilder.m_buf; /* read after mrstrbuilder_cat() as the buffer may be reallocated */
+
+	for( ; *p; p++ ) {
+		if( *p == '\r' ) {
+			continue;
+		}
+		else if( *p == '\n' && remove_lineends ) {
+			if( q == start || q[-1] == '\n' ) {
+				continue;
+			}
+			*(q++) = ' ';
+		}
+		else {
+			*(q++) = *p;
+		}
+	}
+	*q = 0;
+
+	dehtml->m_strbuilder.m_free += (int)(p - q);
+	dehtml->m_strbuilder.m_eos   = q;
+}
+
+
 static void dehtml_starttag_cb(void* userdata, const char* tag, char** attr)
 {
 	dehtml_t* dehtml = (dehtml_t*)userdata;
@@ -72,9 +106,11 @@ static void dehtml_starttag_cb(void* userdata, const char* tag, char** attr)
 	}
 	else if( strcmp(tag, "a")==0 )
 	{
-		free(dehtml->m_last_href);
-		dehtml->m_last_href = strdup_keep_null(mrattr_find(attr, "href"));
-		if( dehtml->m_last_href ) {
+		const char* href = mrattr_find(attr, "href");
+		mrstrbuilder_empty(&dehtml->m_last_href);
+		mrstrbuilder_cat(&dehtml->m_last_href, href);
+		dehtml->m_has_last_href = href? 1 : 0;
+		if( dehtml->m_has_last_href ) {
 			mrstrbuilder_cat(&dehtml->m_strbuilder, "[");
 		}
 	}
@@ -95,32 +131,7 @@ static void dehtml_text_cb(void* userdata, const char* text, int len)
 
 	if( dehtml->m_add_text != DO_NOT_ADD )
 	{
-		char* last_added = mrstrbuilder_cat(&dehtml->m_strbuilder, text);
-
-		if( dehtml->m_add_text==DO_ADD_REMOVE_LINEENDS )
-		{
-			unsigned char* p = (unsigned char*)last_added;
-			while( *p ) {
-				if( *p=='\n' ) {
-					int last_is_lineend = 1; /* avoid converting `text1<br>\ntext2` to `text1\n text2` (`\r` is removed later) */
-					const unsigned char* p2 = p-1;
-					while( p2>=(const unsigned char*)dehtml->m_strbuilder.m_buf ) {
-						if( *p2 == '\r' ) {
-						}
-						else if( *p2 == '\n' ) {
-							break;
-						}
-						else {
-							last_is_lineend = 0;
-							break;
-						}
-						p2--;
-					}
-					*p = last_is_lineend? '\r' : ' ';
-				}
-				p++;
-			}
-		}
+		dehtml_cat(dehtml, text, dehtml->m_add_text==DO_ADD_REMOVE_LINEENDS);
 	}
 }
 
@@ -138,12 +149,11 @@ static void dehtml_endtag_cb(void* userdata, const char* tag)
 	}
 	else if( strcmp(tag, "a")==0 )
 	{
-		if( dehtml->m_last_href ) {
+		if( dehtml->m_has_last_href ) {
 			mrstrbuilder_cat(&dehtml->m_strbuilder, "](");
-			mrstrbuilder_cat(&dehtml->m_strbuilder, dehtml->m_last_href);
+			dehtml_cat(dehtml, dehtml->m_last_href.m_buf, 0);
 			mrstrbuilder_cat(&dehtml->m_strbuilder, ")");
-			free(dehtml->m_last_href);
-			dehtml->m_last_href = NULL;
+			dehtml->m_has_last_href = 0;
 		}
 	}
 	else if( strcmp(tag, "b")==0 || strcmp(tag, "strong")==0 )
@@ -157,10 +167,18 @@ static void dehtml_endtag_cb(void* userdata, const char* tag)
 }
 
 
-char* mr_dehtml(char* buf_terminated)
+char* mr_dehtml(const char* html, size_t html_bytes)
 {
-	mr_trim(buf_terminated);
-	if( buf_terminated[0] == 0 ) {
+	/* the html is not copied or modified, trimming is done by adjusting the range */
+	while( html_bytes > 0 && isspace((unsigned char)html[0]) ) {
+		html++;
+		html_bytes--;
+	}
+	while( html_bytes > 0 && isspace((unsigned char)html[html_bytes-1]) ) {
+		html_bytes--;
+	}
+
+	if( html_bytes == 0 ) {
 		return safe_strdup(""); /* support at least empty HTML-messages; for empty messages, we'll replace the message by the subject later */
 	}
 	else {
@@ -170,15 +188,14 @@ char* mr_dehtml(char* buf_terminated)
 		memset(&dehtml, 0, sizeof(dehtml_t));
 		dehtml.m_add_text   = DO_ADD_REMOVE_LINEENDS;
 		mrstrbuilder_init(&dehtml.m_strbuilder);
+		mrstrbuilder_init(&dehtml.m_last_href);
 
 		mrsaxparser_init(&saxparser, &dehtml);
 		mrsaxparser_set_tag_handler(&saxparser, dehtml_starttag_cb, dehtml_endtag_cb);
 		mrsaxparser_set_text_handler(&saxparser, dehtml_text_cb);
-		mrsaxparser_parse(&saxparser, buf_terminated);
+		mrsaxparser_parse_bytes(&saxparser, html, html_bytes);
 
-		free(dehtml.m_last_href);
+		free(dehtml.m_last_href.m_buf);
 		return dehtml.m_strbuilder.m_buf;
 	}
 }
-
-
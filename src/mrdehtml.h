@@ -34,7 +34,7 @@ extern "C" {
 
 /*** library-private **********************************************************/
 
-char* mr_dehtml(char* buf_terminated); /* mr_dehtml() returns way too many lineends; however, an optimisation on this issue is not needed as the lineends are typically remove in further processing by the caller */
+char* mr_dehtml(const char* html, size_t html_bytes); /* mr_dehtml() returns way too many lineends; however, an optimisation on this issue is not needed as the lineends are typically remove in further processing by the caller */
 
 
 #ifdef __cplusplus
@@ -0,0 +1,351 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ *******************************************************************************
+ *
+ * File:    mrhost.c
+ * Purpose: Run many mailboxes in one process using a shared pool of threads,
+ *          see header for details.
+ *
+ ******************************************************************************/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "mrmailbox.h"
+#include "mrhost.h"
+#include "mrimap.h"
+#include "mrjob.h"
+#include "mrosnative.h"
+#include "mrtools.h"
+
+
+/*******************************************************************************
+ * The schedule
+ *
+ * The schedule is a simple list of accounts, each with a fixed set of tasks.
+ * A worker looking for work scans all tasks; this is a few microseconds even
+ * for some thousand accounts and much less than the work done by a task.
+ ******************************************************************************/
+
+
+static mrhostaccount_t* get_due_task__(mrhost_t* host, int* ret_task, time_t* ret_next_due) /* the caller must hold m_mutex */
+{
+	unsigned int     i, cnt = carray_count(host->m_accounts), index;
+	int              t;
+	time_t           now = time(NULL), due, best_due = 0, next_due = 0;
+	mrhostaccount_t* account, *best_account = NULL;
+	mrhosttask_t*    task;
+
+	for( i = 0; i < cnt; i++ )
+	{
+		index = (host->m_next_account+i) % cnt;
+		account = (mrhostaccount_t*)carray_get(host->m_accounts, index);
+		if( account->m_removed ) {
+			continue;
+		}
+
+		for( t = 0; t < MR_HOST_TASKS; t++ )
+		{
+			task = &account->m_tasks[t];
+			if( task->m_running ) {
+				continue;
+			}
+
+			due = task->m_wakeup? 1 : task->m_due; /* woken up tasks go first */
+			if( due == 0 ) {
+				continue;
+			}
+
+			if( due <= now ) {
+				if( best_account == NULL || due < best_due ) {
+					best_account = account;
+					best_due     = due;
+					*ret_task    = t;
+				}
+			}
+			else if( next_due == 0 || due < next_due ) {
+				next_due = due;
+			}
+		}
+	}
+
+	if( best_account ) {
+		host->m_next_account = (host->m_next_account+1) % cnt;
+	}
+
+	*ret_next_due = next_due;
+	return best_account;
+}
+
+
+static int perform_task(mrmailbox_t* mailbox, int task)
+{
+	int seconds_to_wait;
+
+	mrosnative_setup_thread(mailbox); /* the worker may execute tasks of different mailboxes, so we setup the thread for each task */
+
+		if( task == MR_HOST_TASK_IMAP ) {
+			seconds_to_wait = mrimap_poll(mailbox->m_imap);
+		}
+		else {
+			seconds_to_wait = mrjob_perform_lane(mailbox, task);
+		}
+
+	mrosnative_unsetup_thread(mailbox);
+
+	return seconds_to_wait;
+}
+
+
+static void* worker_thread_entry_point(void* entry_arg)
+{
+	mrhost_t*        host = (mrhost_t*)entry_arg;
+	mrhostaccount_t* account;
+	mrhosttask_t*    task;
+	int              t = 0, seconds_to_wait;
+	time_t           next_due;
+	double           start;
+
+	pthread_mutex_lock(&host->m_mutex);
+
+		while( !host->m_do_exit )
+		{
+			if( (account=get_due_task__(host, &t, &next_due)) == NULL ) {
+				if( next_due ) {
+					struct timespec timeToWait;
+					timeToWait.tv_sec  = next_due;
+					timeToWait.tv_nsec = 0;
+					pthread_cond_timedwait(&host->m_cond, &host->m_mutex, &timeToWait);
+				}
+				else {
+					pthread_cond_wait(&host->m_cond, &host->m_mutex);
+				}
+				continue;
+			}
+
+			task = &account->m_tasks[t];
+			task->m_running = 1;
+			task->m_wakeup  = 0;
+			task->m_due     = 0;
+			host->m_busy_workers++;
+
+			pthread_mutex_unlock(&host->m_mutex);
+
+				start = mr_now_ms();
+				seconds_to_wait = perform_task(account->m_mailbox, t);
+
+			pthread_mutex_lock(&host->m_mutex);
+
+			if( seconds_to_wait == 0 ) {
+				task->m_wakeup = 1;
+			}
+			else if( seconds_to_wait > 0 ) {
+				task->m_due = time(NULL) + seconds_to_wait;
+			}
+			task->m_running = 0;
+			host->m_busy_workers--;
+			host->m_executed_cnt++;
+			host->m_busy_ms += mr_now_ms() - start;
+
+			pthread_cond_broadcast(&host->m_finished_cond);
+		}
+
+	pthread_mutex_unlock(&host->m_mutex);
+
+	return NULL;
+}
+
+
+/*******************************************************************************
+ * Main interface
+ ******************************************************************************/
+
+
+mrhost_t* mrhost_new(int worker_cnt)
+{
+	mrhost_t* host = NULL;
+	int       i;
+
+	if( worker_cnt <= 0 ) {
+		worker_cnt = MR_HOST_DEFAULT_WORKERS;
+	}
+	worker_cnt = MR_MIN(worker_cnt, MR_HOST_MAX_WORKERS);
+
+	if( (host=calloc(1, sizeof(mrhost_t)))==NULL
+	 || (host->m_accounts=carray_new(128))==NULL
+	 || (host->m_workers=calloc(worker_cnt, sizeof(pthread_t)))==NULL ) {
+		exit(64);
+	}
+
+	pthread_mutex_init(&host->m_mutex, NULL);
+	pthread_cond_init(&host->m_cond, NULL);
+	pthread_cond_init(&host->m_finished_cond, NULL);
+
+	host->m_worker_cnt = worker_cnt;
+	for( i = 0; i < worker_cnt; i++ ) {
+		pthread_create(&host->m_workers[i], NULL, worker_thread_entry_point, host);
+	}
+
+	return host;
+}
+
+
+void mrhost_unref(mrhost_t* host)
+{
+	int i;
+
+	if( host == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&host->m_mutex);
+		host->m_do_exit = 1;
+		pthread_cond_broadcast(&host->m_cond);
+	pthread_mutex_unlock(&host->m_mutex);
+
+	for( i = 0; i < host->m_worker_cnt; i++ ) {
+		pthread_join(host->m_workers[i], NULL);
+	}
+
+	for( i = 0; i < (int)carray_count(host->m_accounts); i++ ) {
+		mrhostaccount_t* account = (mrhostaccount_t*)carray_get(host->m_accounts, i);
+		account->m_mailbox->m_host_account = NULL; /* should not happen, the mailboxes must be unref'd before */
+		free(account);
+	}
+	carray_free(host->m_accounts);
+
+	pthread_cond_destroy(&host->m_finished_cond);
+	pthread_cond_destroy(&host->m_cond);
+	pthread_mutex_destroy(&host->m_mutex);
+	free(host->m_workers);
+	free(host);
+}
+
+
+mrmailbox_t* mrhost_new_mailbox(mrhost_t* host, mrmailboxcb_t cb, void* userData)
+{
+	mrmailbox_t*     mailbox;
+	mrhostaccount_t* account;
+	int              t;
+
+	if( host == NULL ) {
+		return NULL;
+	}
+
+	mailbox = mrmailbox_new_hosted(cb, userData, host);
+
+	if( (account=calloc(1, sizeof(mrhostaccount_t)))==NULL ) {
+		exit(65);
+	}
+	account->m_mailbox = mailbox;
+	for( t = 0; t < MR_HOST_TASKS; t++ ) {
+		account->m_tasks[t].m_wakeup = 1; /* run every task once; wakeups before the account is added are lost */
+	}
+
+	pthread_mutex_lock(&host->m_mutex);
+		if( carray_add(host->m_accounts, account, NULL) != 0 ) {
+			exit(66);
+		}
+		mailbox->m_host_account = account;
+		pthread_cond_signal(&host->m_cond);
+	pthread_mutex_unlock(&host->m_mutex);
+
+	return mailbox;
+}
+
+
+void mrhost_remove_mailbox(mrhost_t* host, mrmailbox_t* mailbox)
+{
+	mrhostaccount_t* account;
+	unsigned int     i;
+	int              t, running;
+
+	if( host == NULL || mailbox == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&host->m_mutex);
+
+		if( (account=mailbox->m_host_account) == NULL ) {
+			goto cleanup;
+		}
+
+		account->m_removed = 1;
+
+		/* wait for running tasks, new ones are not started as m_removed is set */
+		while( 1 ) {
+			running = 0;
+			for( t = 0; t < MR_HOST_TASKS; t++ ) {
+				running |= account->m_tasks[t].m_running;
+			}
+			if( !running ) {
+				break;
+			}
+			pthread_cond_wait(&host->m_finished_cond, &host->m_mutex);
+		}
+
+		for( i = 0; i < carray_count(host->m_accounts); i++ ) {
+			if( carray_get(host->m_accounts, i) == account ) {
+				carray_delete_slow(host->m_accounts, i); /* keep the order, m_next_account stays fair */
+				break;
+			}
+		}
+
+		mailbox->m_host_account = NULL;
+		free(account);
+
+cleanup:
+	pthread_mutex_unlock(&host->m_mutex);
+}
+
+
+void mrhost_wakeup(mrmailbox_t* mailbox, int task)
+{
+	mrhost_t* host;
+
+	if( mailbox == NULL || (host=mailbox->m_host) == NULL || task < 0 || task >= MR_HOST_TASKS ) {
+		return;
+	}
+
+	pthread_mutex_lock(&host->m_mutex);
+		if( mailbox->m_host_account && !mailbox->m_host_account->m_removed ) {
+			mailbox->m_host_account->m_tasks[task].m_wakeup = 1;
+			pthread_cond_signal(&host->m_cond);
+		}
+	pthread_mutex_unlock(&host->m_mutex);
+}
+
+
+char* mrhost_get_info(mrhost_t* host)
+{
+	char* ret;
+
+	if( host == NULL ) {
+		return safe_strdup("ErrBadPtr");
+	}
+
+	pthread_mutex_lock(&host->m_mutex);
+		ret = mr_mprintf("Host: %i mailboxes, %i workers (%i busy), %i tasks executed, avg %.1f ms per task\n",
+			(int)carray_count(host->m_accounts), host->m_worker_cnt, host->m_busy_workers, (int)host->m_executed_cnt,
+			host->m_executed_cnt? host->m_busy_ms/host->m_executed_cnt : 0.0);
+	pthread_mutex_unlock(&host->m_mutex);
+
+	return ret;
+}
+
@@ -0,0 +1,102 @@
+/*******************************************************************************
+ *
+ *                              Delta Chat Core
+ *                   Contact: r10s@b44t.com, http://b44t.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see http://www.gnu.org/licenses/ .
+ *
+ *******************************************************************************
+ *
+ * File:    mrhost.h
+ * Purpose: Run many mailboxes in one process using a shared pool of threads
+ *
+ *******************************************************************************
+ *
+ * A mailbox created by mrmailbox_new() starts a thread per job lane, the
+ * IMAP-watch- and the heartbeat-thread and the receive pipeline.  Mailboxes
+ * created by mrhost_new_mailbox() start none of these threads; instead, the
+ * job lanes and the IMAP poll of all hosted mailboxes are tasks in the
+ * schedule of the host and a fixed number of worker threads executes the
+ * tasks that are due.
+ *
+ * Hosted mailboxes poll the INBOX and do not use IDLE, which would block a
+ * worker per mailbox.  Received messages are parsed by the worker that
+ * fetches them and the folders besides the INBOX are synced without
+ * additional connections.
+ *
+ ******************************************************************************/
+
+
+#ifndef __MRHOST_H__
+#define __MRHOST_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct mrhost_t mrhost_t;
+
+
+mrhost_t*    mrhost_new             (int worker_cnt); /* worker_cnt=0 uses MR_HOST_DEFAULT_WORKERS */
+void         mrhost_unref           (mrhost_t*); /* all mailboxes of the host must be unref'd before */
+mrmailbox_t* mrhost_new_mailbox     (mrhost_t*, mrmailboxcb_t, void* userData); /* the mailbox is used as any other mailbox and must be freed using mrmailbox_unref() */
+char*        mrhost_get_info        (mrhost_t*); /* the result must be free()'d */
+
+
+/*** library-private **********************************************************/
+
+#define MR_HOST_DEFAULT_WORKERS  4
+#define MR_HOST_MAX_WORKERS      64
+
+#define MR_HOST_TASK_IMAP        MR_JOB_LANES      /* the tasks 0..MR_JOB_LANES-1 are the job lanes, see mrjob_perform_lane() */
+#define MR_HOST_TASKS            (MR_JOB_LANES+1)
+
+typedef struct mrhosttask_t
+{
+	time_t       m_due;     /* 0=not before mrhost_wakeup() is called */
+	int          m_wakeup;  /* set by mrhost_wakeup(), the task is due at once */
+	int          m_running; /* a task is never executed by two workers at the same time */
+} mrhosttask_t;
+
+typedef struct mrhostaccount_t
+{
+	mrmailbox_t* m_mailbox;
+	mrhosttask_t m_tasks[MR_HOST_TASKS];
+	int          m_removed; /* set by mrhost_remove_mailbox(), the tasks are no longer started */
+} mrhostaccount_t;
+
+struct mrhost_t
+{
+	pthread_mutex_t m_mutex;         /* guards all fields below and the tasks of all accounts */
+	pthread_cond_t  m_cond;          /* signalled if a task becomes due */
+	pthread_cond_t  m_finished_cond; /* broadcasted if a task has finished, see mrhost_remove_mailbox() */
+	carray*         m_accounts;
+	unsigned int    m_next_account;  /* the scan for due tasks starts here, so all mailboxes get their turn */
+	pthread_t*      m_workers;
+	int             m_worker_cnt;
+	int             m_busy_workers;
+	int             m_do_exit;
+	uint32_t        m_executed_cnt;
+	double          m_busy_ms;
+};
+
+void         mrhost_remove_mailbox  (mrhost_t*, mrmailbox_t*); /* returns when no task of the mailbox is running, called by mrmailbox_unref() */
+void         mrhost_wakeup          (mrmailbox_t*, int task); /* makes a task of a hosted mailbox due, does nothing for other mailboxes */
+
+
+#ifdef __cplusplus
+} /* /extern "C" */
+#endif
+#endif /* __MRHOST_H__ */
+
@@ -32,9 +32,11 @@
 #include <unistd.h> /* for sleep() */
 #include "mrmailbox.h"
 #include "mrimap.h"
+#include "mrmimeparser.h"
 #include "mrosnative.h"
 #include "mrtools.h"
 #include "mrloginparam.h"
+#include "mrhost.h"
 
 #define LOCK_HANDLE   pthread_mutex_lock(&ths->m_hEtpanmutex); mrmailbox_wake_lock(ths->m_mailbox); handle_locked = 1;
 #define UNLOCK_HANDLE if( handle_locked ) { mrmailbox_wake_unlock(ths->m_mailbox); pthread_mutex_unlock(&ths->m_hEtpanmutex); handle_locked = 0; }
@@ -480,17 +482,140 @@ static void peek_body(struct mailimap_msg_att* msg_att, char** p_msg, size_t* p_
 }
 
 
+static char* detach_body(struct mailimap_msg_att* msg_att)
+{
+	/* take the body read by peek_body() out of msg_att, so that it is not freed by libEtPan together with msg_att;
+	the result must be freed using mailimap_nstring_free() */
+	clistiter* iter;
+	char*      ret = NULL;
+	for( iter=clist_begin(msg_att->att_list); iter!=NULL; iter=clist_next(iter) )
+	{
+		struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item*)clist_content(iter);
+		if( item && item->att_type == MAILIMAP_MSG_ATT_ITEM_STATIC
+		 && item->att_data.att_static->att_type == MAILIMAP_MSG_ATT_BODY_SECTION
+		 && item->att_data.att_static->att_data.att_body_section->sec_body_part )
+		{
+			ret = item->att_data.att_static->att_data.att_body_section->sec_body_part;
+			item->att_data.att_static->att_data.att_body_section->sec_body_part = NULL;
+			item->att_data.att_static->att_data.att_body_section->sec_length = 0;
+		}
+	}
+	return ret;
+}
+
+
+typedef struct mrimapbody_t
+{
+	uint32_t m_uid;
+	uint32_t m_flags;
+	char*    m_content;    /* the body as read by libEtPan, NULL if written to m_spill_file */
+	size_t   m_bytes;
+	char*    m_spill_file; /* large bodies are written to a temporary file in the blob directory */
+} mrimapbody_t;
+
+
+static mrimapbody_t* take_body(mrimap_t* ths, struct mailimap_msg_att* msg_att, uint32_t server_uid, size_t max_hold_bytes)
+{
+	/* take the body out of msg_att so that it can be received after libEtPan has returned and the handle is unlocked;
+	large bodies and bodies that exceed max_hold_bytes are written to a temporary file at once, so only a limited
+	number of bytes is hold in memory until then.  returns NULL for empty or deleted messages. */
+	mrimapbody_t* body = NULL;
+	char*         msg_content = NULL;
+	size_t        msg_bytes = 0;
+	uint32_t      flags = 0;
+	int           deleted = 0;
+	char*         spill_name = NULL;
+
+	peek_body(msg_att, &msg_content, &msg_bytes, &flags, &deleted);
+	if( msg_content == NULL || msg_bytes <= 0 || deleted ) {
+		return NULL;
+	}
+
+	if( (body=calloc(1, sizeof(mrimapbody_t)))==NULL ) {
+		exit(74);
+	}
+	body->m_uid     = server_uid;
+	body->m_flags   = flags;
+	body->m_content = detach_body(msg_att);
+	body->m_bytes   = msg_bytes;
+
+	pthread_mutex_lock(&ths->m_stats->m_mutex);
+		ths->m_stats->m_bytes_fetched += msg_bytes;
+	pthread_mutex_unlock(&ths->m_stats->m_mutex);
+
+	if( (msg_bytes < MR_IMAP_SPILL_BYTES && msg_bytes <= max_hold_bytes) || ths->m_mailbox==NULL || ths->m_mailbox->m_blobdir==NULL
+	 || (spill_name=mr_mprintf("incoming-%lx-%lu.eml", (unsigned long)(uintptr_t)ths, (unsigned long)server_uid))==NULL /* several connections may receive at the same time, see mrimapsweep_t */
+	 || (body->m_spill_file=mr_get_fine_pathNfilename(ths->m_mailbox->m_blobdir, spill_name))==NULL ) {
+		goto cleanup;
+	}
+
+	if( !mr_write_file(body->m_spill_file, body->m_content, msg_bytes, ths->m_mailbox) ) {
+		mr_delete_file(body->m_spill_file, NULL); /* may be written partly */
+		free(body->m_spill_file);
+		body->m_spill_file = NULL;
+		goto cleanup;
+	}
+
+	mailimap_nstring_free(body->m_content);
+	body->m_content = NULL;
+
+cleanup:
+	free(spill_name);
+	return body;
+}
+
+
+static void receive_body(mrimap_t* ths, mrimapbody_t* body, const char* folder)
+{
+	/* pass the body to the receive callback and free it.  Spilled bodies are parsed from a read-only mapping of the
+	file, so the message itself does not occupy the heap while attachments are decoded (which write directly to their
+	blob files). */
+	void*  spilled = NULL;
+	size_t spilled_bytes = 0;
+	int    spilled_mapped = 0;
+
+	if( body->m_spill_file == NULL ) {
+		ths->m_receive_imf(ths, body->m_content, body->m_bytes, folder, body->m_uid, body->m_flags);
+		goto cleanup;
+	}
+
+	if( mr_mmap_file(body->m_spill_file, &spilled, &spilled_bytes, ths->m_mailbox) ) {
+		spilled_mapped = 1;
+	}
+	else if( !mr_read_file(body->m_spill_file, &spilled, &spilled_bytes, ths->m_mailbox) ) {
+		mrmailbox_log_error(ths->m_mailbox, 0, "Cannot read back message #%i from \"%s\".", (int)body->m_uid, body->m_spill_file);
+		goto cleanup;
+	}
+
+	ths->m_receive_imf(ths, (const char*)spilled, spilled_bytes, folder, body->m_uid, body->m_flags);
+
+cleanup:
+	if( spilled_mapped ) {
+		mr_munmap_file(spilled, spilled_bytes);
+	}
+	else {
+		free(spilled);
+	}
+	if( body->m_spill_file ) {
+		mr_delete_file(body->m_spill_file, NULL);
+		free(body->m_spill_file);
+	}
+	if( body->m_content ) {
+		mailimap_nstring_free(body->m_content);
+	}
+	free(body);
+}
+
+
 static int fetch_single_msg(mrimap_t* ths, const char* folder, uint32_t server_uid, int block_idle)
 {
 	/* the function returns:
 	    0  the caller should try over again later
 	or  1  if the messages should be treated as received, the caller should not try to read the message again (even if no database entries are returned) */
-	char*       msg_content;
-	size_t      msg_bytes;
-	int         r, retry_later = 0, deleted = 0, handle_locked = 0, idle_blocked = 0;
-	uint32_t    flags = 0;
-	clist*      fetch_result = NULL;
-	clistiter*  cur;
+	int           r, retry_later = 0, handle_locked = 0, idle_blocked = 0;
+	clist*        fetch_result = NULL;
+	clistiter*    cur;
+	mrimapbody_t* body;
 
 	if( ths==NULL ) {
 		goto cleanup;
@@ -536,14 +661,15 @@ static int fetch_single_msg(mrimap_t* ths, const char* folder, uint32_t server_u
 		goto cleanup; /* server response is fine, however, there is no such message, do not try to fetch the message again */
 	}
 
-	struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(cur);
-	peek_body(msg_att, &msg_content, &msg_bytes, &flags, &deleted);
-	if( msg_content == NULL  || msg_bytes <= 0 || deleted ) {
+	if( (body=take_body(ths, (struct mailimap_msg_att*)clist_content(cur), server_uid, MR_IMAP_SPILL_BYTES)) == NULL ) {
 		/* mrmailbox_log_warning(ths->m_mailbox, 0, "Message #%i in folder \"%s\" is empty or deleted.", (int)server_uid, folder); -- this is a quite usual situation, do not print a warning */
 		goto cleanup;
 	}
 
-	ths->m_receive_imf(ths, msg_content, msg_bytes, folder, server_uid, flags);
+	mailimap_fetch_list_free(fetch_result); /* free the other data before the message is parsed */
+	fetch_result = NULL;
+
+	receive_body(ths, body, folder);
 
 cleanup:
 	if( block_idle ) {
@@ -558,13 +684,140 @@ cleanup:
 }
 
 
+typedef struct mrimapchunk_t
+{
+	mrimap_t*   m_imap;
+	carray*     m_bodies;     /* mrimapbody_t objects, received after the handle is unlocked */
+	size_t      m_hold_bytes; /* the size of the bodies in m_bodies that are hold in memory, at most MR_IMAP_CHUNK_HOLD_BYTES */
+} mrimapchunk_t;
+
+
+static void chunk_msg_att_handler(struct mailimap_msg_att* msg_att, void* context)
+{
+	/* called by libEtPan for each message as soon as it is read from the stream while the handle is locked; msg_att is
+	freed directly after we return, so we only take the body here.  As large bodies and all bodies exceeding
+	MR_IMAP_CHUNK_HOLD_BYTES are written to a file at once, the memory used depends neither on the message sizes nor on
+	the chunk size. */
+	mrimapchunk_t* chunk = (mrimapchunk_t*)context;
+	mrimapbody_t*  body;
+	uint32_t       cur_uid;
+
+	if( chunk==NULL || msg_att==NULL || (cur_uid=peek_uid(msg_att))==0 ) {
+		return;
+	}
+
+	if( (body=take_body(chunk->m_imap, msg_att, cur_uid, MR_IMAP_CHUNK_HOLD_BYTES-chunk->m_hold_bytes)) == NULL ) {
+		return; /* empty or deleted message, may also be an unsolicited FETCH response, this is not worth a warning */
+	}
+
+	if( body->m_content ) {
+		chunk->m_hold_bytes += MR_MIN(body->m_bytes, MR_IMAP_CHUNK_HOLD_BYTES-chunk->m_hold_bytes); /* if spilling fails, the body is hold anyway */
+	}
+	carray_add(chunk->m_bodies, body, NULL);
+}
+
+
+static int fetch_chunk(mrimap_t* ths, const char* folder, const uint32_t* uids, size_t uid_cnt)
+{
+	/* fetch the bodies of the given, ascending UIDs using a single `UID FETCH` command; the function returns:
+	    0  the caller should try over again later
+	or  1  if the messages should be treated as received, the caller should not try to read the messages again */
+	int                  r = 0, retry_later = 0, handle_locked = 0;
+	size_t               i, received_cnt = 0;
+	clist*               fetch_result = NULL;
+	struct mailimap_set* set = NULL;
+	mrimapchunk_t        chunk;
+
+	memset(&chunk, 0, sizeof(mrimapchunk_t));
+	chunk.m_imap   = ths;
+	chunk.m_bodies = carray_new(16);
+
+	if( ths==NULL || uids==NULL || uid_cnt==0 ) {
+		goto cleanup;
+	}
+
+	/* combine subsequent UIDs to intervals, this keeps the command short, eg. `UID FETCH 100:149,151 ...` */
+	set = mailimap_set_new_empty();
+	for( i = 0; i < uid_cnt; i++ ) {
+		uint32_t first = uids[i];
+		while( i+1 < uid_cnt && uids[i+1] == uids[i]+1 ) {
+			i++;
+		}
+		if( first == uids[i] ) {
+			mailimap_set_add_single(set, first);
+		}
+		else {
+			mailimap_set_add_interval(set, first, uids[i]);
+		}
+	}
+
+	LOCK_HANDLE
+
+		if( ths->m_hEtpan==NULL ) {
+			retry_later = 1;
+			goto cleanup;
+		}
+
+		if( select_folder__(ths, folder)==0 ) { /* normally, this is a no-op; however, between two chunks, other threads may have selected a different folder */
+			mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot select folder \"%s\" for fetching.", folder);
+			retry_later = 1;
+			goto cleanup;
+		}
+
+		mailimap_set_msg_att_handler(ths->m_hEtpan, chunk_msg_att_handler, &chunk);
+		r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_body, &fetch_result);
+		if( ths->m_hEtpan ) {
+			mailimap_set_msg_att_handler(ths->m_hEtpan, NULL, NULL);
+		}
+
+	UNLOCK_HANDLE
+
+	/* the messages are received without the handle being locked, this includes messages read before an error */
+	for( i = 0; i < carray_count(chunk.m_bodies); i++ ) {
+		receive_body(ths, (mrimapbody_t*)carray_get(chunk.m_bodies, i), folder);
+	}
+	received_cnt = carray_count(chunk.m_bodies);
+	carray_set_size(chunk.m_bodies, 0);
+
+	if( is_error(ths, r) ) {
+		mrmailbox_log_warning(ths->m_mailbox, 0, "Error #%i on fetching messages #%i-#%i from folder \"%s\"; retry=%i.", (int)r, (int)uids[0], (int)uids[uid_cnt-1], folder, (int)ths->m_should_reconnect);
+		if( ths->m_should_reconnect ) {
+			retry_later = 1; /* see the comment in fetch_single_msg() */
+		}
+		goto cleanup;
+	}
+
+	mrmailbox_log_info(ths->m_mailbox, 0, "%i of %i requested messages received from \"%s\".", (int)received_cnt, (int)uid_cnt, folder);
+
+cleanup:
+	UNLOCK_HANDLE
+
+	carray_free(chunk.m_bodies); /* all bodies are received above */
+	if( fetch_result ) {
+		mailimap_fetch_list_free(fetch_result); /* normally empty, the messages are passed to the handler */
+	}
+	if( set ) {
+		mailimap_set_free(set);
+	}
+	return retry_later? 0 : 1;
+}
+
+
+static int compare_uids(const void* a, const void* b)
+{
+	uint32_t ua = (uint32_t)(uintptr_t)*((void* const*)a), ub = (uint32_t)(uintptr_t)*((void* const*)b);
+	return ua<ub? -1 : (ua>ub? 1 : 0);
+}
+
+
 static int fetch_from_single_folder(mrimap_t* ths, const char* folder, uint32_t uidvalidity)
 {
 	int        r, handle_locked = 0, log_summary = 1;
 	clist*     fetch_result = NULL;
-	uint32_t   out_largetst_uid = 0;
-	size_t     read_cnt = 0, read_errors = 0;
+	size_t     read_cnt = 0, read_errors = 0, i, chunk_start, chunk_size;
 	clistiter* cur;
+	carray*    new_uids = carray_new(128);
+	uint32_t*  chunk_uids = NULL;
 
 	uint32_t   lastuid = 0; /* The last uid fetched, we fetch from lastuid+1. If 0, we get some of the newest ones. */
 	char*      lastuid_config_key = NULL;
@@ -573,6 +826,8 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder, uint32_t
 		goto cleanup;
 	}
 
+	ths->m_last_fetch_ok = 0;
+
 	LOCK_HANDLE
 
 		if( ths->m_hEtpan==NULL ) {
@@ -668,6 +923,7 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder, uint32_t
 		fetch_result = NULL;
 		if( r == MAILIMAP_ERROR_PROTOCOL ) {
 			mrmailbox_log_info(ths->m_mailbox, 0, "Folder \"%s\" is empty", folder);
+			ths->m_last_fetch_ok = 1;
 			goto cleanup; /* the folder is simply empty, this is no error */
 		}
 		mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot fetch message list from folder \"%s\".", folder);
@@ -675,27 +931,49 @@ static int fetch_from_single_folder(mrimap_t* ths, const char* folder, uint32_t
 		goto cleanup;
 	}
 
-	/* go through all mails in folder (this is typically _fast_ as we already have the whole list) */
+	/* collect the UIDs of all new mails in folder (this is typically _fast_ as we already have the whole list) */
 	for( cur = clist_begin(fetch_result); cur != NULL ; cur = clist_next(cur) )
 	{
 		struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(cur); /* mailimap_msg_att is a list of attributes: list is a list of message attributes */
 		uint32_t cur_uid = peek_uid(msg_att);
 		if( cur_uid && (lastuid==0 || cur_uid>lastuid) ) /* normally, the "cur_uid>lastuid" is not needed, however, some server return some smaller IDs under some curcumstances. Mailcore2 does the same check, see see "if (uid < fromUID) {..}"@IMAPSession::fetchMessageNumberUIDMapping()@MCIMAPSession.cpp */
 		{
-			read_cnt++;
-			if( fetch_single_msg(ths, folder, cur_uid, 0) == 0 ) {
-				read_errors++;
-			}
-			else if( cur_uid > out_largetst_uid ) {
-				out_largetst_uid = cur_uid;
-			}
+			carray_add(new_uids, (void*)(uintptr_t)cur_uid, NULL);
 		}
 	}
 
-	if( !read_errors && out_largetst_uid > 0 ) {
-		ths->m_set_config_int(ths, lastuid_config_key, out_largetst_uid);
+	qsort(carray_data(new_uids), carray_count(new_uids), sizeof(void*), compare_uids);
+
+	/* fetch the bodies in chunks, one `UID FETCH` per chunk instead of one round trip per message.
+	lastuid is written after each chunk, so an interrupted fetch does not restart the whole folder. */
+	chunk_size = (size_t)MR_MAX(ths->m_get_config_int(ths, "imap_fetch_chunk_size", MR_IMAP_FETCH_CHUNK_SIZE), 1);
+	chunk_uids = malloc(sizeof(uint32_t)*chunk_size);
+	if( chunk_uids == NULL ) {
+		goto cleanup;
+	}
+
+	for( chunk_start = 0; chunk_start < carray_count(new_uids); chunk_start += chunk_size )
+	{
+		size_t chunk_cnt = MR_MIN(chunk_size, carray_count(new_uids)-chunk_start);
+		for( i = 0; i < chunk_cnt; i++ ) {
+			chunk_uids[i] = (uint32_t)(uintptr_t)carray_get(new_uids, chunk_start+i);
+		}
+
+		read_cnt += chunk_cnt;
+		if( fetch_chunk(ths, folder, chunk_uids, chunk_cnt) == 0 ) {
+			read_errors++;
+			break; /* the chunk is tried over on the next fetch */
+		}
+
+		if( ths->m_receive_flush ) {
+			ths->m_receive_flush(ths); /* the messages may still be parsed in the background, do not skip them if we are interrupted */
+		}
+
+		ths->m_set_config_int(ths, lastuid_config_key, chunk_uids[chunk_cnt-1]);
 	}
 
+	ths->m_last_fetch_ok = (read_errors==0);
+
 	/* done */
 cleanup:
 	UNLOCK_HANDLE
@@ -720,139 +998,596 @@ cleanup:
 		free(lastuid_config_key);
 	}
 
+	carray_free(new_uids);
+	free(chunk_uids);
 	return read_cnt;
 }
 
 
-static int fetch_from_all_folders(mrimap_t* ths)
+typedef struct mrimapsweep_t
 {
-	int        handle_locked = 0;
-	clist*     folder_list = NULL;
-	clistiter* cur;
-	int        total_cnt = 0;
+	/* a sync of all folders but the INBOX, the folders are taken from the queue by one or more connections */
+	mrimap_t*  m_imap;           /* the object owning the IDLE connection */
+	clist*     m_folders;        /* list of mrimapfolder_t */
+	clistiter* m_next;           /* the next folder to sync; as all following members protected by m_imap->m_sweep_mutex */
+	int        m_folder_cnt;
+	int        m_msg_cnt;
+	double     m_slowest_ms;
+	char*      m_slowest_folder;
+} mrimapsweep_t;
+
+
+typedef struct mrimapfolderstate_t
+{
+	uint32_t m_uidvalidity;
+	uint32_t m_uidnext;
+	uint64_t m_modseq; /* HIGHESTMODSEQ, 0 if the server does not support CONDSTORE */
+} mrimapfolderstate_t;
 
-	mrmailbox_log_info(ths->m_mailbox, 0, "Fetching from all folders.");
+
+static int get_folder_state(mrimap_t* ths, const char* folder, mrimapfolderstate_t* ret)
+{
+	/* STATUS neither selects the folder nor lists messages, so this is much cheaper than the UID FETCH done by fetch_from_single_folder() */
+	int                                  success = 0, handle_locked = 0, r;
+	struct mailimap_status_att_list*     att_list = NULL;
+	struct mailimap_mailbox_data_status* status = NULL;
+	clistiter*                           cur;
+
+	memset(ret, 0, sizeof(mrimapfolderstate_t));
 
 	LOCK_HANDLE
-		folder_list = list_folders__(ths);
-	UNLOCK_HANDLE
 
-	/* first, read the INBOX, this looks much better on the initial load as the INBOX
-	has the most recent mails.  Moreover, this is for speed reasons, as the other folders only have few new messages. */
-	for( cur = clist_begin(folder_list); cur != NULL ; cur = clist_next(cur) )
-	{
-		mrimapfolder_t* folder = (mrimapfolder_t*)clist_content(cur);
-		if( folder->m_meaning == MEANING_INBOX ) {
-			total_cnt += fetch_from_single_folder(ths, folder->m_name_to_select, 0);
+		if( ths->m_hEtpan==NULL ) {
+			goto cleanup;
 		}
-	}
 
-	for( cur = clist_begin(folder_list); cur != NULL ; cur = clist_next(cur) )
-	{
-		mrimapfolder_t* folder = (mrimapfolder_t*)clist_content(cur);
-		if( folder->m_meaning == MEANING_IGNORE ) {
-			mrmailbox_log_info(ths->m_mailbox, 0, "Folder \"%s\" ignored.", folder->m_name_utf8);
+		att_list = mailimap_status_att_list_new_empty();
+		mailimap_status_att_list_add(att_list, MAILIMAP_STATUS_ATT_UIDVALIDITY);
+		mailimap_status_att_list_add(att_list, MAILIMAP_STATUS_ATT_UIDNEXT);
+		if( mailimap_has_condstore(ths->m_hEtpan) ) {
+			mailimap_status_att_list_add(att_list, MAILIMAP_STATUS_ATT_HIGHESTMODSEQ);
 		}
-		else if( folder->m_meaning != MEANING_INBOX ) {
-			total_cnt += fetch_from_single_folder(ths, folder->m_name_to_select, 0);
+
+		r = mailimap_status(ths->m_hEtpan, folder, att_list, &status);
+		if( is_error(ths, r) || status == NULL ) {
+			goto cleanup;
+		}
+
+		for( cur = clist_begin(status->st_info_list); cur != NULL; cur = clist_next(cur) ) {
+			struct mailimap_status_info* info = (struct mailimap_status_info*)clist_content(cur);
+			if( info->st_att == MAILIMAP_STATUS_ATT_UIDVALIDITY ) {
+				ret->m_uidvalidity = info->st_value;
+			}
+			else if( info->st_att == MAILIMAP_STATUS_ATT_UIDNEXT ) {
+				ret->m_uidnext = info->st_value;
+			}
+			else if( info->st_att == MAILIMAP_STATUS_ATT_EXTENSION && info->st_ext_data
+			      && info->st_ext_data->ext_extension == &mailimap_extension_condstore
+			      && info->st_ext_data->ext_type == MAILIMAP_CONDSTORE_TYPE_STATUS_INFO ) {
+				ret->m_modseq = ((struct mailimap_condstore_status_info*)info->st_ext_data->ext_data)->cs_highestmodseq_value;
+			}
 		}
+
+		success = (ret->m_uidvalidity!=0 && ret->m_uidnext!=0);
+
+cleanup:
+	UNLOCK_HANDLE
+
+	if( status ) {
+		mailimap_mailbox_data_status_free(status);
 	}
 
-	free_folders(folder_list);
+	if( att_list ) {
+		mailimap_status_att_list_free(att_list);
+	}
 
-	return total_cnt;
+	return success;
 }
 
 
-/*******************************************************************************
- * Watch thread
- ******************************************************************************/
+static int is_folder_unchanged(mrimapsweep_t* sweep, mrimap_t* ths, const char* folder, const mrimapfolderstate_t* state)
+{
+	/* a folder need not to be fetched if UIDNEXT shows there are no messages after the last one fetched
+	or if UIDNEXT and HIGHESTMODSEQ did not change since the last complete fetch (UIDNEXT may be larger eg. if the newest messages were deleted) */
+	int                  unchanged = 0;
+	char*                lastuid_config_key = mr_mprintf("imap.lastuid.%lu.%s", (unsigned long)state->m_uidvalidity, folder);
+	uint32_t             lastuid = ths->m_get_config_int(ths, lastuid_config_key, 0);
+	chashdatum           key, value;
+
+	if( lastuid > 0 && state->m_uidnext <= lastuid+1 ) {
+		unchanged = 1;
+	}
+	else if( state->m_modseq ) {
+		key.data = (void*)folder;
+		key.len  = strlen(folder);
+		pthread_mutex_lock(&sweep->m_imap->m_sweep_mutex);
+			if( chash_get(sweep->m_imap->m_folder_states, &key, &value) == 0
+			 && memcmp(value.data, state, sizeof(mrimapfolderstate_t)) == 0 ) {
+				unchanged = 1;
+			}
+		pthread_mutex_unlock(&sweep->m_imap->m_sweep_mutex);
+	}
+
+	free(lastuid_config_key);
+	return unchanged;
+}
 
 
-static void* watch_thread_entry_point(void* entry_arg)
+static void set_folder_state(mrimapsweep_t* sweep, const char* folder, const mrimapfolderstate_t* state /*NULL=unknown*/)
 {
-	mrimap_t*       ths = (mrimap_t*)entry_arg;
-	mrosnative_setup_thread(ths->m_mailbox); /* must be very first */
+	mrimapfolderstate_t* copy = NULL;
+	chashdatum           key, value, old_value;
 
-	int             handle_locked = 0, idle_blocked = 0, force_sleep = 0, do_fetch = 0;
-	#define         SLEEP_ON_ERROR_SECONDS     10
-	#define         SLEEP_ON_INTERRUPT_SECONDS  2      /* let the job thread a little bit time before we IDLE again, otherweise there will be many idle-interrupt sequences */
-	#define         IDLE_DELAY_SECONDS         (28*60) /* 28 minutes is a typical maximum, most servers do not allow more. if the delay is reached, we also check _all_ folders. */
-	#define         FULL_FETCH_EVERY_SECONDS   (27*60) /* force a full fetch every 27 minute (typically together the IDLE delay break) */
+	key.data = (void*)folder;
+	key.len  = strlen(folder);
 
-	time_t          last_fullread_time = 0;
+	pthread_mutex_lock(&sweep->m_imap->m_sweep_mutex);
+		memset(&old_value, 0, sizeof(chashdatum));
+		if( state ) {
+			if( (copy=malloc(sizeof(mrimapfolderstate_t)))==NULL ) {
+				exit(60);
+			}
+			memcpy(copy, state, sizeof(mrimapfolderstate_t));
+			value.data = copy;
+			value.len  = sizeof(mrimapfolderstate_t);
+			if( chash_get(sweep->m_imap->m_folder_states, &key, &old_value) != 0 ) {
+				memset(&old_value, 0, sizeof(chashdatum)); /* chash_set() would return the new value as the old one */
+			}
+			if( chash_set(sweep->m_imap->m_folder_states, &key, &value, NULL) != 0 ) {
+				free(copy);
+				chash_delete(sweep->m_imap->m_folder_states, &key, NULL); /* rather unknown than stale */
+			}
+		}
+		else {
+			chash_delete(sweep->m_imap->m_folder_states, &key, &old_value);
+		}
+		free(old_value.data);
+	pthread_mutex_unlock(&sweep->m_imap->m_sweep_mutex);
+}
 
-	mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-watch-thread started.");
 
-	if( ths->m_can_idle )
-	{
-		/* watch using IDLE
-		 **********************************************************************/
+static void sweep_folders(mrimapsweep_t* sweep, mrimap_t* ths)
+{
+	/* sync folders from the queue using the given connection until the queue is empty.
+	`ths` is either the object owning the IDLE connection or a pool connection, which is set up as needed. */
+	int             handle_locked = 0, connected;
+	mrimapfolder_t* folder;
+	double          start, elapsed;
+	int             cnt, has_state;
+	mrimapfolderstate_t state;
 
-		int      r, r2;
-		uint32_t uidvalidity;
+	while( 1 )
+	{
+		folder = NULL;
+		pthread_mutex_lock(&sweep->m_imap->m_sweep_mutex);
+			while( sweep->m_next && !sweep->m_imap->m_watch_do_exit ) {
+				mrimapfolder_t* candidate = (mrimapfolder_t*)clist_content(sweep->m_next);
+				sweep->m_next = clist_next(sweep->m_next);
+				if( candidate->m_meaning != MEANING_INBOX && candidate->m_meaning != MEANING_IGNORE ) {
+					folder = candidate;
+					break;
+				}
+			}
+		pthread_mutex_unlock(&sweep->m_imap->m_sweep_mutex);
 
-		fetch_from_all_folders(ths); /* the initial fetch from all folders is needed as this will init the folder UIDs (see fetch_from_single_folder() if lastuid is unset) */
-		last_fullread_time = time(NULL);
+		if( folder == NULL ) {
+			break;
+		}
 
-		while( 1 )
-		{
-			if( ths->m_watch_do_exit ) {
-				goto exit_;
+		if( ths != sweep->m_imap ) {
+			LOCK_HANDLE
+				connected = setup_handle_if_needed__(ths);
+			UNLOCK_HANDLE
+			if( !connected ) {
+				break; /* the remaining folders are synced by the other connections or on the next sweep */
 			}
+		}
 
-			BLOCK_IDLE /* must be done before LOCK_HANDLE; this allows other threads to block IDLE */
-			LOCK_HANDLE
+		has_state = get_folder_state(ths, folder->m_name_to_select, &state);
+		if( has_state && is_folder_unchanged(sweep, ths, folder->m_name_to_select, &state) ) {
+			mrmailbox_log_info(ths->m_mailbox, 0, "Folder \"%s\" unchanged.", folder->m_name_utf8);
+			pthread_mutex_lock(&ths->m_stats->m_mutex);
+				ths->m_stats->m_folders_skipped++;
+			pthread_mutex_unlock(&ths->m_stats->m_mutex);
+			pthread_mutex_lock(&sweep->m_imap->m_sweep_mutex);
+				sweep->m_folder_cnt++;
+			pthread_mutex_unlock(&sweep->m_imap->m_sweep_mutex);
+			continue;
+		}
 
-				do_fetch = 0;
-				force_sleep = SLEEP_ON_ERROR_SECONDS;
-				uidvalidity = 0;
+		start = mr_now_ms();
+			cnt = fetch_from_single_folder(ths, folder->m_name_to_select, 0);
+		elapsed = mr_now_ms()-start;
 
-				setup_handle_if_needed__(ths);
-				if( ths->m_idle_set_up==0 && ths->m_hEtpan && ths->m_hEtpan->imap_stream ) {
-					if( time(NULL)-last_fullread_time > FULL_FETCH_EVERY_SECONDS ) {
-						/* we go here only if we get MAILSTREAM_IDLE_ERROR or MAILSTREAM_IDLE_CANCELLED instead or a proper timeout */
-						UNLOCK_HANDLE
-						UNBLOCK_IDLE
-							fetch_from_all_folders(ths);
-						BLOCK_IDLE
-						LOCK_HANDLE
-						last_fullread_time = time(NULL);
-					}
-					mailstream_setup_idle(ths->m_hEtpan->imap_stream);
-					ths->m_idle_set_up = 1;
-				}
+		set_folder_state(sweep, folder->m_name_to_select, (has_state && ths->m_last_fetch_ok)? &state : NULL);
 
-				if( select_folder__(ths, "INBOX") )
-				{
-					uidvalidity = ths->m_hEtpan->imap_selection_info->sel_uidvalidity;
-					r = mailimap_idle(ths->m_hEtpan);
-					if( !is_error(ths, r) )
-					{
-						mrmailbox_log_info(ths->m_mailbox, 0, "IDLE start...");
+		mrmailbox_log_info(ths->m_mailbox, 0, "Folder \"%s\" synced in %.0f ms.", folder->m_name_utf8, elapsed);
 
-						ths->m_enter_watch_wait_time = time(NULL);
+		pthread_mutex_lock(&sweep->m_imap->m_sweep_mutex);
+			sweep->m_folder_cnt++;
+			sweep->m_msg_cnt += cnt;
+			if( elapsed > sweep->m_slowest_ms ) {
+				sweep->m_slowest_ms     = elapsed;
+				sweep->m_slowest_folder = folder->m_name_utf8;
+			}
+		pthread_mutex_unlock(&sweep->m_imap->m_sweep_mutex);
+	}
+}
 
-						UNLOCK_HANDLE
-						UNBLOCK_IDLE
 
-							pthread_mutex_lock(&ths->m_inwait_mutex);
-								r = 0; r2 = 0;
-								if( ths->m_hEtpan ) {
-									r = mailstream_wait_idle(ths->m_hEtpan->imap_stream, IDLE_DELAY_SECONDS);
-									r2 = mailimap_idle_done(ths->m_hEtpan); /* it's okay to use the handle without locking as we're inwait */
-								}
-							pthread_mutex_unlock(&ths->m_inwait_mutex);
-							force_sleep = 0;
+static void finish_sweep(mrimapsweep_t* sweep, int connections, double elapsed)
+{
+	mrimap_t* ths = sweep->m_imap;
+	char*     info = mr_mprintf("%i folders synced in %.0f ms using %i connection(s), %i messages read, slowest folder: \"%s\" in %.0f ms",
+		sweep->m_folder_cnt, elapsed, connections, sweep->m_msg_cnt, sweep->m_slowest_folder? sweep->m_slowest_folder : "", sweep->m_slowest_ms);
 
-							if( r == MAILSTREAM_IDLE_ERROR /*0*/ || r==MAILSTREAM_IDLE_CANCELLED /*4*/ ) {
+	mrmailbox_log_info(ths->m_mailbox, 0, "%s.", info);
+
+	pthread_mutex_lock(&ths->m_sweep_mutex);
+		free(ths->m_sweep_info);
+		ths->m_sweep_info = info;
+		ths->m_sweep_running = 0;
+	pthread_mutex_unlock(&ths->m_sweep_mutex);
+
+	free_folders(sweep->m_folders);
+	free(sweep);
+}
+
+
+static void* sweep_worker_entry_point(void* entry_arg)
+{
+	mrimapsweep_t* sweep = (mrimapsweep_t*)entry_arg;
+	mrimap_t*      main_imap = sweep->m_imap;
+	mrimap_t*      ths = NULL;
+	int            handle_locked = 0;
+
+	mrosnative_setup_thread(main_imap->m_mailbox); /* must be very first */
+
+	/* a pool connection is a separate, never "connected" object without threads; it only uses the same login and callbacks */
+	ths = mrimap_new(main_imap->m_get_config_int, main_imap->m_set_config_int, main_imap->m_receive_imf, main_imap->m_receive_flush, main_imap->m_userData, main_imap->m_mailbox);
+	ths->m_imap_server  = safe_strdup(main_imap->m_imap_server);
+	ths->m_imap_port    = main_imap->m_imap_port;
+	ths->m_imap_user    = safe_strdup(main_imap->m_imap_user);
+	ths->m_imap_pw      = safe_strdup(main_imap->m_imap_pw);
+	ths->m_server_flags = main_imap->m_server_flags;
+	ths->m_log_connect_errors = 0; /* errors are already reported by the IDLE connection */
+	ths->m_stats = main_imap->m_stats;
+
+	sweep_folders(sweep, ths);
+
+	LOCK_HANDLE
+		unsetup_handle__(ths);
+	UNLOCK_HANDLE
+	mrimap_unref(ths);
+
+	mrosnative_unsetup_thread(main_imap->m_mailbox); /* must be very last */
+	return NULL;
+}
+
+
+static void* sweep_thread_entry_point(void* entry_arg)
+{
+	mrimapsweep_t* sweep = (mrimapsweep_t*)entry_arg;
+	mrimap_t*      ths = sweep->m_imap;
+	pthread_t      workers[MR_IMAP_MAX_POOL_SIZE];
+	int            i, pool_size;
+	double         start = mr_now_ms();
+
+	mrosnative_setup_thread(ths->m_mailbox); /* must be very first */
+
+	pool_size = MR_MIN(MR_MAX(ths->m_get_config_int(ths, "imap_pool_size", MR_IMAP_POOL_SIZE), 1), MR_IMAP_MAX_POOL_SIZE);
+	pool_size = MR_MIN(pool_size, MR_MAX(clist_count(sweep->m_folders)-1, 1)); /* do not open more connections than there are folders besides the INBOX */
+
+	for( i = 0; i < pool_size; i++ ) {
+		pthread_create(&workers[i], NULL, sweep_worker_entry_point, sweep);
+	}
+
+	for( i = 0; i < pool_size; i++ ) {
+		pthread_join(workers[i], NULL);
+	}
+
+	finish_sweep(sweep, pool_size, mr_now_ms()-start);
+
+	mrosnative_unsetup_thread(ths->m_mailbox); /* must be very last */
+	return NULL;
+}
+
+
+static int fetch_from_all_folders(mrimap_t* ths)
+{
+	int            handle_locked = 0, start_sweep = 0, join_sweep = 0;
+	clist*         folder_list = NULL;
+	clistiter*     cur;
+	int            total_cnt = 0;
+	mrimapsweep_t* sweep = NULL;
+	double         start;
+
+	mrmailbox_log_info(ths->m_mailbox, 0, "Fetching from all folders.");
+
+	pthread_mutex_lock(&ths->m_stats->m_mutex);
+		ths->m_stats->m_full_syncs++;
+	pthread_mutex_unlock(&ths->m_stats->m_mutex);
+
+	LOCK_HANDLE
+		folder_list = list_folders__(ths);
+	UNLOCK_HANDLE
+
+	/* first, read the INBOX, this looks much better on the initial load as the INBOX
+	has the most recent mails.  Moreover, this is for speed reasons, as the other folders only have few new messages. */
+	for( cur = clist_begin(folder_list); cur != NULL ; cur = clist_next(cur) )
+	{
+		mrimapfolder_t* folder = (mrimapfolder_t*)clist_content(cur);
+		if( folder->m_meaning == MEANING_INBOX ) {
+			total_cnt += fetch_from_single_folder(ths, folder->m_name_to_select, 0);
+		}
+		else if( folder->m_meaning == MEANING_IGNORE ) {
+			mrmailbox_log_info(ths->m_mailbox, 0, "Folder \"%s\" ignored.", folder->m_name_utf8);
+		}
+	}
+
+	/* then, sync the other folders.  If we have a pool of connections, this is done in the background,
+	so the IDLE connection can go back to the INBOX at once. */
+	if( (sweep=calloc(1, sizeof(mrimapsweep_t)))==NULL ) {
+		exit(26);
+	}
+	sweep->m_imap    = ths;
+	sweep->m_folders = folder_list;
+	sweep->m_next    = clist_begin(folder_list);
+	folder_list      = NULL; /* owned by the sweep now */
+
+	if( ths->m_hosted || ths->m_get_config_int(ths, "imap_pool_size", MR_IMAP_POOL_SIZE) <= 0 )
+	{
+		start = mr_now_ms();
+		pthread_mutex_lock(&ths->m_sweep_mutex);
+			ths->m_sweep_running = 1;
+		pthread_mutex_unlock(&ths->m_sweep_mutex);
+
+		sweep_folders(sweep, ths);
+		total_cnt += sweep->m_msg_cnt;
+		finish_sweep(sweep, 1, mr_now_ms()-start);
+		return total_cnt;
+	}
+
+	pthread_mutex_lock(&ths->m_sweep_mutex);
+		if( !ths->m_sweep_running ) {
+			join_sweep = ths->m_sweep_thread_created; /* the thread is about to terminate, as the sweep is no longer running */
+			ths->m_sweep_running = 1;
+			start_sweep = 1;
+		}
+	pthread_mutex_unlock(&ths->m_sweep_mutex);
+
+	if( !start_sweep ) {
+		mrmailbox_log_info(ths->m_mailbox, 0, "Previous sync of all folders still in progress.");
+		free_folders(sweep->m_folders);
+		free(sweep);
+		return total_cnt;
+	}
+
+	if( join_sweep ) {
+		pthread_join(ths->m_sweep_thread, NULL);
+	}
+
+	ths->m_sweep_thread_created = 1;
+	pthread_create(&ths->m_sweep_thread, NULL, sweep_thread_entry_point, sweep);
+
+	return total_cnt;
+}
+
+
+char* mrimap_get_info(mrimap_t* ths)
+{
+	char* ret = NULL;
+
+	if( ths == NULL ) {
+		return safe_strdup(NULL);
+	}
+
+	pthread_mutex_lock(&ths->m_sweep_mutex);
+	pthread_mutex_lock(&ths->m_stats->m_mutex);
+		ret = mr_mprintf("IMAP sync of all folders: %s%s\n"
+			"IMAP IDLE timeout: %i seconds, %i IDLE interrupts, %i reconnects, %i syncs of all folders, %i unchanged folders skipped, %llu bytes fetched\n",
+			ths->m_sweep_info? ths->m_sweep_info : "none yet",
+			ths->m_sweep_running? " (running)" : "",
+			ths->m_idle_timeout, (int)ths->m_stats->m_idle_interrupts, (int)ths->m_stats->m_reconnects,
+			(int)ths->m_stats->m_full_syncs, (int)ths->m_stats->m_folders_skipped, (unsigned long long)ths->m_stats->m_bytes_fetched);
+	pthread_mutex_unlock(&ths->m_stats->m_mutex);
+	pthread_mutex_unlock(&ths->m_sweep_mutex);
+
+	return ret;
+}
+
+
+/*******************************************************************************
+ * Watch thread
+ ******************************************************************************/
+
+
+void mrimap_set_pending_jobs(mrimap_t* ths, int pending_jobs)
+{
+	if( ths == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&ths->m_watch_condmutex);
+		ths->m_pending_jobs = pending_jobs;
+	pthread_mutex_unlock(&ths->m_watch_condmutex);
+}
+
+
+static void wait_for_pending_jobs(mrimap_t* ths)
+{
+	/* each IMAP job interrupts IDLE; so, if there are more jobs, we do not IDLE again just to be interrupted at once.
+	If there are no jobs, we IDLE at once, there is no fixed delay. */
+	int waited_ms = 0, pending_jobs;
+
+	while( waited_ms < MR_IMAP_SETTLE_MAX_MS && !ths->m_watch_do_exit )
+	{
+		pthread_mutex_lock(&ths->m_watch_condmutex);
+			pending_jobs = ths->m_pending_jobs;
+		pthread_mutex_unlock(&ths->m_watch_condmutex);
+
+		if( pending_jobs <= 0 ) {
+			break;
+		}
+
+		usleep(100*1000);
+		waited_ms += 100;
+	}
+}
+
+
+static void set_idle_timeout(mrimap_t* ths, int idle_timeout)
+{
+	ths->m_idle_timeout   = MR_MIN(MR_MAX(idle_timeout, MR_IMAP_MIN_IDLE_TIMEOUT), MR_IMAP_IDLE_TIMEOUT);
+	ths->m_idle_last_drop = 0;
+	ths->m_idle_timeouts  = 0;
+	ths->m_set_config_int(ths, "imap_idle_timeout", ths->m_idle_timeout);
+}
+
+
+static void learn_idle_timeout(mrimap_t* ths, int idle_seconds)
+{
+	/* many servers or NAT routers drop IDLE connections earlier than after the 29 minutes allowed by RFC 2177.
+	If two successive connections are dropped at the same stage, we use a timeout a minute shorter than the observed one,
+	so we leave IDLE before the connection is dropped. Drops in the first minutes are not considered as they are caused by network changes typically,
+	drops at different stages are not considered either. */
+	int last_drop = ths->m_idle_last_drop;
+
+	ths->m_idle_timeouts = 0;
+
+	if( idle_seconds < MR_IMAP_MIN_IDLE_TIMEOUT || idle_seconds >= ths->m_idle_timeout-MR_IMAP_IDLE_DROP_TOLERANCE ) {
+		ths->m_idle_last_drop = 0;
+		return;
+	}
+
+	if( last_drop == 0 || abs(idle_seconds-last_drop) > MR_IMAP_IDLE_DROP_TOLERANCE ) {
+		ths->m_idle_last_drop = idle_seconds; /* wait for a confirmation */
+		return;
+	}
+
+	set_idle_timeout(ths, MR_MIN(idle_seconds, last_drop)-60);
+	mrmailbox_log_info(ths->m_mailbox, 0, "IDLE connections are dropped after %i seconds, IDLE timeout set to %i seconds.", idle_seconds, ths->m_idle_timeout);
+}
+
+
+static void idle_timeout_reached(mrimap_t* ths)
+{
+	/* a learned timeout may be caused by a network that is no longer used, so we probe for longer timeouts from time to time;
+	if the connections are dropped at the new stage, the timeout is lowered again by learn_idle_timeout() */
+	ths->m_idle_last_drop = 0;
+
+	if( ths->m_idle_timeout < MR_IMAP_IDLE_TIMEOUT ) {
+		ths->m_idle_timeouts++;
+		if( ths->m_idle_timeouts >= MR_IMAP_IDLE_RAISE_AFTER ) {
+			set_idle_timeout(ths, ths->m_idle_timeout+MR_IMAP_IDLE_RAISE_SECONDS);
+			mrmailbox_log_info(ths->m_mailbox, 0, "IDLE timeout raised to %i seconds.", ths->m_idle_timeout);
+		}
+	}
+}
+
+
+static time_t get_poll_seconds(time_t now, time_t last_message_time)
+{
+	/* calculate the wait time: every 10 seconds in the first 2 minutes after a new message, after that growing up to 5 minutes */
+	if( now-last_message_time < 2*60 ) {
+		return MR_IMAP_POLL_MIN_SECONDS;
+	}
+	return MR_MIN(MR_MAX((now-last_message_time)/6, MR_IMAP_POLL_MIN_SECONDS), MR_IMAP_POLL_MAX_SECONDS);
+}
+
+
+static void* watch_thread_entry_point(void* entry_arg)
+{
+	mrimap_t*       ths = (mrimap_t*)entry_arg;
+	mrosnative_setup_thread(ths->m_mailbox); /* must be very first */
+
+	int             handle_locked = 0, idle_blocked = 0, force_sleep = 0, do_fetch = 0;
+	#define         SLEEP_ON_ERROR_SECONDS     10
+	#define         FULL_FETCH_EVERY_SECONDS   (27*60) /* force a full fetch every 27 minute (typically together the IDLE delay break); independent of the learned IDLE timeout */
+
+	time_t          last_fullread_time = 0, idle_start;
+
+	mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-watch-thread started.");
+
+	ths->m_idle_timeout = MR_MIN(MR_MAX(ths->m_get_config_int(ths, "imap_idle_timeout", MR_IMAP_IDLE_TIMEOUT), MR_IMAP_MIN_IDLE_TIMEOUT), MR_IMAP_IDLE_TIMEOUT);
+	ths->m_idle_last_drop = 0;
+	ths->m_idle_timeouts  = 0;
+
+	if( ths->m_can_idle )
+	{
+		/* watch using IDLE
+		 **********************************************************************/
+
+		int      r, r2;
+		uint32_t uidvalidity;
+
+		fetch_from_all_folders(ths); /* the initial fetch from all folders is needed as this will init the folder UIDs (see fetch_from_single_folder() if lastuid is unset) */
+		last_fullread_time = time(NULL);
+
+		while( 1 )
+		{
+			if( ths->m_watch_do_exit ) {
+				goto exit_;
+			}
+
+			wait_for_pending_jobs(ths);
+
+			BLOCK_IDLE /* must be done before LOCK_HANDLE; this allows other threads to block IDLE */
+			LOCK_HANDLE
+
+				do_fetch = 0;
+				force_sleep = SLEEP_ON_ERROR_SECONDS;
+				uidvalidity = 0;
+
+				setup_handle_if_needed__(ths);
+				if( ths->m_idle_set_up==0 && ths->m_hEtpan && ths->m_hEtpan->imap_stream ) {
+					if( time(NULL)-last_fullread_time > FULL_FETCH_EVERY_SECONDS ) {
+						/* we go here only if we get MAILSTREAM_IDLE_ERROR or MAILSTREAM_IDLE_CANCELLED instead or a proper timeout */
+						UNLOCK_HANDLE
+						UNBLOCK_IDLE
+							fetch_from_all_folders(ths);
+						BLOCK_IDLE
+						LOCK_HANDLE
+						last_fullread_time = time(NULL);
+					}
+					mailstream_setup_idle(ths->m_hEtpan->imap_stream);
+					ths->m_idle_set_up = 1;
+				}
+
+				if( select_folder__(ths, "INBOX") )
+				{
+					uidvalidity = ths->m_hEtpan->imap_selection_info->sel_uidvalidity;
+					r = mailimap_idle(ths->m_hEtpan);
+					if( !is_error(ths, r) )
+					{
+						mrmailbox_log_info(ths->m_mailbox, 0, "IDLE start...");
+
+						ths->m_enter_watch_wait_time = time(NULL);
+						idle_start = ths->m_enter_watch_wait_time;
+
+						UNLOCK_HANDLE
+						UNBLOCK_IDLE
+
+							pthread_mutex_lock(&ths->m_inwait_mutex);
+								r = 0; r2 = 0;
+								if( ths->m_hEtpan ) {
+									r = mailstream_wait_idle(ths->m_hEtpan->imap_stream, ths->m_idle_timeout);
+									r2 = mailimap_idle_done(ths->m_hEtpan); /* it's okay to use the handle without locking as we're inwait */
+								}
+							pthread_mutex_unlock(&ths->m_inwait_mutex);
+							force_sleep = 0;
+
+							if( r == MAILSTREAM_IDLE_ERROR /*0*/ || r==MAILSTREAM_IDLE_CANCELLED /*4*/ ) {
 								mrmailbox_log_info(ths->m_mailbox, 0, "IDLE wait cancelled, r=%i, r2=%i; we'll reconnect soon.", (int)r, (int)r2);
 								force_sleep = SLEEP_ON_ERROR_SECONDS;
 								ths->m_should_reconnect = 1;
+								learn_idle_timeout(ths, (int)(time(NULL)-idle_start));
 							}
 							else if( r == MAILSTREAM_IDLE_INTERRUPTED /*1*/ ) {
 								mrmailbox_log_info(ths->m_mailbox, 0, "IDLE interrupted.");
-								force_sleep = SLEEP_ON_INTERRUPT_SECONDS;
+								pthread_mutex_lock(&ths->m_stats->m_mutex);
+									ths->m_stats->m_idle_interrupts++;
+								pthread_mutex_unlock(&ths->m_stats->m_mutex);
 							}
 							else if( r ==  MAILSTREAM_IDLE_HASDATA /*2*/ ) {
 								mrmailbox_log_info(ths->m_mailbox, 0, "IDLE has data.");
@@ -860,6 +1595,7 @@ static void* watch_thread_entry_point(void* entry_arg)
 							}
 							else if( r == MAILSTREAM_IDLE_TIMEOUT /*3*/ ) {
 								mrmailbox_log_info(ths->m_mailbox, 0, "IDLE timeout.");
+								idle_timeout_reached(ths);
 								do_fetch = 1;
 							}
 
@@ -931,16 +1667,7 @@ static void* watch_thread_entry_point(void* entry_arg)
 				last_fullread_time = now;
 			}
 
-			/* calculate the wait time: every 10 seconds in the first 2 minutes after a new message, after that growing up to 5 minutes */
-			if( now-last_message_time < 2*60 ) {
-				seconds_to_wait = 10;
-			}
-			else {
-				seconds_to_wait = (now-last_message_time)/6;
-				if( seconds_to_wait > 5*60 ) {
-					seconds_to_wait = 5*60;
-				}
-			}
+			seconds_to_wait = get_poll_seconds(now, last_message_time);
 
 			/* wait */
 			mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-watch-thread waits %i seconds.", (int)seconds_to_wait);
@@ -1033,7 +1760,7 @@ void mrimap_heartbeat(mrimap_t* ths)
 		}
 
 		if( ths->m_enter_watch_wait_time != 0
-		 && time(NULL)-ths->m_enter_watch_wait_time > (IDLE_DELAY_SECONDS+60) )
+		 && time(NULL)-ths->m_enter_watch_wait_time > (ths->m_idle_timeout+60) )
 		{
 			/* force reconnect if the IDLE timeout does not arrive */
 			mrmailbox_log_info(ths->m_mailbox, 0, "Reconnect forced from the heartbeat thread.");
@@ -1062,6 +1789,50 @@ cleanup:
 }
 
 
+int mrimap_poll(mrimap_t* ths)
+{
+	/* a single round of the POLL-branch of watch_thread_entry_point() for hosted mailboxes, see mrhost.c;
+	the caller waits the returned number of seconds or until mrimap_fetch() is called */
+	int    handle_locked = 0, seconds_to_wait = -1;
+	time_t now;
+
+	if( ths == NULL ) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&ths->m_poll_mutex);
+
+		if( !ths->m_connected || ths->m_watch_do_exit ) {
+			goto cleanup; /* wait until mrimap_connect() wakes us up */
+		}
+
+		now = time(NULL);
+
+		LOCK_HANDLE
+			setup_handle_if_needed__(ths);
+			forget_folder_selection__(ths); /* see watch_thread_entry_point() */
+		UNLOCK_HANDLE
+
+		if( now-ths->m_poll_last_fullread_time > FULL_FETCH_EVERY_SECONDS ) {
+			if( fetch_from_all_folders(ths) > 0 ) {
+				ths->m_poll_last_message_time = now;
+			}
+			ths->m_poll_last_fullread_time = now;
+		}
+		else {
+			if( fetch_from_single_folder(ths, "INBOX", 0) > 0 ) {
+				ths->m_poll_last_message_time = now;
+			}
+		}
+
+		seconds_to_wait = (int)get_poll_seconds(now, ths->m_poll_last_message_time);
+
+cleanup:
+	pthread_mutex_unlock(&ths->m_poll_mutex);
+	return seconds_to_wait;
+}
+
+
 /*******************************************************************************
  * Setup handle
  ******************************************************************************/
@@ -1077,6 +1848,9 @@ static int setup_handle_if_needed__(mrimap_t* ths)
 
     if( ths->m_should_reconnect ) {
 		unsetup_handle__(ths);
+		pthread_mutex_lock(&ths->m_stats->m_mutex);
+			ths->m_stats->m_reconnects++;
+		pthread_mutex_unlock(&ths->m_stats->m_mutex);
     }
 
     if( ths->m_hEtpan ) {
@@ -1227,7 +2001,7 @@ int mrimap_connect(mrimap_t* ths, const mrloginparam_t* lp)
 		ths->m_connected = 1;
 
 		/* we set the following flags here and not in setup_handle_if_needed__() as they must not change during connection */
-		ths->m_can_idle = mailimap_has_idle(ths->m_hEtpan);
+		ths->m_can_idle = ths->m_hosted? 0 : mailimap_has_idle(ths->m_hEtpan); /* hosted mailboxes poll, IDLE would block a worker of the host */
 		ths->m_has_xlist = mailimap_has_xlist(ths->m_hEtpan);
 
 		if( ths->m_hEtpan->imap_connection_info && ths->m_hEtpan->imap_connection_info->imap_capability ) {
@@ -1249,13 +2023,26 @@ int mrimap_connect(mrimap_t* ths, const mrloginparam_t* lp)
 			free(capinfostr.m_buf);
 		}
 
-		mrmailbox_log_info(ths->m_mailbox, 0, "Starting IMAP-watch-thread...");
 		ths->m_watch_do_exit = 0;
 
+		if( ths->m_hosted ) {
+			ths->m_idle_timeout = MR_MIN(MR_MAX(ths->m_get_config_int(ths, "imap_idle_timeout", MR_IMAP_IDLE_TIMEOUT), MR_IMAP_MIN_IDLE_TIMEOUT), MR_IMAP_IDLE_TIMEOUT);
+			ths->m_poll_last_fullread_time = 0; /* the first poll fetches from all folders, see watch_thread_entry_point() */
+			ths->m_poll_last_message_time  = time(NULL);
+		}
+		else {
+			mrmailbox_log_info(ths->m_mailbox, 0, "Starting IMAP-watch-thread...");
+		}
+
 	UNLOCK_HANDLE
 
-	pthread_create(&ths->m_watch_thread, NULL, watch_thread_entry_point, ths);
-	pthread_create(&ths->m_heartbeat_thread, NULL, heartbeat_thread_entry_point, ths);
+	if( ths->m_hosted ) {
+		mrhost_wakeup(ths->m_mailbox, MR_HOST_TASK_IMAP);
+	}
+	else {
+		pthread_create(&ths->m_watch_thread, NULL, watch_thread_entry_point, ths);
+		pthread_create(&ths->m_heartbeat_thread, NULL, heartbeat_thread_entry_point, ths);
+	}
 
 	success = 1;
 
@@ -1280,7 +2067,16 @@ void mrimap_disconnect(mrimap_t* ths)
 		connected = (ths->m_hEtpan && ths->m_connected);
 	UNLOCK_HANDLE
 
-	if( connected )
+	if( connected && ths->m_hosted )
+	{
+		pthread_mutex_lock(&ths->m_watch_condmutex);
+			ths->m_watch_do_exit = 1;
+		pthread_mutex_unlock(&ths->m_watch_condmutex);
+
+		pthread_mutex_lock(&ths->m_poll_mutex); /* wait for a running mrimap_poll(), further calls return at once as m_watch_do_exit is set */
+		pthread_mutex_unlock(&ths->m_poll_mutex);
+	}
+	else if( connected )
 	{
 		mrmailbox_log_info(ths->m_mailbox, 0, "Stopping IMAP-watch-thread...");
 
@@ -1311,6 +2107,17 @@ void mrimap_disconnect(mrimap_t* ths)
 			pthread_join(ths->m_heartbeat_thread, NULL);
 
 		mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-watch-thread stopped.");
+	}
+
+	if( connected )
+	{
+		if( ths->m_sweep_thread_created )
+		{
+			mrmailbox_log_info(ths->m_mailbox, 0, "Waiting for the IMAP-sync-thread...");
+				pthread_join(ths->m_sweep_thread, NULL); /* the pool connections stop after the current folder as m_watch_do_exit is set */
+				ths->m_sweep_thread_created = 0;
+			mrmailbox_log_info(ths->m_mailbox, 0, "IMAP-sync-thread stopped.");
+		}
 
 		if( ths->m_restore_thread_created )
 		{
@@ -1461,9 +2268,10 @@ cleanup:
  ******************************************************************************/
 
 
-mrimap_t* mrimap_new(mr_get_config_int_t get_config_int, mr_set_config_int_t set_config_int, mr_receive_imf_t receive_imf, void* userData, mrmailbox_t* mailbox)
+mrimap_t* mrimap_new(mr_get_config_int_t get_config_int, mr_set_config_int_t set_config_int, mr_receive_imf_t receive_imf, mr_receive_flush_t receive_flush, void* userData, mrmailbox_t* mailbox)
 {
 	mrimap_t* ths = NULL;
+	clist*    header_names = NULL;
 
 	if( (ths=calloc(1, sizeof(mrimap_t)))==NULL ) {
 		exit(25); /* cannot allocate little memory, unrecoverable error */
@@ -1475,6 +2283,7 @@ mrimap_t* mrimap_new(mr_get_config_int_t get_config_int, mr_set_config_int_t set
 	ths->m_get_config_int = get_config_int;
 	ths->m_set_config_int = set_config_int;
 	ths->m_receive_imf    = receive_imf;
+	ths->m_receive_flush  = receive_flush;
 	ths->m_userData       = userData;
 
 	pthread_mutex_init(&ths->m_hEtpanmutex, NULL);
@@ -1488,6 +2297,15 @@ mrimap_t* mrimap_new(mr_get_config_int_t get_config_int, mr_set_config_int_t set
 	pthread_mutex_init(&ths->m_heartbeat_condmutex, NULL);
 	pthread_cond_init (&ths->m_heartbeat_cond, NULL);
 
+	pthread_mutex_init(&ths->m_poll_mutex, NULL);
+
+	pthread_mutex_init(&ths->m_sweep_mutex, NULL);
+	ths->m_folder_states = chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY);
+
+	ths->m_idle_timeout = MR_IMAP_IDLE_TIMEOUT;
+	ths->m_stats = &ths->m_own_stats;
+	pthread_mutex_init(&ths->m_own_stats.m_mutex, NULL);
+
 	ths->m_selected_folder = calloc(1, 1);
 	ths->m_moveto_folder   = NULL;
 	ths->m_sent_folder     = NULL;
@@ -1503,6 +2321,13 @@ mrimap_t* mrimap_new(mr_get_config_int_t get_config_int, mr_set_config_int_t set
 	ths->m_fetch_type_flags = mailimap_fetch_type_new_fetch_att_list_empty(); /* object to fetch flags only */
 	mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_flags, mailimap_fetch_att_new_flags());
 
+	header_names = clist_new();
+	clist_append(header_names, safe_strdup("Message-ID"));
+	ths->m_fetch_type_message_id = mailimap_fetch_type_new_fetch_att_list_empty(); /* object to fetch the UID and the Message-ID header only */
+	mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_message_id, mailimap_fetch_att_new_uid());
+	mailimap_fetch_type_new_fetch_att_list_add(ths->m_fetch_type_message_id, mailimap_fetch_att_new_body_peek_section(
+		mailimap_section_new_header_fields(mailimap_header_list_new(header_names))));
+
     return ths;
 }
 
@@ -1518,8 +2343,25 @@ void mrimap_unref(mrimap_t* ths)
 	pthread_cond_destroy(&ths->m_heartbeat_cond);
 	pthread_mutex_destroy(&ths->m_heartbeat_condmutex);
 
-	pthread_cond_destroy(&ths->m_watch_cond);
-	pthread_mutex_destroy(&ths->m_watch_condmutex);
+	pthread_mutex_destroy(&ths->m_poll_mutex);
+
+	pthread_mutex_destroy(&ths->m_sweep_mutex);
+	free(ths->m_sweep_info);
+
+	if( ths->m_folder_states ) {
+		chashiter* iter;
+		for( iter = chash_begin(ths->m_folder_states); iter != NULL; iter = chash_next(ths->m_folder_states, iter) ) {
+			chashdatum value;
+			chash_value(iter, &value);
+			free(value.data);
+		}
+		chash_free(ths->m_folder_states);
+	}
+
+	pthread_mutex_destroy(&ths->m_own_stats.m_mutex);
+
+	pthread_cond_destroy(&ths->m_watch_cond);
+	pthread_mutex_destroy(&ths->m_watch_condmutex);
 	pthread_mutex_destroy(&ths->m_inwait_mutex);
 	pthread_mutex_destroy(&ths->m_idlemutex);
 	pthread_mutex_destroy(&ths->m_hEtpanmutex);
@@ -1534,6 +2376,7 @@ void mrimap_unref(mrimap_t* ths)
 	if( ths->m_fetch_type_uid )  { mailimap_fetch_type_free(ths->m_fetch_type_uid);  }
 	if( ths->m_fetch_type_body ) { mailimap_fetch_type_free(ths->m_fetch_type_body); }
 	if( ths->m_fetch_type_flags ){ mailimap_fetch_type_free(ths->m_fetch_type_flags);}
+	if( ths->m_fetch_type_message_id ){ mailimap_fetch_type_free(ths->m_fetch_type_message_id);}
 
 	free(ths);
 }
@@ -1545,6 +2388,11 @@ int mrimap_fetch(mrimap_t* ths)
 		return 0;
 	}
 
+	if( ths->m_hosted ) {
+		mrhost_wakeup(ths->m_mailbox, MR_HOST_TASK_IMAP);
+		return 1;
+	}
+
 	/* the following code has no effect in IDLE mode, however, it also does not disturb */
 	pthread_mutex_lock(&ths->m_watch_condmutex);
 		ths->m_watch_condflag = 1;
@@ -1627,12 +2475,112 @@ cleanup:
 }
 
 
-static int add_flag__(mrimap_t* ths, const char* folder, uint32_t server_uid, struct mailimap_flag* flag)
+/*******************************************************************************
+ * Flag, move and delete messages
+ *
+ * The jobs for marking messages as seen, moving and deleting them are
+ * coalesced by the job thread; here, the messages are grouped by folder and
+ * each group is handled by a single UID STORE, UID MOVE or UID EXPUNGE using
+ * UID sets, eg. "UID STORE 123,456,678 +FLAGS (\Seen)".  So, marking a chat
+ * with hundreds of unread messages as seen results in a few commands and in a
+ * single IDLE interruption.
+ ******************************************************************************/
+
+
+static int compare_stores(const void* p1, const void* p2)
+{
+	const mrimapstore_t* s1 = *(const mrimapstore_t**)p1;
+	const mrimapstore_t* s2 = *(const mrimapstore_t**)p2;
+	int                  r = strcmp(s1->m_folder, s2->m_folder);
+	if( r ) {
+		return r;
+	}
+	return s1->m_uid<s2->m_uid? -1 : (s1->m_uid>s2->m_uid? 1 : 0);
+}
+
+
+static mrimapstore_t** sort_stores(mrimapstore_t* stores, int store_cnt, int* ret_cnt)
+{
+	/* returns pointers to all valid stores, sorted by folder and UID; the result must be free()'d */
+	mrimapstore_t** sorted;
+	int             i;
+
+	if( (sorted=calloc(store_cnt+1, sizeof(mrimapstore_t*)))==NULL ) {
+		exit(51);
+	}
+
+	*ret_cnt = 0;
+	for( i = 0; i < store_cnt; i++ ) {
+		if( stores[i].m_folder && stores[i].m_folder[0] && stores[i].m_uid ) {
+			sorted[(*ret_cnt)++] = &stores[i];
+		}
+	}
+
+	qsort(sorted, *ret_cnt, sizeof(mrimapstore_t*), compare_stores);
+	return sorted;
+}
+
+
+static struct mailimap_set* new_uid_set(mrimapstore_t** stores, int store_cnt, int ms_flag)
+{
+	/* create a set with the UIDs of the given stores having all bits of ms_flag set, returns NULL if there are no such stores.
+	The stores are sorted by UID, so duplicates (several parts of the same message) are easily skipped. */
+	struct mailimap_set* set = NULL;
+	uint32_t             last_uid = 0;
+	int                  i;
+
+	for( i = 0; i < store_cnt; i++ ) {
+		if( (stores[i]->m_ms_flags&ms_flag)==ms_flag && stores[i]->m_uid!=last_uid ) {
+			if( set==NULL && (set=mailimap_set_new_empty())==NULL ) {
+				exit(52);
+			}
+			mailimap_set_add_single(set, stores[i]->m_uid);
+			last_uid = stores[i]->m_uid;
+		}
+	}
+
+	return set;
+}
+
+
+static carray* expand_uid_set(struct mailimap_set* set, size_t max_cnt)
+{
+	/* returns the UIDs of a set in the order given by the server; NULL if the set contains more than max_cnt UIDs */
+	carray*    uids = carray_new(16);
+	clistiter* cur;
+	uint32_t   uid;
+
+	for( cur = clist_begin(set->set_list); cur!=NULL; cur = clist_next(cur) ) {
+		struct mailimap_set_item* item = (struct mailimap_set_item*)clist_content(cur);
+		uint32_t first = item->set_first<=item->set_last? item->set_first : item->set_last;
+		uint32_t last  = item->set_first<=item->set_last? item->set_last : item->set_first;
+		if( first==0 || (size_t)(last-first) >= max_cnt ) {
+			goto error; /* "*" or a range larger than the number of moved messages */
+		}
+		for( uid = first; ; uid++ ) {
+			if( carray_count(uids) >= max_cnt ) {
+				goto error;
+			}
+			carray_add(uids, (void*)(uintptr_t)uid, NULL);
+			if( uid==last ) {
+				break;
+			}
+		}
+	}
+
+	return uids;
+
+error:
+	carray_free(uids);
+	return NULL;
+}
+
+
+static int add_flag__(mrimap_t* ths, const char* folder, struct mailimap_set* set, struct mailimap_flag* flag)
 {
 	int                              r;
 	struct mailimap_flag_list*       flag_list = NULL;
 	struct mailimap_store_att_flags* store_att_flags = NULL;
-	struct mailimap_set*             set = mailimap_set_new_single(server_uid);
 
 	if( ths==NULL || ths->m_hEtpan==NULL ) {
 		goto cleanup;
@@ -1644,6 +2592,7 @@ static int add_flag__(mrimap_t* ths, const char* folder, uint32_t server_uid, st
 
 	flag_list = mailimap_flag_list_new_empty();
 	mailimap_flag_list_add(flag_list, flag);
+	flag = NULL;
 
 	store_att_flags = mailimap_store_att_flags_new_add_flags(flag_list); /* FLAGS.SILENT does not return the new value */
 
@@ -1656,141 +2605,337 @@ cleanup:
 	if( store_att_flags ) {
 		mailimap_store_att_flags_free(store_att_flags);
 	}
-	if( set ) {
-		mailimap_set_free(set);
+	if( flag ) {
+		mailimap_flag_free(flag);
 	}
 	return ths->m_should_reconnect? 0 : 1; /* all non-connection states are treated as success - the mail may already be deleted or moved away on the server */
 }
 
 
-int mrimap_markseen_msg(mrimap_t* ths, const char* folder, uint32_t server_uid, int ms_flags,
-                        char** ret_server_folder, uint32_t* ret_server_uid, int* ret_ms_flags)
+static int can_create_mdnsent_flag__(mrimap_t* ths)
 {
-	// when marking as seen, there is no real need to check against the rfc724_mid - in the worst case, when the UID validity or the mailbox has changed, we mark the wrong message as "seen" - as the very most messages are seen, this is no big thing.
-	// command would be "STORE 123,456,678 +FLAGS (\Seen)"
-	int                  handle_locked = 0, idle_blocked = 0, r;
-	struct mailimap_set* set = NULL;
+	/* Check if the selected folder can handle the `$MDNSent` flag (see RFC 3503). */
+	clistiter* iter;
 
-	if( ths==NULL || folder==NULL || server_uid==0 || ret_server_folder==NULL || ret_server_uid==NULL || ret_ms_flags==NULL
-	 || *ret_server_folder!=NULL || *ret_server_uid!=0 || *ret_ms_flags!=0 ) {
-		return 1; /* job done */
+	if( ths->m_hEtpan->imap_selection_info==NULL || ths->m_hEtpan->imap_selection_info->sel_perm_flags==NULL ) {
+		return 0;
 	}
 
-	if( (set=mailimap_set_new_single(server_uid))==NULL ) {
-		goto cleanup;
+	for( iter=clist_begin(ths->m_hEtpan->imap_selection_info->sel_perm_flags); iter!=NULL; iter=clist_next(iter) )
+	{
+		struct mailimap_flag_perm* fp = (struct mailimap_flag_perm*)clist_content(iter);
+		if( fp ) {
+			if( fp->fl_type==MAILIMAP_FLAG_PERM_ALL ) {
+				return 1;
+			}
+			else if( fp->fl_type==MAILIMAP_FLAG_PERM_FLAG && fp->fl_flag ) {
+				struct mailimap_flag* fl = (struct mailimap_flag*)fp->fl_flag;
+				if( fl->fl_type==MAILIMAP_FLAG_KEYWORD && fl->fl_data.fl_keyword && strcmp(fl->fl_data.fl_keyword, "$MDNSent")==0 ) {
+					return 1;
+				}
+			}
+		}
 	}
 
-	LOCK_HANDLE
+	return 0;
+}
 
-	if( ths->m_hEtpan==NULL ) {
-		goto cleanup;
+
+static int set_ms_flags_by_uid(mrimapstore_t** stores, int store_cnt, uint32_t uid, int ms_flags)
+{
+	/* add ms_flags to all stores with the given UID, returns the number of stores found */
+	int i, found = 0;
+	for( i = 0; i < store_cnt; i++ ) {
+		if( stores[i]->m_uid==uid ) {
+			stores[i]->m_ms_flags |= ms_flags;
+			found++;
+		}
 	}
+	return found;
+}
 
-	BLOCK_IDLE
 
-		INTERRUPT_IDLE
+static void set_mdnsent_flags__(mrimap_t* ths, const char* folder, mrimapstore_t** stores, int store_cnt)
+{
+	/* if the folder cannot handle the `$MDNSent` flag, we risk duplicated MDNs; it's up to the receiving MUA to handle this then (eg. Delta Chat has no problem with this). */
+	struct mailimap_set* set = NULL, *just_set = NULL;
+	clist*               fetch_result = NULL;
+	clistiter*           cur;
+	int                  i, r;
 
-		mrmailbox_log_info(ths->m_mailbox, 0, "Marking message %s/%i as seen...", folder, (int)server_uid);
+	if( (set=new_uid_set(stores, store_cnt, MR_MS_SET_MDNSent_FLAG))==NULL ) {
+		goto cleanup;
+	}
 
-		if( add_flag__(ths, folder, server_uid, mailimap_flag_new_seen())==0 ) {
-			mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot mark message as seen.");
-			goto cleanup;
+	if( !can_create_mdnsent_flag__(ths) ) {
+		for( i = 0; i < store_cnt; i++ ) {
+			if( stores[i]->m_ms_flags&MR_MS_SET_MDNSent_FLAG ) {
+				stores[i]->m_ms_flags |= MR_MS_MDNSent_JUST_SET;
+			}
 		}
+		mrmailbox_log_info(ths->m_mailbox, 0, "Cannot store $MDNSent flags, risk sending duplicate MDN.");
+		goto cleanup;
+	}
 
-		mrmailbox_log_info(ths->m_mailbox, 0, "Message marked as seen.");
+	r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_flags, &fetch_result);
+	if( is_error(ths, r) || fetch_result==NULL ) {
+		goto cleanup;
+	}
 
-		if( (ms_flags&MR_MS_SET_MDNSent_FLAG)
-		 && ths->m_hEtpan->imap_selection_info!=NULL && ths->m_hEtpan->imap_selection_info->sel_perm_flags!=NULL )
-		{
-			/* Check if the folder can handle the `$MDNSent` flag (see RFC 3503).  If so, and not set: set the flags and return this information.
-			If the folder cannot handle the `$MDNSent` flag, we risk duplicated MDNs; it's up to the receiving MUA to handle this then (eg. Delta Chat has no problem with this). */
-			int can_create_flag = 0;
-			clistiter* iter;
-			for( iter=clist_begin(ths->m_hEtpan->imap_selection_info->sel_perm_flags); iter!=NULL; iter=clist_next(iter) )
-			{
-				struct mailimap_flag_perm* fp = (struct mailimap_flag_perm*)clist_content(iter);
-				if( fp ) {
-					if( fp->fl_type==MAILIMAP_FLAG_PERM_ALL ) {
-						can_create_flag = 1;
-						break;
-					}
-					else if( fp->fl_type==MAILIMAP_FLAG_PERM_FLAG && fp->fl_flag ) {
-						struct mailimap_flag* fl = (struct mailimap_flag*)fp->fl_flag;
-						if( fl->fl_type==MAILIMAP_FLAG_KEYWORD && fl->fl_data.fl_keyword && strcmp(fl->fl_data.fl_keyword, "$MDNSent")==0 ) {
-							can_create_flag = 1;
-							break;
-						}
-					}
+	for( cur = clist_begin(fetch_result); cur!=NULL; cur = clist_next(cur) ) {
+		struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(cur);
+		uint32_t                 uid = peek_uid(msg_att);
+		if( uid && !peek_flag_keyword(msg_att, "$MDNSent") ) {
+			if( set_ms_flags_by_uid(stores, store_cnt, uid, 0) ) {
+				if( just_set==NULL && (just_set=mailimap_set_new_empty())==NULL ) {
+					exit(52);
 				}
+				mailimap_set_add_single(just_set, uid);
 			}
+		}
+	}
 
-			if( can_create_flag )
-			{
-				clist* fetch_result = NULL;
-				r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_flags, &fetch_result);
-				if( !is_error(ths, r) && fetch_result ) {
-					clistiter* cur=clist_begin(fetch_result);
-					if( cur ) {
-						if( !peek_flag_keyword((struct mailimap_msg_att*)clist_content(cur), "$MDNSent") ) {
-							add_flag__(ths, folder, server_uid, mailimap_flag_new_flag_keyword(safe_strdup("$MDNSent")));
-							*ret_ms_flags |= MR_MS_MDNSent_JUST_SET;
-						}
-					}
-					mailimap_fetch_list_free(fetch_result);
+	if( just_set ) {
+		add_flag__(ths, folder, just_set, mailimap_flag_new_flag_keyword(safe_strdup("$MDNSent")));
+		if( ths->m_should_reconnect ) {
+			goto cleanup;
+		}
+		for( cur = clist_begin(just_set->set_list); cur!=NULL; cur = clist_next(cur) ) {
+			uint32_t uid = ((struct mailimap_set_item*)clist_content(cur))->set_first;
+			for( i = 0; i < store_cnt; i++ ) {
+				if( stores[i]->m_uid==uid && (stores[i]->m_ms_flags&MR_MS_SET_MDNSent_FLAG) ) {
+					stores[i]->m_ms_flags |= MR_MS_MDNSent_JUST_SET;
 				}
-				mrmailbox_log_info(ths->m_mailbox, 0, ((*ret_ms_flags)&MR_MS_MDNSent_JUST_SET)? "$MDNSent just set and MDN will be send." : "$MDNSent already set and MDN already send.");
 			}
-			else
-			{
-				*ret_ms_flags |= MR_MS_MDNSent_JUST_SET;
-				mrmailbox_log_info(ths->m_mailbox, 0, "Cannot store $MDNSent flags, risk sending duplicate MDN.");
+		}
+	}
+
+	mrmailbox_log_info(ths->m_mailbox, 0, "%i $MDNSent flags just set, MDNs will be send.", just_set? clist_count(just_set->set_list) : 0);
+
+cleanup:
+	if( fetch_result ) {
+		mailimap_fetch_list_free(fetch_result);
+	}
+	if( just_set ) {
+		mailimap_set_free(just_set);
+	}
+	if( set ) {
+		mailimap_set_free(set);
+	}
+}
+
+
+static void move_msgs__(mrimap_t* ths, const char* folder, mrimapstore_t** stores, int store_cnt)
+{
+	struct mailimap_set* set = NULL, *res_setsrc = NULL, *res_setdest = NULL;
+	carray*              src_uids = NULL, *dest_uids = NULL;
+	uint32_t             res_uidvalidity = 0;
+	int                  i, r, moved_cnt;
+
+	if( (ths->m_server_flags&MR_NO_MOVE_TO_CHATS)!=0 ) {
+		goto cleanup;
+	}
+
+	init_chat_folders__(ths);
+	if( ths->m_moveto_folder==NULL ) {
+		goto cleanup;
+	}
+
+	if( (set=new_uid_set(stores, store_cnt, MR_MS_ALSO_MOVE))==NULL ) {
+		goto cleanup;
+	}
+
+	if( strcmp(folder, ths->m_moveto_folder)==0 ) {
+		mrmailbox_log_info(ths->m_mailbox, 0, "%i message(s) already in %s.", clist_count(set->set_list), ths->m_moveto_folder);
+		/* avoid deadlocks as moving messages in the same folder may be result in a new server_uid and the state "fresh" -
+		we will catch these messages again on the next pull, try to move them away and so on, see also (***) */
+		goto cleanup;
+	}
+
+	moved_cnt = clist_count(set->set_list);
+	mrmailbox_log_info(ths->m_mailbox, 0, "Moving %i message(s) from %s to %s...", moved_cnt, folder, ths->m_moveto_folder);
+
+	/* TODO/TOCHECK: MOVE may not be supported on servers, if this is often the case, we should fallback to a COPY/DELETE implementation.
+	Same for the UIDPLUS extension (if in doubt, we can find out the resulting UID using "imap_selection_info->sel_uidnext" then). */
+	r = mailimap_uidplus_uid_move(ths->m_hEtpan, set, ths->m_moveto_folder, &res_uidvalidity, &res_setsrc, &res_setdest); /* the correct folder is already selected by add_flag__() */
+	if( is_error(ths, r) ) {
+		mrmailbox_log_info(ths->m_mailbox, 0, "Cannot move messages.");
+		goto cleanup;
+	}
+
+	/* COPYUID (RFC 4315) returns the source and the destination UIDs in corresponding order; map them back to the stores */
+	if( res_setsrc && res_setdest
+	 && (src_uids=expand_uid_set(res_setsrc, moved_cnt))!=NULL
+	 && (dest_uids=expand_uid_set(res_setdest, moved_cnt))!=NULL
+	 && carray_count(src_uids)==carray_count(dest_uids) )
+	{
+		for( i = 0; i < (int)carray_count(src_uids); i++ ) {
+			uint32_t src_uid  = (uint32_t)(uintptr_t)carray_get(src_uids, i);
+			uint32_t dest_uid = (uint32_t)(uintptr_t)carray_get(dest_uids, i);
+			int      j;
+			for( j = 0; j < store_cnt; j++ ) {
+				if( stores[j]->m_uid==src_uid && (stores[j]->m_ms_flags&MR_MS_ALSO_MOVE) && stores[j]->m_new_folder==NULL ) {
+					stores[j]->m_new_folder = safe_strdup(ths->m_moveto_folder);
+					stores[j]->m_new_uid    = dest_uid;
+				}
 			}
 		}
+	}
+
+	// TODO: If the new UID is equal to lastuid.Chats, we should increase lastuid.Chats by one
+	// (otherwise, we'll download the mail in moment again from the chats folder ...)
+
+	mrmailbox_log_info(ths->m_mailbox, 0, "Messages moved.");
+
+cleanup:
+	if( src_uids ) {
+		carray_free(src_uids);
+	}
+	if( dest_uids ) {
+		carray_free(dest_uids);
+	}
+	if( res_setsrc ) {
+		mailimap_set_free(res_setsrc);
+	}
+	if( res_setdest ) {
+		mailimap_set_free(res_setdest);
+	}
+	if( set ) {
+		mailimap_set_free(set);
+	}
+}
+
+
+static char* peek_message_id(struct mailimap_msg_att* msg_att)
+{
+	/* parse the Message-ID from the header fields returned by a FETCH command, the result must be free()'d */
+	char*                  msg = NULL;
+	size_t                 msg_bytes = 0, index = 0;
+	uint32_t               flags = 0;
+	int                    deleted = 0;
+	struct mailimf_fields* fields = NULL;
+	struct mailimf_field*  field;
+	char*                  ret = NULL;
+
+	peek_body(msg_att, &msg, &msg_bytes, &flags, &deleted);
+	if( msg==NULL || msg_bytes==0
+	 || mailimf_fields_parse(msg, msg_bytes, &index, &fields)!=MAILIMF_NO_ERROR || fields==NULL ) {
+		goto cleanup;
+	}
+
+	if( (field=mr_find_mailimf_field(fields, MAILIMF_FIELD_MESSAGE_ID))!=NULL
+	 && field->fld_data.fld_message_id && field->fld_data.fld_message_id->mid_value ) {
+		ret = safe_strdup(field->fld_data.fld_message_id->mid_value);
+	}
+
+cleanup:
+	if( fields ) {
+		mailimf_fields_free(fields);
+	}
+	return ret;
+}
+
+
+static void verify_message_ids__(mrimap_t* ths, mrimapstore_t** stores, int store_cnt)
+{
+	/* the UID validity or the mailbox may have changed since the UIDs were stored, so MR_MS_MID_MATCHES is added only to
+	the stores whose UID still has the expected Message-ID; all UIDs are checked by a single UID FETCH */
+	struct mailimap_set* set = NULL;
+	clist*               fetch_result = NULL;
+	clistiter*           cur;
+	char*                rfc724_mid;
+	uint32_t             uid;
+	int                  i, r;
+
+	if( (set=new_uid_set(stores, store_cnt, 0))==NULL ) {
+		goto cleanup;
+	}
+
+	r = mailimap_uid_fetch(ths->m_hEtpan, set, ths->m_fetch_type_message_id, &fetch_result);
+	if( is_error(ths, r) || fetch_result==NULL ) {
+		goto cleanup;
+	}
+
+	for( cur = clist_begin(fetch_result); cur!=NULL; cur = clist_next(cur) ) {
+		struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(cur);
+		if( (uid=peek_uid(msg_att))==0 || (rfc724_mid=peek_message_id(msg_att))==NULL ) {
+			continue;
+		}
+		for( i = 0; i < store_cnt; i++ ) {
+			if( stores[i]->m_uid==uid && stores[i]->m_rfc724_mid && strcmp(stores[i]->m_rfc724_mid, rfc724_mid)==0 ) {
+				stores[i]->m_ms_flags |= MR_MS_MID_MATCHES;
+			}
+		}
+		free(rfc724_mid);
+	}
+
+cleanup:
+	if( fetch_result ) {
+		mailimap_fetch_list_free(fetch_result);
+	}
+	if( set ) {
+		mailimap_set_free(set);
+	}
+}
+
+
+int mrimap_markseen_msgs(mrimap_t* ths, mrimapstore_t* stores, int store_cnt)
+{
+	// when marking as seen, there is no real need to check against the rfc724_mid - in the worst case, when the UID validity or the mailbox has changed, we mark the wrong message as "seen" - as the very most messages are seen, this is no big thing.
+	int                  handle_locked = 0, idle_blocked = 0, sorted_cnt = 0, first, next;
+	mrimapstore_t**      sorted = NULL;
+	struct mailimap_set* set = NULL;
+
+	if( ths==NULL || stores==NULL || store_cnt<=0 ) {
+		return 1; /* job done */
+	}
+
+	sorted = sort_stores(stores, store_cnt, &sorted_cnt);
+	if( sorted_cnt==0 ) {
+		free(sorted);
+		return 1; /* job done */
+	}
+
+	LOCK_HANDLE
+
+	if( ths->m_hEtpan==NULL ) {
+		goto cleanup;
+	}
+
+	BLOCK_IDLE
 
-		if( (ms_flags&MR_MS_ALSO_MOVE) && (ths->m_server_flags&MR_NO_MOVE_TO_CHATS)==0 )
+		INTERRUPT_IDLE
+
+		for( first = 0; first < sorted_cnt; first = next )
 		{
-			init_chat_folders__(ths);
-			if( ths->m_moveto_folder && strcmp(folder, ths->m_moveto_folder)==0 )
-			{
-				mrmailbox_log_info(ths->m_mailbox, 0, "Message %s/%i is already in %s...", folder, (int)server_uid, ths->m_moveto_folder);
-				/* avoid deadlocks as moving messages in the same folder may be result in a new server_uid and the state "fresh" -
-				we will catch these messages again on the next pull, try to move them away and so on, see also (***) */
+			const char* folder = sorted[first]->m_folder;
+			for( next = first+1; next < sorted_cnt && strcmp(sorted[next]->m_folder, folder)==0; next++ ) {
+				;
 			}
-			else if( ths->m_moveto_folder )
-			{
-				mrmailbox_log_info(ths->m_mailbox, 0, "Moving message %s/%i to %s...", folder, (int)server_uid, ths->m_moveto_folder);
-
-				/* TODO/TOCHECK: MOVE may not be supported on servers, if this is often the case, we should fallback to a COPY/DELETE implementation.
-				Same for the UIDPLUS extension (if in doubt, we can find out the resulting UID using "imap_selection_info->sel_uidnext" then). */
-				uint32_t             res_uid = 0;
-				struct mailimap_set* res_setsrc = NULL;
-				struct mailimap_set* res_setdest = NULL;
-				r = mailimap_uidplus_uid_move(ths->m_hEtpan, set, ths->m_moveto_folder, &res_uid, &res_setsrc, &res_setdest); /* the correct folder is already selected in add_flag__() above */
-				if( is_error(ths, r) ) {
-					mrmailbox_log_info(ths->m_mailbox, 0, "Cannot move message.");
-					goto cleanup;
-				}
 
-				if( res_setsrc ) {
-					mailimap_set_free(res_setsrc);
-				}
+			set = new_uid_set(&sorted[first], next-first, 0);
 
-				if( res_setdest ) {
-					clistiter* cur = clist_begin(res_setdest->set_list);
-					if (cur != NULL) {
-						struct mailimap_set_item* item;
-						item = clist_content(cur);
-						*ret_server_uid = item->set_first;
-						*ret_server_folder = safe_strdup(ths->m_moveto_folder);
-					}
-					mailimap_set_free(res_setdest);
-				}
+			mrmailbox_log_info(ths->m_mailbox, 0, "Marking %i message(s) in %s as seen...", clist_count(set->set_list), folder);
+
+			if( add_flag__(ths, folder, set, mailimap_flag_new_seen())==0 ) {
+				mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot mark messages as seen.");
+				goto cleanup;
+			}
 
-				// TODO: If the new UID is equal to lastuid.Chats, we should increase lastuid.Chats by one
-				// (otherwise, we'll download the mail in moment again from the chats folder ...)
+			mrmailbox_log_info(ths->m_mailbox, 0, "Messages marked as seen.");
 
-				mrmailbox_log_info(ths->m_mailbox, 0, "Message moved.");
+			set_mdnsent_flags__(ths, folder, &sorted[first], next-first);
+			if( ths->m_should_reconnect ) {
+				goto cleanup;
+			}
+
+			move_msgs__(ths, folder, &sorted[first], next-first);
+			if( ths->m_should_reconnect ) {
+				goto cleanup;
 			}
+
+			mailimap_set_free(set);
+			set = NULL;
 		}
 
 cleanup:
@@ -1799,39 +2944,93 @@ cleanup:
 	if( set ) {
 		mailimap_set_free(set);
 	}
+	free(sorted);
 	return ths->m_should_reconnect? 0 : 1;
 }
 
 
-int mrimap_delete_msg(mrimap_t* ths, const char* rfc724_mid, const char* folder, uint32_t server_uid)
+int mrimap_delete_msgs(mrimap_t* ths, mrimapstore_t* stores, int store_cnt)
 {
-	// when deleting using server_uid, we have to check against rfc724_mid first - the UID validity or the mailbox may have change
-	int success = 0, handle_locked = 0, idle_blocked = 0;
+	// when deleting using server_uid, we have to check against rfc724_mid first - the UID validity or the mailbox may have change, see verify_message_ids__()
+	int                  success = 0, handle_locked = 0, idle_blocked = 0, sorted_cnt = 0, first, next, r;
+	mrimapstore_t**      sorted = NULL;
+	struct mailimap_set* set = NULL;
+
+	if( ths==NULL || stores==NULL || store_cnt<=0 ) {
+		return 1; /* job done */
+	}
 
-	if( ths==NULL || rfc724_mid==NULL || folder==NULL || folder[0]==0 || server_uid==0 ) {
+	sorted = sort_stores(stores, store_cnt, &sorted_cnt);
+	if( sorted_cnt==0 ) {
+		free(sorted);
 		return 1; /* job done */
 	}
 
 	LOCK_HANDLE
+
+	if( ths->m_hEtpan==NULL ) {
+		goto cleanup;
+	}
+
 	BLOCK_IDLE
 
 		INTERRUPT_IDLE
 
-		mrmailbox_log_info(ths->m_mailbox, 0, "Deleting message \"%s\", server_folder=%s, server_uid=%i...", rfc724_mid, folder, (int)server_uid);
+		for( first = 0; first < sorted_cnt; first = next )
+		{
+			const char* folder = sorted[first]->m_folder;
+			for( next = first+1; next < sorted_cnt && strcmp(sorted[next]->m_folder, folder)==0; next++ ) {
+				;
+			}
 
-		if( add_flag__(ths, folder, server_uid, mailimap_flag_new_deleted())==0 ) {
-			mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot delete message."); /* maybe the message is already deleted */
-			goto cleanup;
-		}
+			if( select_folder__(ths, folder)==0 ) {
+				if( ths->m_should_reconnect ) {
+					goto cleanup;
+				}
+				mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot select %s for deleting messages.", folder); /* maybe the folder is deleted */
+				continue;
+			}
+
+			/* only delete the UIDs that still belong to the messages, flagging or expunging other messages cannot be undone */
+			verify_message_ids__(ths, &sorted[first], next-first);
+			if( ths->m_should_reconnect ) {
+				goto cleanup;
+			}
+
+			if( (set=new_uid_set(&sorted[first], next-first, MR_MS_MID_MATCHES))==NULL ) {
+				mrmailbox_log_info(ths->m_mailbox, 0, "Messages in %s to delete not found, maybe already deleted.", folder);
+				continue;
+			}
 
-		mrmailbox_log_info(ths->m_mailbox, 0, "Message deleted.");
+			mrmailbox_log_info(ths->m_mailbox, 0, "Deleting %i of %i message(s) in %s...", clist_count(set->set_list), next-first, folder);
+
+			if( add_flag__(ths, folder, set, mailimap_flag_new_deleted())==0 ) {
+				mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot delete messages."); /* maybe the messages are already deleted */
+				goto cleanup;
+			}
+
+			/* UID EXPUNGE (RFC 4315) only removes the given messages, without UIDPLUS, the messages are just flagged and expunged by the next EXPUNGE of any client */
+			if( ths->m_hEtpan && mailimap_has_uidplus(ths->m_hEtpan) ) {
+				r = mailimap_uid_expunge(ths->m_hEtpan, set);
+				if( is_error(ths, r) && ths->m_should_reconnect ) {
+					goto cleanup;
+				}
+			}
+
+			mrmailbox_log_info(ths->m_mailbox, 0, "Messages deleted.");
+
+			mailimap_set_free(set);
+			set = NULL;
+		}
 
 		success = 1;
 
 cleanup:
 	UNBLOCK_IDLE
 	UNLOCK_HANDLE
-
+	if( set ) {
+		mailimap_set_free(set);
+	}
+	free(sorted);
 	return success;
 }
-
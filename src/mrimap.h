@@ -41,9 +41,37 @@ typedef struct mrimap_t mrimap_t;
 
 #define MR_IMAP_SEEN 0x0001L
 
+#define MR_IMAP_SPILL_BYTES (1*1024*1024) /* messages of this size or larger are parsed from a temporary file instead of the heap */
+#define MR_IMAP_CHUNK_HOLD_BYTES (4*1024*1024) /* max. size of the bodies of a chunk hold in memory until the chunk is received, further bodies are written to temporary files */
+#define MR_IMAP_FETCH_CHUNK_SIZE 50 /* default number of messages requested by a single `UID FETCH`, may be changed using the config-key `imap_fetch_chunk_size` */
+#define MR_IMAP_POOL_SIZE         3 /* default number of additional connections to sync the folders other than the INBOX, may be changed using the config-key `imap_pool_size`; 0=sync sequentially using the IDLE connection */
+#define MR_IMAP_MAX_POOL_SIZE     8
+
+#define MR_IMAP_IDLE_TIMEOUT     (28*60) /* 28 minutes is a typical maximum, most servers do not allow more; shorter server timeouts are learned, see learn_idle_timeout() */
+#define MR_IMAP_MIN_IDLE_TIMEOUT  (2*60)
+#define MR_IMAP_IDLE_DROP_TOLERANCE  30  /* two early drops are considered to be caused by the same server timeout if they differ by at most this number of seconds */
+#define MR_IMAP_IDLE_RAISE_AFTER      3  /* a learned IDLE timeout is raised again after this number of successive regular timeouts ... */
+#define MR_IMAP_IDLE_RAISE_SECONDS (2*60) /* ... by this number of seconds */
+#define MR_IMAP_SETTLE_MAX_MS    30000   /* max. time the IDLE connection waits for pending IMAP jobs before it IDLEs again */
+#define MR_IMAP_POLL_MIN_SECONDS    10   /* without IDLE, we poll every 10 seconds in the first 2 minutes after a new message, after that growing up to 5 minutes */
+#define MR_IMAP_POLL_MAX_SECONDS (5*60)
+
 typedef int32_t  (*mr_get_config_int_t)(mrimap_t*, const char*, int32_t);
 typedef void     (*mr_set_config_int_t)(mrimap_t*, const char*, int32_t);
 typedef void     (*mr_receive_imf_t)   (mrimap_t*, const char* imf_raw_not_terminated, size_t imf_raw_bytes, const char* server_folder, uint32_t server_uid, uint32_t flags);
+typedef void     (*mr_receive_flush_t) (mrimap_t*); /* called before the UIDs of received messages are persisted; returns when all messages passed to mr_receive_imf_t so far are added to the database */
+
+
+typedef struct mrimapstats_t
+{
+	/* shared by the IDLE connection and its pool connections, guarded by m_mutex */
+	pthread_mutex_t       m_mutex;
+	uint32_t              m_idle_interrupts;
+	uint32_t              m_reconnects;
+	uint32_t              m_full_syncs;
+	uint32_t              m_folders_skipped;   /* folders not fetched during a full sync as UIDNEXT and HIGHESTMODSEQ were unchanged */
+	uint64_t              m_bytes_fetched;
+} mrimapstats_t;
 
 
 typedef struct mrimap_t
@@ -75,36 +103,59 @@ typedef struct mrimap_t
 	int                   m_watch_do_exit;
 
 	time_t                m_enter_watch_wait_time;
+	int                   m_idle_timeout;     /* seconds, starts with MR_IMAP_IDLE_TIMEOUT and is lowered if the server drops IDLE connections earlier */
+	int                   m_idle_last_drop;   /* seconds after which the last IDLE connection was dropped early and that is not yet confirmed, 0=none */
+	int                   m_idle_timeouts;    /* number of successive IDLE connections that reached m_idle_timeout */
+	int                   m_pending_jobs;     /* guarded by m_watch_condmutex, set by the job thread */
 
 	pthread_t             m_heartbeat_thread;
 	pthread_cond_t        m_heartbeat_cond;
 	pthread_mutex_t       m_heartbeat_condmutex;
 
+	int                   m_hosted;                  /* no watch- and heartbeat-thread, the host calls mrimap_poll() instead, see mrhost.c */
+	pthread_mutex_t       m_poll_mutex;              /* held by mrimap_poll() */
+	time_t                m_poll_last_message_time;  /* the following fields are guarded by m_poll_mutex */
+	time_t                m_poll_last_fullread_time;
+
 	pthread_t             m_restore_thread;
 	int                   m_restore_thread_created;
 	int                   m_restore_do_exit;
 
+	pthread_t             m_sweep_thread; /* syncs all folders but the INBOX using a pool of additional connections, see fetch_from_all_folders() */
+	int                   m_sweep_thread_created;
+	int                   m_sweep_running;
+	pthread_mutex_t       m_sweep_mutex;  /* protects m_sweep_running, m_sweep_info and the folder queue of a running sweep */
+	char*                 m_sweep_info;   /* summary of the last sweep, NULL if there was none */
+	chash*                m_folder_states;/* UIDNEXT and HIGHESTMODSEQ per folder as seen on the last sweep, guarded by m_sweep_mutex */
+
+	mrimapstats_t*        m_stats;        /* points to m_own_stats or, for pool connections, to the stats of the IDLE connection */
+	mrimapstats_t         m_own_stats;
+
 	struct mailimap_fetch_type* m_fetch_type_uid;
 	struct mailimap_fetch_type* m_fetch_type_body;
 	struct mailimap_fetch_type* m_fetch_type_flags;
+	struct mailimap_fetch_type* m_fetch_type_message_id;
 
 	mr_get_config_int_t   m_get_config_int;
 	mr_set_config_int_t   m_set_config_int;
 	mr_receive_imf_t      m_receive_imf;
+	mr_receive_flush_t    m_receive_flush;
 	void*                 m_userData;
 	mrmailbox_t*          m_mailbox;
 
 	int                   m_log_connect_errors;
+	int                   m_last_fetch_ok;  /* set by fetch_from_single_folder() */
 } mrimap_t;
 
 
-mrimap_t* mrimap_new               (mr_get_config_int_t, mr_set_config_int_t, mr_receive_imf_t, void* userData, mrmailbox_t*);
+mrimap_t* mrimap_new               (mr_get_config_int_t, mr_set_config_int_t, mr_receive_imf_t, mr_receive_flush_t, void* userData, mrmailbox_t*);
 void      mrimap_unref             (mrimap_t*);
 
 int       mrimap_connect           (mrimap_t*, const mrloginparam_t*);
 void      mrimap_disconnect        (mrimap_t*);
 int       mrimap_is_connected      (mrimap_t*);
 int       mrimap_fetch             (mrimap_t*);
+int       mrimap_poll              (mrimap_t*); /* for hosted mailboxes only, returns the seconds to wait before the next call or -1 if not connected */
 int       mrimap_restore           (mrimap_t*, time_t seconds_to_restore);
 
 int       mrimap_append_msg        (mrimap_t*, time_t timestamp, const char* data_not_terminated, size_t data_bytes, char** ret_server_folder, uint32_t* ret_server_uid);
@@ -112,11 +163,22 @@ int       mrimap_append_msg        (mrimap_t*, time_t timestamp, const char* dat
 #define   MR_MS_ALSO_MOVE          0x01
 #define   MR_MS_SET_MDNSent_FLAG   0x02
 #define   MR_MS_MDNSent_JUST_SET   0x10
-int       mrimap_markseen_msg      (mrimap_t*, const char* folder, uint32_t server_uid, int ms_flags, char** ret_server_folder, uint32_t* ret_server_uid, int* ret_ms_flags); /* only returns 0 on connection problems; we should try later again in this case */
-
-int       mrimap_delete_msg        (mrimap_t*, const char* rfc724_mid, const char* folder, uint32_t server_uid); /* only returns 0 on connection problems; we should try later again in this case */
+#define   MR_MS_MID_MATCHES        0x20
+typedef struct mrimapstore_t {
+	const char* m_folder;      /* in: the folder and the UID of the message on the server */
+	uint32_t    m_uid;
+	const char* m_rfc724_mid;  /* in: for deleting, the Message-ID the UID must still have on the server; out: MR_MS_MID_MATCHES may be added */
+	int         m_ms_flags;    /* in: MR_MS_ALSO_MOVE, MR_MS_SET_MDNSent_FLAG; out: MR_MS_MDNSent_JUST_SET may be added */
+	char*       m_new_folder;  /* out: set if the message was moved, must be free()'d */
+	uint32_t    m_new_uid;
+} mrimapstore_t;
+int       mrimap_markseen_msgs     (mrimap_t*, mrimapstore_t*, int store_cnt); /* only returns 0 on connection problems; we should try later again in this case */
+int       mrimap_delete_msgs       (mrimap_t*, mrimapstore_t*, int store_cnt); /* only returns 0 on connection problems; we should try later again in this case */
 
 void      mrimap_heartbeat         (mrimap_t*);
+void      mrimap_set_pending_jobs  (mrimap_t*, int pending_jobs);
+
+char*     mrimap_get_info          (mrimap_t*); /* the result must be free()'d */
 
 #ifdef __cplusplus
 } /* /extern "C" */
@@ -26,155 +26,476 @@
 
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <memory.h>
+#include <dirent.h>
 #include "mrmailbox.h"
 #include "mrjob.h"
 #include "mrchat.h"
+#include "mrimap.h"
 #include "mrmsg.h"
 #include "mrosnative.h"
+#include "mrhost.h"
+#include "mrtools.h"
 
 
 /*******************************************************************************
- * The job thread
+ * The job queues
+ *
+ * Jobs are executed by independent lanes, currently one for SMTP and one for
+ * IMAP, so that eg. a slow IMAP-upload of a large attachment does not delay
+ * outgoing messages.  Each lane has its own thread, wakeup condition and
+ * queue; the lane is given by the action, see mrjob_get_lane().
+ *
+ * All pending jobs are mirrored from the `jobs` table to two binary min-heaps
+ * per lane guarded by m_condmutex: m_ready holds the jobs that can be executed
+ * at once, ordered by priority (higher action first, then FIFO by id);
+ * m_waiting holds the delayed jobs, ordered by desired_timestamp.  So the
+ * job threads go to the database only to persist state changes.
  ******************************************************************************/
 
 
-static int get_wait_seconds(mrmailbox_t* mailbox) // >0: wait seconds, =0: do not wait, <0: wait until signal
+static const char* s_lane_names[MR_JOB_LANES] = { "imap", "smtp" };
+
+
+int mrjob_get_lane(int action)
+{
+	switch( action ) {
+		case MRJ_SEND_MSG_TO_SMTP:
+		case MRJ_SEND_MDN:
+			return MR_JOB_LANE_SMTP;
+
+		default:
+			return MR_JOB_LANE_IMAP;
+	}
+}
+
+
+static int ready_before(const mrjob_t* a, const mrjob_t* b)
+{
+	if( a->m_action != b->m_action ) {
+		return a->m_action > b->m_action;
+	}
+	return a->m_job_id < b->m_job_id;
+}
+
+
+static int waiting_before(const mrjob_t* a, const mrjob_t* b)
+{
+	if( a->m_desired_timestamp != b->m_desired_timestamp ) {
+		return a->m_desired_timestamp < b->m_desired_timestamp;
+	}
+	return ready_before(a, b);
+}
+
+
+static void heap_push(carray* heap, mrjob_t* job, int (*before)(const mrjob_t*, const mrjob_t*))
+{
+	unsigned int i, parent;
+
+	if( carray_add(heap, job, &i) != 0 ) {
+		exit(45);
+	}
+
+	while( i > 0 ) {
+		parent = (i-1)/2;
+		if( !before(job, (mrjob_t*)carray_get(heap, parent)) ) {
+			break;
+		}
+		carray_set(heap, i, carray_get(heap, parent));
+		i = parent;
+	}
+	carray_set(heap, i, job);
+}
+
+
+static mrjob_t* heap_pop(carray* heap, int (*before)(const mrjob_t*, const mrjob_t*))
+{
+	unsigned int cnt = carray_count(heap), i = 0, child;
+	mrjob_t*     ret, *last;
+
+	if( cnt == 0 ) {
+		return NULL;
+	}
+
+	ret  = (mrjob_t*)carray_get(heap, 0);
+	last = (mrjob_t*)carray_get(heap, cnt-1);
+	carray_set_size(heap, --cnt);
+
+	if( cnt > 0 ) {
+		while( (child=i*2+1) < cnt ) {
+			if( child+1 < cnt && before((mrjob_t*)carray_get(heap, child+1), (mrjob_t*)carray_get(heap, child)) ) {
+				child++;
+			}
+			if( !before((mrjob_t*)carray_get(heap, child), last) ) {
+				break;
+			}
+			carray_set(heap, i, carray_get(heap, child));
+			i = child;
+		}
+		carray_set(heap, i, last);
+	}
+
+	return ret;
+}
+
+
+static mrjob_t* mrjob_new(uint32_t job_id, int action, uint32_t foreign_id, const char* packed_param, time_t desired_timestamp)
+{
+	mrjob_t* ths = NULL;
+
+	if( (ths=calloc(1, sizeof(mrjob_t)))==NULL ) {
+		exit(46);
+	}
+
+	ths->m_job_id            = job_id;
+	ths->m_action            = action;
+	ths->m_foreign_id        = foreign_id;
+	ths->m_param             = mrparam_new();
+	ths->m_desired_timestamp = desired_timestamp;
+	mrparam_set_packed(ths->m_param, packed_param);
+
+	return ths;
+}
+
+
+static void mrjob_unref(mrjob_t* ths)
+{
+	if( ths == NULL ) {
+		return;
+	}
+
+	mrparam_unref(ths->m_param);
+	free(ths);
+}
+
+
+static void delete_job_files(mrmailbox_t* mailbox, mrjob_t* job)
+{
+	/* called when a job ends in any state, the rendered message saved for the IMAP upload is not needed any longer */
+	char* file;
+
+	if( job->m_action == MRJ_SEND_MSG_TO_IMAP
+	 && (file=mrparam_get(job->m_param, MRP_FILE, NULL))!=NULL ) {
+		if( mr_file_exist(file) ) {
+			mr_delete_file(file, mailbox);
+		}
+		free(file);
+	}
+}
+
+
+static void publish_pending__(mrjoblane_t* lane) /* the caller must hold m_condmutex */
 {
-	int           ret = -1;
+	/* the IMAP-watch-thread does not re-enter IDLE while there are IMAP jobs, see mrimap_set_pending_jobs() */
+	if( lane->m_lane == MR_JOB_LANE_IMAP ) {
+		mrimap_set_pending_jobs(lane->m_mailbox->m_imap, carray_count(lane->m_ready) + lane->m_executing);
+	}
+}
+
+
+static void queue_job__(mrjoblane_t* lane, mrjob_t* job) /* the caller must hold m_condmutex */
+{
+	if( job->m_desired_timestamp <= time(NULL) ) {
+		job->m_ready_ms = mr_now_ms();
+		heap_push(lane->m_ready, job, ready_before);
+		publish_pending__(lane);
+	}
+	else {
+		heap_push(lane->m_waiting, job, waiting_before);
+	}
+}
+
+
+static void clear_queue__(mrjoblane_t* lane) /* the caller must hold m_condmutex */
+{
+	unsigned int i;
+
+	for( i = 0; i < carray_count(lane->m_ready); i++ ) {
+		mrjob_unref((mrjob_t*)carray_get(lane->m_ready, i));
+	}
+	carray_set_size(lane->m_ready, 0);
+
+	for( i = 0; i < carray_count(lane->m_waiting); i++ ) {
+		mrjob_unref((mrjob_t*)carray_get(lane->m_waiting, i));
+	}
+	carray_set_size(lane->m_waiting, 0);
+
+	lane->m_executing = 0;
+	publish_pending__(lane);
+}
+
+
+static mrjob_t* pop_due_job__(mrjoblane_t* lane) /* the caller must hold m_condmutex */
+{
+	time_t   now = time(NULL);
+	mrjob_t* job;
+
+	while( carray_count(lane->m_waiting) > 0
+	    && ((mrjob_t*)carray_get(lane->m_waiting, 0))->m_desired_timestamp <= now ) {
+		job = heap_pop(lane->m_waiting, waiting_before);
+		job->m_ready_ms = mr_now_ms();
+		heap_push(lane->m_ready, job, ready_before);
+	}
+
+	return heap_pop(lane->m_ready, ready_before);
+}
+
+
+static int get_wait_seconds__(mrjoblane_t* lane) /* the caller must hold m_condmutex; >0: wait seconds, =0: do not wait, <0: wait until signal */
+{
+	time_t min_desired_timestamp, now;
+
+	if( carray_count(lane->m_ready) > 0 ) {
+		return 0;
+	}
+
+	if( carray_count(lane->m_waiting) > 0 ) {
+		min_desired_timestamp = ((mrjob_t*)carray_get(lane->m_waiting, 0))->m_desired_timestamp;
+		now = time(NULL);
+		if( min_desired_timestamp <= now ) {
+			return 0;
+		}
+		return (int)(min_desired_timestamp-now) + 1 /*wait a second longer, pthread_cond_timedwait() is not _that_ exact and we want to be sure to catch the jobs in the first try*/;
+	}
+
+	return -1;
+}
+
+
+static void signal_lane__(mrjoblane_t* lane) /* the caller must hold m_condmutex */
+{
+	lane->m_condflag = 1;
+	pthread_cond_signal(&lane->m_cond);
+	mrhost_wakeup(lane->m_mailbox, lane->m_lane); /* hosted mailboxes have no job threads, the lanes are the first tasks, see mrhost.c */
+}
+
+
+/*******************************************************************************
+ * The job threads
+ ******************************************************************************/
+
+
+static int is_batchable(int action)
+{
+	/* jobs that can be coalesced and executed by a single call, see mrimap_markseen_msgs() */
+	switch( action ) {
+		case MRJ_DELETE_MSG_ON_IMAP:
+		case MRJ_MARKSEEN_MSG_ON_IMAP:
+		case MRJ_MARKSEEN_MDN_ON_IMAP:
+			return 1;
+
+		default:
+			return 0;
+	}
+}
+
+
+static void pop_due_jobs__(mrjoblane_t* lane, carray* batch) /* the caller must hold m_condmutex */
+{
+	mrjob_t* job;
+
+	carray_set_size(batch, 0);
+	if( (job=pop_due_job__(lane)) == NULL ) {
+		return;
+	}
+	carray_add(batch, job, NULL);
+
+	/* as the ready heap is ordered by action, all due jobs of the same action are on top */
+	if( is_batchable(job->m_action) ) {
+		while( carray_count(batch) < MR_JOB_BATCH_SIZE
+		    && carray_count(lane->m_ready) > 0
+		    && ((mrjob_t*)carray_get(lane->m_ready, 0))->m_action == job->m_action ) {
+			carray_add(batch, heap_pop(lane->m_ready, ready_before), NULL);
+		}
+	}
+
+	lane->m_executing = carray_count(batch);
+	publish_pending__(lane);
+}
+
+
+static void finish_jobs(mrjoblane_t* lane, carray* batch)
+{
+	mrmailbox_t*  mailbox = lane->m_mailbox;
 	sqlite3_stmt* stmt;
+	mrjob_t*      job;
+	unsigned int  i, cnt = carray_count(batch);
+	double        latency_ms, end_ms = mr_now_ms();
+
+	/* statistics: the latency is the time from the job becoming due until the end of its execution */
+	pthread_mutex_lock(&lane->m_condmutex);
+		for( i = 0; i < cnt; i++ ) {
+			latency_ms = end_ms - ((mrjob_t*)carray_get(batch, i))->m_ready_ms;
+			lane->m_executed_cnt++;
+			lane->m_latency_sum_ms += latency_ms;
+			if( latency_ms > lane->m_latency_max_ms ) {
+				lane->m_latency_max_ms = latency_ms;
+			}
+		}
+	pthread_mutex_unlock(&lane->m_condmutex);
 
+	/* delete jobs or execute jobs later again; a batch is persisted by a single transaction */
 	mrsqlite3_lock(mailbox->m_sql);
-		stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_MIN_d_FROM_jobs, "SELECT MIN(desired_timestamp) FROM jobs;");
-		if( stmt && sqlite3_step(stmt) == SQLITE_ROW )
-		{
-			if( sqlite3_column_type(stmt, 0)!=SQLITE_NULL )
-			{
-				time_t min_desired_timestamp = (time_t)sqlite3_column_int64(stmt, 0);
-				time_t now = time(NULL);
-				if( min_desired_timestamp <= now ) {
-					ret = 0;
+	if( cnt > 1 ) {
+		mrsqlite3_begin_transaction__(mailbox->m_sql);
+	}
+
+		for( i = 0; i < cnt; i++ ) {
+			job = (mrjob_t*)carray_get(batch, i);
+			if( job->m_start_again_at ) {
+				stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_jobs_SET_dp_WHERE_id,
+					"UPDATE jobs SET desired_timestamp=?, param=? WHERE id=?;");
+				sqlite3_bind_int64(stmt, 1, job->m_start_again_at);
+				sqlite3_bind_text (stmt, 2, mrparam_get_packed(job->m_param), -1, SQLITE_STATIC);
+				sqlite3_bind_int  (stmt, 3, job->m_job_id);
+				if( sqlite3_step(stmt)==SQLITE_DONE && sqlite3_changes(mailbox->m_sql->m_cobj)>0 ) {
+					mrmailbox_log_info(mailbox, 0, "Job #%i delayed for %i seconds", (int)job->m_job_id, (int)(job->m_start_again_at-time(NULL)));
+					job->m_desired_timestamp = job->m_start_again_at;
 				}
 				else {
-					ret = (int)(min_desired_timestamp-now) + 1 /*wait a second longer, pthread_cond_timedwait() is not _that_ exact and we want to be sure to catch the jobs in the first try*/;
+					job->m_desired_timestamp = 0; /* the job may be killed in between */
 				}
 			}
+			else {
+				stmt = mrsqlite3_predefine__(mailbox->m_sql, DELETE_FROM_jobs_WHERE_id,
+					"DELETE FROM jobs WHERE id=?;");
+				sqlite3_bind_int(stmt, 1, job->m_job_id);
+				sqlite3_step(stmt);
+				mrmailbox_log_info(mailbox, 0, "Job #%i done and deleted from database", (int)job->m_job_id);
+				job->m_desired_timestamp = 0;
+			}
 		}
+
+	if( cnt > 1 ) {
+		mrsqlite3_commit__(mailbox->m_sql);
+	}
 	mrsqlite3_unlock(mailbox->m_sql);
 
-	return ret;
+	for( i = 0; i < cnt; i++ ) {
+		job = (mrjob_t*)carray_get(batch, i);
+		if( job->m_desired_timestamp == 0 ) {
+			delete_job_files(mailbox, job);
+		}
+	}
+
+	pthread_mutex_lock(&lane->m_condmutex);
+		for( i = 0; i < cnt; i++ ) {
+			job = (mrjob_t*)carray_get(batch, i);
+			if( job->m_desired_timestamp ) {
+				queue_job__(lane, job);
+			}
+			else {
+				mrjob_unref(job);
+			}
+		}
+		lane->m_executing = 0;
+		publish_pending__(lane);
+	pthread_mutex_unlock(&lane->m_condmutex);
+
+	carray_set_size(batch, 0);
+}
+
+
+static int perform_due_jobs(mrjoblane_t* lane, carray* batch) /* returns 0 if the lane should exit */
+{
+	mrmailbox_t*  mailbox = lane->m_mailbox;
+	mrjob_t*      job;
+	mrjob_t**     jobs;
+	int           i, job_cnt;
+
+	mrmailbox_log_info(mailbox, 0, "Job thread for %s-lane checks for pending jobs...", s_lane_names[lane->m_lane]);
+	while( 1 )
+	{
+		/* get next waiting job, batchable jobs are coalesced */
+		pthread_mutex_lock(&lane->m_condmutex);
+			if( lane->m_do_exit ) {
+				pthread_mutex_unlock(&lane->m_condmutex);
+				return 0;
+			}
+			pop_due_jobs__(lane, batch);
+		pthread_mutex_unlock(&lane->m_condmutex);
+
+		if( (job_cnt=carray_count(batch)) == 0 ) {
+			break;
+		}
+
+		/* execute job */
+		jobs = (mrjob_t**)carray_data(batch);
+		job = jobs[0];
+		for( i = 0; i < job_cnt; i++ ) {
+			jobs[i]->m_start_again_at = 0;
+		}
+
+		if( job_cnt > 1 ) {
+			mrmailbox_log_info(mailbox, 0, "Executing %i jobs #%i..., action %i...", job_cnt, (int)job->m_job_id, (int)job->m_action);
+		}
+		else {
+			mrmailbox_log_info(mailbox, 0, "Executing job #%i, action %i...", (int)job->m_job_id, (int)job->m_action);
+		}
+
+		switch( job->m_action ) {
+			case MRJ_CONNECT_TO_IMAP:      mrmailbox_connect_to_imap       (mailbox, job); break;
+			case MRJ_SEND_MSG_TO_SMTP:     mrmailbox_send_msg_to_smtp      (mailbox, job); break;
+			case MRJ_SEND_MSG_TO_IMAP:     mrmailbox_send_msg_to_imap      (mailbox, job); break;
+			case MRJ_DELETE_MSG_ON_IMAP:   mrmailbox_delete_msgs_on_imap   (mailbox, jobs, job_cnt); break;
+			case MRJ_MARKSEEN_MSG_ON_IMAP: mrmailbox_markseen_msgs_on_imap (mailbox, jobs, job_cnt); break;
+			case MRJ_MARKSEEN_MDN_ON_IMAP: mrmailbox_markseen_mdns_on_imap (mailbox, jobs, job_cnt); break;
+			case MRJ_SEND_MDN:             mrmailbox_send_mdn              (mailbox, job); break;
+		}
+
+		finish_jobs(lane, batch);
+	}
+
+	return 1;
 }
 
 
 static void* job_thread_entry_point(void* entry_arg)
 {
-	mrmailbox_t*  mailbox = (mrmailbox_t*)entry_arg;
+	mrjoblane_t*  lane = (mrjoblane_t*)entry_arg;
+	mrmailbox_t*  mailbox = lane->m_mailbox;
 	mrosnative_setup_thread(mailbox); /* must be very first */
 
-	sqlite3_stmt* stmt;
-	mrjob_t       job;
+	carray*       batch = carray_new(16);
 	int           seconds_to_wait;
 
-	memset(&job, 0, sizeof(mrjob_t));
-	job.m_param = mrparam_new();
-
 	/* init thread */
-	mrmailbox_log_info(mailbox, 0, "Job thread entered.");
+	mrmailbox_log_info(mailbox, 0, "Job thread for %s-lane entered.", s_lane_names[lane->m_lane]);
 
 	while( 1 )
 	{
 		/* wait for condition */
-		pthread_mutex_lock(&mailbox->m_job_condmutex);
-			seconds_to_wait = get_wait_seconds(mailbox);
+		pthread_mutex_lock(&lane->m_condmutex);
+			seconds_to_wait = get_wait_seconds__(lane);
 			if( seconds_to_wait > 0 ) {
-				mrmailbox_log_info(mailbox, 0, "Job thread waiting for %i seconds or signal...", seconds_to_wait);
-				if( mailbox->m_job_condflag == 0 ) {
+				mrmailbox_log_info(mailbox, 0, "Job thread for %s-lane waiting for %i seconds or signal...", s_lane_names[lane->m_lane], seconds_to_wait);
+				if( lane->m_condflag == 0 ) {
 					struct timespec timeToWait;
 					timeToWait.tv_sec  = time(NULL)+seconds_to_wait;
 					timeToWait.tv_nsec = 0;
-					pthread_cond_timedwait(&mailbox->m_job_cond, &mailbox->m_job_condmutex, &timeToWait);
+					pthread_cond_timedwait(&lane->m_cond, &lane->m_condmutex, &timeToWait);
 				}
 			}
 			else if( seconds_to_wait < 0 ) {
-				mrmailbox_log_info(mailbox, 0, "Job thread waiting for signal...");
-				while( mailbox->m_job_condflag == 0 ) {
-					pthread_cond_wait(&mailbox->m_job_cond, &mailbox->m_job_condmutex); /* wait unlocks the mutex and waits for signal; if it returns, the mutex is locked again */
+				mrmailbox_log_info(mailbox, 0, "Job thread for %s-lane waiting for signal...", s_lane_names[lane->m_lane]);
+				while( lane->m_condflag == 0 ) {
+					pthread_cond_wait(&lane->m_cond, &lane->m_condmutex); /* wait unlocks the mutex and waits for signal; if it returns, the mutex is locked again */
 				}
 			}
-			mailbox->m_job_condflag = 0;
-		pthread_mutex_unlock(&mailbox->m_job_condmutex);
+			lane->m_condflag = 0;
+		pthread_mutex_unlock(&lane->m_condmutex);
 
 		/* do all waiting jobs */
-		mrmailbox_log_info(mailbox, 0, "Job thread checks for pending jobs...");
-		while( 1 )
-		{
-			pthread_mutex_lock(&mailbox->m_job_condmutex);
-				if( mailbox->m_job_do_exit ) {
-					pthread_mutex_unlock(&mailbox->m_job_condmutex);
-					goto exit_;
-				}
-			pthread_mutex_unlock(&mailbox->m_job_condmutex);
-
-			/* get next waiting job */
-			job.m_job_id = 0;
-			mrsqlite3_lock(mailbox->m_sql);
-				stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_iafp_FROM_jobs,
-					"SELECT id, action, foreign_id, param FROM jobs WHERE desired_timestamp<=? ORDER BY action DESC, id LIMIT 1;");
-				sqlite3_bind_int64(stmt, 1, time(NULL));
-				if( sqlite3_step(stmt) == SQLITE_ROW ) {
-					job.m_job_id                         = sqlite3_column_int (stmt, 0);
-					job.m_action                         = sqlite3_column_int (stmt, 1);
-					job.m_foreign_id                     = sqlite3_column_int (stmt, 2);
-					mrparam_set_packed(job.m_param, (char*)sqlite3_column_text(stmt, 3));
-				}
-			mrsqlite3_unlock(mailbox->m_sql);
-
-			if( job.m_job_id == 0 ) {
-				break;
-			}
-
-			/* execute job */
-			mrmailbox_log_info(mailbox, 0, "Executing job #%i, action %i...", (int)job.m_job_id, (int)job.m_action);
-			job.m_start_again_at = 0;
-			switch( job.m_action ) {
-				case MRJ_CONNECT_TO_IMAP:      mrmailbox_connect_to_imap      (mailbox, &job); break;
-                case MRJ_SEND_MSG_TO_SMTP:     mrmailbox_send_msg_to_smtp     (mailbox, &job); break;
-                case MRJ_SEND_MSG_TO_IMAP:     mrmailbox_send_msg_to_imap     (mailbox, &job); break;
-                case MRJ_DELETE_MSG_ON_IMAP:   mrmailbox_delete_msg_on_imap   (mailbox, &job); break;
-                case MRJ_MARKSEEN_MSG_ON_IMAP: mrmailbox_markseen_msg_on_imap (mailbox, &job); break;
-                case MRJ_MARKSEEN_MDN_ON_IMAP: mrmailbox_markseen_mdn_on_imap (mailbox, &job); break;
-                case MRJ_SEND_MDN:             mrmailbox_send_mdn             (mailbox, &job); break;
-			}
-
-			/* delete job or execute job later again */
-			if( job.m_start_again_at ) {
-				mrsqlite3_lock(mailbox->m_sql);
-					stmt = mrsqlite3_predefine__(mailbox->m_sql, UPDATE_jobs_SET_dp_WHERE_id,
-						"UPDATE jobs SET desired_timestamp=?, param=? WHERE id=?;");
-					sqlite3_bind_int64(stmt, 1, job.m_start_again_at);
-					sqlite3_bind_text (stmt, 2, job.m_param->m_packed, -1, SQLITE_STATIC);
-					sqlite3_bind_int  (stmt, 3, job.m_job_id);
-					sqlite3_step(stmt);
-				mrsqlite3_unlock(mailbox->m_sql);
-				mrmailbox_log_info(mailbox, 0, "Job #%i delayed for %i seconds", (int)job.m_job_id, (int)(job.m_start_again_at-time(NULL)));
-			}
-			else {
-				mrsqlite3_lock(mailbox->m_sql);
-					stmt = mrsqlite3_predefine__(mailbox->m_sql, DELETE_FROM_jobs_WHERE_id,
-						"DELETE FROM jobs WHERE id=?;");
-					sqlite3_bind_int(stmt, 1, job.m_job_id);
-					sqlite3_step(stmt);
-				mrsqlite3_unlock(mailbox->m_sql);
-				mrmailbox_log_info(mailbox, 0, "Job #%i done and deleted from database", (int)job.m_job_id);
-			}
+		if( !perform_due_jobs(lane, batch) ) {
+			goto exit_;
 		}
-
 	}
 
 	/* exit thread */
 exit_:
-	mrparam_unref(job.m_param);
-	mrmailbox_log_info(mailbox, 0, "Exit job thread.");
+	carray_free(batch);
+	mrmailbox_log_info(mailbox, 0, "Exit job thread for %s-lane.", s_lane_names[lane->m_lane]);
 	mrosnative_unsetup_thread(mailbox); /* must be very last */
 	return NULL;
 }
@@ -187,23 +508,273 @@ exit_:
 
 void mrjob_init_thread(mrmailbox_t* mailbox)
 {
-	pthread_mutex_init(&mailbox->m_job_condmutex, NULL);
-    pthread_cond_init(&mailbox->m_job_cond, NULL);
-    pthread_create(&mailbox->m_job_thread, NULL, job_thread_entry_point, mailbox);
+	int          i;
+	mrjoblane_t* lane;
+
+	for( i = 0; i < MR_JOB_LANES; i++ )
+	{
+		if( (lane=calloc(1, sizeof(mrjoblane_t)))==NULL
+		 || (lane->m_ready=carray_new(128))==NULL
+		 || (lane->m_waiting=carray_new(128))==NULL ) {
+			exit(47);
+		}
+
+		lane->m_mailbox = mailbox;
+		lane->m_lane    = i;
+		pthread_mutex_init(&lane->m_condmutex, NULL);
+		pthread_cond_init(&lane->m_cond, NULL);
+		mailbox->m_job_lanes[i] = lane;
+
+		if( mailbox->m_host == NULL ) {
+			pthread_create(&lane->m_thread, NULL, job_thread_entry_point, lane);
+		}
+	}
 }
 
 
 void mrjob_exit_thread(mrmailbox_t* mailbox)
 {
-	pthread_mutex_lock(&mailbox->m_job_condmutex);
-		mailbox->m_job_condflag = 1;
-		mailbox->m_job_do_exit = 1;
-		pthread_cond_signal(&mailbox->m_job_cond);
-	pthread_mutex_unlock(&mailbox->m_job_condmutex);
-
-	pthread_join(mailbox->m_job_thread, NULL);
-	pthread_cond_destroy(&mailbox->m_job_cond);
-	pthread_mutex_destroy(&mailbox->m_job_condmutex);
+	int          i;
+	mrjoblane_t* lane;
+
+	for( i = 0; i < MR_JOB_LANES; i++ ) {
+		lane = mailbox->m_job_lanes[i];
+		pthread_mutex_lock(&lane->m_condmutex);
+			lane->m_do_exit = 1;
+			signal_lane__(lane);
+		pthread_mutex_unlock(&lane->m_condmutex);
+	}
+
+	for( i = 0; i < MR_JOB_LANES; i++ ) {
+		lane = mailbox->m_job_lanes[i];
+		if( mailbox->m_host == NULL ) {
+			pthread_join(lane->m_thread, NULL);
+		}
+		mailbox->m_job_lanes[i] = NULL;
+
+		clear_queue__(lane);
+		carray_free(lane->m_ready);
+		carray_free(lane->m_waiting);
+		pthread_cond_destroy(&lane->m_cond);
+		pthread_mutex_destroy(&lane->m_condmutex);
+		free(lane);
+	}
+}
+
+
+int mrjob_perform_lane(mrmailbox_t* mailbox, int lane_index)
+{
+	/* for hosted mailboxes, see mrhost.c, this is called instead of a job thread loop; the caller is responsible for not running a lane twice at the same time */
+	mrjoblane_t* lane;
+	carray*      batch;
+	int          seconds_to_wait = -1;
+
+	if( mailbox == NULL || (lane=mailbox->m_job_lanes[lane_index]) == NULL ) {
+		return -1;
+	}
+
+	pthread_mutex_lock(&lane->m_condmutex);
+		lane->m_condflag = 0;
+	pthread_mutex_unlock(&lane->m_condmutex);
+
+	batch = carray_new(16);
+	if( perform_due_jobs(lane, batch) ) {
+		pthread_mutex_lock(&lane->m_condmutex);
+			seconds_to_wait = get_wait_seconds__(lane);
+		pthread_mutex_unlock(&lane->m_condmutex);
+	}
+	carray_free(batch);
+
+	return seconds_to_wait;
+}
+
+
+int mrjob_get_spool_type(const char* name, uint32_t* ret_msg_id)
+{
+	unsigned long msg_id = 0;
+	int           len = 0, ret = 0;
+
+	if( name == NULL ) {
+		return 0;
+	}
+
+	/* %n is only set if the whole format matches */
+	if( sscanf(name, MR_SPOOL_SENT_FMT "%n", &msg_id, &len)==1 && len > 0 && name[len]==0 ) {
+		ret = MR_SPOOL_SENT;
+	}
+	else if( sscanf(name, MR_SPOOL_APPEND_FMT "%n", &msg_id, &len)==1 && len > 0 && name[len]==0 ) {
+		ret = MR_SPOOL_APPEND;
+	}
+
+	if( ret && ret_msg_id ) {
+		*ret_msg_id = (uint32_t)msg_id;
+	}
+	return ret;
+}
+
+
+static void delete_orphaned_spool_files__(mrmailbox_t* mailbox)
+{
+	/* the jobs may be gone without being executed (killed, tables reset, crashes), delete the files written for them */
+	DIR*           dir_handle;
+	struct dirent* dir_entry;
+	sqlite3_stmt*  stmt;
+	uint32_t       msg_id;
+	int            type, has_job;
+	char*          path;
+
+	if( mailbox->m_blobdir == NULL || (dir_handle=opendir(mailbox->m_blobdir))==NULL ) {
+		return;
+	}
+
+	stmt = mrsqlite3_prepare_v2_(mailbox->m_sql, "SELECT id FROM jobs WHERE action=? AND foreign_id=?;");
+	while( stmt && (dir_entry=readdir(dir_handle))!=NULL ) {
+		if( (type=mrjob_get_spool_type(dir_entry->d_name, &msg_id)) == 0 ) {
+			continue;
+		}
+
+		has_job = 0;
+		if( type == MR_SPOOL_SENT ) {
+			sqlite3_reset(stmt);
+			sqlite3_bind_int(stmt, 1, MRJ_SEND_MSG_TO_IMAP);
+			sqlite3_bind_int(stmt, 2, msg_id);
+			has_job = (sqlite3_step(stmt)==SQLITE_ROW);
+		}
+
+		if( !has_job ) {
+			path = mr_mprintf("%s/%s", mailbox->m_blobdir, dir_entry->d_name);
+			mr_delete_file(path, mailbox);
+			free(path);
+		}
+	}
+
+	if( stmt ) {
+		sqlite3_finalize(stmt);
+	}
+	closedir(dir_handle);
+}
+
+
+void mrjob_load_queue__(mrmailbox_t* mailbox)
+{
+	sqlite3_stmt* stmt = NULL;
+	int           i, cnt = 0;
+	mrjob_t*      job;
+	mrjoblane_t*  lane;
+
+	if( mailbox == NULL ) {
+		return;
+	}
+
+	delete_orphaned_spool_files__(mailbox);
+
+	if( mailbox->m_job_lanes[0] == NULL ) {
+		return;
+	}
+
+	mrjob_clear_queue(mailbox);
+	mrjob_end_transaction__(mailbox->m_sql, 0, 0); /* jobs added by a running transaction are read from the database below */
+
+	stmt = mrsqlite3_prepare_v2_(mailbox->m_sql, "SELECT id, action, foreign_id, param, desired_timestamp FROM jobs;");
+	while( stmt && sqlite3_step(stmt) == SQLITE_ROW ) {
+		job = mrjob_new(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 2),
+			(const char*)sqlite3_column_text(stmt, 3), (time_t)sqlite3_column_int64(stmt, 4));
+		lane = mailbox->m_job_lanes[mrjob_get_lane(job->m_action)];
+		pthread_mutex_lock(&lane->m_condmutex);
+			queue_job__(lane, job);
+		pthread_mutex_unlock(&lane->m_condmutex);
+		cnt++;
+	}
+
+	if( stmt ) {
+		sqlite3_finalize(stmt);
+	}
+
+	for( i = 0; i < MR_JOB_LANES; i++ ) {
+		lane = mailbox->m_job_lanes[i];
+		pthread_mutex_lock(&lane->m_condmutex);
+			signal_lane__(lane);
+		pthread_mutex_unlock(&lane->m_condmutex);
+	}
+
+	mrmailbox_log_info(mailbox, 0, "%i pending job(s) loaded.", cnt);
+}
+
+
+void mrjob_clear_queue(mrmailbox_t* mailbox)
+{
+	int          i;
+	mrjoblane_t* lane;
+
+	if( mailbox == NULL || mailbox->m_job_lanes[0] == NULL ) {
+		return; /* job threads already exited */
+	}
+
+	for( i = 0; i < MR_JOB_LANES; i++ ) {
+		lane = mailbox->m_job_lanes[i];
+		pthread_mutex_lock(&lane->m_condmutex);
+			clear_queue__(lane);
+		pthread_mutex_unlock(&lane->m_condmutex);
+	}
+}
+
+
+void mrjob_end_transaction__(mrsqlite3_t* sql, int level, int commit)
+{
+	/* jobs added inside a transaction are queued only when the outermost transaction is committed, so that a rollback
+	does not leave jobs in the queue that are not in the database; committing a nested transaction passes its jobs to
+	the enclosing one.  level=0 drops all pending jobs. */
+	mrmailbox_t*  mailbox = sql->m_mailbox;
+	mrjob_t*      job;
+	mrjoblane_t*  lane;
+	unsigned int  i, kept_cnt = 0;
+	int           signal_lanes[MR_JOB_LANES];
+
+	if( sql->m_pending_jobs == NULL || carray_count(sql->m_pending_jobs) == 0 ) {
+		return;
+	}
+
+	memset(signal_lanes, 0, sizeof(signal_lanes));
+	for( i = 0; i < carray_count(sql->m_pending_jobs); i++ )
+	{
+		job = (mrjob_t*)carray_get(sql->m_pending_jobs, i);
+		if( job->m_transaction_level < level ) {
+			carray_set(sql->m_pending_jobs, kept_cnt++, job); /* added by an enclosing transaction */
+		}
+		else if( !commit || level == 0 ) {
+			mrjob_unref(job); /* rolled back */
+		}
+		else if( level > 1 ) {
+			job->m_transaction_level = level-1;
+			carray_set(sql->m_pending_jobs, kept_cnt++, job);
+		}
+		else if( (lane=mailbox->m_job_lanes[mrjob_get_lane(job->m_action)]) == NULL ) {
+			mrjob_unref(job); /* job threads already exited, the job will be loaded on the next start */
+		}
+		else {
+			pthread_mutex_lock(&lane->m_condmutex);
+				if( !lane->m_do_exit ) {
+					job->m_transaction_level = 0;
+					queue_job__(lane, job);
+					signal_lanes[lane->m_lane] = 1;
+				}
+				else {
+					mrjob_unref(job);
+				}
+			pthread_mutex_unlock(&lane->m_condmutex);
+		}
+	}
+	carray_set_size(sql->m_pending_jobs, kept_cnt);
+
+	for( i = 0; i < MR_JOB_LANES; i++ ) {
+		if( signal_lanes[i] ) {
+			lane = mailbox->m_job_lanes[i];
+			mrmailbox_log_info(mailbox, 0, "Signal job thread for %s-lane to wake up...", s_lane_names[lane->m_lane]);
+			pthread_mutex_lock(&lane->m_condmutex);
+				signal_lane__(lane);
+			pthread_mutex_unlock(&lane->m_condmutex);
+		}
+	}
 }
 
 
@@ -212,6 +783,8 @@ uint32_t mrjob_add__(mrmailbox_t* mailbox, int action, int foreign_id, const cha
 	time_t        timestamp = time(NULL);
 	sqlite3_stmt* stmt;
 	uint32_t      job_id = 0;
+	mrjoblane_t*  lane;
+	mrjob_t*      job;
 
 	stmt = mrsqlite3_predefine__(mailbox->m_sql, INSERT_INTO_jobs_aafp,
 		"INSERT INTO jobs (added_timestamp, action, foreign_id, param) VALUES (?,?,?,?);");
@@ -225,13 +798,28 @@ uint32_t mrjob_add__(mrmailbox_t* mailbox, int action, int foreign_id, const cha
 
 	job_id = sqlite3_last_insert_rowid(mailbox->m_sql->m_cobj);
 
-	pthread_mutex_lock(&mailbox->m_job_condmutex);
-		if( !mailbox->m_job_do_exit ) {
-			mrmailbox_log_info(mailbox, 0, "Signal job thread to wake up...");
-			mailbox->m_job_condflag = 1;
-			pthread_cond_signal(&mailbox->m_job_cond);
+	if( (lane=mailbox->m_job_lanes[mrjob_get_lane(action)]) == NULL ) {
+		return job_id; /* job threads already exited, the job will be loaded on the next start */
+	}
+
+	if( mailbox->m_sql->m_transactionCount > 0 ) {
+		/* the job is queued when the transaction is committed, see mrjob_end_transaction__() */
+		if( mailbox->m_sql->m_pending_jobs == NULL ) {
+			mailbox->m_sql->m_pending_jobs = carray_new(16);
+		}
+		job = mrjob_new(job_id, action, foreign_id, param, 0);
+		job->m_transaction_level = mailbox->m_sql->m_transactionCount;
+		carray_add(mailbox->m_sql->m_pending_jobs, job, NULL);
+		return job_id;
+	}
+
+	pthread_mutex_lock(&lane->m_condmutex);
+		if( !lane->m_do_exit ) {
+			queue_job__(lane, mrjob_new(job_id, action, foreign_id, param, 0));
+			mrmailbox_log_info(mailbox, 0, "Signal job thread for %s-lane to wake up...", s_lane_names[lane->m_lane]);
+			signal_lane__(lane);
 		}
-	pthread_mutex_unlock(&mailbox->m_job_condmutex);
+	pthread_mutex_unlock(&lane->m_condmutex);
 
 	return job_id;
 }
@@ -283,5 +871,65 @@ void mrjob_kill_action__(mrmailbox_t* mailbox, int action)
 		"DELETE FROM jobs WHERE action=?;");
 	sqlite3_bind_int(stmt, 1, action);
 	sqlite3_step(stmt);
+
+	mrjoblane_t* lane = mailbox->m_job_lanes[mrjob_get_lane(action)];
+	if( lane == NULL ) {
+		return;
+	}
+
+	/* remove the jobs from the queue; this is rare, so we simply rebuild the heaps */
+	pthread_mutex_lock(&lane->m_condmutex);
+	{
+		carray*      heaps[2] = { lane->m_ready, lane->m_waiting };
+		carray*      keep = carray_new(128);
+		unsigned int h, i;
+		mrjob_t*     job;
+		for( h = 0; h < 2; h++ ) {
+			for( i = 0; i < carray_count(heaps[h]); i++ ) {
+				job = (mrjob_t*)carray_get(heaps[h], i);
+				if( job->m_action == action ) {
+					delete_job_files(mailbox, job);
+					mrjob_unref(job);
+				}
+				else {
+					carray_add(keep, job, NULL);
+				}
+			}
+			carray_set_size(heaps[h], 0);
+		}
+		for( i = 0; i < carray_count(keep); i++ ) {
+			queue_job__(lane, (mrjob_t*)carray_get(keep, i));
+		}
+		carray_free(keep);
+		publish_pending__(lane);
+	}
+	pthread_mutex_unlock(&lane->m_condmutex);
 }
 
+
+char* mrjob_get_info(mrmailbox_t* mailbox)
+{
+	int            i;
+	mrjoblane_t*   lane;
+	char*          temp;
+	mrstrbuilder_t ret;
+	mrstrbuilder_init(&ret);
+
+	for( i = 0; i < MR_JOB_LANES; i++ )
+	{
+		if( (lane=mailbox->m_job_lanes[i]) == NULL ) {
+			continue;
+		}
+
+		pthread_mutex_lock(&lane->m_condmutex);
+			temp = mr_mprintf("Job lane %s: %i ready, %i delayed, %i executed, latency avg %.0f ms, max %.0f ms\n",
+				s_lane_names[i], (int)carray_count(lane->m_ready), (int)carray_count(lane->m_waiting), (int)lane->m_executed_cnt,
+				lane->m_executed_cnt? lane->m_latency_sum_ms/lane->m_executed_cnt : 0.0, lane->m_latency_max_ms);
+		pthread_mutex_unlock(&lane->m_condmutex);
+
+		mrstrbuilder_cat(&ret, temp);
+		free(temp);
+	}
+
+	return ret.m_buf;
+}
@@ -46,14 +46,52 @@ typedef struct mrjob_t {
 	int        m_action;
 	uint32_t   m_foreign_id;
 	mrparam_t* m_param;
+	time_t     m_desired_timestamp; /* mirrors jobs.desired_timestamp, 0=at once */
+	double     m_ready_ms;          /* time when the job became due, used for statistics */
 	/* the following fields are set by the execution routines, m_param may also be modified */
 	time_t     m_start_again_at; /* 1=on next loop, >1=on timestamp, 0=delete job (default) */
+	int        m_transaction_level; /* set while the job waits for the commit of the transaction it was added in */
 } mrjob_t;
 
+#define MR_JOB_BATCH_SIZE          500    /* max. number of jobs of the same action executed by a single call, see mrimap_markseen_msgs() */
+
+#define MR_JOB_LANE_IMAP           0      /* see MR_JOB_LANES in mrmailbox.h */
+#define MR_JOB_LANE_SMTP           1
+
+typedef struct mrjoblane_t {
+	mrmailbox_t*    m_mailbox;
+	int             m_lane;
+	pthread_t       m_thread;
+	pthread_cond_t  m_cond;
+	pthread_mutex_t m_condmutex; /* guards all fields below */
+	int             m_condflag;
+	int             m_do_exit;
+	carray*         m_ready;     /* heap of due jobs */
+	carray*         m_waiting;   /* heap of delayed jobs */
+	int             m_executing; /* number of jobs popped but not yet finished */
+	uint32_t        m_executed_cnt;
+	double          m_latency_sum_ms;
+	double          m_latency_max_ms;
+} mrjoblane_t;
+
+int      mrjob_get_lane        (int action); /* returns MR_JOB_LANE_* */
+char*    mrjob_get_info        (mrmailbox_t*); /* queue depth and latency per lane, the result must be free()'d */
+
 void     mrjob_init_thread     (mrmailbox_t*);
 void     mrjob_exit_thread     (mrmailbox_t*);
+int      mrjob_perform_lane    (mrmailbox_t*, int lane); /* for hosted mailboxes, executes the due jobs of the lane, returns the seconds until the next job is due or -1 */
 uint32_t mrjob_add__           (mrmailbox_t*, int action, int foreign_id, const char* param); /* returns the job_id or 0 on errors. the job may or may not be done if the function returns. */
 void     mrjob_kill_action__   (mrmailbox_t*, int action); /* delete all pending jobs with the given action */
+void     mrjob_load_queue__    (mrmailbox_t*); /* mirror the jobs table to the in-memory queue, must be called after the database is opened */
+void     mrjob_clear_queue     (mrmailbox_t*); /* must be called before the database is closed */
+void     mrjob_end_transaction__(mrsqlite3_t*, int level, int commit); /* called when the transaction of the given level ends, queues or drops the jobs added inside it */
+
+/* files in the blobdir written by the send jobs; they are deleted when the job ends and are not backed up */
+#define  MR_SPOOL_SENT         1 /* rendered message saved by mrmailbox_send_msg_to_smtp() for MRJ_SEND_MSG_TO_IMAP */
+#define  MR_SPOOL_APPEND       2 /* message spooled by mrmailbox_send_msg_to_imap() for the IMAP APPEND */
+#define  MR_SPOOL_SENT_FMT     "sent-%lu.eml"
+#define  MR_SPOOL_APPEND_FMT   "append-%lu.eml"
+int      mrjob_get_spool_type  (const char* name, uint32_t* ret_msg_id); /* returns MR_SPOOL_* for the name without path, 0 for other files */
 
 #define  MR_AT_ONCE            0
 #define  MR_INCREATION_POLL    2 /* this value does not increase the number of tries */
@@ -31,6 +31,7 @@
 #include <sqlite3.h>
 #include "mrmailbox.h"
 #include "mrkey.h"
+#include "mrkeyring.h"
 #include "mrpgp.h"
 #include "mrtools.h"
 
@@ -251,6 +252,45 @@ int mrkey_equals(const mrkey_t* ths, const mrkey_t* o)
  ******************************************************************************/
 
 
+int mrkey_use_self_cache__(mrsqlite3_t* sql, const char* self_addr)
+{
+	/* returns 1 if the m_self_* members of the mailbox can be used for the given address;
+	the self-keys are cached for one address only, typically, this is the configured address */
+	mrmailbox_t* mailbox = sql->m_mailbox;
+
+	if( mailbox==NULL || sql!=mailbox->m_sql ) {
+		return 0; /* eg. a database opened for backup */
+	}
+
+	if( mailbox->m_self_keys_addr==NULL || strcmp(mailbox->m_self_keys_addr, self_addr)!=0 ) {
+		mrkey_uncache_self__(mailbox);
+		mailbox->m_self_keys_addr = safe_strdup(self_addr);
+	}
+
+	return 1;
+}
+
+
+void mrkey_uncache_self__(mrmailbox_t* mailbox)
+{
+	if( mailbox==NULL ) {
+		return;
+	}
+
+	free(mailbox->m_self_keys_addr);
+	mailbox->m_self_keys_addr = NULL;
+
+	mrkey_unref(mailbox->m_self_public);
+	mailbox->m_self_public = NULL;
+
+	mrkey_unref(mailbox->m_self_private); /* wipes the secret */
+	mailbox->m_self_private = NULL;
+
+	mrkeyring_unref(mailbox->m_self_keyring);
+	mailbox->m_self_keyring = NULL;
+}
+
+
 int mrkey_save_self_keypair__(const mrkey_t* public_key, const mrkey_t* private_key, const char* addr, int is_default, mrsqlite3_t* sql)
 {
 	sqlite3_stmt* stmt;
@@ -260,6 +300,10 @@ int mrkey_save_self_keypair__(const mrkey_t* public_key, const mrkey_t* private_
 		return 0;
 	}
 
+	if( sql->m_mailbox && sql==sql->m_mailbox->m_sql ) {
+		mrkey_uncache_self__(sql->m_mailbox); /* the defaults may change; also done on failure as the caller may have modified the table before */
+	}
+
 	stmt = mrsqlite3_predefine__(sql, INSERT_INTO_keypairs_aippc,
 		"INSERT INTO keypairs (addr, is_default, public_key, private_key, created) VALUES (?,?,?,?,?);");
 	sqlite3_bind_text (stmt, 1, addr, -1, SQLITE_STATIC);
@@ -271,6 +315,9 @@ int mrkey_save_self_keypair__(const mrkey_t* public_key, const mrkey_t* private_
 		return 0;
 	}
 
+	mrpgp_cache_key(sql->m_mailbox, public_key); /* replace outdated keys with the same fingerprint */
+	mrpgp_cache_key(sql->m_mailbox, private_key);
+
 	return 1;
 }
 
@@ -278,12 +325,18 @@ int mrkey_save_self_keypair__(const mrkey_t* public_key, const mrkey_t* private_
 int mrkey_load_self_public__(mrkey_t* ths, const char* self_addr, mrsqlite3_t* sql)
 {
 	sqlite3_stmt* stmt;
+	int           use_cache;
 
 	if( ths==NULL || self_addr==NULL || sql==NULL ) {
 		return 0;
 	}
 
 	mrkey_empty(ths);
+
+	if( (use_cache=mrkey_use_self_cache__(sql, self_addr)) && sql->m_mailbox->m_self_public ) {
+		return mrkey_set_from_key(ths, sql->m_mailbox->m_self_public);
+	}
+
 	stmt = mrsqlite3_predefine__(sql, SELECT_public_key_FROM_keypairs_WHERE_default,
 		"SELECT public_key FROM keypairs WHERE addr=? AND is_default=1;");
 	sqlite3_bind_text (stmt, 1, self_addr, -1, SQLITE_STATIC);
@@ -291,6 +344,11 @@ int mrkey_load_self_public__(mrkey_t* ths, const char* self_addr, mrsqlite3_t* s
 		return 0;
 	}
 	mrkey_set_from_stmt(ths, stmt, 0, MR_PUBLIC);
+
+	if( use_cache ) {
+		sql->m_mailbox->m_self_public = mrkey_new();
+		mrkey_set_from_key(sql->m_mailbox->m_self_public, ths);
+	}
 	return 1;
 }
 
@@ -298,12 +356,18 @@ int mrkey_load_self_public__(mrkey_t* ths, const char* self_addr, mrsqlite3_t* s
 int mrkey_load_self_private_for_signing__(mrkey_t* ths, const char* self_addr, mrsqlite3_t* sql)
 {
 	sqlite3_stmt* stmt;
+	int           use_cache;
 
 	if( ths==NULL || self_addr==NULL || sql==NULL ) {
 		return 0;
 	}
 
 	mrkey_empty(ths);
+
+	if( (use_cache=mrkey_use_self_cache__(sql, self_addr)) && sql->m_mailbox->m_self_private ) {
+		return mrkey_set_from_key(ths, sql->m_mailbox->m_self_private);
+	}
+
 	stmt = mrsqlite3_predefine__(sql, SELECT_private_key_FROM_keypairs_WHERE_default,
 		"SELECT private_key FROM keypairs WHERE addr=? AND is_default=1;");
 	sqlite3_bind_text (stmt, 1, self_addr, -1, SQLITE_STATIC);
@@ -311,6 +375,11 @@ int mrkey_load_self_private_for_signing__(mrkey_t* ths, const char* self_addr, m
 		return 0;
 	}
 	mrkey_set_from_stmt(ths, stmt, 0, MR_PRIVATE);
+
+	if( use_cache ) {
+		sql->m_mailbox->m_self_private = mrkey_new();
+		mrkey_set_from_key(sql->m_mailbox->m_self_private, ths);
+	}
 	return 1;
 }
 
@@ -66,6 +66,8 @@ int   mrkey_equals        (const mrkey_t*, const mrkey_t*);
 int   mrkey_save_self_keypair__(const mrkey_t* public_key, const mrkey_t* private_key, const char* addr, int is_default, mrsqlite3_t* sql);
 int   mrkey_load_self_public__ (mrkey_t*, const char* self_addr, mrsqlite3_t* sql);
 int   mrkey_load_self_private_for_signing__(mrkey_t*, const char* self_addr, mrsqlite3_t* sql);
+int   mrkey_use_self_cache__   (mrsqlite3_t*, const char* self_addr); /* the self-keys are cached in the mailbox object for one address */
+void  mrkey_uncache_self__     (mrmailbox_t*);
 
 char* mr_render_base64   (const void* buf, size_t buf_bytes, int break_every, const char* break_chars, int add_checksum); /* the result must be freed */
 char* mrkey_render_base64(const mrkey_t* ths, int break_every, const char* break_chars, int add_checksum); /* the result must be freed */
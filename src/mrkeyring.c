@@ -90,11 +90,29 @@ int mrkeyring_load_self_private_for_decrypting__(mrkeyring_t* ths, const char* s
 {
 	sqlite3_stmt* stmt;
 	mrkey_t*      key;
+	mrkeyring_t*  cached = NULL;
+	int           i;
 
 	if( ths==NULL || self_addr==NULL || sql==NULL ) {
 		return 0;
 	}
 
+	if( mrkey_use_self_cache__(sql, self_addr) ) {
+		if( sql->m_mailbox->m_self_keyring == NULL ) {
+			sql->m_mailbox->m_self_keyring = mrkeyring_new();
+			cached = sql->m_mailbox->m_self_keyring; /* filled below */
+		}
+		else {
+			for( i = 0; i < sql->m_mailbox->m_self_keyring->m_count; i++ ) {
+				key = mrkey_new(); /* copy the key, the reference counter is not thread-safe and the returned keyring is typically freed without the lock */
+					mrkey_set_from_key(key, sql->m_mailbox->m_self_keyring->m_keys[i]);
+					mrkeyring_add(ths, key);
+				mrkey_unref(key);
+			}
+			return 1;
+		}
+	}
+
 	stmt = mrsqlite3_predefine__(sql, SELECT_private_key_FROM_keypairs_ORDER_BY_default,
 		"SELECT private_key FROM keypairs ORDER BY addr=? DESC, is_default DESC;");
 	sqlite3_bind_text (stmt, 1, self_addr, -1, SQLITE_STATIC);
@@ -102,6 +120,12 @@ int mrkeyring_load_self_private_for_decrypting__(mrkeyring_t* ths, const char* s
 		key = mrkey_new();
 			if( mrkey_set_from_stmt(key, stmt, 0, MR_PRIVATE) ) {
 				mrkeyring_add(ths, key);
+				if( cached ) {
+					mrkey_t* copy = mrkey_new();
+					mrkey_set_from_key(copy, key);
+					mrkeyring_add(cached, copy);
+					mrkey_unref(copy);
+				}
 			}
 		mrkey_unref(key); /* unref in any case, mrkeyring_add() adds its own reference */
 	}
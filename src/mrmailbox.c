@@ -42,6 +42,9 @@
 #include "mrloginparam.h"
 #include "mrkey.h"
 #include "mrpgp.h"
+#include "mrblob.h"
+#include "mrhost.h"
+#include "mrosnative.h"
 
 
 /*******************************************************************************
@@ -151,7 +154,7 @@ static uint32_t lookup_group_by_grpid__(mrmailbox_t* mailbox, mrmimeparser_t* mi
 	/* check if the group does not exist but should be created */
 	int group_explicitly_left = mrmailbox_group_explicitly_left__(mailbox, grpid);
 
-	self_addr = mrsqlite3_get_config__(mailbox->m_sql, "configured_addr", "");
+	self_addr = safe_strdup(mailbox->m_self_addr);
 	if( chat_id == 0
 	 && (create_flags&MR_CREATE_GROUP_AS_NEEDED)
 	 && grpname
@@ -291,10 +294,11 @@ cleanup:
  ******************************************************************************/
 
 
-static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
-                          const char* server_folder, uint32_t server_uid, uint32_t flags)
+static void apply_imf__(mrmailbox_t* ths, mrmimeparser_t* mime_parser, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
+                        const char* server_folder, uint32_t server_uid, uint32_t flags, carray* events)
 {
-	/* the function returns the number of created messages in the database */
+	/* add a parsed message to the database; the caller must hold the sql-lock.
+	The events to send are added to `events` as triples of event, data1 and data2; send them using send_events() after unlocking. */
 	int              incoming = 0;
 	int              incoming_origin = MR_ORIGIN_UNSET;
 	#define          outgoing (!incoming)
@@ -312,8 +316,6 @@ static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, si
 	uint32_t         first_dblocal_id = 0;
 	char*            rfc724_mid = NULL; /* Message-ID from the header */
 	time_t           message_timestamp = MR_INVALID_TIMESTAMP;
-	mrmimeparser_t*  mime_parser = mrmimeparser_new(ths->m_blobdir, ths);
-	int              db_locked = 0;
 	int              transaction_pending = 0;
 	clistiter*       cur1;
 	const struct mailimf_field* field;
@@ -326,35 +328,17 @@ static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, si
 	int              has_return_path = 0;
 	char*            txt_raw = NULL;
 
-	mrmailbox_log_info(ths, 0, "Receive message #%lu from %s.", server_uid, server_folder? server_folder:"?");
-
 	to_ids = carray_new(16);
-	if( to_ids==NULL || created_db_entries==NULL || rr_event_to_send==NULL || mime_parser == NULL ) {
+	if( to_ids==NULL || created_db_entries==NULL || rr_event_to_send==NULL || mime_parser == NULL || events == NULL ) {
 		mrmailbox_log_info(ths, 0, "Bad param.");
 		goto cleanup;
 	}
 
-	/* parse the imf to mailimf_message {
-	        mailimf_fields* msg_fields {
-	          clist* fld_list; // list of mailimf_field
-	        }
-	        mailimf_body* msg_body { // != NULL
-                const char * bd_text; // != NULL
-                size_t bd_size;
-	        }
-	   };
-	normally, this is done by mailimf_message_parse(), however, as we also need the MIME data,
-	we use mailmime_parse() through MrMimeParser (both call mailimf_struct_multiple_parse() somewhen, I did not found out anything
-	that speaks against this approach yet) */
-	mrmimeparser_parse(mime_parser, imf_raw_not_terminated, imf_raw_bytes);
 	if( mime_parser->m_header == NULL ) {
 		mrmailbox_log_info(ths, 0, "No header.");
 		goto cleanup; /* Error - even adding an empty record won't help as we do not know the message ID */
 	}
 
-	mrsqlite3_lock(ths->m_sql);
-	db_locked = 1;
-
 	mrsqlite3_begin_transaction__(ths->m_sql);
 	transaction_pending = 1;
 
@@ -624,8 +608,8 @@ static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, si
 				}
 
 				stmt = mrsqlite3_predefine__(ths->m_sql, INSERT_INTO_msgs_msscftttsmttpb,
-					"INSERT INTO msgs (rfc724_mid,server_folder,server_uid,chat_id,from_id, to_id,timestamp,type, state,msgrmsg,txt,txt_raw,param,bytes)"
-					" VALUES (?,?,?,?,?, ?,?,?, ?,?,?,?,?,?);");
+					"INSERT INTO msgs (rfc724_mid,server_folder,server_uid,chat_id,from_id, to_id,timestamp,type, state,msgrmsg,txt,txt_raw,param,bytes,blob)"
+					" VALUES (?,?,?,?,?, ?,?,?, ?,?,?,?,?,?,?);");
 				sqlite3_bind_text (stmt,  1, rfc724_mid, -1, SQLITE_STATIC);
 				sqlite3_bind_text (stmt,  2, server_folder, -1, SQLITE_STATIC);
 				sqlite3_bind_int  (stmt,  3, server_uid);
@@ -638,8 +622,9 @@ static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, si
 				sqlite3_bind_int  (stmt, 10, msgrmsg);
 				sqlite3_bind_text (stmt, 11, part->m_msg? part->m_msg : "", -1, SQLITE_STATIC);
 				sqlite3_bind_text (stmt, 12, txt_raw? txt_raw : "", -1, SQLITE_STATIC);
-				sqlite3_bind_text (stmt, 13, part->m_param->m_packed, -1, SQLITE_STATIC);
+				sqlite3_bind_text (stmt, 13, mrparam_get_packed(part->m_param), -1, SQLITE_STATIC);
 				sqlite3_bind_int  (stmt, 14, part->m_bytes);
+				sqlite3_bind_text (stmt, 15, mrblob_get_name(ths->m_blobdir, mrparam_peek(part->m_param, MRP_FILE, NULL)), -1, SQLITE_STATIC);
 				if( sqlite3_step(stmt) != SQLITE_DONE ) {
 					mrmailbox_log_info(ths, 0, "Cannot write DB.");
 					goto cleanup; /* i/o error - there is nothing more we can do - in other cases, we try to write at least an empty record */
@@ -790,14 +775,6 @@ cleanup:
 		mrsqlite3_rollback__(ths->m_sql);
 	}
 
-	if( db_locked ) {
-		mrsqlite3_unlock(ths->m_sql);
-	}
-
-	if( mime_parser ) {
-		mrmimeparser_unref(mime_parser);
-	}
-
 	if( rfc724_mid ) {
 		free(rfc724_mid);
 	}
@@ -807,10 +784,12 @@ cleanup:
 	}
 
 	if( created_db_entries ) {
-		if( create_event_to_send ) {
+		if( create_event_to_send && events ) {
 			size_t i, icnt = carray_count(created_db_entries);
 			for( i = 0; i < icnt; i += 2 ) {
-				ths->m_cb(ths, create_event_to_send, (uintptr_t)carray_get(created_db_entries, i), (uintptr_t)carray_get(created_db_entries, i+1));
+				carray_add(events, (void*)(uintptr_t)create_event_to_send, NULL);
+				carray_add(events, carray_get(created_db_entries, i), NULL);
+				carray_add(events, carray_get(created_db_entries, i+1), NULL);
 			}
 		}
 		carray_free(created_db_entries);
@@ -818,8 +797,10 @@ cleanup:
 
 	if( rr_event_to_send ) {
 		size_t i, icnt = carray_count(rr_event_to_send);
-		for( i = 0; i < icnt; i += 2 ) {
-			ths->m_cb(ths, MR_EVENT_MSG_READ, (uintptr_t)carray_get(rr_event_to_send, i), (uintptr_t)carray_get(rr_event_to_send, i+1));
+		for( i = 0; i < icnt && events; i += 2 ) {
+			carray_add(events, (void*)(uintptr_t)MR_EVENT_MSG_READ, NULL);
+			carray_add(events, carray_get(rr_event_to_send, i), NULL);
+			carray_add(events, carray_get(rr_event_to_send, i+1), NULL);
 		}
 		carray_free(rr_event_to_send);
 	}
@@ -828,6 +809,332 @@ cleanup:
 }
 
 
+static void send_events(mrmailbox_t* ths, carray* events)
+{
+	/* send the events collected by apply_imf__(); MR_EVENT_MSGS_CHANGED is sent only once per chat, with the last message added */
+	size_t i, j, icnt = carray_count(events);
+	for( i = 0; i < icnt; i += 3 ) {
+		int       event = (int)(uintptr_t)carray_get(events, i);
+		uintptr_t data1 = (uintptr_t)carray_get(events, i+1);
+		uintptr_t data2 = (uintptr_t)carray_get(events, i+2);
+		if( event == MR_EVENT_MSGS_CHANGED ) {
+			for( j = i+3; j < icnt; j += 3 ) {
+				if( (int)(uintptr_t)carray_get(events, j)==MR_EVENT_MSGS_CHANGED && (uintptr_t)carray_get(events, j+1)==data1 ) {
+					break;
+				}
+			}
+			if( j < icnt ) {
+				continue; /* a later event for the same chat follows */
+			}
+		}
+		ths->m_cb(ths, event, data1, data2);
+	}
+}
+
+
+static void receive_imf(mrmailbox_t* ths, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
+                          const char* server_folder, uint32_t server_uid, uint32_t flags)
+{
+	/* parse and add a single message synchronously, see the receive pipeline below for the usual way */
+	mrmimeparser_t* mime_parser = mrmimeparser_new(ths->m_blobdir, ths);
+	carray*         events = carray_new(16);
+
+	mrmailbox_log_info(ths, 0, "Receive message #%lu from %s.", server_uid, server_folder? server_folder:"?");
+
+	/* parse the imf to mailimf_message {
+	        mailimf_fields* msg_fields {
+	          clist* fld_list; // list of mailimf_field
+	        }
+	        mailimf_body* msg_body { // != NULL
+                const char * bd_text; // != NULL
+                size_t bd_size;
+	        }
+	   };
+	normally, this is done by mailimf_message_parse(), however, as we also need the MIME data,
+	we use mailmime_parse() through MrMimeParser (both call mailimf_struct_multiple_parse() somewhen, I did not found out anything
+	that speaks against this approach yet) */
+	mrmimeparser_parse(mime_parser, imf_raw_not_terminated, imf_raw_bytes);
+
+	mrsqlite3_lock(ths->m_sql);
+		apply_imf__(ths, mime_parser, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags, events);
+	mrsqlite3_unlock(ths->m_sql);
+
+	send_events(ths, events);
+
+	mrmimeparser_unref(mime_parser);
+	carray_free(events);
+}
+
+
+/*******************************************************************************
+ * Receive pipeline
+ ******************************************************************************/
+
+
+/* Messages fetched by IMAP are parsed and decrypted by a pool of workers while the
+fetching connection continues reading from the network.  A single committer adds the
+parsed messages in the order they were fetched, all messages parsed so far in one
+transaction.  The pipeline is bounded by the number of messages and by their size;
+if it is full, the fetching connection waits. */
+
+
+#define MR_RECEIVE_WORKERS     3
+#define MR_RECEIVE_QUEUE_SIZE  128                /* max. number of messages in the pipeline */
+#define MR_RECEIVE_QUEUE_BYTES (32*1024*1024)     /* max. size of the messages in the pipeline; larger messages are received directly */
+#define MR_RECEIVE_BATCH_SIZE  100                /* max. number of messages added in one transaction */
+
+
+typedef struct mrreceiveitem_t
+{
+	char*           m_raw;
+	size_t          m_raw_bytes;
+	char*           m_folder;
+	uint32_t        m_server_uid;
+	uint32_t        m_flags;
+	mrmimeparser_t* m_mime_parser; /* set by the worker */
+	int             m_parsed;
+} mrreceiveitem_t;
+
+
+typedef struct mrreceiver_t
+{
+	pthread_mutex_t  m_mutex;        /* protects all following members */
+	pthread_cond_t   m_cond;         /* broadcasted on every state change */
+	mrreceiveitem_t* m_items[MR_RECEIVE_QUEUE_SIZE]; /* ring buffer, the item with the sequence number n is at n%MR_RECEIVE_QUEUE_SIZE */
+	uint64_t         m_enqueued;     /* the sequence number of the next item to add */
+	uint64_t         m_parse_next;   /* the sequence number of the next item to parse */
+	uint64_t         m_committed;    /* all items before this sequence number are in the database */
+	size_t           m_queued_bytes;
+	int              m_do_exit;
+
+	pthread_t        m_workers[MR_RECEIVE_WORKERS];
+	pthread_t        m_committer;
+} mrreceiver_t;
+
+
+static void free_receive_item(mrreceiveitem_t* item)
+{
+	if( item ) {
+		mrmimeparser_unref(item->m_mime_parser);
+		free(item->m_raw);
+		free(item->m_folder);
+		free(item);
+	}
+}
+
+
+static void* receive_worker_entry_point(void* entry_arg)
+{
+	mrmailbox_t*     mailbox = (mrmailbox_t*)entry_arg;
+	mrreceiver_t*    receiver = mailbox->m_receiver;
+	mrreceiveitem_t* item;
+
+	mrosnative_setup_thread(mailbox); /* must be very first */
+
+	pthread_mutex_lock(&receiver->m_mutex);
+	while( 1 )
+	{
+		while( !receiver->m_do_exit && receiver->m_parse_next == receiver->m_enqueued ) {
+			pthread_cond_wait(&receiver->m_cond, &receiver->m_mutex);
+		}
+
+		if( receiver->m_parse_next == receiver->m_enqueued ) {
+			break; /* exit requested and nothing left */
+		}
+
+		item = receiver->m_items[receiver->m_parse_next%MR_RECEIVE_QUEUE_SIZE];
+		receiver->m_parse_next++;
+
+		pthread_mutex_unlock(&receiver->m_mutex);
+
+			mrmailbox_log_info(mailbox, 0, "Receive message #%lu from %s.", (unsigned long)item->m_server_uid, item->m_folder);
+			item->m_mime_parser = mrmimeparser_new(mailbox->m_blobdir, mailbox);
+			mrmimeparser_parse(item->m_mime_parser, item->m_raw, item->m_raw_bytes); /* see receive_imf() */
+
+		pthread_mutex_lock(&receiver->m_mutex);
+		item->m_parsed = 1;
+		pthread_cond_broadcast(&receiver->m_cond);
+	}
+	pthread_mutex_unlock(&receiver->m_mutex);
+
+	mrosnative_unsetup_thread(mailbox); /* must be very last */
+	return NULL;
+}
+
+
+static void* receive_committer_entry_point(void* entry_arg)
+{
+	mrmailbox_t*     mailbox = (mrmailbox_t*)entry_arg;
+	mrreceiver_t*    receiver = mailbox->m_receiver;
+	mrreceiveitem_t* batch[MR_RECEIVE_BATCH_SIZE];
+	int              batch_cnt, i;
+	size_t           batch_bytes;
+	carray*          events;
+
+	mrosnative_setup_thread(mailbox); /* must be very first */
+
+	events = carray_new(MR_RECEIVE_BATCH_SIZE*3);
+
+	#define FIRST_PARSED (receiver->m_committed < receiver->m_enqueued && receiver->m_items[receiver->m_committed%MR_RECEIVE_QUEUE_SIZE]->m_parsed)
+
+	pthread_mutex_lock(&receiver->m_mutex);
+	while( 1 )
+	{
+		while( !FIRST_PARSED && !(receiver->m_do_exit && receiver->m_committed == receiver->m_enqueued) ) {
+			pthread_cond_wait(&receiver->m_cond, &receiver->m_mutex);
+		}
+
+		if( !FIRST_PARSED ) {
+			break; /* exit requested and nothing left */
+		}
+
+		/* take all subsequent items parsed so far; they are not touched by others until m_committed is increased */
+		batch_cnt = 0;
+		batch_bytes = 0;
+		while( batch_cnt < MR_RECEIVE_BATCH_SIZE && receiver->m_committed+batch_cnt < receiver->m_enqueued ) {
+			mrreceiveitem_t* item = receiver->m_items[(receiver->m_committed+batch_cnt)%MR_RECEIVE_QUEUE_SIZE];
+			if( !item->m_parsed ) {
+				break;
+			}
+			batch[batch_cnt++] = item;
+			batch_bytes += item->m_raw_bytes;
+		}
+
+		pthread_mutex_unlock(&receiver->m_mutex);
+
+			mrsqlite3_lock(mailbox->m_sql);
+			mrsqlite3_begin_transaction__(mailbox->m_sql); /* the transactions of apply_imf__() become savepoints */
+
+				for( i = 0; i < batch_cnt; i++ ) {
+					apply_imf__(mailbox, batch[i]->m_mime_parser, batch[i]->m_raw, batch[i]->m_raw_bytes,
+						batch[i]->m_folder, batch[i]->m_server_uid, batch[i]->m_flags, events);
+				}
+
+			mrsqlite3_commit__(mailbox->m_sql);
+			mrsqlite3_unlock(mailbox->m_sql);
+
+			if( batch_cnt > 1 ) {
+				mrmailbox_log_info(mailbox, 0, "%i received messages added in one transaction.", batch_cnt);
+			}
+
+			send_events(mailbox, events);
+			carray_set_size(events, 0);
+
+			for( i = 0; i < batch_cnt; i++ ) {
+				free_receive_item(batch[i]);
+			}
+
+		pthread_mutex_lock(&receiver->m_mutex);
+		for( i = 0; i < batch_cnt; i++ ) {
+			receiver->m_items[(receiver->m_committed+i)%MR_RECEIVE_QUEUE_SIZE] = NULL;
+		}
+		receiver->m_committed    += batch_cnt;
+		receiver->m_queued_bytes -= batch_bytes;
+		pthread_cond_broadcast(&receiver->m_cond);
+	}
+	pthread_mutex_unlock(&receiver->m_mutex);
+
+	#undef FIRST_PARSED
+
+	carray_free(events);
+	mrosnative_unsetup_thread(mailbox); /* must be very last */
+	return NULL;
+}
+
+
+static void start_receiver(mrmailbox_t* mailbox)
+{
+	mrreceiver_t* receiver;
+	int           i;
+
+	if( (receiver=calloc(1, sizeof(mrreceiver_t)))==NULL ) {
+		exit(58);
+	}
+	pthread_mutex_init(&receiver->m_mutex, NULL);
+	pthread_cond_init(&receiver->m_cond, NULL);
+	mailbox->m_receiver = receiver;
+
+	for( i = 0; i < MR_RECEIVE_WORKERS; i++ ) {
+		pthread_create(&receiver->m_workers[i], NULL, receive_worker_entry_point, mailbox);
+	}
+	pthread_create(&receiver->m_committer, NULL, receive_committer_entry_point, mailbox);
+}
+
+
+static void flush_receiver(mrmailbox_t* mailbox)
+{
+	/* wait until all messages enqueued so far are added to the database */
+	mrreceiver_t* receiver = mailbox->m_receiver;
+	uint64_t      target;
+
+	if( receiver == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&receiver->m_mutex);
+		target = receiver->m_enqueued;
+		while( receiver->m_committed < target ) {
+			pthread_cond_wait(&receiver->m_cond, &receiver->m_mutex);
+		}
+	pthread_mutex_unlock(&receiver->m_mutex);
+}
+
+
+static void stop_receiver(mrmailbox_t* mailbox)
+{
+	mrreceiver_t* receiver = mailbox->m_receiver;
+	int           i;
+
+	if( receiver == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&receiver->m_mutex);
+		receiver->m_do_exit = 1; /* the threads exit as soon as the pipeline is empty */
+		pthread_cond_broadcast(&receiver->m_cond);
+	pthread_mutex_unlock(&receiver->m_mutex);
+
+	for( i = 0; i < MR_RECEIVE_WORKERS; i++ ) {
+		pthread_join(receiver->m_workers[i], NULL);
+	}
+	pthread_join(receiver->m_committer, NULL);
+
+	pthread_cond_destroy(&receiver->m_cond);
+	pthread_mutex_destroy(&receiver->m_mutex);
+	free(receiver);
+	mailbox->m_receiver = NULL;
+}
+
+
+static void enqueue_imf(mrmailbox_t* mailbox, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
+                        const char* server_folder, uint32_t server_uid, uint32_t flags)
+{
+	mrreceiver_t*    receiver = mailbox->m_receiver;
+	mrreceiveitem_t* item;
+
+	if( (item=calloc(1, sizeof(mrreceiveitem_t)))==NULL
+	 || (item->m_raw=malloc(imf_raw_bytes))==NULL ) {
+		exit(59);
+	}
+	memcpy(item->m_raw, imf_raw_not_terminated, imf_raw_bytes); /* the caller frees the buffer when we return */
+	item->m_raw_bytes  = imf_raw_bytes;
+	item->m_folder     = safe_strdup(server_folder);
+	item->m_server_uid = server_uid;
+	item->m_flags      = flags;
+
+	pthread_mutex_lock(&receiver->m_mutex);
+		while( receiver->m_enqueued-receiver->m_committed >= MR_RECEIVE_QUEUE_SIZE
+		 || (receiver->m_queued_bytes+imf_raw_bytes > MR_RECEIVE_QUEUE_BYTES && receiver->m_enqueued > receiver->m_committed) ) {
+			pthread_cond_wait(&receiver->m_cond, &receiver->m_mutex);
+		}
+		receiver->m_items[receiver->m_enqueued%MR_RECEIVE_QUEUE_SIZE] = item;
+		receiver->m_enqueued++;
+		receiver->m_queued_bytes += imf_raw_bytes;
+		pthread_cond_broadcast(&receiver->m_cond);
+	pthread_mutex_unlock(&receiver->m_mutex);
+}
+
+
 /*******************************************************************************
  * Main interface
  ******************************************************************************/
@@ -855,28 +1162,56 @@ static void cb_set_config_int(mrimap_t* imap, const char* key, int32_t def)
 static void cb_receive_imf(mrimap_t* imap, const char* imf_raw_not_terminated, size_t imf_raw_bytes, const char* server_folder, uint32_t server_uid, uint32_t flags)
 {
 	mrmailbox_t* mailbox = (mrmailbox_t*)imap->m_userData;
-	receive_imf(mailbox, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags);
+	if( imf_raw_bytes >= MR_IMAP_SPILL_BYTES || mailbox->m_receiver == NULL ) {
+		flush_receiver(mailbox); /* keep the order; large messages are parsed directly from the spilled file, see receive_body() */
+		receive_imf(mailbox, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags);
+	}
+	else {
+		enqueue_imf(mailbox, imf_raw_not_terminated, imf_raw_bytes, server_folder, server_uid, flags);
+	}
+}
+static void cb_receive_flush(mrimap_t* imap)
+{
+	mrmailbox_t* mailbox = (mrmailbox_t*)imap->m_userData;
+	flush_receiver(mailbox);
 }
 
 
 mrmailbox_t* mrmailbox_new(mrmailboxcb_t cb, void* userData)
 {
-	mrmailbox_get_thread_index(); /* make sure, the main thread has the index #1, only for a nicer look of the logs */
+	return mrmailbox_new_hosted(cb, userData, NULL);
+}
 
+
+mrmailbox_t* mrmailbox_new_hosted(mrmailboxcb_t cb, void* userData, struct mrhost_t* host)
+{
 	mrmailbox_t* ths = NULL;
 
 	if( (ths=calloc(1, sizeof(mrmailbox_t)))==NULL ) {
 		exit(23); /* cannot allocate little memory, unrecoverable error */
 	}
 
-	pthread_mutex_init(&ths->m_log_ringbuf_critical, NULL);
+	ths->m_log_level    = MR_LOG_DEFAULT_LEVEL;
+	ths->m_log_callback = 1;
+	pthread_mutex_init(&ths->m_thread_ids_critical, NULL);
+	mrmailbox_get_thread_index(ths); /* make sure, the creating thread has the index #1, only for a nicer look of the logs */
 
 	pthread_mutex_init(&ths->m_wake_lock_critical, NULL);
 
+	pthread_mutex_init(&ths->m_blobstore_critical, NULL);
+	if( (ths->m_blob_pins=chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY))==NULL ) {
+		exit(73);
+	}
+
+	ths->m_configure_do_exit = 1;
+	ths->m_imex_do_exit      = 1;
+
+	ths->m_host     = host; /* must be set before the job lanes are created */
 	ths->m_sql      = mrsqlite3_new(ths);
 	ths->m_cb       = cb? cb : cb_dummy;
 	ths->m_userData = userData;
-	ths->m_imap     = mrimap_new(cb_get_config_int, cb_set_config_int, cb_receive_imf, (void*)ths, ths);
+	ths->m_imap     = mrimap_new(cb_get_config_int, cb_set_config_int, cb_receive_imf, cb_receive_flush, (void*)ths, ths);
+	ths->m_imap->m_hosted = (host!=NULL);
 	ths->m_smtp     = mrsmtp_new(ths);
 
 	mrjob_init_thread(ths);
@@ -911,7 +1246,12 @@ void mrmailbox_unref(mrmailbox_t* ths)
 		return;
 	}
 
-	mrpgp_exit(ths);
+	if( ths->m_host ) {
+		mrhost_remove_mailbox(ths->m_host, ths); /* after this, the workers of the host do not use the mailbox any longer */
+	}
+
+	mrmailbox_configure_cancel(ths);
+	mrmailbox_imex(ths, MR_IMEX_CANCEL, NULL, NULL);
 
 	mrjob_exit_thread(ths);
 
@@ -919,15 +1259,17 @@ void mrmailbox_unref(mrmailbox_t* ths)
 		mrmailbox_close(ths);
 	}
 
+	mrpgp_exit(ths); /* after the job threads and the receive pipeline are gone as they may still use cached keys */
+
 	mrimap_unref(ths->m_imap);
 	mrsmtp_unref(ths->m_smtp);
 	mrsqlite3_unref(ths->m_sql);
 	pthread_mutex_destroy(&ths->m_wake_lock_critical);
 
-	pthread_mutex_destroy(&ths->m_log_ringbuf_critical);
-	for( int i = 0; i < MR_LOG_RINGBUF_SIZE; i++ ) {
-		free(ths->m_log_ringbuf[i]);
-	}
+	chash_free(ths->m_blob_pins);
+	pthread_mutex_destroy(&ths->m_blobstore_critical);
+
+	pthread_mutex_destroy(&ths->m_thread_ids_critical);
 
 	free(ths);
 
@@ -937,11 +1279,28 @@ void mrmailbox_unref(mrmailbox_t* ths)
 }
 
 
-static void update_config_cache__(mrmailbox_t* ths, const char* key)
+void mrmailbox_update_config_cache__(mrmailbox_t* ths, const char* key)
 {
 	if( key==NULL || strcmp(key, "e2ee_enabled")==0 ) {
 		ths->m_e2ee_enabled = mrsqlite3_get_config_int__(ths->m_sql, "e2ee_enabled", MR_E2EE_DEFAULT_ENABLED);
 	}
+
+	if( key==NULL || strcmp(key, "search_index")==0 ) {
+		ths->m_search_index = mrsqlite3_get_config_int__(ths->m_sql, "search_index", 0);
+	}
+
+	if( key==NULL || strcmp(key, "configured_addr")==0 ) {
+		free(ths->m_self_addr);
+		ths->m_self_addr = mrsqlite3_get_config__(ths->m_sql, "configured_addr", NULL);
+	}
+
+	if( key==NULL || strcmp(key, "log_level")==0 ) {
+		ths->m_log_level = mrsqlite3_get_config_int__(ths->m_sql, "log_level", MR_LOG_DEFAULT_LEVEL);
+	}
+
+	if( key==NULL || strcmp(key, "log_callback")==0 ) {
+		ths->m_log_callback = mrsqlite3_get_config_int__(ths->m_sql, "log_callback", 1);
+	}
 }
 
 
@@ -961,10 +1320,9 @@ int mrmailbox_open(mrmailbox_t* ths, const char* dbfile, const char* blobdir)
 	from which all configuration is read/written to. */
 
 	/* Create/open sqlite database */
-	if( !mrsqlite3_open__(ths->m_sql, dbfile, 0) ) {
+	if( !mrsqlite3_open__(ths->m_sql, dbfile, MR_OPEN_WITH_READERS) ) {
 		goto cleanup;
 	}
-	mrjob_kill_action__(ths, MRJ_CONNECT_TO_IMAP);
 
 	/* backup dbfile name */
 	ths->m_dbfile = safe_strdup(dbfile);
@@ -979,8 +1337,17 @@ int mrmailbox_open(mrmailbox_t* ths, const char* dbfile, const char* blobdir)
 		mr_create_folder(ths->m_blobdir, ths);
 	}
 
+	/* load the jobs, this needs the blob-directory for cleaning up */
+	mrjob_load_queue__(ths);
+	mrjob_kill_action__(ths, MRJ_CONNECT_TO_IMAP);
+
 	/* cache some settings */
-	update_config_cache__(ths, NULL);
+	mrmailbox_update_config_cache__(ths, NULL);
+
+	/* move the files of former versions to the blob store, this is done only once */
+	if( mrsqlite3_get_config_int__(ths->m_sql, "blobstore", 0)==0 ) {
+		mrblob_migrate__(ths);
+	}
 
 	/* success */
 	success = 1;
@@ -997,6 +1364,10 @@ cleanup:
 		mrsqlite3_unlock(ths->m_sql);
 	}
 
+	if( success && ths->m_host == NULL && ths->m_receiver == NULL ) {
+		start_receiver(ths); /* hosted mailboxes parse received messages on the worker thread that fetches them, see cb_receive_imf() */
+	}
+
 	return success;
 }
 
@@ -1010,12 +1381,22 @@ void mrmailbox_close(mrmailbox_t* ths)
 	mrimap_disconnect(ths->m_imap);
 	mrsmtp_disconnect(ths->m_smtp);
 
+	stop_receiver(ths); /* messages fetched before disconnecting are still added to the database */
+
+	mrjob_clear_queue(ths);
+
+	mrpgp_uncache_all_keys(ths); /* do not keep secret keys of a closed account in memory */
+
 	mrsqlite3_lock(ths->m_sql);
 
 		if( mrsqlite3_is_open(ths->m_sql) ) {
 			mrsqlite3_close__(ths->m_sql);
 		}
 
+		mrmailbox_uncache_e2ee__(ths);
+		free(ths->m_self_addr);
+		ths->m_self_addr = NULL;
+
 		free(ths->m_dbfile);
 		ths->m_dbfile = NULL;
 
@@ -1041,13 +1422,13 @@ int mrmailbox_poke_eml_file(mrmailbox_t* ths, const char* filename)
 	/* mainly for testing, may be called by mrmailbox_import_spec() */
 	int     success = 0;
 	char*   data = NULL;
-	size_t  data_bytes;
+	size_t  data_bytes = 0;
 
 	if( ths == NULL ) {
 		return 0;
 	}
 
-	if( mr_read_file(filename, (void**)&data, &data_bytes, ths) == 0 ) {
+	if( mr_mmap_file(filename, (void**)&data, &data_bytes, ths) == 0 ) { /* mapped, so large messages are not copied to the heap */
 		goto cleanup;
 	}
 
@@ -1055,7 +1436,7 @@ int mrmailbox_poke_eml_file(mrmailbox_t* ths, const char* filename)
 	success = 1;
 
 cleanup:
-	free(data);
+	mr_munmap_file(data, data_bytes);
 
 	return success;
 }
@@ -1076,7 +1457,7 @@ int mrmailbox_set_config(mrmailbox_t* ths, const char* key, const char* value)
 
 	mrsqlite3_lock(ths->m_sql);
 		ret = mrsqlite3_set_config__(ths->m_sql, key, value);
-		update_config_cache__(ths, key);
+		mrmailbox_update_config_cache__(ths, key);
 	mrsqlite3_unlock(ths->m_sql);
 
 	return ret;
@@ -1085,15 +1466,16 @@ int mrmailbox_set_config(mrmailbox_t* ths, const char* key, const char* value)
 
 char* mrmailbox_get_config(mrmailbox_t* ths, const char* key, const char* def)
 {
-	char* ret;
+	char*        ret;
+	mrsqlite3_t* reader;
 
 	if( ths == NULL || key == NULL ) { /* "def" may be NULL */
 		return strdup_keep_null(def);
 	}
 
-	mrsqlite3_lock(ths->m_sql);
-		ret = mrsqlite3_get_config__(ths->m_sql, key, def);
-	mrsqlite3_unlock(ths->m_sql);
+	reader = mrsqlite3_lock_reader(ths->m_sql); /* the readers use the config cache of the writer, so we do not wait for running transactions */
+		ret = mrsqlite3_get_config__(reader, key, def);
+	mrsqlite3_unlock(reader);
 
 	return ret; /* the returned string must be free()'d, returns NULL only if "def" is NULL and "key" is unset */
 }
@@ -1109,7 +1491,7 @@ int mrmailbox_set_config_int(mrmailbox_t* ths, const char* key, int32_t value)
 
 	mrsqlite3_lock(ths->m_sql);
 		ret = mrsqlite3_set_config_int__(ths->m_sql, key, value);
-		update_config_cache__(ths, key);
+		mrmailbox_update_config_cache__(ths, key);
 	mrsqlite3_unlock(ths->m_sql);
 
 	return ret;
@@ -1118,15 +1500,16 @@ int mrmailbox_set_config_int(mrmailbox_t* ths, const char* key, int32_t value)
 
 int32_t mrmailbox_get_config_int(mrmailbox_t* ths, const char* key, int32_t def)
 {
-	int32_t ret;
+	int32_t      ret;
+	mrsqlite3_t* reader;
 
 	if( ths == NULL || key == NULL ) {
 		return def;
 	}
 
-	mrsqlite3_lock(ths->m_sql);
-		ret = mrsqlite3_get_config_int__(ths->m_sql, key, def);
-	mrsqlite3_unlock(ths->m_sql);
+	reader = mrsqlite3_lock_reader(ths->m_sql); /* the readers use the config cache of the writer, so we do not wait for running transactions */
+		ret = mrsqlite3_get_config_int__(reader, key, def);
+	mrsqlite3_unlock(reader);
 
 	return ret;
 }
@@ -1135,7 +1518,7 @@ int32_t mrmailbox_get_config_int(mrmailbox_t* ths, const char* key, int32_t def)
 char* mrmailbox_get_info(mrmailbox_t* ths)
 {
 	const char* unset = "0";
-	char *displayname = NULL, *temp = NULL, *l_readable_str = NULL, *l2_readable_str = NULL, *fingerprint_str = NULL;
+	char *displayname = NULL, *temp = NULL, *l_readable_str = NULL, *l2_readable_str = NULL, *fingerprint_str = NULL, *job_info = NULL, *imap_info = NULL;
 	mrloginparam_t *l = NULL, *l2 = NULL;
 	int contacts, chats, real_msgs, deaddrop_msgs, is_configured, dbversion, mdns_enabled, e2ee_enabled, prv_key_count, pub_key_count;
 	mrkey_t* self_public = mrkey_new();
@@ -1192,6 +1575,8 @@ char* mrmailbox_get_info(mrmailbox_t* ths)
 
 	l_readable_str = mrloginparam_get_readable(l);
 	l2_readable_str = mrloginparam_get_readable(l2);
+	job_info = mrjob_get_info(ths);
+	imap_info = mrimap_get_info(ths->m_imap);
 
 	/* create info
 	- some keys are display lower case - these can be changed using the `set`-command
@@ -1214,6 +1599,9 @@ char* mrmailbox_get_info(mrmailbox_t* ths)
 		"E2EE_DEFAULT_ENABLED=%i\n"
 		"Private keys=%i, public keys=%i, fingerprint=\n%s\n"
 		"\n"
+		"%s"
+		"%s"
+		"\n"
 		"Using Delta Chat Core v%i.%i.%i, SQLite %s-ts%i, libEtPan %i.%i, OpenSSL %i.%i.%i%c. Compiled " __DATE__ ", " __TIME__ " for %i bit usage.\n\n"
 		"Log excerpt:\n"
 		/* In the frontends, additional software hints may follow here. */
@@ -1231,6 +1619,9 @@ char* mrmailbox_get_info(mrmailbox_t* ths)
 		, MR_E2EE_DEFAULT_ENABLED
 		, prv_key_count, pub_key_count, fingerprint_str
 
+		, job_info
+		, imap_info
+
 		, MR_VERSION_MAJOR, MR_VERSION_MINOR, MR_VERSION_REVISION
 		, SQLITE_VERSION, sqlite3_threadsafe()   ,  libetpan_get_version_major(), libetpan_get_version_minor()
 		, (int)(OPENSSL_VERSION_NUMBER>>28), (int)(OPENSSL_VERSION_NUMBER>>20)&0xFF, (int)(OPENSSL_VERSION_NUMBER>>12)&0xFF, (char)('a'-1+((OPENSSL_VERSION_NUMBER>>4)&0xFF))
@@ -1241,19 +1632,26 @@ char* mrmailbox_get_info(mrmailbox_t* ths)
 	free(temp);
 
 	/* add log excerpt */
-	pthread_mutex_lock(&ths->m_log_ringbuf_critical); /*take care not to log here! */
-		for( int i = 0; i < MR_LOG_RINGBUF_SIZE; i++ ) {
-			int j = (ths->m_log_ringbuf_pos+i) % MR_LOG_RINGBUF_SIZE;
-			if( ths->m_log_ringbuf[j] ) {
+	{
+		#define        LOG_EXCERPT_BATCH 16
+		mrlogrecord_t* records = malloc(sizeof(mrlogrecord_t)*LOG_EXCERPT_BATCH);
+		uint32_t       cursor = 0;
+		int            i, cnt;
+		if( records == NULL ) {
+			exit(68);
+		}
+		while( (cnt=mrmailbox_get_log(ths, &cursor, records, LOG_EXCERPT_BATCH)) > 0 ) {
+			for( i = 0; i < cnt; i++ ) {
 				struct tm wanted_struct;
-				memcpy(&wanted_struct, localtime(&ths->m_log_ringbuf_times[j]), sizeof(struct tm));
+				memcpy(&wanted_struct, localtime(&records[i].m_timestamp), sizeof(struct tm));
 				temp = mr_mprintf("\n%02i:%02i:%02i ", (int)wanted_struct.tm_hour, (int)wanted_struct.tm_min, (int)wanted_struct.tm_sec);
 					mrstrbuilder_cat(&ret, temp);
-					mrstrbuilder_cat(&ret, ths->m_log_ringbuf[j]);
+					mrstrbuilder_cat(&ret, records[i].m_text);
 				free(temp);
 			}
 		}
-	pthread_mutex_unlock(&ths->m_log_ringbuf_critical);
+		free(records);
+	}
 
 	/* free data */
 	mrloginparam_unref(l);
@@ -1262,6 +1660,8 @@ char* mrmailbox_get_info(mrmailbox_t* ths)
 	free(l_readable_str);
 	free(l2_readable_str);
 	free(fingerprint_str);
+	free(job_info);
+	free(imap_info);
 	mrkey_unref(self_public);
 	return ret.m_buf; /* must be freed by the caller */
 }
@@ -1280,6 +1680,7 @@ int mrmailbox_reset_tables(mrmailbox_t* ths, int bits)
 
 		if( bits & 1 ) {
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM jobs;");
+			mrjob_load_queue__(ths); /* empty the in-memory queues, too */
 			mrmailbox_log_info(ths, 0, "Job resetted.");
 		}
 
@@ -1299,11 +1700,13 @@ int mrmailbox_reset_tables(mrmailbox_t* ths, int bits)
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM chats_contacts;");
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM msgs WHERE id>" MR_STRINGIFY(MR_MSG_ID_LAST_SPECIAL) ";");
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM config WHERE keyname LIKE 'imap.%' OR keyname LIKE 'configured%';");
+			mrsqlite3_reload_config__(ths->m_sql);
 			mrsqlite3_execute__(ths->m_sql, "DELETE FROM leftgrps;");
 			mrmailbox_log_info(ths, 0, "Rest but server config resetted.");
 		}
 
-		update_config_cache__(ths, NULL);
+		mrmailbox_update_config_cache__(ths, NULL);
+		mrmailbox_uncache_e2ee__(ths);
 
 	mrsqlite3_unlock(ths->m_sql);
 
@@ -1313,6 +1716,36 @@ int mrmailbox_reset_tables(mrmailbox_t* ths, int bits)
 }
 
 
+int mrmailbox_rebuild_search_index(mrmailbox_t* ths)
+{
+	int success = 0;
+
+	if( ths == NULL ) {
+		return 0;
+	}
+
+	mrmailbox_log_info(ths, 0, "Rebuilding search index...");
+
+	mrsqlite3_lock(ths->m_sql);
+	mrsqlite3_begin_transaction__(ths->m_sql);
+
+		if( mrsqlite3_create_search_index__(ths->m_sql) ) {
+			mrsqlite3_commit__(ths->m_sql);
+			success = 1;
+		}
+		else {
+			mrsqlite3_rollback__(ths->m_sql);
+		}
+
+		mrmailbox_update_config_cache__(ths, "search_index");
+
+	mrsqlite3_unlock(ths->m_sql);
+
+	mrmailbox_log_info(ths, 0, success? "Search index rebuilt." : "Search index not available.");
+	return success;
+}
+
+
 char* mrmailbox_get_version_str(void)
 {
 	return mr_mprintf("%i.%i.%i", (int)MR_VERSION_MAJOR, (int)MR_VERSION_MINOR, (int)MR_VERSION_REVISION);
@@ -104,6 +104,26 @@ typedef uintptr_t (*mrmailboxcb_t) (mrmailbox_t*, int event, uintptr_t data1, ui
 #define MR_ERR_NONETWORK          2
 
 
+/* The last log lines are kept in records of a fixed size and can be pulled by
+mrmailbox_get_log(), so frontends do not need to handle one event per line. */
+#define MR_LOG_TEXT_BYTES 256
+typedef struct mrlogrecord_t
+{
+	uint32_t         m_pos;          /* position in the log, increased by one for every line */
+	int              m_event;        /* MR_EVENT_INFO, MR_EVENT_WARNING or MR_EVENT_ERROR */
+	int              m_code;
+	time_t           m_timestamp;
+	char             m_text[MR_LOG_TEXT_BYTES]; /* null-terminated, longer lines are truncated */
+} mrlogrecord_t;
+
+typedef struct mrlogslot_t
+{
+	uint32_t         m_seq;          /* position+1 of the record if it is complete, 0 while it is written */
+	int              m_busy;         /* claimed by a writer */
+	mrlogrecord_t    m_record;
+} mrlogslot_t;
+
+
 typedef struct mrmailbox_t
 {
 	/* the following members should be treated as library private */
@@ -114,11 +134,30 @@ typedef struct mrmailbox_t
 	mrimap_t*        m_imap;     /* != NULL */
 	mrsmtp_t*        m_smtp;     /* != NULL */
 
-	pthread_t        m_job_thread;
-	pthread_cond_t   m_job_cond;
-	pthread_mutex_t  m_job_condmutex;
-	int              m_job_condflag;
-	int              m_job_do_exit;
+	#define          MR_JOB_LANES 2
+	struct mrjoblane_t* m_job_lanes[MR_JOB_LANES]; /* independent job threads and queues, see mrjob.c */
+
+	struct mrhost_t*        m_host;         /* set for mailboxes created by mrhost_new_mailbox(); they have no threads of their own, see mrhost.c */
+	struct mrhostaccount_t* m_host_account; /* the tasks of the mailbox in the host's schedule, guarded by the host */
+
+	pthread_t        m_configure_thread;
+	int              m_configure_thread_created;
+	int              m_configure_do_exit; /* the initial value 1 avoids mrmailbox_configure_cancel() from stopping already stopped threads */
+
+	pthread_t        m_imex_thread;
+	int              m_imex_thread_created;
+	int              m_imex_do_exit;      /* the initial value 1 avoids MR_IMEX_CANCEL from stopping already stopped threads */
+
+	struct mrpgpcache_t* m_pgp_cache; /* parsed keys, see mrpgp.c */
+
+	struct mrreceiver_t* m_receiver; /* pipeline to parse and add received messages, see mrmailbox.c */
+
+	/* caches used for end-to-end-encryption, protected by the sql-lock */
+	struct mrapeerstatecache_t* m_peerstate_cache; /* recently used peerstates, see mrapeerstate.c */
+	char*               m_self_keys_addr;   /* the address the following keys are cached for, see mrkey.c */
+	struct mrkey_t*     m_self_public;      /* the default public key, NULL if not yet loaded */
+	struct mrkey_t*     m_self_private;     /* the default private key, NULL if not yet loaded */
+	struct mrkeyring_t* m_self_keyring;     /* all private keys for decrypting, NULL if not yet loaded */
 
 	mrmailboxcb_t    m_cb;
 	void*            m_userData;
@@ -128,13 +167,27 @@ typedef struct mrmailbox_t
 	int              m_wake_lock;
 	pthread_mutex_t  m_wake_lock_critical;
 
+	pthread_mutex_t  m_blobstore_critical; /* serializes storing and deleting files in the blob store, see mrblob.c */
+	chash*           m_blob_pins;          /* files stored for messages not yet in the database, guarded by m_blobstore_critical */
+
 	int              m_e2ee_enabled;
+	int              m_search_index; /* cached config-key `search_index`, 1=msgs_fts is available */
+	char*            m_self_addr;    /* cached config-key `configured_addr`, NULL if unconfigured */
+
+	int              m_in_key_creation;        /* avoid double creation of the keypair, guarded by the sql-lock */
+	time_t           m_last_smeared_timestamp; /* see mr_create_smeared_timestamp__(), guarded by the sql-lock */
+
+	int              m_log_level;    /* cached config-key `log_level`, infos and warnings below this event are dropped before they are formatted */
+	int              m_log_callback; /* cached config-key `log_callback`, 0=infos and warnings are not sent as events but can be pulled by mrmailbox_get_log() */
 
-	#define          MR_LOG_RINGBUF_SIZE 200
-	pthread_mutex_t  m_log_ringbuf_critical;
-	char*            m_log_ringbuf[MR_LOG_RINGBUF_SIZE];
-	time_t           m_log_ringbuf_times[MR_LOG_RINGBUF_SIZE];
-	int              m_log_ringbuf_pos; /* the oldest position resp. the position that is overwritten next */
+	#define          MR_LOG_RINGBUF_SIZE 256 /* must be a power of two */
+	uint32_t         m_log_head;     /* position of the next record, advanced atomically by the logging threads, see mrmailbox_log_vprintf() */
+	mrlogslot_t      m_log_ringbuf[MR_LOG_RINGBUF_SIZE];
+
+	#define          MR_MAX_THREADS 32 /* if more threads log, the full ID is printed (this may happen eg. on many failed connections so that we try to start a working thread several times) */
+	pthread_mutex_t  m_thread_ids_critical;
+	pthread_t        m_thread_ids[MR_MAX_THREADS]; /* entries are only appended, guarded by m_thread_ids_critical, see mrmailbox_get_thread_index() */
+	int              m_thread_ids_cnt;
 
 } mrmailbox_t;
 
@@ -221,15 +274,36 @@ Optionally, some special markers added to the ID-array may help to implement vir
 carray* mrmailbox_get_chat_msgs (mrmailbox_t*, uint32_t chat_id, uint32_t flags, uint32_t marker1before);
 
 
+/* Paged access to a chat, the results are as for mrmailbox_get_chat_msgs() but only a part of the chat is returned:
+- mrmailbox_get_chat_msgs_keyset() returns up to limit message IDs before (flag MR_GCM_BEFORE) or after the anchor given by
+  the timestamp and the ID of a message, the anchor itself is not returned.  With MR_GCM_BEFORE and anchor_msg_id=0, the last
+  messages of the chat are returned; without MR_GCM_BEFORE and anchor_msg_id=0, the first ones.
+- mrmailbox_get_chat_msgs_page() returns up to before_cnt message IDs before around_msg_id followed by up to after_cnt message
+  IDs starting with around_msg_id.  If around_msg_id is 0 or not in the chat, the last before_cnt messages are returned.
+- mrmailbox_get_chat_msgs_since() returns the IDs of the messages added after since_msg_id, without day markers;
+  useful to update a list on MR_EVENT_MSGS_CHANGED.
+Use mrmailbox_get_msgs() to load the messages of a page at once. */
+#define MR_GCM_BEFORE 0x02
+carray* mrmailbox_get_chat_msgs_keyset (mrmailbox_t*, uint32_t chat_id, uint32_t flags, time_t anchor_timestamp, uint32_t anchor_msg_id, int limit);
+carray* mrmailbox_get_chat_msgs_page   (mrmailbox_t*, uint32_t chat_id, uint32_t flags, uint32_t around_msg_id, int before_cnt, int after_cnt);
+carray* mrmailbox_get_chat_msgs_since  (mrmailbox_t*, uint32_t chat_id, uint32_t since_msg_id);
+
+
 /* Search messages containing the given query string.
 Searching can be done globally (chat_id=0) or in a specified chat only (chat_id set).
 - The function returns an array of messages IDs which must be carray_free()'d by the caller.
 - If nothing can be found, the function returns NULL.  */
 carray*  mrmailbox_search_msgs (mrmailbox_t*, uint32_t chat_id, const char* query);
 
+/* The full-text index used by mrmailbox_search_msgs() is updated automatically;
+mrmailbox_rebuild_search_index() is only needed if the index is missing or
+suspected to be damaged.  Returns 1 on success, 0 if the index is not available. */
+int      mrmailbox_rebuild_search_index (mrmailbox_t*);
+
 
 /* Get messages - for a list, see mrmailbox_get_chatlist() */
 mrmsg_t*             mrmailbox_get_msg              (mrmailbox_t*, uint32_t msg_id); /* the result must be unref'd */
+int                  mrmailbox_get_msgs             (mrmailbox_t*, const uint32_t* msg_ids, int msg_cnt, mrmsg_t** ret_msgs); /* loads msg_cnt messages at once, NULL for unknown IDs and markers; returns the number of loaded messages, each must be unref'd */
 char*                mrmailbox_get_msg_info         (mrmailbox_t*, uint32_t msg_id); /* the result must be free()'d */
 int                  mrmailbox_delete_msgs          (mrmailbox_t*, const uint32_t* msg_ids, int msg_cnt);
 int                  mrmailbox_forward_msgs         (mrmailbox_t*, const uint32_t* msg_ids, int msg_cnt, uint32_t chat_id);
@@ -248,6 +322,7 @@ int                  mrmailbox_markseen_msgs        (mrmailbox_t*, const uint32_
 /* handle contacts. */
 carray*              mrmailbox_get_known_contacts   (mrmailbox_t*, const char* query); /* returns known and unblocked contacts, the result must be carray_free()'d */
 mrcontact_t*         mrmailbox_get_contact          (mrmailbox_t*, uint32_t contact_id);
+int                  mrmailbox_get_contacts         (mrmailbox_t*, const uint32_t* contact_ids, int contact_cnt, mrcontact_t** ret_contacts); /* loads contact_cnt contacts at once, NULL for unknown IDs; returns the number of loaded contacts, each must be unref'd */
 uint32_t             mrmailbox_create_contact       (mrmailbox_t*, const char* name, const char* addr);
 int                  mrmailbox_get_blocked_count    (mrmailbox_t*);
 carray*              mrmailbox_get_blocked_contacts (mrmailbox_t*);
@@ -259,7 +334,10 @@ int                  mrmailbox_delete_contact       (mrmailbox_t*, uint32_t cont
 /* Handle configurations as:
 - addr
 - mail_server, mail_user, mail_pw, mail_port,
-- send_server, send_user, send_pw, send_port, server_flags */
+- send_server, send_user, send_pw, send_port, server_flags
+- imap_fetch_chunk_size (number of messages fetched with one IMAP command, 1=fetch messages one by one)
+- imap_pool_size (number of additional IMAP connections to sync the folders other than the INBOX, 0=sync all folders using the IDLE connection)
+- search_index (1=use the full-text index for searching, set by mrmailbox_rebuild_search_index()) */
 int                  mrmailbox_set_config           (mrmailbox_t*, const char* key, const char* value);
 char*                mrmailbox_get_config           (mrmailbox_t*, const char* key, const char* def);
 int                  mrmailbox_set_config_int       (mrmailbox_t*, const char* key, int32_t value);
@@ -273,6 +351,7 @@ To avoid double slashes, the given directory should not end with a slash. */
 #define MR_IMEX_IMPORT_SELF_KEYS            2 /* param1 is a directory where the keys are searched in and read from */
 #define MR_IMEX_EXPORT_BACKUP              11 /* param1 is a directory where the backup is written to */
 #define MR_IMEX_IMPORT_BACKUP              12 /* param1 is the file with the backup to import */
+#define MR_IMEX_EXPORT_BACKUP_INCREMENTAL  13 /* as MR_IMEX_EXPORT_BACKUP, however, only files changed since the last backup in the directory are added; this backup is needed for importing then */
 #define MR_BAK_PREFIX             "delta-chat"
 #define MR_BAK_SUFFIX             "bak"
 void                 mrmailbox_imex                 (mrmailbox_t*, int what, const char* param1, const char* setup_code); /* user import/export function, sends MR_EVENT_IMEX_* events */
@@ -284,6 +363,7 @@ int                  mrmailbox_poke_spec            (mrmailbox_t*, const char* s
 
 /* Misc. */
 char*                mrmailbox_get_info             (mrmailbox_t*); /* multi-line output; the returned string must be free()'d, returns NULL on errors */
+int                  mrmailbox_get_log              (mrmailbox_t*, uint32_t* cursor, mrlogrecord_t* records, int max_records); /* copies the log records from the cursor on and advances it, start with cursor=0; lines overwritten in between are skipped; returns the number of records copied */
 int                  mrmailbox_add_address_book     (mrmailbox_t*, const char*); /* format: Name one\nAddress one\nName two\Address two */
 char*                mrmailbox_get_version_str      (void); /* the return value must be free()'d */
 int                  mrmailbox_reset_tables         (mrmailbox_t*, int bits); /* reset tables but leaves server configuration, 1=jobs, 2=e2ee, 8=rest but server config */
@@ -301,10 +381,13 @@ void                 mrmailbox_heartbeat            (mrmailbox_t*);
 
 #define MR_E2EE_DEFAULT_ENABLED  1
 #define MR_MDNS_DEFAULT_ENABLED  1
+#define MR_LOG_DEFAULT_LEVEL     MR_EVENT_INFO
 
+mrmailbox_t*         mrmailbox_new_hosted           (mrmailboxcb_t, void* userData, struct mrhost_t*); /* host=NULL creates a mailbox with threads of its own, see mrhost_new_mailbox() */
 void                 mrmailbox_connect_to_imap      (mrmailbox_t*, mrjob_t*);
 void                 mrmailbox_wake_lock            (mrmailbox_t*);
 void                 mrmailbox_wake_unlock          (mrmailbox_t*);
+void                 mrmailbox_update_config_cache__(mrmailbox_t*, const char* key); /* key=NULL updates all cached config-keys */
 
 
 /* end-to-end-encryption */
@@ -317,6 +400,7 @@ void mrmailbox_e2ee_encrypt             (mrmailbox_t*, const clist* recipients_a
 int  mrmailbox_e2ee_decrypt             (mrmailbox_t*, struct mailmime* in_out_message, int* ret_validation_errors); /* returns 1 if sth. was decrypted, 0 in other cases */
 void mrmailbox_e2ee_thanks              (mrmailbox_e2ee_helper_t*); /* frees data referenced by "mailmime" but not freed by mailmime_free(). After calling mre2ee_unhelp(), in_out_message cannot be used any longer! */
 int  mrmailbox_ensure_secret_key_exists (mrmailbox_t*); /* makes sure, the private key exists, needed only for exporting keys and the case no message was sent before */
+void mrmailbox_uncache_e2ee__           (mrmailbox_t*); /* drops cached peerstates and self-keys; call if the tables are modified in other ways than by the load/save functions */
 
 
 /* logging */
@@ -325,7 +409,7 @@ void mrmailbox_log_error_if        (int* condition, mrmailbox_t*, int code, cons
 void mrmailbox_log_warning         (mrmailbox_t*, int code, const char* msg, ...);
 void mrmailbox_log_info            (mrmailbox_t*, int code, const char* msg, ...);
 void mrmailbox_log_vprintf         (mrmailbox_t*, int event, int code, const char* msg, va_list);
-int  mrmailbox_get_thread_index    (void);
+int  mrmailbox_get_thread_index    (mrmailbox_t*);
 
 
 /* misc. tools */
@@ -365,11 +365,6 @@ cleanup:
  ******************************************************************************/
 
 
-static pthread_t s_configure_thread;
-static int       s_configure_thread_created = 0;
-static int       s_configure_do_exit = 1; /* the value 1 avoids mrmailbox_configure_cancel() from stopping already stopped threads */
-
-
 static void* configure_thread_entry_point(void* entry_arg)
 {
 	mrmailbox_t*    mailbox = (mrmailbox_t*)entry_arg;
@@ -384,7 +379,7 @@ static void* configure_thread_entry_point(void* entry_arg)
 	mrloginparam_t* param_autoconfig = NULL;
 
 	#define         PROGRESS(p) \
-						if( s_configure_do_exit ) { goto exit_; } \
+						if( mailbox->m_configure_do_exit ) { goto exit_; } \
 						mailbox->m_cb(mailbox, MR_EVENT_CONFIGURE_PROGRESS, (p), 0);
 
 	mrmailbox_log_info(mailbox, 0, "Configure ...");
@@ -613,8 +608,12 @@ static void* configure_thread_entry_point(void* entry_arg)
 	PROGRESS(90)
 
 	/* configuration success - write back the configured parameters with the "configured_" prefix; also write the "configured"-flag */
-	mrloginparam_write__(param, mailbox->m_sql, "configured_" /*the trailing underscore is correct*/);
-	mrsqlite3_set_config_int__(mailbox->m_sql, "configured", 1);
+	mrsqlite3_lock(mailbox->m_sql);
+		mrloginparam_write__(param, mailbox->m_sql, "configured_" /*the trailing underscore is correct*/);
+		mrsqlite3_set_config_int__(mailbox->m_sql, "configured", 1);
+		mrmailbox_update_config_cache__(mailbox, "configured_addr");
+		mrmailbox_uncache_e2ee__(mailbox);
+	mrsqlite3_unlock(mailbox->m_sql);
 	success = 1;
 	mrmailbox_log_info(mailbox, 0, "Configure completed successfully.");
 
@@ -626,9 +625,9 @@ exit_:
 	mrloginparam_unref(param_autoconfig);
 	free(param_addr_urlencoded);
 
-	s_configure_do_exit = 1; /* set this before sending MR_EVENT_CONFIGURE_ENDED, avoids mrmailbox_configure_cancel() to stop the thread */
+	mailbox->m_configure_do_exit = 1; /* set this before sending MR_EVENT_CONFIGURE_ENDED, avoids mrmailbox_configure_cancel() to stop the thread */
 	mailbox->m_cb(mailbox, MR_EVENT_CONFIGURE_ENDED, success, 0);
-	s_configure_thread_created = 0;
+	mailbox->m_configure_thread_created = 0;
 	mrosnative_unsetup_thread(mailbox); /* must be very last */
 	return NULL;
 }
@@ -647,18 +646,18 @@ void mrmailbox_configure_and_connect(mrmailbox_t* mailbox)
 
 	if( !mrsqlite3_is_open(mailbox->m_sql) ) {
 		mrmailbox_log_error(mailbox, 0, "Cannot configure, database not opened.");
-		s_configure_do_exit = 1;
+		mailbox->m_configure_do_exit = 1;
 		mailbox->m_cb(mailbox, MR_EVENT_CONFIGURE_ENDED, 0, 0);
 		return;
 	}
 
-	if( s_configure_thread_created || s_configure_do_exit == 0 ) {
+	if( mailbox->m_configure_thread_created || mailbox->m_configure_do_exit == 0 ) {
 		mrmailbox_log_error(mailbox, 0, "Already configuring.");
 		return; /* do not send a MR_EVENT_CONFIGURE_ENDED event, this is done by the already existing thread */
 	}
 
-	s_configure_thread_created = 1;
-	s_configure_do_exit        = 0;
+	mailbox->m_configure_thread_created = 1;
+	mailbox->m_configure_do_exit        = 0;
 
 	/* disconnect */
 	mrmailbox_disconnect(mailbox);
@@ -670,7 +669,7 @@ void mrmailbox_configure_and_connect(mrmailbox_t* mailbox)
 	mrsqlite3_unlock(mailbox->m_sql);
 
 	/* start a thread for the configuration it self, when done, we'll post a MR_EVENT_CONFIGURE_ENDED event */
-	pthread_create(&s_configure_thread, NULL, configure_thread_entry_point, mailbox);
+	pthread_create(&mailbox->m_configure_thread, NULL, configure_thread_entry_point, mailbox);
 }
 
 
@@ -680,11 +679,11 @@ void mrmailbox_configure_cancel(mrmailbox_t* mailbox)
 		return;
 	}
 
-	if( s_configure_thread_created && s_configure_do_exit==0 )
+	if( mailbox->m_configure_thread_created && mailbox->m_configure_do_exit==0 )
 	{
 		mrmailbox_log_info(mailbox, 0, "Stopping configure-thread...");
-			s_configure_do_exit = 1;
-			pthread_join(s_configure_thread, NULL);
+			mailbox->m_configure_do_exit = 1;
+			pthread_join(mailbox->m_configure_thread, NULL);
 		mrmailbox_log_info(mailbox, 0, "Configure-thread stopped.");
 	}
 }
@@ -154,7 +154,6 @@ static struct mailmime* new_data_part(void* data, size_t data_bytes, char* defau
 static int load_or_generate_self_public_key__(mrmailbox_t* mailbox, mrkey_t* public_key, const char* self_addr,
                                               struct mailmime* random_data_mime /*for an extra-seed of the random generator. For speed reasons, only give _available_ pointers here, do not create any data - in very most cases, the key is not generated!*/)
 {
-	static int s_in_key_creation = 0; /* avoid double creation (we unlock the database during creation) */
 	int        key_created = 0;
 	int        success = 0, key_creation_here = 0;
 
@@ -165,9 +164,9 @@ static int load_or_generate_self_public_key__(mrmailbox_t* mailbox, mrkey_t* pub
 	if( !mrkey_load_self_public__(public_key, self_addr, mailbox->m_sql) )
 	{
 		/* create the keypair - this may take a moment, however, as this is in a thread, this is no big deal */
-		if( s_in_key_creation ) { goto cleanup; }
+		if( mailbox->m_in_key_creation ) { goto cleanup; }
 		key_creation_here = 1;
-		s_in_key_creation = 1;
+		mailbox->m_in_key_creation = 1;
 
 		/* seed the random generator */
 		{
@@ -233,7 +232,7 @@ static int load_or_generate_self_public_key__(mrmailbox_t* mailbox, mrkey_t* pub
 	success = 1;
 
 cleanup:
-	if( key_creation_here ) { s_in_key_creation = 0; }
+	if( key_creation_here ) { mailbox->m_in_key_creation = 0; }
 	return success;
 }
 
@@ -253,7 +252,7 @@ int mrmailbox_ensure_secret_key_exists(mrmailbox_t* mailbox)
 	mrsqlite3_lock(mailbox->m_sql);
 	locked = 1;
 
-		if( (self_addr=mrsqlite3_get_config__(mailbox->m_sql, "configured_addr", NULL))==NULL ) {
+		if( (self_addr=strdup_keep_null(mailbox->m_self_addr))==NULL ) {
 			goto cleanup;
 		}
 
@@ -271,6 +270,17 @@ cleanup:
 }
 
 
+void mrmailbox_uncache_e2ee__(mrmailbox_t* mailbox)
+{
+	if( mailbox == NULL ) {
+		return;
+	}
+
+	mrapeerstate_uncache_all__(mailbox);
+	mrkey_uncache_self__(mailbox);
+}
+
+
 /*******************************************************************************
  * Encrypt
  ******************************************************************************/
@@ -306,7 +316,7 @@ void mrmailbox_e2ee_encrypt(mrmailbox_t* mailbox, const clist* recipients_addr,
 			autocryptheader->m_prefer_encrypt = MRA_PE_MUTUAL;
 		}
 
-		autocryptheader->m_addr = mrsqlite3_get_config__(mailbox->m_sql, "configured_addr", NULL);
+		autocryptheader->m_addr = strdup_keep_null(mailbox->m_self_addr);
 		if( autocryptheader->m_addr == NULL ) {
 			goto cleanup;
 		}
@@ -709,7 +719,7 @@ int mrmailbox_e2ee_decrypt(mrmailbox_t* mailbox, struct mailmime* in_out_message
 		}
 
 		/* load private key for decryption */
-		if( (self_addr=mrsqlite3_get_config__(mailbox->m_sql, "configured_addr", NULL))==NULL ) {
+		if( (self_addr=strdup_keep_null(mailbox->m_self_addr))==NULL ) {
 			goto cleanup;
 		}
 
@@ -27,6 +27,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <openssl/rand.h>
 #include <libetpan/mmapstring.h>
 #include <netpgp-extra.h>
@@ -37,9 +41,17 @@
 #include "mraheader.h"
 #include "mrapeerstate.h"
 #include "mrtools.h"
+#include "mrblob.h"
 #include "mrpgp.h"
+#include "mrjob.h"
 
-static int s_imex_do_exit = 1; /* the value 1 avoids MR_IMEX_CANCEL from stopping already stopped threads */
+
+#define MR_BACKUP_STEP_PAGES   256          /* pages copied at a time while holding the sql-lock */
+#define MR_BACKUP_CHUNK_BYTES  (64*1024)    /* files are copied from and to backups in chunks of this size */
+#define MR_BACKUP_MAX_BASES    32           /* max. number of former backups an incremental backup may be based on */
+#define MR_IMPORT_MAX_WRITERS  4            /* max. number of threads writing imported files, one per core */
+#define MR_IMPORT_FSYNC_FILES  32           /* imported files are fsync()'d after this number of files ... */
+#define MR_IMPORT_FSYNC_BYTES  (16*1024*1024) /* ... or this number of bytes per thread */
 
 
 /*******************************************************************************
@@ -704,31 +716,234 @@ cleanup:
 
 
 /* the FILE_PROGRESS macro calls the callback with the permille of files processed.
-The macro avoids weird values of 0% or 100% while still working. */
-#define FILE_PROGRESS \
-	processed_files_count++; \
-	int permille = (processed_files_count*1000)/total_files_count; \
-	if( permille <  10 ) { permille =  10; } \
-	if( permille > 990 ) { permille = 990; } \
+The function avoids weird values of 0% or 100% while still working. */
+static void file_progress(mrmailbox_t* mailbox, int* processed_files_count, int total_files_count)
+{
+	(*processed_files_count)++;
+	int permille = total_files_count>0? ((*processed_files_count)*1000)/total_files_count : 0;
+	if( permille <  10 ) { permille =  10; }
+	if( permille > 990 ) { permille = 990; }
 	mailbox->m_cb(mailbox, MR_EVENT_IMEX_PROGRESS, permille, 0);
+}
+#define FILE_PROGRESS file_progress(mailbox, &processed_files_count, total_files_count);
+
+
+static int is_backup_file_name(const char* name)
+{
+	int prefix_len = strlen(MR_BAK_PREFIX);
+	int suffix_len = strlen(MR_BAK_SUFFIX);
+	int name_len = strlen(name);
+	return (name_len > prefix_len && strncmp(name, MR_BAK_PREFIX, prefix_len)==0
+	     && name_len > suffix_len && strncmp(&name[name_len-suffix_len-1], "." MR_BAK_SUFFIX, suffix_len)==0);
+}
+
+
+static int copy_db_to_backup(mrmailbox_t* mailbox, mrsqlite3_t* dest_sql)
+{
+	/* copy the database using SQLite's online backup API while the database is in use.  The sql-lock is held only for
+	MR_BACKUP_STEP_PAGES pages at a time; as the source connection is our writer, changes done meanwhile are applied to
+	the copy by SQLite.  Changes from other connections restart the copy, however, these connections are read-only. */
+	sqlite3_backup* backup = NULL;
+	int             rc = SQLITE_OK, total_pages = 0, remaining_pages = 0, success = 0;
+
+	mrsqlite3_lock(mailbox->m_sql);
+		if( mailbox->m_sql->m_cobj ) {
+			backup = sqlite3_backup_init(dest_sql->m_cobj, "main", mailbox->m_sql->m_cobj, "main");
+		}
+	mrsqlite3_unlock(mailbox->m_sql);
+
+	if( backup == NULL ) {
+		mrmailbox_log_error(mailbox, 0, "Backup: Cannot start copying the database: %s", sqlite3_errmsg(dest_sql->m_cobj));
+		goto cleanup;
+	}
+
+	while( 1 )
+	{
+		if( mailbox->m_imex_do_exit ) {
+			goto cleanup;
+		}
+
+		mrsqlite3_lock(mailbox->m_sql);
+			rc = sqlite3_backup_step(backup, MR_BACKUP_STEP_PAGES);
+			total_pages     = sqlite3_backup_pagecount(backup);
+			remaining_pages = sqlite3_backup_remaining(backup);
+		mrsqlite3_unlock(mailbox->m_sql);
+
+		if( rc == SQLITE_DONE ) {
+			break;
+		}
+		else if( rc == SQLITE_BUSY || rc == SQLITE_LOCKED ) {
+			sqlite3_sleep(10);
+		}
+		else if( rc != SQLITE_OK ) {
+			mrmailbox_log_error(mailbox, 0, "Backup: Cannot copy the database (error %i).", rc);
+			goto cleanup;
+		}
+	}
+
+	mrmailbox_log_info(mailbox, 0, "Backup: %i database pages copied (%i remaining).", total_pages, remaining_pages);
+	success = 1;
+
+cleanup:
+	if( backup ) {
+		mrsqlite3_lock(mailbox->m_sql);
+			sqlite3_backup_finish(backup);
+		mrsqlite3_unlock(mailbox->m_sql);
+	}
+	return success;
+}
+
+
+static int add_file_to_backup(mrmailbox_t* mailbox, mrsqlite3_t* dest_sql, const char* name, const char* pathNfilename, size_t file_bytes, void* buf)
+{
+	/* stream the file to the backup using incremental BLOB I/O, at most MR_BACKUP_CHUNK_BYTES are hold in memory */
+	int           success = 0;
+	sqlite3_stmt* stmt = NULL;
+	sqlite3_blob* blob = NULL;
+	FILE*         f = NULL;
+	size_t        offset = 0, chunk_bytes;
+
+	if( (f=fopen(pathNfilename, "rb"))==NULL ) {
+		mrmailbox_log_warning(mailbox, 0, "Backup: Cannot read \"%s\", skipped.", pathNfilename);
+		success = 1; /* the file may have been deleted meanwhile */
+		goto cleanup;
+	}
+
+	stmt = mrsqlite3_predefine__(dest_sql, INSERT_INTO_backup_blobs_fz,
+		"INSERT INTO backup_blobs (file_name, file_content) VALUES (?, ?);");
+	sqlite3_bind_text     (stmt, 1, name, -1, SQLITE_STATIC);
+	sqlite3_bind_zeroblob64(stmt, 2, file_bytes);
+	if( sqlite3_step(stmt)!=SQLITE_DONE ) {
+		mrmailbox_log_error(mailbox, 0, "Disk full? Cannot add file \"%s\" with %lu bytes to backup.", pathNfilename, (unsigned long)file_bytes);
+		goto cleanup; /* this is not recoverable! writing to the sqlite database should work! */
+	}
+
+	if( sqlite3_blob_open(dest_sql->m_cobj, "main", "backup_blobs", "file_content", sqlite3_last_insert_rowid(dest_sql->m_cobj), 1, &blob)!=SQLITE_OK ) {
+		mrmailbox_log_error(mailbox, 0, "Backup: Cannot open blob for \"%s\".", pathNfilename);
+		goto cleanup;
+	}
+
+	while( offset < file_bytes ) {
+		chunk_bytes = MR_MIN(MR_BACKUP_CHUNK_BYTES, file_bytes-offset);
+		if( fread(buf, 1, chunk_bytes, f) != chunk_bytes ) {
+			mrmailbox_log_warning(mailbox, 0, "Backup: \"%s\" was truncated while reading.", pathNfilename);
+			break; /* the rest stays zero-filled */
+		}
+		if( sqlite3_blob_write(blob, buf, chunk_bytes, offset)!=SQLITE_OK ) {
+			mrmailbox_log_error(mailbox, 0, "Disk full? Cannot write file \"%s\" to backup.", pathNfilename);
+			goto cleanup;
+		}
+		offset += chunk_bytes;
+	}
+
+	success = 1;
+
+cleanup:
+	if( blob ) { sqlite3_blob_close(blob); }
+	if( f ) { fclose(f); }
+	return success;
+}
+
+
+static int add_blob_names(carray* names, const char* dir, const char* prefix/*NULL for the root*/)
+{
+	DIR*           dir_handle = NULL;
+	struct dirent* dir_entry;
+	char*          name_with_prefix;
+
+	if( (dir_handle=opendir(dir))==NULL ) {
+		return 0;
+	}
+
+	while( (dir_entry=readdir(dir_handle))!=NULL ) {
+		const char* name = dir_entry->d_name; /* name without path; may also be `.` or `..` */
+		int name_len = strlen(name);
+		if( (name_len==1 && name[0]=='.')
+		 || (name_len==2 && name[0]=='.' && name[1]=='.')
+		 || is_backup_file_name(name)
+		 || (prefix == NULL && mrjob_get_spool_type(name, NULL)) ) {
+			continue; /* the files written by the send jobs are temporary and not backed up */
+		}
+
+		if( prefix == NULL && mrblob_is_shard_name(name) ) {
+			char* shard_dir = mr_mprintf("%s/%s", dir, name);
+			add_blob_names(names, shard_dir, name);
+			free(shard_dir);
+			continue;
+		}
+
+		name_with_prefix = prefix? mr_mprintf("%s/%s", prefix, name) : safe_strdup(name);
+		carray_add(names, name_with_prefix, NULL);
+	}
+
+	closedir(dir_handle);
+	return 1;
+}
+
+
+static carray* get_blob_names(mrmailbox_t* mailbox)
+{
+	/* returns the names of all files in the blobdir relative to it; the blob store keeps the files in sub-directories,
+	see mrblob.h, other directories are not backed up */
+	carray* names = carray_new(128);
+	if( !add_blob_names(names, mailbox->m_blobdir, NULL) ) {
+		carray_free(names);
+		return NULL;
+	}
+	return names;
+}
 
 
-static int export_backup(mrmailbox_t* mailbox, const char* dir)
+static void free_blob_names(carray* names)
 {
-	int            success = 0, locked = 0, closed = 0;
+	int i, cnt;
+	if( names ) {
+		cnt = carray_count(names);
+		for( i = 0; i < cnt; i++ ) {
+			free(carray_get(names, i));
+		}
+		carray_free(names);
+	}
+}
+
+
+static int export_backup(mrmailbox_t* mailbox, const char* dir, int incremental)
+{
+	int            success = 0, transaction_pending = 0;
 	char*          dest_pathNfilename = NULL;
 	mrsqlite3_t*   dest_sql = NULL;
 	time_t         now = time(NULL);
-	DIR*           dir_handle = NULL;
-	struct dirent* dir_entry;
-	int            prefix_len = strlen(MR_BAK_PREFIX);
-	int            suffix_len = strlen(MR_BAK_SUFFIX);
+	carray*        blob_names = NULL;
 	char*          curr_pathNfilename = NULL;
 	void*          buf = NULL;
-	size_t         buf_bytes = 0;
-	sqlite3_stmt*  stmt = NULL;
-	int            total_files_count = 0, processed_files_count = 0;
+	struct stat    st;
+	int            total_files_count = 0, processed_files_count = 0, added_files_count = 0, unchanged_files_count = 0, i;
 	int            delete_dest_file = 0;
+	char*          base_pathNfilename = NULL;
+	time_t         base_time = 0;
+	double         start_ms = mr_now_ms();
+	struct rusage  usage;
+
+	/* for incremental backups, find the last backup of this blob directory; files not modified since then are not added */
+	if( incremental ) {
+		mrsqlite3_t* base_sql = NULL;
+		if( (base_pathNfilename=mrmailbox_imex_has_backup(mailbox, dir))!=NULL
+		 && (base_sql=mrsqlite3_new(mailbox/*for logging only*/))!=NULL
+		 && mrsqlite3_open__(base_sql, base_pathNfilename, MR_OPEN_READONLY) ) {
+			char* base_for = mrsqlite3_get_config__(base_sql, "backup_for", NULL);
+			if( base_for && strcmp(base_for, mailbox->m_blobdir)==0 ) {
+				base_time = mrsqlite3_get_config_int__(base_sql, "backup_time", 0);
+			}
+			free(base_for);
+		}
+		mrsqlite3_unref(base_sql);
+
+		if( base_time <= 0 ) {
+			mrmailbox_log_info(mailbox, 0, "Backup: No former backup of \"%s\" found, creating a full backup.", mailbox->m_blobdir);
+			free(base_pathNfilename);
+			base_pathNfilename = NULL;
+		}
+	}
 
 	/* get a fine backup file name (the name includes the date so that multiple backup instances are possible) */
 	{
@@ -741,94 +956,75 @@ static int export_backup(mrmailbox_t* mailbox, const char* dir)
 			goto cleanup;
 		}
 	}
+	delete_dest_file = 1; /* the name is reserved by an empty file */
 
-	/* temporary lock and close the source (we just make a copy of the whole file, this is the fastest and easiest approach) */
-	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
-	mrsqlite3_close__(mailbox->m_sql);
-	closed = 1;
-
-	/* copy file to backup directory */
+	/* copy the database to the backup directory; the database stays usable meanwhile */
 	mrmailbox_log_info(mailbox, 0, "Backup \"%s\" to \"%s\".", mailbox->m_dbfile, dest_pathNfilename);
-	if( !mr_copy_file(mailbox->m_dbfile, dest_pathNfilename, mailbox) ) {
+	if( (dest_sql=mrsqlite3_new(mailbox/*for logging only*/))==NULL
+	 || !mrsqlite3_open__(dest_sql, dest_pathNfilename, 0) ) {
 		goto cleanup; /* error already logged */
 	}
 
-	/* unlock and re-open the source and make it availabe again for the normal use */
-	mrsqlite3_open__(mailbox->m_sql, mailbox->m_dbfile, 0);
-	closed = 0;
-	mrsqlite3_unlock(mailbox->m_sql);
-	locked = 0;
-
-	/* add all files as blobs to the database copy (this does not require the source to be locked, neigher the destination as it is used only here) */
-	if( (dest_sql=mrsqlite3_new(mailbox/*for logging only*/))==NULL
-	 || !mrsqlite3_open__(dest_sql, dest_pathNfilename, 0) ) {
+	mrsqlite3_reset_all_predefinitions(dest_sql); /* the destination must not be in use while being overwritten */
+	if( !copy_db_to_backup(mailbox, dest_sql) ) {
 		goto cleanup; /* error already logged */
 	}
 
+	/* the copy inherits the WAL journal mode from the source; backups should be a single, self-contained file */
+	mrsqlite3_execute__(dest_sql, "PRAGMA journal_mode=DELETE;");
+
 	if( !mrsqlite3_table_exists__(dest_sql, "backup_blobs") ) {
 		if( !mrsqlite3_execute__(dest_sql, "CREATE TABLE backup_blobs (id INTEGER PRIMARY KEY, file_name, file_content);") ) {
 			goto cleanup; /* error already logged */
 		}
 	}
 
-	/* scan directory, pass 1: collect file info */
-	total_files_count = 0;
-	if( (dir_handle=opendir(mailbox->m_blobdir))==NULL ) {
+	/* scan directory, pass 1: collect the file names, including the files in the shard directories of the blob store */
+	if( (blob_names=get_blob_names(mailbox))==NULL ) {
 		mrmailbox_log_error(mailbox, 0, "Backup: Cannot get info for blob-directory \"%s\".", mailbox->m_blobdir);
 		goto cleanup;
 	}
-
-	while( (dir_entry=readdir(dir_handle))!=NULL ) {
-		total_files_count++;
-	}
-
-	closedir(dir_handle);
-	dir_handle = NULL;
+	total_files_count = carray_count(blob_names);
 
 	if( total_files_count>0 )
 	{
-		/* scan directory, pass 2: copy files */
-		if( (dir_handle=opendir(mailbox->m_blobdir))==NULL ) {
-			mrmailbox_log_error(mailbox, 0, "Backup: Cannot copy from blob-directory \"%s\".", mailbox->m_blobdir);
+		/* scan directory, pass 2: copy files; all files are added in a single transaction */
+		if( (buf=malloc(MR_BACKUP_CHUNK_BYTES))==NULL ) {
 			goto cleanup;
 		}
 
-		stmt = mrsqlite3_prepare_v2_(dest_sql, "INSERT INTO backup_blobs (file_name, file_content) VALUES (?, ?);");
-		while( (dir_entry=readdir(dir_handle))!=NULL )
+		mrsqlite3_begin_transaction__(dest_sql);
+		transaction_pending = 1;
+
+		for( i = 0; i < total_files_count; i++ )
 		{
-			if( s_imex_do_exit ) {
-				delete_dest_file = 1;
+			if( mailbox->m_imex_do_exit ) {
 				goto cleanup;
 			}
 
 			FILE_PROGRESS
 
-			char* name = dir_entry->d_name; /* name without path; may also be `.` or `..` */
-			int name_len = strlen(name);
-			if( (name_len==1 && name[0]=='.')
-			 || (name_len==2 && name[0]=='.' && name[1]=='.')
-			 || (name_len > prefix_len && strncmp(name, MR_BAK_PREFIX, prefix_len)==0 && name_len > suffix_len && strncmp(&name[name_len-suffix_len-1], "." MR_BAK_SUFFIX, suffix_len)==0) ) {
-				//mrmailbox_log_info(mailbox, 0, "Backup: Skipping \"%s\".", name);
-				continue;
-			}
+			const char* name = (const char*)carray_get(blob_names, i); /* name relative to the blobdir, eg. `ab/ab12...ef.jpg` */
 
-			//mrmailbox_log_info(mailbox, 0, "Backup \"%s\".", name);
 			free(curr_pathNfilename);
 			curr_pathNfilename = mr_mprintf("%s/%s", mailbox->m_blobdir, name);
-			free(buf);
-			if( !mr_read_file(curr_pathNfilename, &buf, &buf_bytes, mailbox) || buf==NULL || buf_bytes<=0 ) {
+			if( stat(curr_pathNfilename, &st)!=0 || !S_ISREG(st.st_mode) || st.st_size<=0 ) {
 				continue;
 			}
 
-			sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
-			sqlite3_bind_blob(stmt, 2, buf, buf_bytes, SQLITE_STATIC);
-			if( sqlite3_step(stmt)!=SQLITE_DONE ) {
-				mrmailbox_log_error(mailbox, 0, "Disk full? Cannot add file \"%s\" to backup.", curr_pathNfilename);
-				goto cleanup; /* this is not recoverable! writing to the sqlite database should work! */
+			if( base_time > 0 && st.st_mtime < base_time ) {
+				unchanged_files_count++;
+				continue; /* the file is in the former backup */
 			}
-			sqlite3_reset(stmt);
+
+			if( !add_file_to_backup(mailbox, dest_sql, name, curr_pathNfilename, (size_t)st.st_size, buf) ) {
+				goto cleanup; /* error already logged */
+			}
+			added_files_count++;
 		}
+
+		mrsqlite3_commit__(dest_sql);
+		transaction_pending = 0;
 	}
 	else
 	{
@@ -836,22 +1032,31 @@ static int export_backup(mrmailbox_t* mailbox, const char* dir)
 	}
 
 	/* done - set some special config values (do this last to avoid importing crashed backups) */
+	if( base_pathNfilename ) {
+		char* base_name = strrchr(base_pathNfilename, '/');
+		mrsqlite3_set_config__(dest_sql, "backup_base", base_name? base_name+1 : base_pathNfilename); /* the former backup is needed for importing, see import_backup() */
+	}
 	mrsqlite3_set_config_int__(dest_sql, "backup_time", now);
 	mrsqlite3_set_config__    (dest_sql, "backup_for", mailbox->m_blobdir);
 
+	getrusage(RUSAGE_SELF, &usage);
+	mrmailbox_log_info(mailbox, 0, "Backup: %i files added, %i unchanged files left in \"%s\"; %.1f seconds, peak memory %li KB.",
+		added_files_count, unchanged_files_count, base_pathNfilename? base_pathNfilename : "-",
+		(mr_now_ms()-start_ms)/1000.0, (long)usage.ru_maxrss);
+
 	mailbox->m_cb(mailbox, MR_EVENT_IMEX_FILE_WRITTEN, (uintptr_t)dest_pathNfilename, (uintptr_t)"application/octet-stream");
+	delete_dest_file = 0;
 	success = 1;
 
 cleanup:
-	if( dir_handle ) { closedir(dir_handle); }
-	if( closed ) { mrsqlite3_open__(mailbox->m_sql, mailbox->m_dbfile, 0); }
-	if( locked ) { mrsqlite3_unlock(mailbox->m_sql); }
+	free_blob_names(blob_names);
 
-	if( stmt ) { sqlite3_finalize(stmt); }
+	if( transaction_pending ) { mrsqlite3_rollback__(dest_sql); }
 	mrsqlite3_close__(dest_sql);
 	mrsqlite3_unref(dest_sql);
 	if( delete_dest_file ) { mr_delete_file(dest_pathNfilename, mailbox); }
 	free(dest_pathNfilename);
+	free(base_pathNfilename);
 
 	free(curr_pathNfilename);
 	free(buf);
@@ -919,6 +1124,238 @@ cleanup:
 }
 
 
+static int count_backup_blobs(mrsqlite3_t* sql)
+{
+	int           cnt = 0;
+	sqlite3_stmt* stmt = mrsqlite3_prepare_v2_(sql, "SELECT COUNT(*) FROM backup_blobs;");
+	if( stmt && sqlite3_step(stmt)==SQLITE_ROW ) {
+		cnt = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	return cnt;
+}
+
+
+/* The blobs are written by a pool of up to MR_IMPORT_MAX_WRITERS threads (one per core and at most one per file), each with its own read-only connection to the backup.
+Files are read using incremental BLOB I/O in chunks of MR_BACKUP_CHUNK_BYTES, so the memory used does not depend on
+the file sizes.  Written files are fsync()'d in batches before the backup table is dropped. */
+typedef struct mrimportblobs_t
+{
+	mrmailbox_t*    m_mailbox;
+	const char*     m_src_file;
+	carray*         m_ids;                   /* the IDs of the rows in backup_blobs to import */
+
+	pthread_mutex_t m_mutex;                 /* protects the following members */
+	size_t          m_next;                  /* index of the next row to import */
+	int             m_failed;
+	int*            m_processed_files_count;
+	int             m_total_files_count;
+} mrimportblobs_t;
+
+
+static int sync_and_close_files(int* fds, int* fd_cnt)
+{
+	int i, success = 1;
+	for( i = 0; i < *fd_cnt; i++ ) {
+		if( fsync(fds[i])!=0 ) {
+			success = 0;
+		}
+		close(fds[i]);
+	}
+	*fd_cnt = 0;
+	return success;
+}
+
+
+static int write_all(int fd, const void* buf, size_t bytes)
+{
+	while( bytes > 0 ) {
+		ssize_t w = write(fd, buf, bytes);
+		if( w <= 0 ) {
+			return 0;
+		}
+		buf = (const char*)buf + w;
+		bytes -= w;
+	}
+	return 1;
+}
+
+
+static void* import_blobs_thread_entry_point(void* entry_arg)
+{
+	mrimportblobs_t* job = (mrimportblobs_t*)entry_arg;
+	mrmailbox_t*     mailbox = job->m_mailbox;
+	mrsqlite3_t*     src_sql = NULL;
+	sqlite3_stmt*    stmt = NULL;
+	sqlite3_blob*    blob = NULL;
+	void*            buf = NULL;
+	int              fds[MR_IMPORT_FSYNC_FILES], fd_cnt = 0, fd, failed = 0, row_id, file_bytes, offset, chunk_bytes;
+	size_t           unsynced_bytes = 0;
+	char*            pathNfilename = NULL;
+	const char*      file_name;
+
+	mrosnative_setup_thread(mailbox); /* must be very first */
+
+	src_sql = mrsqlite3_new(mailbox);
+	buf     = malloc(MR_BACKUP_CHUNK_BYTES);
+	if( buf == NULL || !mrsqlite3_open__(src_sql, job->m_src_file, MR_OPEN_READONLY)
+	 || (stmt=mrsqlite3_prepare_v2_(src_sql, "SELECT file_name, length(file_content) FROM backup_blobs WHERE id=?;"))==NULL ) {
+		failed = 1; /* length() does not read the content of blobs */
+		goto cleanup;
+	}
+
+	while( 1 )
+	{
+		pthread_mutex_lock(&job->m_mutex);
+			if( job->m_failed || mailbox->m_imex_do_exit || job->m_next >= carray_count(job->m_ids) ) {
+				pthread_mutex_unlock(&job->m_mutex);
+				break;
+			}
+			row_id = (int)(uintptr_t)carray_get(job->m_ids, job->m_next);
+			job->m_next++;
+		pthread_mutex_unlock(&job->m_mutex);
+
+		sqlite3_reset(stmt);
+		sqlite3_bind_int(stmt, 1, row_id);
+		if( sqlite3_step(stmt)!=SQLITE_ROW ) {
+			continue;
+		}
+
+		file_name  = (const char*)sqlite3_column_text(stmt, 0);
+		file_bytes = sqlite3_column_int(stmt, 1);
+		if( file_bytes > 0 && file_name
+		 && (strchr(file_name, '/')==NULL || mrblob_is_name(file_name)) ) /* only the sub-directories of the blob store are expected, see get_blob_names() */
+		{
+			free(pathNfilename);
+			pathNfilename = mr_mprintf("%s/%s", mailbox->m_blobdir, file_name);
+
+			if( strchr(file_name, '/') ) {
+				char* shard_dir = mr_mprintf("%s/%.2s", mailbox->m_blobdir, file_name);
+				mkdir(shard_dir, 0755); /* may exist; errors are reported by open() below */
+				free(shard_dir);
+			}
+
+			if( (blob==NULL? sqlite3_blob_open(src_sql->m_cobj, "main", "backup_blobs", "file_content", row_id, 0, &blob)
+			               : sqlite3_blob_reopen(blob, row_id)) != SQLITE_OK ) {
+				mrmailbox_log_error(mailbox, 0, "Cannot read file %s from backup.", pathNfilename);
+				failed = 1;
+				goto cleanup;
+			}
+
+			if( (fd=open(pathNfilename, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0 ) {
+				mrmailbox_log_error(mailbox, 0, "Storage full? Cannot write file %s with %i bytes.", pathNfilename, file_bytes);
+				failed = 1;
+				goto cleanup;
+			}
+			fds[fd_cnt++] = fd;
+
+			for( offset = 0; offset < file_bytes; offset += chunk_bytes ) {
+				chunk_bytes = MR_MIN(MR_BACKUP_CHUNK_BYTES, file_bytes-offset);
+				if( mailbox->m_imex_do_exit ) {
+					goto cleanup;
+				}
+				if( sqlite3_blob_read(blob, buf, chunk_bytes, offset)!=SQLITE_OK
+				 || !write_all(fd, buf, chunk_bytes) ) {
+					mrmailbox_log_error(mailbox, 0, "Storage full? Cannot write file %s with %i bytes.", pathNfilename, file_bytes);
+					failed = 1; /* otherwise the user may believe the stuff is imported correctly, but there are files missing ... */
+					goto cleanup;
+				}
+			}
+
+			unsynced_bytes += file_bytes;
+			if( fd_cnt >= MR_IMPORT_FSYNC_FILES || unsynced_bytes >= MR_IMPORT_FSYNC_BYTES ) {
+				if( !sync_and_close_files(fds, &fd_cnt) ) {
+					mrmailbox_log_error(mailbox, 0, "Storage full? Cannot sync imported files.");
+					failed = 1;
+					goto cleanup;
+				}
+				unsynced_bytes = 0;
+			}
+		}
+
+		pthread_mutex_lock(&job->m_mutex);
+			file_progress(mailbox, job->m_processed_files_count, job->m_total_files_count);
+		pthread_mutex_unlock(&job->m_mutex);
+	}
+
+cleanup:
+	if( !sync_and_close_files(fds, &fd_cnt) && !failed ) {
+		mrmailbox_log_error(mailbox, 0, "Storage full? Cannot sync imported files.");
+		failed = 1;
+	}
+
+	if( failed ) {
+		pthread_mutex_lock(&job->m_mutex);
+			job->m_failed = 1;
+		pthread_mutex_unlock(&job->m_mutex);
+	}
+
+	if( blob ) { sqlite3_blob_close(blob); }
+	sqlite3_finalize(stmt);
+	mrsqlite3_close__(src_sql);
+	mrsqlite3_unref(src_sql);
+	free(pathNfilename);
+	free(buf);
+	mrosnative_unsetup_thread(mailbox); /* must be very last */
+	return NULL;
+}
+
+
+static int import_backup_blobs(mrmailbox_t* mailbox, mrsqlite3_t* src_sql, int* processed_files_count, int total_files_count)
+{
+	int              success = 0, i, writers;
+	sqlite3_stmt*    stmt = NULL;
+	mrimportblobs_t  job;
+	pthread_t        threads[MR_IMPORT_MAX_WRITERS];
+
+	memset(&job, 0, sizeof(mrimportblobs_t));
+	job.m_mailbox               = mailbox;
+	job.m_src_file              = sqlite3_db_filename(src_sql->m_cobj, "main");
+	job.m_ids                   = carray_new(128);
+	job.m_processed_files_count = processed_files_count;
+	job.m_total_files_count     = total_files_count;
+	pthread_mutex_init(&job.m_mutex, NULL);
+
+	/* collect the IDs only, the content is read by the writer threads */
+	stmt = mrsqlite3_prepare_v2_(src_sql, "SELECT id FROM backup_blobs ORDER BY id;");
+	while( sqlite3_step(stmt) == SQLITE_ROW ) {
+		carray_add(job.m_ids, (void*)(uintptr_t)sqlite3_column_int(stmt, 0), NULL);
+	}
+	sqlite3_finalize(stmt);
+
+	if( carray_count(job.m_ids) == 0 ) {
+		success = 1;
+		goto cleanup;
+	}
+
+	if( job.m_src_file == NULL ) {
+		goto cleanup;
+	}
+
+	writers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	writers = MR_MAX(1, MR_MIN(writers, MR_IMPORT_MAX_WRITERS));
+	writers = MR_MIN(writers, (int)carray_count(job.m_ids));
+
+	for( i = 0; i < writers; i++ ) {
+		pthread_create(&threads[i], NULL, import_blobs_thread_entry_point, &job);
+	}
+	for( i = 0; i < writers; i++ ) {
+		pthread_join(threads[i], NULL);
+	}
+
+	if( job.m_failed || mailbox->m_imex_do_exit ) {
+		goto cleanup;
+	}
+
+	success = 1;
+
+cleanup:
+	pthread_mutex_destroy(&job.m_mutex);
+	carray_free(job.m_ids);
+	return success;
+}
+
+
 static int import_backup(mrmailbox_t* mailbox, const char* backup_to_import)
 {
 	/* command for testing eg.
@@ -928,8 +1365,8 @@ static int import_backup(mrmailbox_t* mailbox, const char* backup_to_import)
 	int           success = 0;
 	int           locked = 0;
 	int           processed_files_count = 0, total_files_count = 0;
-	sqlite3_stmt* stmt = NULL;
-	char*         pathNfilename = NULL;
+	carray*       bases = carray_new(4); /* mrsqlite3_t objects of former backups, the newest first */
+	size_t        i;
 
 	mrmailbox_log_info(mailbox, 0, "Import \"%s\" to \"%s\".", backup_to_import, mailbox->m_dbfile);
 
@@ -940,6 +1377,7 @@ static int import_backup(mrmailbox_t* mailbox, const char* backup_to_import)
 
 	/* close and delete the original file */
 	mrmailbox_disconnect(mailbox);
+	mrjob_clear_queue(mailbox);
 
 	mrsqlite3_lock(mailbox->m_sql);
 	locked = 1;
@@ -961,53 +1399,77 @@ static int import_backup(mrmailbox_t* mailbox, const char* backup_to_import)
 	}
 
 	/* re-open copied database file */
-	if( !mrsqlite3_open__(mailbox->m_sql, mailbox->m_dbfile, 0) ) {
+	if( !mrsqlite3_open__(mailbox->m_sql, mailbox->m_dbfile, MR_OPEN_WITH_READERS) ) {
 		goto cleanup;
 	}
+	mrjob_load_queue__(mailbox);
+	mrmailbox_update_config_cache__(mailbox, NULL);
+	mrmailbox_uncache_e2ee__(mailbox);
 
-	/* copy all blobs to files */
-	stmt = mrsqlite3_prepare_v2_(mailbox->m_sql, "SELECT COUNT(*) FROM backup_blobs;");
-	sqlite3_step(stmt);
-	total_files_count = sqlite3_column_int(stmt, 0);
-	sqlite3_finalize(stmt);
-	stmt = NULL;
-
-	stmt = mrsqlite3_prepare_v2_(mailbox->m_sql, "SELECT file_name, file_content FROM backup_blobs ORDER BY id;");
-	while( sqlite3_step(stmt) == SQLITE_ROW )
+	/* incremental backups contain only the files changed since the former backup, collect the chain of former backups */
 	{
-		if( s_imex_do_exit ) {
-			goto cleanup;
+		char* base_name = mrsqlite3_get_config__(mailbox->m_sql, "backup_base", NULL);
+		char* dir = safe_strdup(backup_to_import), *p;
+		if( (p=strrchr(dir, '/'))!=NULL ) { *p = 0; } else { free(dir); dir = safe_strdup("."); }
+		while( base_name && carray_count(bases) < MR_BACKUP_MAX_BASES ) {
+			mrsqlite3_t* base_sql = mrsqlite3_new(mailbox);
+			char*        base_pathNfilename = mr_mprintf("%s/%s", dir, base_name);
+			free(base_name);
+			base_name = NULL;
+			if( !mrsqlite3_open__(base_sql, base_pathNfilename, MR_OPEN_READONLY) ) {
+				mrmailbox_log_error(mailbox, 0, "Cannot import backups: The former backup \"%s\" is missing.", base_pathNfilename);
+				mrsqlite3_unref(base_sql);
+				free(base_pathNfilename);
+				free(dir);
+				goto cleanup;
+			}
+			free(base_pathNfilename);
+			carray_add(bases, base_sql, NULL);
+			base_name = mrsqlite3_get_config__(base_sql, "backup_base", NULL);
 		}
+		free(base_name);
+		free(dir);
+	}
 
-        FILE_PROGRESS
-
-        const char* file_name    = (const char*)sqlite3_column_text (stmt, 0);
-        int         file_bytes   = sqlite3_column_bytes(stmt, 1);
-        const void* file_content = sqlite3_column_blob (stmt, 1);
+	/* copy all blobs to files, starting with the oldest backup so that newer versions of a file win */
+	for( i = 0; i < carray_count(bases); i++ ) {
+		total_files_count += count_backup_blobs((mrsqlite3_t*)carray_get(bases, i));
+	}
+	total_files_count += count_backup_blobs(mailbox->m_sql);
 
-        if( file_bytes > 0 && file_content ) {
-			free(pathNfilename);
-			pathNfilename = mr_mprintf("%s/%s", mailbox->m_blobdir, file_name);
-			if( !mr_write_file(pathNfilename, file_content, file_bytes, mailbox) ) {
-				mrmailbox_log_error(mailbox, 0, "Storage full? Cannot write file %s with %i bytes.", pathNfilename, file_bytes);
-				goto cleanup; /* otherwise the user may believe the stuff is imported correctly, but there are files missing ... */
-			}
+	for( i = carray_count(bases); i > 0; i-- ) {
+		if( !import_backup_blobs(mailbox, (mrsqlite3_t*)carray_get(bases, i-1), &processed_files_count, total_files_count) ) {
+			goto cleanup; /* error already logged */
 		}
 	}
 
-	/* finalize/reset all statements - otherwise the table cannot be DROPped below */
-	sqlite3_finalize(stmt);
-	stmt = 0;
+	if( !import_backup_blobs(mailbox, mailbox->m_sql, &processed_files_count, total_files_count) ) {
+		goto cleanup; /* error already logged */
+	}
+
+	/* reset all statements - otherwise the table cannot be DROPped below */
 	mrsqlite3_reset_all_predefinitions(mailbox->m_sql);
+	mrsqlite3_execute__(mailbox->m_sql, "DELETE FROM config WHERE keyname='backup_base';");
+	mrsqlite3_reload_config__(mailbox->m_sql);
 
 	mrsqlite3_execute__(mailbox->m_sql, "DROP TABLE backup_blobs;");
+
+	/* backups of former versions contain a flat blobdir, see mrblob.h */
+	if( mrsqlite3_get_config_int__(mailbox->m_sql, "blobstore", 0)==0 ) {
+		mrblob_migrate__(mailbox);
+	}
+
 	mrsqlite3_execute__(mailbox->m_sql, "VACUUM;");
 
 	success = 1;
 
 cleanup:
-	free(pathNfilename);
-	if( stmt )  { sqlite3_finalize(stmt); }
+	for( i = 0; i < carray_count(bases); i++ ) {
+		mrsqlite3_t* base_sql = (mrsqlite3_t*)carray_get(bases, i);
+		mrsqlite3_close__(base_sql);
+		mrsqlite3_unref(base_sql);
+	}
+	carray_free(bases);
 	if( locked ) { mrsqlite3_unlock(mailbox->m_sql); }
 	return success;
 }
@@ -1027,10 +1489,6 @@ typedef struct mrimexthreadparam_t
 } mrimexthreadparam_t;
 
 
-static pthread_t s_imex_thread;
-static int       s_imex_thread_created = 0;
-
-
 static void* imex_thread_entry_point(void* entry_arg)
 {
 	int                  success = 0;
@@ -1045,7 +1503,7 @@ static void* imex_thread_entry_point(void* entry_arg)
 		goto cleanup;
 	}
 
-	if( thread_param->m_what==MR_IMEX_EXPORT_SELF_KEYS || thread_param->m_what==MR_IMEX_EXPORT_BACKUP ) {
+	if( thread_param->m_what==MR_IMEX_EXPORT_SELF_KEYS || thread_param->m_what==MR_IMEX_EXPORT_BACKUP || thread_param->m_what==MR_IMEX_EXPORT_BACKUP_INCREMENTAL ) {
 		/* before we export anything, make sure the private key exists */
 		if( !mrmailbox_ensure_secret_key_exists(mailbox) ) {
 			mrmailbox_log_error(mailbox, 0, "Import/export: Cannot create private key or private key not available.");
@@ -1070,7 +1528,8 @@ static void* imex_thread_entry_point(void* entry_arg)
 			break;
 
 		case MR_IMEX_EXPORT_BACKUP:
-			if( !export_backup(mailbox, thread_param->m_param1) ) {
+		case MR_IMEX_EXPORT_BACKUP_INCREMENTAL:
+			if( !export_backup(mailbox, thread_param->m_param1, thread_param->m_what==MR_IMEX_EXPORT_BACKUP_INCREMENTAL) ) {
 				goto cleanup;
 			}
 			break;
@@ -1086,9 +1545,9 @@ static void* imex_thread_entry_point(void* entry_arg)
 
 cleanup:
 	mrmailbox_log_info(mailbox, 0, "Import/export thread ended.");
-	s_imex_do_exit = 1; /* set this before sending MR_EVENT_EXPORT_ENDED, avoids MR_IMEX_CANCEL to stop the thread */
+	mailbox->m_imex_do_exit = 1; /* set this before sending MR_EVENT_EXPORT_ENDED, avoids MR_IMEX_CANCEL to stop the thread */
 	mailbox->m_cb(mailbox, MR_EVENT_IMEX_ENDED, success, 0);
-	s_imex_thread_created = 0;
+	mailbox->m_imex_thread_created = 0;
 	free(thread_param->m_param1);
 	free(thread_param->m_setup_code);
 	free(thread_param);
@@ -1107,10 +1566,10 @@ void mrmailbox_imex(mrmailbox_t* mailbox, int what, const char* param1, const ch
 
 	if( what == MR_IMEX_CANCEL ) {
 		/* cancel an running export */
-		if( s_imex_thread_created && s_imex_do_exit==0 ) {
+		if( mailbox->m_imex_thread_created && mailbox->m_imex_do_exit==0 ) {
 			mrmailbox_log_info(mailbox, 0, "Stopping import/export thread...");
-				s_imex_do_exit = 1;
-				pthread_join(s_imex_thread, NULL);
+				mailbox->m_imex_do_exit = 1;
+				pthread_join(mailbox->m_imex_thread, NULL);
 			mrmailbox_log_info(mailbox, 0, "Import/export thread stopped.");
 		}
 		return;
@@ -1121,20 +1580,20 @@ void mrmailbox_imex(mrmailbox_t* mailbox, int what, const char* param1, const ch
 		return;
 	}
 
-	if( s_imex_thread_created || s_imex_do_exit==0 ) {
+	if( mailbox->m_imex_thread_created || mailbox->m_imex_do_exit==0 ) {
 		mrmailbox_log_warning(mailbox, 0, "Already importing/exporting.");
 		return;
 	}
-	s_imex_thread_created = 1;
-	s_imex_do_exit = 0;
+	mailbox->m_imex_thread_created = 1;
+	mailbox->m_imex_do_exit = 0;
 
-	memset(&s_imex_thread, 0, sizeof(pthread_t));
+	memset(&mailbox->m_imex_thread, 0, sizeof(pthread_t));
 	thread_param = calloc(1, sizeof(mrimexthreadparam_t));
 	thread_param->m_mailbox    = mailbox;
 	thread_param->m_what       = what;
 	thread_param->m_param1     = safe_strdup(param1);
 	thread_param->m_setup_code = safe_strdup(setup_code);
-	pthread_create(&s_imex_thread, NULL, imex_thread_entry_point, thread_param);
+	pthread_create(&mailbox->m_imex_thread, NULL, imex_thread_entry_point, thread_param);
 }
 
 
@@ -39,6 +39,7 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <memory.h>
+#include <sched.h>
 #include "mrmailbox.h"
 #include "mrtools.h"
 
@@ -48,34 +49,134 @@
  ******************************************************************************/
 
 
-int mrmailbox_get_thread_index(void)
-{
-	#define          MR_MAX_THREADS 32 /* if more threads are started, the full ID is printed (this may happen eg. on many failed connections so that we try to start a working thread several times) */
-	static pthread_t s_threadIds[MR_MAX_THREADS];
-	static int       s_threadIdsCnt = 0;
+static __thread mrmailbox_t* s_cached_thread_mailbox = NULL; /* the last lookup of the thread, so we do not need the lock and the scan on every line */
+static __thread int          s_cached_thread_index = 0;
+
 
-	int       i;
+int mrmailbox_get_thread_index(mrmailbox_t* mailbox)
+{
+	/* the indices are counted per mailbox, so they stay small if many mailboxes share the threads of a host, see mrhost.c */
+	int       i, ret = 0;
 	pthread_t self = pthread_self();
 
-	if( s_threadIdsCnt==0 ) {
-		for( i = 0; i < MR_MAX_THREADS; i++ ) {
-			s_threadIds[i] = 0;
-		}
+	/* the table entries are never changed once they are added, so the cache is checked without locking;
+	the check also catches a new mailbox allocated at the address of a freed one */
+	if( s_cached_thread_mailbox == mailbox
+	 && s_cached_thread_index >= 1 && s_cached_thread_index <= MR_MAX_THREADS
+	 && pthread_equal(mailbox->m_thread_ids[s_cached_thread_index-1], self) ) {
+		return s_cached_thread_index;
 	}
 
-	for( i = 0; i < s_threadIdsCnt; i++ ) {
-		if( s_threadIds[i] == self ) {
-			return i+1;
+	pthread_mutex_lock(&mailbox->m_thread_ids_critical);
+
+		for( i = 0; i < mailbox->m_thread_ids_cnt; i++ ) {
+			if( pthread_equal(mailbox->m_thread_ids[i], self) ) {
+				ret = i+1;
+				goto cleanup;
+			}
+		}
+
+		if( mailbox->m_thread_ids_cnt >= MR_MAX_THREADS ) {
+			ret = (int)(self); /* Fallback, this may happen, see comment at MR_MAX_THREADS */
+			goto cleanup;
 		}
+
+		mailbox->m_thread_ids[mailbox->m_thread_ids_cnt] = self;
+		mailbox->m_thread_ids_cnt++;
+		ret = mailbox->m_thread_ids_cnt;
+
+cleanup:
+	pthread_mutex_unlock(&mailbox->m_thread_ids_critical);
+
+	s_cached_thread_mailbox = mailbox;
+	s_cached_thread_index   = ret;
+	return ret;
+}
+
+
+/*******************************************************************************
+ * The ring buffer
+ *
+ * Each logging thread takes the next position by an atomic increment and
+ * writes the record to the slot of this position, overwriting the oldest
+ * record.  A slot is claimed by m_busy, so two writers do not mix up one
+ * record; this only waits if the writer of the record MR_LOG_RINGBUF_SIZE
+ * lines before is still busy.  Readers do not block the writers: m_seq is
+ * set to 0 while the record is written and to position+1 afterwards, a copy
+ * is valid if m_seq is the expected value before and after copying.
+ ******************************************************************************/
+
+
+static void add_to_ringbuf(mrmailbox_t* mailbox, int event, int code, const char* text)
+{
+	uint32_t     pos  = __atomic_fetch_add(&mailbox->m_log_head, 1, __ATOMIC_RELAXED);
+	mrlogslot_t* slot = &mailbox->m_log_ringbuf[pos & (MR_LOG_RINGBUF_SIZE-1)];
+	int          expected;
+	size_t       bytes;
+
+	while( 1 ) {
+		expected = 0;
+		if( __atomic_compare_exchange_n(&slot->m_busy, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ) {
+			break;
+		}
+		sched_yield();
+	}
+
+	__atomic_store_n(&slot->m_seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE); /* readers must see m_seq=0 before any part of the new record */
+
+		slot->m_record.m_pos       = pos;
+		slot->m_record.m_event     = event;
+		slot->m_record.m_code      = code;
+		slot->m_record.m_timestamp = time(NULL);
+		bytes = MR_MIN(strlen(text), MR_LOG_TEXT_BYTES-1);
+		memcpy(slot->m_record.m_text, text, bytes);
+		slot->m_record.m_text[bytes] = 0;
+
+	__atomic_store_n(&slot->m_seq, pos+1, __ATOMIC_RELEASE);
+	__atomic_store_n(&slot->m_busy, 0, __ATOMIC_RELEASE);
+}
+
+
+int mrmailbox_get_log(mrmailbox_t* mailbox, uint32_t* cursor, mrlogrecord_t* records, int max_records)
+{
+	uint32_t     head, pos, seq;
+	mrlogslot_t* slot;
+	int          cnt = 0;
+
+	if( mailbox == NULL || cursor == NULL || records == NULL ) {
+		return 0;
 	}
 
-	if( s_threadIdsCnt >= MR_MAX_THREADS ) {
-		return (int)(self); /* Fallback, this may happen, see comment above */
+	head = __atomic_load_n(&mailbox->m_log_head, __ATOMIC_ACQUIRE);
+	pos  = *cursor;
+	if( head-pos > MR_LOG_RINGBUF_SIZE ) {
+		pos = head - MR_LOG_RINGBUF_SIZE; /* the older records are overwritten (or the cursor is invalid) */
+	}
+
+	while( pos != head && cnt < max_records )
+	{
+		slot = &mailbox->m_log_ringbuf[pos & (MR_LOG_RINGBUF_SIZE-1)];
+
+		seq = __atomic_load_n(&slot->m_seq, __ATOMIC_ACQUIRE);
+		if( seq == pos+1 ) {
+			memcpy(&records[cnt], &slot->m_record, sizeof(mrlogrecord_t));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if( __atomic_load_n(&slot->m_seq, __ATOMIC_RELAXED) == seq ) {
+				cnt++;
+			}
+			/* else: overwritten while copying, skip */
+		}
+		else if( seq == 0 || (int32_t)(seq-1-pos) < 0 ) {
+			break; /* the record is not yet written, try again on the next call */
+		}
+		/* else: already overwritten by a newer record, skip */
+
+		pos++;
 	}
 
-	s_threadIds[s_threadIdsCnt] = self;
-	s_threadIdsCnt++;
-	return s_threadIdsCnt;
+	*cursor = pos;
+	return cnt;
 }
 
 
@@ -86,64 +187,71 @@ int mrmailbox_get_thread_index(void)
 
 void mrmailbox_log_vprintf(mrmailbox_t* mailbox, int event, int code, const char* msg_format, va_list va)
 {
-	char* msg = NULL;
+	#define BUFSIZE 1024
+	char  msg[BUFSIZE];
+	char* temp = NULL;
+	int   prefix_bytes = 0;
 
 	if( mailbox==NULL ) {
 		return;
 	}
 
-	/* format message from variable parameters or translate very comming errors */
+	/* errors are always reported, they are shown to the user */
+	if( event != MR_EVENT_ERROR && event < mailbox->m_log_level ) {
+		return;
+	}
+
+	/* prefix the message by the thread-id? we do this for non-errros that are normally only logged (for the few errros, the thread should be clear (enough)) */
+	if( event != MR_EVENT_ERROR ) {
+		prefix_bytes = snprintf(msg, BUFSIZE, "T%i: ", (int)mrmailbox_get_thread_index(mailbox));
+	}
+
+	/* format message from variable parameters or translate very comming errors; this is done once and directly into the buffer */
 	if( code == MR_ERR_SELF_NOT_IN_GROUP )
 	{
-		msg = mrstock_str(MR_STR_SELFNOTINGRP);
+		temp = mrstock_str(MR_STR_SELFNOTINGRP);
 	}
 	else if( code == MR_ERR_NONETWORK )
 	{
-		msg = mrstock_str(MR_STR_NONETWORK);
+		temp = mrstock_str(MR_STR_NONETWORK);
 	}
 	else if( msg_format )
 	{
-		#define BUFSIZE 1024
-		char tempbuf[BUFSIZE];
-		vsnprintf(tempbuf, BUFSIZE, msg_format, va);
-		msg = safe_strdup(tempbuf);
+		vsnprintf(msg+prefix_bytes, BUFSIZE-prefix_bytes, msg_format, va);
 
 		if( event == MR_EVENT_ERROR ) {
-			char* temp = msg;
-			msg = mrstock_str_repl_string(MR_STR_ERROR, temp);
-			free(temp);
+			temp = mrstock_str_repl_string(MR_STR_ERROR, msg);
 		}
 	}
-
-	/* if we have still no message, create one based upon  the code */
-	if( msg == NULL ) {
-		     if( event == MR_EVENT_INFO )    { msg = mr_mprintf("Info: %i",    (int)code); }
-		else if( event == MR_EVENT_WARNING ) { msg = mr_mprintf("Warning: %i", (int)code); }
-		else                                 { msg = mrstock_str_repl_int(MR_STR_ERROR, code); }
+	else
+	{
+		/* if we have still no message, create one based upon  the code */
+		     if( event == MR_EVENT_INFO )    { snprintf(msg+prefix_bytes, BUFSIZE-prefix_bytes, "Info: %i",    (int)code); }
+		else if( event == MR_EVENT_WARNING ) { snprintf(msg+prefix_bytes, BUFSIZE-prefix_bytes, "Warning: %i", (int)code); }
+		else                                 { temp = mrstock_str_repl_int(MR_STR_ERROR, code); }
 	}
 
-	/* prefix the message by the thread-id? we do this for non-errros that are normally only logged (for the few errros, the thread should be clear (enough)) */
-	if( event != MR_EVENT_ERROR ) {
-		char* temp = msg;
-		msg = mr_mprintf("T%i: %s", (int)mrmailbox_get_thread_index(), temp);
+	if( temp ) {
+		snprintf(msg+prefix_bytes, BUFSIZE-prefix_bytes, "%s", temp);
 		free(temp);
 	}
 
 	/* finally, log */
-	mailbox->m_cb(mailbox, event, (uintptr_t)code, (uintptr_t)msg);
+	if( event == MR_EVENT_ERROR || mailbox->m_log_callback ) {
+		mailbox->m_cb(mailbox, event, (uintptr_t)code, (uintptr_t)msg);
+	}
 
 	/* remember the last N log entries */
-	pthread_mutex_lock(&mailbox->m_log_ringbuf_critical);
-		free(mailbox->m_log_ringbuf[mailbox->m_log_ringbuf_pos]);
-		mailbox->m_log_ringbuf[mailbox->m_log_ringbuf_pos] = msg;
-		mailbox->m_log_ringbuf_times[mailbox->m_log_ringbuf_pos] = time(NULL);
-		mailbox->m_log_ringbuf_pos = (mailbox->m_log_ringbuf_pos+1) % MR_LOG_RINGBUF_SIZE;
-	pthread_mutex_unlock(&mailbox->m_log_ringbuf_critical);
+	add_to_ringbuf(mailbox, event, code, msg);
 }
 
 
 void mrmailbox_log_info(mrmailbox_t* mailbox, int code, const char* msg, ...)
 {
+	if( mailbox==NULL || MR_EVENT_INFO < mailbox->m_log_level ) {
+		return; /* check before va_start(), this is the most frequent case */
+	}
+
 	va_list va;
 	va_start(va, msg); /* va_start() expects the last non-variable argument as the second parameter */
 		mrmailbox_log_vprintf(mailbox, MR_EVENT_INFO, code, msg, va);
@@ -154,6 +262,10 @@ void mrmailbox_log_info(mrmailbox_t* mailbox, int code, const char* msg, ...)
 
 void mrmailbox_log_warning(mrmailbox_t* mailbox, int code, const char* msg, ...)
 {
+	if( mailbox==NULL || MR_EVENT_WARNING < mailbox->m_log_level ) {
+		return;
+	}
+
 	va_list va;
 	va_start(va, msg);
 		mrmailbox_log_vprintf(mailbox, MR_EVENT_WARNING, code, msg, va);
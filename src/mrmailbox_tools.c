@@ -300,9 +300,9 @@ time_t mrmailbox_correct_bad_timestamp__(mrmailbox_t* ths, uint32_t chat_id, uin
 	}
 
 	/* use the (smeared) current time as the MAXIMUM */
-	if( desired_timestamp >= mr_smeared_time__() )
+	if( desired_timestamp >= mr_smeared_time__(ths) )
 	{
-		desired_timestamp = mr_create_smeared_timestamp__();
+		desired_timestamp = mr_create_smeared_timestamp__(ths);
 	}
 
 	return desired_timestamp;
@@ -87,6 +87,17 @@ void mrmimefactory_empty(mrmimefactory_t* factory)
 		mmap_string_free(factory->m_out);
 		factory->m_out = NULL;
 	}
+
+	if( factory->m_out_mime ) {
+		mailmime_free(factory->m_out_mime);
+		factory->m_out_mime = NULL;
+	}
+
+	free(factory->m_out_text);
+	factory->m_out_text = NULL;
+
+	free(factory->m_out_text2);
+	factory->m_out_text2 = NULL;
 	factory->m_out_encrypted = 0;
 	factory->m_loaded = MR_MF_NOTHING_LOADED;
 
@@ -96,7 +107,7 @@ void mrmimefactory_empty(mrmimefactory_t* factory)
 
 static void load_from__(mrmimefactory_t* factory)
 {
-	factory->m_from_addr        = mrsqlite3_get_config__(factory->m_mailbox->m_sql, "configured_addr", NULL);
+	factory->m_from_addr        = strdup_keep_null(factory->m_mailbox->m_self_addr);
 	factory->m_from_displayname = mrsqlite3_get_config__(factory->m_mailbox->m_sql, "displayname", NULL);
 
 	factory->m_selfstatus       = mrsqlite3_get_config__(factory->m_mailbox->m_sql, "selfstatus", NULL);
@@ -147,7 +158,7 @@ int mrmimefactory_load_msg(mrmimefactory_t* factory, uint32_t msg_id)
 			int system_command = mrparam_get_int(factory->m_msg->m_param, MRP_SYSTEM_CMD, 0);
 			if( system_command==MR_SYSTEM_MEMBER_REMOVED_FROM_GROUP /* for added members, the list is just fine */) {
 				char* email_to_remove = mrparam_get(factory->m_msg->m_param, MRP_SYSTEM_CMD_PARAM, NULL);
-				char* self_addr = mrsqlite3_get_config__(mailbox->m_sql, "configured_addr", "");
+				char* self_addr = safe_strdup(mailbox->m_self_addr);
 				if( email_to_remove && strcasecmp(email_to_remove, self_addr)!=0 )
 				{
 					if( clist_search_string_nocase(factory->m_recipients_addr, email_to_remove)==0 )
@@ -272,7 +283,7 @@ int mrmimefactory_load_mdn(mrmimefactory_t* factory, uint32_t msg_id)
 
 		load_from__(factory);
 
-		factory->m_timestamp = mr_create_smeared_timestamp__();
+		factory->m_timestamp = mr_create_smeared_timestamp__(factory->m_mailbox);
 		factory->m_rfc724_mid = mr_create_outgoing_rfc724_mid(NULL, factory->m_from_addr);
 
 	mrsqlite3_unlock(mailbox->m_sql);
@@ -317,8 +328,9 @@ static struct mailmime* build_body_file(const mrmsg_t* msg, const char* base_nam
 	struct mailmime_content* content;
 
 	char* pathNfilename = mrparam_get(msg->m_param, MRP_FILE, NULL);
+	char* orig_filename = mrparam_get(msg->m_param, MRP_FILENAME, NULL); /* set for files in the blob store which are named after their content */
 	char* mimetype = mrparam_get(msg->m_param, MRP_MIMETYPE, NULL);
-	char* suffix = mr_get_filesuffix_lc(pathNfilename);
+	char* suffix = mr_get_filesuffix_lc(orig_filename? orig_filename : pathNfilename);
 	char* filename_to_send = NULL;
 
 	if( pathNfilename == NULL ) {
@@ -335,16 +347,14 @@ static struct mailmime* build_body_file(const mrmsg_t* msg, const char* base_nam
 			suffix? suffix : "dat");
 	}
 	else if( msg->m_type == MR_MSG_AUDIO ) {
-		char* author = mrparam_get(msg->m_param, MRP_AUTHORNAME, NULL);
-		char* title = mrparam_get(msg->m_param, MRP_TRACKNAME, NULL);
+		const char* author = mrparam_peek(msg->m_param, MRP_AUTHORNAME, NULL);
+		const char* title = mrparam_peek(msg->m_param, MRP_TRACKNAME, NULL);
 		if( author && author[0] && title && title[0] && suffix ) {
 			filename_to_send = mr_mprintf("%s - %s.%s",  author, title, suffix); /* the separator ` - ` is used on the receiver's side to construct the information; we avoid using ID3-scanners for security purposes */
 		}
 		else {
-			filename_to_send = mr_get_filename(pathNfilename);
+			filename_to_send = orig_filename? safe_strdup(orig_filename) : mr_get_filename(pathNfilename);
 		}
-		free(author);
-		free(title);
 	}
 	else if( msg->m_type == MR_MSG_IMAGE || msg->m_type == MR_MSG_GIF ) {
 		if( base_name == NULL ) {
@@ -356,7 +366,7 @@ static struct mailmime* build_body_file(const mrmsg_t* msg, const char* base_nam
 		filename_to_send = mr_mprintf("video.%s", suffix? suffix : "dat");
 	}
 	else {
-		filename_to_send = mr_get_filename(pathNfilename);
+		filename_to_send = orig_filename? safe_strdup(orig_filename) : mr_get_filename(pathNfilename);
 	}
 
 	/* check mimetype */
@@ -397,6 +407,7 @@ static struct mailmime* build_body_file(const mrmsg_t* msg, const char* base_nam
 
 cleanup:
 	free(pathNfilename);
+	free(orig_filename);
 	free(mimetype);
 	free(filename_to_send);
 	free(suffix);
@@ -427,7 +438,7 @@ int mrmimefactory_render(mrmimefactory_t* factory, int encrypt_to_self)
 {
 	if( factory == NULL
 	 || factory->m_loaded == MR_MF_NOTHING_LOADED
-	 || factory->m_out/*call empty() before*/ ) {
+	 || factory->m_out || factory->m_out_mime/*call empty() before*/ ) {
 		return 0;
 	}
 
@@ -443,6 +454,7 @@ int mrmimefactory_render(mrmimefactory_t* factory, int encrypt_to_self)
 	int                          system_command = 0;
 	int                          force_unencrypted = 0;
 	char*                        grpimage = NULL;
+	size_t                       file_bytes = 0;
 
 	memset(&e2ee_helper, 0, sizeof(mrmailbox_e2ee_helper_t));
 
@@ -541,6 +553,7 @@ int mrmimefactory_render(mrmimefactory_t* factory, int encrypt_to_self)
 			char* filename_as_sended = NULL;
 			if( (meta_part=build_body_file(meta, "group-image", &filename_as_sended))!=NULL ) {
 				mailimf_fields_add(imf_fields, mailimf_field_new_custom(strdup("Chat-Group-Image"), filename_as_sended/*takes ownership*/));
+				file_bytes += mr_get_filebytes(grpimage);
 			}
 			mrmsg_unref(meta);
 		}
@@ -591,6 +604,7 @@ int mrmimefactory_render(mrmimefactory_t* factory, int encrypt_to_self)
 			if( file_part ) {
 				mailmime_smart_add_part(message, file_part);
 				parts++;
+				file_bytes += mr_get_filebytes(mrparam_peek(msg->m_param, MRP_FILE, NULL));
 			}
 		}
 
@@ -671,10 +685,8 @@ int mrmimefactory_render(mrmimefactory_t* factory, int encrypt_to_self)
 	 *************************************************************************/
 
 	if( !force_unencrypted ) {
-		if( encrypt_to_self==0 || e2ee_guaranteed ) {
-			/* we're here (1) _always_ on SMTP and (2) on IMAP _only_ if SMTP was encrypted before */
-			mrmailbox_e2ee_encrypt(factory->m_mailbox, factory->m_recipients_addr, e2ee_guaranteed, encrypt_to_self, message, &e2ee_helper);
-		}
+		/* always encrypt if possible; encrypt_to_self only adds our own key so that the same data can be uploaded to IMAP */
+		mrmailbox_e2ee_encrypt(factory->m_mailbox, factory->m_recipients_addr, e2ee_guaranteed, encrypt_to_self, message, &e2ee_helper);
 	}
 
 	/* add a subject line */
@@ -693,9 +705,20 @@ int mrmimefactory_render(mrmimefactory_t* factory, int encrypt_to_self)
 	struct mailimf_subject* subject = mailimf_subject_new(mr_encode_header_string(subject_str));
 	mailimf_fields_add(imf_fields, mailimf_field_new(MAILIMF_FIELD_SUBJECT, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, subject, NULL, NULL, NULL));
 
-	/* create the full mail and return */
-	factory->m_out = mmap_string_new("");
-	mailmime_write_mem(factory->m_out, &col, message);
+	/* create the full mail and return; attachments of unencrypted messages are base64-encoded only when the message is written
+	out, so large files need not to be held in memory (encrypted messages are rendered to memory by the encryption anyway) */
+	if( !factory->m_out_encrypted && file_bytes >= MR_MIMEFACTORY_STREAM_BYTES ) {
+		factory->m_out_mime  = message;
+		factory->m_out_text  = message_text;
+		factory->m_out_text2 = message_text2;
+		message       = NULL;
+		message_text  = NULL;
+		message_text2 = NULL;
+	}
+	else {
+		factory->m_out = mmap_string_new("");
+		mailmime_write_mem(factory->m_out, &col, message);
+	}
 
 	//{char* t4=mr_null_terminate(ret->str,ret->len); printf("MESSAGE:\n%s\n",t4);free(t4);}
 
@@ -712,3 +735,62 @@ cleanup:
 	return success;
 }
 
+
+int mrmimefactory_write(mrmimefactory_t* factory, int (*do_write)(void*, const char*, size_t), void* data)
+{
+	/* do_write() is called in small chunks, it must return 0 on errors, see mailmime_write_driver() */
+	int col = 0;
+
+	if( factory == NULL || do_write == NULL ) {
+		return 0;
+	}
+
+	if( factory->m_out ) {
+		return do_write(data, factory->m_out->str, factory->m_out->len)!=0;
+	}
+	else if( factory->m_out_mime ) {
+		return mailmime_write_driver(do_write, data, &col, factory->m_out_mime)==MAILIMF_NO_ERROR;
+	}
+
+	return 0;
+}
+
+
+static int write_to_file(void* data, const char* str, size_t length)
+{
+	return fwrite(str, 1, length, (FILE*)data)==length;
+}
+
+
+int mrmimefactory_write_file(mrmimefactory_t* factory, const char* pathNfilename)
+{
+	int   success = 0;
+	FILE* f = NULL;
+
+	if( factory == NULL || pathNfilename == NULL ) {
+		goto cleanup;
+	}
+
+	if( (f=fopen(pathNfilename, "wb"))==NULL ) {
+		mrmailbox_log_warning(factory->m_mailbox, 0, "Cannot open \"%s\" for writing.", pathNfilename);
+		goto cleanup;
+	}
+
+	if( !mrmimefactory_write(factory, write_to_file, f) ) {
+		mrmailbox_log_warning(factory->m_mailbox, 0, "Cannot write message to \"%s\".", pathNfilename);
+		goto cleanup;
+	}
+
+	success = 1;
+
+cleanup:
+	if( f ) {
+		if( fclose(f)!=0 ) {
+			success = 0;
+		}
+	}
+	if( !success && pathNfilename ) {
+		remove(pathNfilename);
+	}
+	return success;
+}
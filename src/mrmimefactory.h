@@ -44,6 +44,9 @@ typedef struct mrmailbox_t mrmailbox_t;
 #define MR_SYSTEM_MEMBER_REMOVED_FROM_GROUP   5
 
 
+#define MR_MIMEFACTORY_STREAM_BYTES           (256*1024) /* unencrypted messages with at least these attachment bytes are not rendered to memory */
+
+
 typedef enum {
 	MR_MF_NOTHING_LOADED = 0,
 	MR_MF_MSG_LOADED,
@@ -72,12 +75,17 @@ typedef struct mrmimefactory_t {
 	char*        m_references;
 	int          m_req_mdn;
 
-	/* out: after a successfull mrmimefactory_create_mime(), here's the data */
+	/* out: after a successfull mrmimefactory_render(), here's the data.
+	Unencrypted messages with large attachments are not rendered to memory; m_out is NULL then and
+	m_out_mime is written chunk by chunk using mrmimefactory_write() or mrmimefactory_write_file(). */
 	MMAPString*  m_out;
+	struct mailmime* m_out_mime;
 	int          m_out_encrypted;
 
 	/* private */
 	mrmailbox_t* m_mailbox;
+	char*        m_out_text;  /* referenced by m_out_mime */
+	char*        m_out_text2;
 
 } mrmimefactory_t;
 
@@ -87,6 +95,8 @@ void        mrmimefactory_empty             (mrmimefactory_t*);
 int         mrmimefactory_load_msg          (mrmimefactory_t*, uint32_t msg_id);
 int         mrmimefactory_load_mdn          (mrmimefactory_t*, uint32_t msg_id);
 int         mrmimefactory_render            (mrmimefactory_t*, int encrypt_to_self);
+int         mrmimefactory_write             (mrmimefactory_t*, int (*do_write)(void*, const char*, size_t), void* data);
+int         mrmimefactory_write_file        (mrmimefactory_t*, const char* pathNfilename);
 
 
 #ifdef __cplusplus
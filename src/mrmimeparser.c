@@ -32,6 +32,7 @@
 #include "mrmimefactory.h"
 #include "mrsimplify.h"
 #include "mrtools.h"
+#include "mrblob.h"
 
 
 /*******************************************************************************
@@ -579,6 +580,7 @@ mrmimeparser_t* mrmimeparser_new(const char* blobdir, mrmailbox_t* mailbox)
 	ths->m_parts   = carray_new(16);
 	ths->m_blobdir = blobdir; /* no need to copy the string at the moment */
 	ths->m_reports = carray_new(16);
+	ths->m_stored_files = carray_new(16);
 
 	return ths;
 }
@@ -593,6 +595,7 @@ void mrmimeparser_unref(mrmimeparser_t* ths)
 	mrmimeparser_empty(ths);
 	if( ths->m_parts )   { carray_free(ths->m_parts); }
 	if( ths->m_reports ) { carray_free(ths->m_reports); }
+	if( ths->m_stored_files ) { carray_free(ths->m_stored_files); }
 	free(ths);
 }
 
@@ -633,6 +636,18 @@ void mrmimeparser_empty(mrmimeparser_t* ths)
 		carray_set_size(ths->m_reports, 0);
 	}
 
+	if( ths->m_stored_files )
+	{
+		/* the messages referencing the files are in the database now (or will never be), see mrblob_delete_unused__() */
+		int i, cnt = carray_count(ths->m_stored_files);
+		for( i = 0; i < cnt; i++ ) {
+			char* pathNfilename = (char*)carray_get(ths->m_stored_files, i);
+			mrblob_unpin(ths->m_mailbox, pathNfilename);
+			free(pathNfilename);
+		}
+		carray_set_size(ths->m_stored_files, 0);
+	}
+
 	ths->m_decrypted_and_validated = 0;
 	ths->m_decrypted_with_validation_errors = 0;
 	ths->m_decrypting_failed = 0;
@@ -788,6 +803,21 @@ static char* get_file_disposition_suffix_(struct mailmime_disposition* file_disp
 #endif
 
 
+static int get_transfer_encoding(struct mailmime* mime)
+{
+	if( mime->mm_mime_fields != NULL ) {
+		clistiter* cur;
+		for( cur = clist_begin(mime->mm_mime_fields->fld_list); cur != NULL; cur = clist_next(cur) ) {
+			struct mailmime_field* field = (struct mailmime_field*)clist_content(cur);
+			if( field && field->fld_type == MAILMIME_FIELD_TRANSFER_ENCODING && field->fld_data.fld_encoding ) {
+				return field->fld_data.fld_encoding->enc_type;
+			}
+		}
+	}
+	return MAILMIME_MECHANISM_BINARY;
+}
+
+
 int mr_mime_transfer_decode(struct mailmime* mime, const char** ret_decoded_data, size_t* ret_decoded_data_bytes, char** ret_to_mmap_string_unref)
 {
 	int                   mime_transfer_encoding = MAILMIME_MECHANISM_BINARY;
@@ -801,16 +831,7 @@ int mr_mime_transfer_decode(struct mailmime* mime, const char** ret_decoded_data
 		return 0;
 	}
 
-	if( mime->mm_mime_fields != NULL ) {
-		clistiter* cur;
-		for( cur = clist_begin(mime->mm_mime_fields->fld_list); cur != NULL; cur = clist_next(cur) ) {
-			struct mailmime_field* field = (struct mailmime_field*)clist_content(cur);
-			if( field && field->fld_type == MAILMIME_FIELD_TRANSFER_ENCODING && field->fld_data.fld_encoding ) {
-				mime_transfer_encoding = field->fld_data.fld_encoding->enc_type;
-				break;
-			}
-		}
-	}
+	mime_transfer_encoding = get_transfer_encoding(mime);
 
 	/* regard `Content-Transfer-Encoding:` */
 	if( mime_transfer_encoding == MAILMIME_MECHANISM_7BIT
@@ -843,6 +864,140 @@ int mr_mime_transfer_decode(struct mailmime* mime, const char** ret_decoded_data
 }
 
 
+#define MR_DECODE_BUF_SIZE  (64*1024)
+
+
+static int base64_value(unsigned char c)
+{
+	if( c>='A' && c<='Z' ) { return c-'A'; }
+	if( c>='a' && c<='z' ) { return c-'a'+26; }
+	if( c>='0' && c<='9' ) { return c-'0'+52; }
+	if( c=='+' ) { return 62; }
+	if( c=='/' ) { return 63; }
+	return -1; /* line breaks and other characters are ignored */
+}
+
+
+int mr_mime_transfer_decode_to_file(struct mailmime* mime, const char* pathNfilename, size_t* ret_bytes, mrmailbox_t* log)
+{
+	/* Same as mr_mime_transfer_decode(), however, the data are decoded directly to the given file in small pieces,
+	so there is never a decoded copy of an attachment on the heap. */
+	int                   success = 0, mime_transfer_encoding;
+	struct mailmime_data* mime_data;
+	const char*           data;
+	size_t                data_bytes, i, written = 0;
+	FILE*                 f = NULL;
+	unsigned char*        buf = NULL;
+
+	if( mime == NULL || pathNfilename == NULL || ret_bytes == NULL
+	 || (mime_data=mime->mm_data.mm_single)==NULL
+	 || (data=mime_data->dt_data.dt_text.dt_data)==NULL
+	 || (data_bytes=mime_data->dt_data.dt_text.dt_length)<=0 ) {
+		goto cleanup;
+	}
+
+	*ret_bytes = 0;
+	mime_transfer_encoding = get_transfer_encoding(mime);
+
+	if( mime_transfer_encoding == MAILMIME_MECHANISM_7BIT
+	 || mime_transfer_encoding == MAILMIME_MECHANISM_8BIT
+	 || mime_transfer_encoding == MAILMIME_MECHANISM_BINARY )
+	{
+		if( !mr_write_file(pathNfilename, data, data_bytes, log) ) {
+			goto cleanup;
+		}
+		*ret_bytes = data_bytes;
+		success = 1;
+		goto cleanup;
+	}
+
+	if( (f=fopen(pathNfilename, "wb"))==NULL ) {
+		mrmailbox_log_warning(log, 0, "Cannot open \"%s\" for writing.", pathNfilename);
+		goto cleanup;
+	}
+
+	if( mime_transfer_encoding == MAILMIME_MECHANISM_BASE64 )
+	{
+		uint32_t bits = 0;
+		int      bit_cnt = 0, v;
+		size_t   buf_bytes = 0;
+
+		if( (buf=malloc(MR_DECODE_BUF_SIZE))==NULL ) {
+			exit(50);
+		}
+
+		for( i = 0; i < data_bytes && data[i] != '='; i++ ) {
+			if( (v=base64_value((unsigned char)data[i])) >= 0 ) {
+				bits = (bits<<6) | v;
+				bit_cnt += 6;
+				if( bit_cnt >= 8 ) {
+					bit_cnt -= 8;
+					buf[buf_bytes++] = (unsigned char)(bits>>bit_cnt);
+					if( buf_bytes == MR_DECODE_BUF_SIZE ) {
+						if( fwrite(buf, 1, buf_bytes, f)!=buf_bytes ) { goto cleanup; }
+						written += buf_bytes;
+						buf_bytes = 0;
+					}
+				}
+			}
+		}
+
+		if( buf_bytes > 0 ) {
+			if( fwrite(buf, 1, buf_bytes, f)!=buf_bytes ) { goto cleanup; }
+			written += buf_bytes;
+		}
+	}
+	else
+	{
+		/* quoted-printable and others: let libEtPan decode line-aligned pieces, no encoded sequence spans a line break */
+		size_t start = 0;
+		while( start < data_bytes ) {
+			size_t end = start + MR_DECODE_BUF_SIZE, index = start, decoded_bytes = 0;
+			char*  decoded = NULL;
+			if( end >= data_bytes ) {
+				end = data_bytes;
+			}
+			else {
+				while( end < data_bytes && data[end-1] != '\n' ) {
+					end++;
+				}
+			}
+
+			if( mailmime_part_parse(data, end, &index, mime_transfer_encoding, &decoded, &decoded_bytes) != MAILIMF_NO_ERROR ) {
+				goto cleanup;
+			}
+			if( decoded ) {
+				size_t w = fwrite(decoded, 1, decoded_bytes, f);
+				mmap_string_unref(decoded);
+				if( w != decoded_bytes ) { goto cleanup; }
+				written += decoded_bytes;
+			}
+			start = end;
+		}
+	}
+
+	if( written <= 0 ) {
+		goto cleanup; /* no error - but no data */
+	}
+
+	*ret_bytes = written;
+	success = 1;
+
+cleanup:
+	if( f ) {
+		if( fclose(f)!=0 ) {
+			success = 0;
+		}
+		if( !success ) {
+			mrmailbox_log_warning(log, 0, "Cannot decode attachment to \"%s\".", pathNfilename);
+			mr_delete_file(pathNfilename, log);
+		}
+	}
+	free(buf);
+	return success;
+}
+
+
 static int mrmimeparser_add_single_part_if_known(mrmimeparser_t* ths, struct mailmime* mime)
 {
 	mrmimepart_t*                part = mrmimepart_new();
@@ -851,6 +1006,7 @@ static int mrmimeparser_add_single_part_if_known(mrmimeparser_t* ths, struct mai
 	int                          mime_type;
 	struct mailmime_data*        mime_data;
 	char*                        pathNfilename = NULL;
+	char*                        tmp_pathNfilename = NULL;
 	char*                        file_suffix = NULL, *desired_filename = NULL;
 	int                          msg_type;
 
@@ -876,16 +1032,16 @@ static int mrmimeparser_add_single_part_if_known(mrmimeparser_t* ths, struct mai
 	}
 
 
-	/* regard `Content-Transfer-Encoding:` */
-	if( !mr_mime_transfer_decode(mime, &decoded_data, &decoded_data_bytes, &transfer_decoding_buffer) ) {
-		goto cleanup; /* no always error - but no data */
-	}
-
 	switch( mime_type )
 	{
 		case MR_MIMETYPE_TEXT_PLAIN:
 		case MR_MIMETYPE_TEXT_HTML:
 			{
+				/* regard `Content-Transfer-Encoding:` */
+				if( !mr_mime_transfer_decode(mime, &decoded_data, &decoded_data_bytes, &transfer_decoding_buffer) ) {
+					goto cleanup; /* no always error - but no data */
+				}
+
 				if( simplifier==NULL ) {
 					simplifier = mrsimplify_new();
 					if( simplifier==NULL ) {
@@ -968,36 +1124,50 @@ static int mrmimeparser_add_single_part_if_known(mrmimeparser_t* ths, struct mai
 				}
 
 				mr_replace_bad_utf8_chars(desired_filename);
+				mr_validate_filename(desired_filename);
 
-				/* create a free file name to use */
-				if( (pathNfilename=mr_get_fine_pathNfilename(ths->m_blobdir, desired_filename)) == NULL ) {
+				/* decode data to a temporary file, regarding `Content-Transfer-Encoding:`, and move it to the blob store;
+				the file is named after its content there, the original name is kept in MRP_FILENAME, see mrblob.h */
+				if( (tmp_pathNfilename=mrblob_get_temp_pathNfilename(ths->m_blobdir, ths->m_mailbox)) == NULL ) {
 					goto cleanup;
 				}
 
-				/* copy data to file */
-                if( mr_write_file(pathNfilename, decoded_data, decoded_data_bytes, ths->m_mailbox)==0 ) {
+				if( !mr_mime_transfer_decode_to_file(mime, tmp_pathNfilename, &decoded_data_bytes, ths->m_mailbox) ) {
+					goto cleanup; /* no always error - but no data */
+				}
+
+				if( (pathNfilename=mrblob_store_file(ths->m_blobdir, tmp_pathNfilename, desired_filename, 1/*pin*/, ths->m_mailbox)) == NULL ) {
 					goto cleanup;
-                }
+				}
+				free(tmp_pathNfilename);
+				tmp_pathNfilename = NULL; /* moved or deleted by mrblob_store_file() */
+				carray_add(ths->m_stored_files, safe_strdup(pathNfilename), NULL);
 
 				part->m_type  = msg_type;
 				part->m_bytes = decoded_data_bytes;
 				mrparam_set(part->m_param, MRP_FILE, pathNfilename);
+				mrparam_set(part->m_param, MRP_FILENAME, desired_filename);
 				if( MR_MSG_MAKE_FILENAME_SEARCHABLE(msg_type) ) {
-					part->m_msg = mr_get_filename(pathNfilename);
+					part->m_msg = safe_strdup(desired_filename);
 				}
 				else if( MR_MSG_MAKE_SUFFIX_SEARCHABLE(msg_type) ) {
-					part->m_msg = mr_get_filesuffix_lc(pathNfilename);
+					part->m_msg = mr_get_filesuffix_lc(desired_filename);
 				}
 
 				if( mime_type == MR_MIMETYPE_IMAGE ) {
 					uint32_t w = 0, h = 0;
-					if( mr_get_filemeta(decoded_data, decoded_data_bytes, &w, &h) ) {
-						mrparam_set_int(part->m_param, MRP_WIDTH, w);
-						mrparam_set_int(part->m_param, MRP_HEIGHT, h);
+					void*    mapped = NULL;
+					size_t   mapped_bytes = 0;
+					if( mr_mmap_file(pathNfilename, &mapped, &mapped_bytes, ths->m_mailbox) ) {
+						if( mr_get_filemeta(mapped, mapped_bytes, &w, &h) ) {
+							mrparam_set_int(part->m_param, MRP_WIDTH, w);
+							mrparam_set_int(part->m_param, MRP_HEIGHT, h);
+						}
+						mr_munmap_file(mapped, mapped_bytes);
 					}
 				}
 
-				/* split author/title from the original filename (if we do it from the real filename, we'll also get numbers appended by mr_get_fine_pathNfilename()) */
+				/* split author/title from the original filename (the real filename is the hash of the content) */
 				if( msg_type == MR_MSG_AUDIO ) {
 					char* author = NULL, *title = NULL;
 					mr_get_authorNtitle_from_filename(desired_filename, &author, &title);
@@ -1029,6 +1199,13 @@ cleanup:
 		mmap_string_unref(transfer_decoding_buffer);
 	}
 
+	if( tmp_pathNfilename ) {
+		if( mr_file_exist(tmp_pathNfilename) ) {
+			mr_delete_file(tmp_pathNfilename, ths->m_mailbox); /* not deleted by mr_mime_transfer_decode_to_file() on all errors */
+		}
+		free(tmp_pathNfilename);
+	}
+
 	free(pathNfilename);
 	free(file_suffix);
 	free(desired_filename);
@@ -71,6 +71,8 @@ typedef struct mrmimeparser_t
 
 	carray*                m_reports; /* array of mailmime objects */
 
+	carray*                m_stored_files; /* files stored by mrblob_store_file(), they are pinned until the parser is emptied */
+
 } mrmimeparser_t;
 
 
@@ -99,6 +101,7 @@ struct mailimf_field*          mr_find_mailimf_field (struct mailimf_fields*, in
 struct mailimf_optional_field* mr_find_mailimf_field2(struct mailimf_fields*, const char* wanted_fld_name);
 struct mailmime_parameter*     mr_find_ct_parameter  (struct mailmime*, const char* name);
 int                            mr_mime_transfer_decode(struct mailmime*, const char** ret_decoded_data, size_t* ret_decoded_data_bytes, char** ret_to_mmap_string_unref);
+int                            mr_mime_transfer_decode_to_file(struct mailmime*, const char* pathNfilename, size_t* ret_bytes, mrmailbox_t* log);
 
 
 #ifdef MR_USE_MIME_DEBUG
@@ -35,6 +35,7 @@
 #include "mrjob.h"
 #include "mrpgp.h"
 #include "mrmimefactory.h"
+#include "mrblob.h"
 
 
 /*******************************************************************************
@@ -72,14 +73,24 @@ int mrmsg_set_from_stmt__(mrmsg_t* ths, sqlite3_stmt* row, int row_offset) /* fi
 
 
 int mrmsg_load_from_db__(mrmsg_t* ths, mrmailbox_t* mailbox, uint32_t id)
+{
+	if( mailbox==NULL ) {
+		return 0;
+	}
+
+	return mrmsg_load_from_sql__(ths, mailbox, mailbox->m_sql, id);
+}
+
+
+int mrmsg_load_from_sql__(mrmsg_t* ths, mrmailbox_t* mailbox, mrsqlite3_t* sql, uint32_t id) /* sql may be a reader, see mrsqlite3_lock_reader() */
 {
 	sqlite3_stmt* stmt;
 
-	if( ths==NULL || mailbox==NULL || mailbox->m_sql==NULL ) {
+	if( ths==NULL || mailbox==NULL || sql==NULL ) {
 		return 0;
 	}
 
-	stmt = mrsqlite3_predefine__(mailbox->m_sql, SELECT_ircftttstpb_FROM_msg_WHERE_i,
+	stmt = mrsqlite3_predefine__(sql, SELECT_ircftttstpb_FROM_msg_WHERE_i,
 		"SELECT " MR_MSG_FIELDS " FROM msgs m WHERE m.id=?;");
 	sqlite3_bind_int(stmt, 1, id);
 
@@ -298,21 +309,20 @@ void mrmsg_empty(mrmsg_t* ths)
 mrmsg_t* mrmailbox_get_msg(mrmailbox_t* ths, uint32_t id)
 {
 	int success = 0;
-	int db_locked = 0;
+	mrsqlite3_t* reader = NULL;
 	mrmsg_t* obj = mrmsg_new();
 
-	mrsqlite3_lock(ths->m_sql);
-	db_locked = 1;
+	reader = mrsqlite3_lock_reader(ths->m_sql);
 
-		if( !mrmsg_load_from_db__(obj, ths, id) ) {
+		if( !mrmsg_load_from_sql__(obj, ths, reader, id) ) {
 			goto cleanup;
 		}
 
 		success = 1;
 
 cleanup:
-	if( db_locked ) {
-		mrsqlite3_unlock(ths->m_sql);
+	if( reader ) {
+		mrsqlite3_unlock(reader);
 	}
 
 	if( success ) {
@@ -325,6 +335,82 @@ cleanup:
 }
 
 
+int mrmailbox_get_msgs(mrmailbox_t* ths, const uint32_t* msg_ids, int msg_cnt, mrmsg_t** ret_msgs)
+{
+	/* load the messages for a window of IDs using one lock and one statement per MR_BULK_LOAD_CHUNK IDs,
+	instead of calling mrmailbox_get_msg() for each ID */
+	int           loaded_cnt = 0, first, last, i;
+	mrsqlite3_t*  reader = NULL;
+	mridpos_t*    sorted = NULL;
+	char*         idsstr = NULL, *q3 = NULL;
+	sqlite3_stmt* stmt = NULL;
+	uint32_t      id;
+
+	if( ths==NULL || msg_ids==NULL || msg_cnt<=0 || ret_msgs==NULL ) {
+		return 0;
+	}
+
+	memset(ret_msgs, 0, sizeof(mrmsg_t*)*msg_cnt);
+
+	sorted = mr_sort_ids(msg_ids, msg_cnt);
+	for( first = 0; first < msg_cnt && sorted[first].m_id <= MR_MSG_ID_LAST_SPECIAL; first++ ) {
+		; /* skip markers as MR_MSG_ID_DAYMARKER */
+	}
+
+	reader = mrsqlite3_lock_reader(ths->m_sql);
+
+		for( ; first < msg_cnt; first = last )
+		{
+			last = first+MR_BULK_LOAD_CHUNK < msg_cnt? first+MR_BULK_LOAD_CHUNK : msg_cnt;
+
+			idsstr = mr_idpos_to_string(&sorted[first], last-first);
+			q3 = sqlite3_mprintf("SELECT " MR_MSG_FIELDS " FROM msgs m WHERE m.id IN(%s) ORDER BY m.id;", idsstr);
+			stmt = mrsqlite3_prepare_v2_(reader, q3);
+			if( stmt==NULL ) {
+				goto cleanup;
+			}
+
+			i = first;
+			while( sqlite3_step(stmt)==SQLITE_ROW )
+			{
+				id = (uint32_t)sqlite3_column_int(stmt, 0);
+				while( i < last && sorted[i].m_id < id ) {
+					i++;
+				}
+				while( i < last && sorted[i].m_id == id ) { /* the same ID may be requested several times */
+					mrmsg_t* msg = mrmsg_new();
+					mrmsg_set_from_stmt__(msg, stmt, 0);
+					msg->m_mailbox = ths;
+					ret_msgs[sorted[i].m_pos] = msg;
+					loaded_cnt++;
+					i++;
+				}
+			}
+
+			sqlite3_finalize(stmt);
+			stmt = NULL;
+			sqlite3_free(q3);
+			q3 = NULL;
+			free(idsstr);
+			idsstr = NULL;
+		}
+
+cleanup:
+	if( reader ) {
+		mrsqlite3_unlock(reader);
+	}
+	if( stmt ) {
+		sqlite3_finalize(stmt);
+	}
+	if( q3 ) {
+		sqlite3_free(q3);
+	}
+	free(idsstr);
+	free(sorted);
+	return loaded_cnt;
+}
+
+
 char* mrmailbox_get_msg_info(mrmailbox_t* mailbox, uint32_t msg_id)
 {
 	mrstrbuilder_t ret;
@@ -497,8 +583,9 @@ char* mrmsg_get_summarytext(mrmsg_t* msg, int approx_characters)
 
 char* mrmsg_get_summarytext_by_raw(int type, const char* text, mrparam_t* param, int approx_characters)
 {
-	char* ret = NULL;
-	char* pathNfilename = NULL, *label = NULL, *value = NULL;
+	char*       ret = NULL;
+	char*       label = NULL, *value = NULL;
+	const char* pathNfilename = NULL; /* borrowed from param */
 
 	switch( type ) {
 		case MR_MSG_IMAGE:
@@ -519,7 +606,7 @@ char* mrmsg_get_summarytext_by_raw(int type, const char* text, mrparam_t* param,
 
 		case MR_MSG_AUDIO:
 			if( (value=mrparam_get(param, MRP_TRACKNAME, NULL))==NULL ) { /* although we send files with "author - title" in the filename, existing files may follow other conventions, so this lookup is neccessary */
-				pathNfilename = mrparam_get(param, MRP_FILE, "ErrFilename");
+				pathNfilename = mrparam_peek(param, MRP_FILENAME, mrparam_peek(param, MRP_FILE, "ErrFilename"));
 				mr_get_authorNtitle_from_filename(pathNfilename, NULL, &value);
 			}
 			label = mrstock_str(MR_STR_AUDIO);
@@ -527,7 +614,7 @@ char* mrmsg_get_summarytext_by_raw(int type, const char* text, mrparam_t* param,
 			break;
 
 		case MR_MSG_FILE:
-			pathNfilename = mrparam_get(param, MRP_FILE, "ErrFilename");
+			pathNfilename = mrparam_peek(param, MRP_FILENAME, mrparam_peek(param, MRP_FILE, "ErrFilename"));
 			value = mr_get_filename(pathNfilename);
 			label = mrstock_str(MR_STR_FILE);
 			ret = mr_mprintf("%s: %s", label, value);
@@ -542,7 +629,6 @@ char* mrmsg_get_summarytext_by_raw(int type, const char* text, mrparam_t* param,
 	}
 
 	/* cleanup */
-	free(pathNfilename);
 	free(label);
 	free(value);
 	if( ret == NULL ) {
@@ -560,6 +646,11 @@ char* mrmsg_get_filename(mrmsg_t* msg)
 		goto cleanup;
 	}
 
+	/* files in the blob store are named after their content, the original name is kept separately */
+	if( (ret=mrparam_get(msg->m_param, MRP_FILENAME, NULL)) != NULL ) {
+		goto cleanup;
+	}
+
 	pathNfilename = mrparam_get(msg->m_param, MRP_FILE, NULL);
 	if( pathNfilename == NULL ) {
 		goto cleanup;
@@ -609,8 +700,8 @@ mrpoortext_t* mrmsg_get_mediainfo(mrmsg_t* msg)
 		free(ret->m_text1); ret->m_text1 = NULL;
 		free(ret->m_text2); ret->m_text2 = NULL;
 
-		pathNfilename = mrparam_get(msg->m_param, MRP_FILE, NULL);
-		if( pathNfilename == NULL ) {
+		if( (pathNfilename=mrparam_get(msg->m_param, MRP_FILENAME, NULL)) == NULL
+		 && (pathNfilename=mrparam_get(msg->m_param, MRP_FILE, NULL)) == NULL ) {
 			goto cleanup;
 		}
 		mr_get_authorNtitle_from_filename(pathNfilename, &ret->m_text1, &ret->m_text2);
@@ -666,7 +757,7 @@ void mrmsg_save_param_to_disk__(mrmsg_t* msg)
 
 	sqlite3_stmt* stmt = mrsqlite3_predefine__(msg->m_mailbox->m_sql, UPDATE_msgs_SET_param_WHERE_id,
 		"UPDATE msgs SET param=? WHERE id=?;");
-	sqlite3_bind_text(stmt, 1, msg->m_param->m_packed, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 1, mrparam_get_packed(msg->m_param), -1, SQLITE_STATIC);
 	sqlite3_bind_int (stmt, 2, msg->m_id);
 	sqlite3_step(stmt);
 }
@@ -689,41 +780,148 @@ void mrmsg_save_param_to_disk(mrmsg_t* msg)
  ******************************************************************************/
 
 
-void mrmailbox_delete_msg_on_imap(mrmailbox_t* mailbox, mrjob_t* job)
+static void delete_side_files(mrmailbox_t* mailbox, mrmsg_t* msg, const char* pathNfilename)
 {
-	int      locked = 0, delete_from_server = 1;
-	mrmsg_t* msg = mrmsg_new();
+	char* increation_file = mr_mprintf("%s.increation", pathNfilename);
+	mr_delete_file(increation_file, mailbox);
+	free(increation_file);
+
+	char* filenameOnly = mr_get_filename(pathNfilename);
+	if( msg->m_type==MR_MSG_VOICE ) {
+		char* waveform_file = mr_mprintf("%s/%s.waveform", mailbox->m_blobdir, filenameOnly);
+		mr_delete_file(waveform_file, mailbox);
+		free(waveform_file);
+	}
+	else if( msg->m_type==MR_MSG_VIDEO ) {
+		char* preview_file = mr_mprintf("%s/%s-preview.jpg", mailbox->m_blobdir, filenameOnly);
+		mr_delete_file(preview_file, mailbox);
+		free(preview_file);
+	}
+	free(filenameOnly);
+}
+
+
+static void delete_msg_from_db__(mrmailbox_t* mailbox, mrmsg_t* msg)
+{
+	sqlite3_stmt* stmt = mrsqlite3_predefine__(mailbox->m_sql, DELETE_FROM_msgs_WHERE_id, "DELETE FROM msgs WHERE id=?;");
+	sqlite3_bind_int(stmt, 1, msg->m_id);
+	sqlite3_step(stmt);
+
+	char* pathNfilename = mrparam_get(msg->m_param, MRP_FILE, NULL);
+	if( pathNfilename ) {
+		const char* blob_name = mrblob_get_name(mailbox->m_blobdir, pathNfilename);
+		if( blob_name )
+		{
+			/* the references to files in the blob store are counted by the database, see mrblob.h; the file itself is
+			deleted by mrblob_delete_unused__(), the files the UI has created next to it by delete_side_files() */
+			sqlite3_stmt* stmt2 = mrsqlite3_prepare_v2_(mailbox->m_sql, "SELECT refs FROM blobs WHERE name=?;");
+			sqlite3_bind_text(stmt2, 1, blob_name, -1, SQLITE_STATIC);
+			int file_used_by_other_msgs = (sqlite3_step(stmt2)==SQLITE_ROW && sqlite3_column_int(stmt2, 0)>0)? 1 : 0;
+			sqlite3_finalize(stmt2);
+
+			if( !file_used_by_other_msgs ) {
+				mrblob_delete_unused__(mailbox, blob_name);
+				delete_side_files(mailbox, msg, pathNfilename);
+			}
+		}
+		else if( strncmp(mailbox->m_blobdir, pathNfilename, strlen(mailbox->m_blobdir))==0 )
+		{
+			char* strLikeFilename = mr_mprintf("%%f=%s%%", pathNfilename);
+			sqlite3_stmt* stmt2 = mrsqlite3_prepare_v2_(mailbox->m_sql, "SELECT id FROM msgs WHERE type!=? AND param LIKE ?;"); /* if this gets too slow, an index over "type" should help. */
+			sqlite3_bind_int (stmt2, 1, MR_MSG_TEXT);
+			sqlite3_bind_text(stmt2, 2, strLikeFilename, -1, SQLITE_STATIC);
+			int file_used_by_other_msgs = (sqlite3_step(stmt2)==SQLITE_ROW)? 1 : 0;
+			free(strLikeFilename);
+			sqlite3_finalize(stmt2);
+
+			if( !file_used_by_other_msgs )
+			{
+				mr_delete_file(pathNfilename, mailbox);
+				delete_side_files(mailbox, msg, pathNfilename);
+			}
+		}
+		free(pathNfilename);
+	}
+}
+
+
+void mrmailbox_delete_msgs_on_imap(mrmailbox_t* mailbox, mrjob_t** jobs, int job_cnt)
+{
+	/* the jobs are coalesced by the job thread, so all messages are deleted from the server using a few commands */
+	int            i, j, store_cnt = 0, same_mid_cnt, is_last_part;
+	mrmsg_t**      msgs = NULL;
+	mrimapstore_t* stores = NULL;
+	int*           store_job = NULL;
+
+	if( (msgs=calloc(job_cnt, sizeof(mrmsg_t*)))==NULL
+	 || (stores=calloc(job_cnt, sizeof(mrimapstore_t)))==NULL
+	 || (store_job=calloc(job_cnt, sizeof(int)))==NULL ) {
+		exit(53);
+	}
 
 	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
 
-		if( !mrmsg_load_from_db__(msg, mailbox, job->m_foreign_id) ) {
-			goto cleanup;
+		for( i = 0; i < job_cnt; i++ )
+		{
+			msgs[i] = mrmsg_new();
+			if( !mrmsg_load_from_db__(msgs[i], mailbox, jobs[i]->m_foreign_id) ) {
+				mrmsg_unref(msgs[i]);
+				msgs[i] = NULL;
+			}
 		}
 
-		if( mrmailbox_rfc724_mid_cnt__(mailbox, msg->m_rfc724_mid) != 1 ) {
-			mrmailbox_log_info(mailbox, 0, "The message is deleted from the server when all message are deleted.");
-			delete_from_server = 0;
+		for( i = 0; i < job_cnt; i++ )
+		{
+			if( msgs[i]==NULL ) {
+				continue;
+			}
+
+			/* if this is the last existing part of the message, we delete the message from the server;
+			other parts deleted by the same batch are handled as if the jobs were executed one after another */
+			same_mid_cnt = 0;
+			is_last_part = 1;
+			for( j = 0; j < job_cnt; j++ ) {
+				if( msgs[j] && strcmp(msgs[j]->m_rfc724_mid, msgs[i]->m_rfc724_mid)==0 ) {
+					same_mid_cnt++;
+					if( j > i ) {
+						is_last_part = 0;
+					}
+				}
+			}
+
+			if( mrmailbox_rfc724_mid_cnt__(mailbox, msgs[i]->m_rfc724_mid) != same_mid_cnt || !is_last_part ) {
+				mrmailbox_log_info(mailbox, 0, "The message is deleted from the server when all message are deleted.");
+				continue;
+			}
+
+			stores[store_cnt].m_folder     = msgs[i]->m_server_folder;
+			stores[store_cnt].m_uid        = msgs[i]->m_server_uid;
+			stores[store_cnt].m_rfc724_mid = msgs[i]->m_rfc724_mid;
+			store_job[store_cnt]       = i;
+			store_cnt++;
 		}
 
 	mrsqlite3_unlock(mailbox->m_sql);
-	locked = 0;
 
-	/* if this is the last existing part of the message, we delete the message from the server */
-	if( delete_from_server )
+	if( store_cnt > 0 )
 	{
+		int imap_ok = 1;
+
 		if( !mrimap_is_connected(mailbox->m_imap) ) {
 			mrmailbox_connect_to_imap(mailbox, NULL);
 			if( !mrimap_is_connected(mailbox->m_imap) ) {
-				mrjob_try_again_later(job, MR_STANDARD_DELAY);
-				goto cleanup;
+				imap_ok = 0;
 			}
 		}
 
-		if( !mrimap_delete_msg(mailbox->m_imap, msg->m_rfc724_mid, msg->m_server_folder, msg->m_server_uid) )
-		{
-			mrjob_try_again_later(job, MR_STANDARD_DELAY);
-			goto cleanup;
+		if( imap_ok && !mrimap_delete_msgs(mailbox->m_imap, stores, store_cnt) ) {
+			imap_ok = 0;
+		}
+
+		if( !imap_ok ) {
+			for( i = 0; i < store_cnt; i++ ) {
+				mrjob_try_again_later(jobs[store_job[i]], MR_STANDARD_DELAY);
+			}
 		}
 	}
 
@@ -732,57 +930,23 @@ void mrmailbox_delete_msg_on_imap(mrmailbox_t* mailbox, mrjob_t* job)
 	- or if there are other parts of the messages in the database (in this case we have not deleted if from the server)
 	(As long as the message is not removed from the IMAP-server, we need at least one database entry to avoid a re-download) */
 	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
-
-		sqlite3_stmt* stmt = mrsqlite3_predefine__(mailbox->m_sql, DELETE_FROM_msgs_WHERE_id, "DELETE FROM msgs WHERE id=?;");
-		sqlite3_bind_int(stmt, 1, msg->m_id);
-		sqlite3_step(stmt);
-
-		char* pathNfilename = mrparam_get(msg->m_param, MRP_FILE, NULL);
-		if( pathNfilename ) {
-			if( strncmp(mailbox->m_blobdir, pathNfilename, strlen(mailbox->m_blobdir))==0 )
-			{
-				char* strLikeFilename = mr_mprintf("%%f=%s%%", pathNfilename);
-				sqlite3_stmt* stmt2 = mrsqlite3_prepare_v2_(mailbox->m_sql, "SELECT id FROM msgs WHERE type!=? AND param LIKE ?;"); /* if this gets too slow, an index over "type" should help. */
-				sqlite3_bind_int (stmt2, 1, MR_MSG_TEXT);
-				sqlite3_bind_text(stmt2, 2, strLikeFilename, -1, SQLITE_STATIC);
-				int file_used_by_other_msgs = (sqlite3_step(stmt2)==SQLITE_ROW)? 1 : 0;
-				free(strLikeFilename);
-				sqlite3_finalize(stmt2);
-
-				if( !file_used_by_other_msgs )
-				{
-					mr_delete_file(pathNfilename, mailbox);
-
-					char* increation_file = mr_mprintf("%s.increation", pathNfilename);
-					mr_delete_file(increation_file, mailbox);
-					free(increation_file);
+	mrsqlite3_begin_transaction__(mailbox->m_sql);
 
-					char* filenameOnly = mr_get_filename(pathNfilename);
-					if( msg->m_type==MR_MSG_VOICE ) {
-						char* waveform_file = mr_mprintf("%s/%s.waveform", mailbox->m_blobdir, filenameOnly);
-						mr_delete_file(waveform_file, mailbox);
-						free(waveform_file);
-					}
-					else if( msg->m_type==MR_MSG_VIDEO ) {
-						char* preview_file = mr_mprintf("%s/%s-preview.jpg", mailbox->m_blobdir, filenameOnly);
-						mr_delete_file(preview_file, mailbox);
-						free(preview_file);
-					}
-					free(filenameOnly);
-				}
+		for( i = 0; i < job_cnt; i++ ) {
+			if( msgs[i] && jobs[i]->m_start_again_at==0 ) {
+				delete_msg_from_db__(mailbox, msgs[i]);
 			}
-			free(pathNfilename);
 		}
 
+	mrsqlite3_commit__(mailbox->m_sql);
 	mrsqlite3_unlock(mailbox->m_sql);
-	locked = 0;
 
-cleanup:
-	if( locked ) {
-		mrsqlite3_unlock(mailbox->m_sql);
+	for( i = 0; i < job_cnt; i++ ) {
+		mrmsg_unref(msgs[i]);
 	}
-	mrmsg_unref(msg);
+	free(msgs);
+	free(stores);
+	free(store_job);
 }
 
 
@@ -800,7 +964,7 @@ int mrmailbox_delete_msgs(mrmailbox_t* ths, const uint32_t* msg_ids, int msg_cnt
 		for( i = 0; i < msg_cnt; i++ )
 		{
 			mrmailbox_update_msg_chat_id__(ths, msg_ids[i], MR_CHAT_ID_TRASH);
-			mrjob_add__(ths, MRJ_DELETE_MSG_ON_IMAP, msg_ids[i], NULL); /* results in a call to mrmailbox_delete_msg_on_imap() */
+			mrjob_add__(ths, MRJ_DELETE_MSG_ON_IMAP, msg_ids[i], NULL); /* results in a call to mrmailbox_delete_msgs_on_imap() */
 		}
 
 	mrsqlite3_commit__(ths->m_sql);
@@ -836,7 +1000,7 @@ int mrmailbox_forward_msgs(mrmailbox_t* mailbox, const uint32_t* msg_ids_unsorte
 			goto cleanup;
 		}
 
-		curr_timestamp = mr_create_smeared_timestamps__(msg_cnt);
+		curr_timestamp = mr_create_smeared_timestamps__(mailbox, msg_cnt);
 
 		idsstr = mr_arr_to_string(msg_ids_unsorted, msg_cnt);
 		q3 = sqlite3_mprintf("SELECT id FROM msgs WHERE id IN(%s) ORDER BY timestamp,id", idsstr);
@@ -885,101 +1049,144 @@ cleanup:
  ******************************************************************************/
 
 
-void mrmailbox_markseen_msg_on_imap(mrmailbox_t* mailbox, mrjob_t* job)
+void mrmailbox_markseen_msgs_on_imap(mrmailbox_t* mailbox, mrjob_t** jobs, int job_cnt)
 {
-	int      locked = 0;
-	mrmsg_t* msg = mrmsg_new();
-	char*    new_server_folder = NULL;
-	uint32_t new_server_uid = 0;
-	int      in_ms_flags = 0, out_ms_flags = 0;
+	/* the jobs are coalesced by the job thread, so all messages are marked as seen and moved using a few commands */
+	int            i, mdns_enabled, update_db = 0;
+	mrmsg_t**      msgs = NULL;
+	mrimapstore_t* stores = NULL;
+
+	if( (msgs=calloc(job_cnt, sizeof(mrmsg_t*)))==NULL
+	 || (stores=calloc(job_cnt, sizeof(mrimapstore_t)))==NULL ) {
+		exit(53);
+	}
 
 	if( !mrimap_is_connected(mailbox->m_imap) ) {
 		mrmailbox_connect_to_imap(mailbox, NULL);
 		if( !mrimap_is_connected(mailbox->m_imap) ) {
-			mrjob_try_again_later(job, MR_STANDARD_DELAY);
+			for( i = 0; i < job_cnt; i++ ) {
+				mrjob_try_again_later(jobs[i], MR_STANDARD_DELAY);
+			}
 			goto cleanup;
 		}
 	}
 
 	mrsqlite3_lock(mailbox->m_sql);
-	locked = 1;
 
-		if( !mrmsg_load_from_db__(msg, mailbox, job->m_foreign_id) ) {
-			goto cleanup;
-		}
+		mdns_enabled = mrsqlite3_get_config_int__(mailbox->m_sql, "mdns_enabled", MR_MDNS_DEFAULT_ENABLED);
 
-		/* add an additional job for sending the MDN (here in a thread for fast ui resonses) (an extra job as the MDN has a lower priority) */
-		if( mrparam_get_int(msg->m_param, MRP_WANTS_MDN, 0) /* MRP_WANTS_MDN is set only for one part of a multipart-message */
-		 && mrsqlite3_get_config_int__(mailbox->m_sql, "mdns_enabled", MR_MDNS_DEFAULT_ENABLED) ) {
-			in_ms_flags |= MR_MS_SET_MDNSent_FLAG;
+		for( i = 0; i < job_cnt; i++ )
+		{
+			msgs[i] = mrmsg_new();
+			if( !mrmsg_load_from_db__(msgs[i], mailbox, jobs[i]->m_foreign_id) ) {
+				mrmsg_unref(msgs[i]);
+				msgs[i] = NULL;
+				continue;
+			}
+
+			stores[i].m_folder = msgs[i]->m_server_folder;
+			stores[i].m_uid    = msgs[i]->m_server_uid;
+
+			/* add an additional job for sending the MDN (here in a thread for fast ui resonses) (an extra job as the MDN has a lower priority) */
+			if( mrparam_get_int(msgs[i]->m_param, MRP_WANTS_MDN, 0) /* MRP_WANTS_MDN is set only for one part of a multipart-message */
+			 && mdns_enabled ) {
+				stores[i].m_ms_flags |= MR_MS_SET_MDNSent_FLAG;
+			}
+
+			if( msgs[i]->m_is_msgrmsg ) {
+				stores[i].m_ms_flags |= MR_MS_ALSO_MOVE;
+			}
 		}
 
 	mrsqlite3_unlock(mailbox->m_sql);
-	locked = 0;
 
-	if( msg->m_is_msgrmsg ) {
-		in_ms_flags |= MR_MS_ALSO_MOVE;
+	if( mrimap_markseen_msgs(mailbox->m_imap, stores, job_cnt) == 0 )
+	{
+		for( i = 0; i < job_cnt; i++ ) {
+			mrjob_try_again_later(jobs[i], MR_STANDARD_DELAY);
+		}
+		goto cleanup;
+	}
+
+	for( i = 0; i < job_cnt; i++ ) {
+		if( (stores[i].m_new_folder && stores[i].m_new_uid) || stores[i].m_ms_flags&MR_MS_MDNSent_JUST_SET ) {
+			update_db = 1;
+		}
 	}
 
-	if( mrimap_markseen_msg(mailbox->m_imap, msg->m_server_folder, msg->m_server_uid,
-		   in_ms_flags, &new_server_folder, &new_server_uid, &out_ms_flags) != 0 )
+	if( update_db )
 	{
-		if( (new_server_folder && new_server_uid) || out_ms_flags&MR_MS_MDNSent_JUST_SET )
-		{
-			mrsqlite3_lock(mailbox->m_sql);
-			locked = 1;
+		mrsqlite3_lock(mailbox->m_sql);
+		mrsqlite3_begin_transaction__(mailbox->m_sql);
+
+			for( i = 0; i < job_cnt; i++ )
+			{
+				if( msgs[i]==NULL ) {
+					continue;
+				}
 
-				if( new_server_folder && new_server_uid )
+				if( stores[i].m_new_folder && stores[i].m_new_uid )
 				{
-					mrmailbox_update_server_uid__(mailbox, msg->m_rfc724_mid, new_server_folder, new_server_uid);
+					mrmailbox_update_server_uid__(mailbox, msgs[i]->m_rfc724_mid, stores[i].m_new_folder, stores[i].m_new_uid);
 				}
 
-				if( out_ms_flags&MR_MS_MDNSent_JUST_SET )
+				if( stores[i].m_ms_flags&MR_MS_MDNSent_JUST_SET )
 				{
-					mrjob_add__(mailbox, MRJ_SEND_MDN, msg->m_id, NULL); /* results in a call to mrmailbox_send_mdn() */
+					mrjob_add__(mailbox, MRJ_SEND_MDN, msgs[i]->m_id, NULL); /* results in a call to mrmailbox_send_mdn() */
 				}
+			}
 
-			mrsqlite3_unlock(mailbox->m_sql);
-			locked = 0;
-		}
-	}
-	else
-	{
-		mrjob_try_again_later(job, MR_STANDARD_DELAY);
+		mrsqlite3_commit__(mailbox->m_sql);
+		mrsqlite3_unlock(mailbox->m_sql);
 	}
 
 cleanup:
-	if( locked ) {
-		mrsqlite3_unlock(mailbox->m_sql);
+	for( i = 0; i < job_cnt; i++ ) {
+		mrmsg_unref(msgs[i]);
+		free(stores[i].m_new_folder);
 	}
-	mrmsg_unref(msg);
-	free(new_server_folder);
+	free(msgs);
+	free(stores);
 }
 
 
-void mrmailbox_markseen_mdn_on_imap(mrmailbox_t* mailbox, mrjob_t* job)
+void mrmailbox_markseen_mdns_on_imap(mrmailbox_t* mailbox, mrjob_t** jobs, int job_cnt)
 {
-	char*    server_folder = mrparam_get    (job->m_param, MRP_SERVER_FOLDER, NULL);
-	uint32_t server_uid    = mrparam_get_int(job->m_param, MRP_SERVER_UID, 0);
-	char*    new_server_folder = NULL;
-	uint32_t new_server_uid    = 0;
-	int      out_ms_flags = 0;
+	int            i;
+	mrimapstore_t* stores = NULL;
+
+	if( (stores=calloc(job_cnt, sizeof(mrimapstore_t)))==NULL ) {
+		exit(53);
+	}
+
+	for( i = 0; i < job_cnt; i++ ) {
+		stores[i].m_folder   = mrparam_get    (jobs[i]->m_param, MRP_SERVER_FOLDER, NULL);
+		stores[i].m_uid      = mrparam_get_int(jobs[i]->m_param, MRP_SERVER_UID, 0);
+		stores[i].m_ms_flags = MR_MS_ALSO_MOVE;
+	}
 
 	if( !mrimap_is_connected(mailbox->m_imap) ) {
 		mrmailbox_connect_to_imap(mailbox, NULL);
 		if( !mrimap_is_connected(mailbox->m_imap) ) {
-			mrjob_try_again_later(job, MR_STANDARD_DELAY);
+			for( i = 0; i < job_cnt; i++ ) {
+				mrjob_try_again_later(jobs[i], MR_STANDARD_DELAY);
+			}
 			goto cleanup;
 		}
 	}
 
-	if( mrimap_markseen_msg(mailbox->m_imap, server_folder, server_uid, MR_MS_ALSO_MOVE, &new_server_folder, &new_server_uid, &out_ms_flags) == 0 ) {
-		mrjob_try_again_later(job, MR_STANDARD_DELAY);
+	if( mrimap_markseen_msgs(mailbox->m_imap, stores, job_cnt) == 0 ) {
+		for( i = 0; i < job_cnt; i++ ) {
+			mrjob_try_again_later(jobs[i], MR_STANDARD_DELAY);
+		}
 	}
 
 cleanup:
-	free(server_folder);
-	free(new_server_folder);
+	for( i = 0; i < job_cnt; i++ ) {
+		free((char*)stores[i].m_folder);
+		free(stores[i].m_new_folder);
+	}
+	free(stores);
 }
 
 
@@ -1004,7 +1211,7 @@ int mrmailbox_markseen_msgs(mrmailbox_t* mailbox, const uint32_t* msg_ids, int m
 			if( sqlite3_changes(mailbox->m_sql->m_cobj) )
 			{
 				mrmailbox_log_info(mailbox, 0, "Seen message #%i.", msg_ids[i]);
-				mrjob_add__(mailbox, MRJ_MARKSEEN_MSG_ON_IMAP, msg_ids[i], NULL); /* results in a call to mrmailbox_markseen_msg_on_imap() */
+				mrjob_add__(mailbox, MRJ_MARKSEEN_MSG_ON_IMAP, msg_ids[i], NULL); /* results in a call to mrmailbox_markseen_msgs_on_imap() */
 			}
 			else
 			{
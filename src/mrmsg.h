@@ -110,6 +110,7 @@ void          mrmsg_save_param_to_disk     (mrmsg_t*); /* can be used to add som
 #define      MR_MSG_FIELDS                    " m.id,rfc724_mid,m.server_folder,m.server_uid,m.chat_id, m.from_id,m.to_id,m.timestamp, m.type,m.state,m.msgrmsg,m.txt, m.param "
 int          mrmsg_set_from_stmt__            (mrmsg_t*, sqlite3_stmt* row, int row_offset); /* row order is MR_MSG_FIELDS */
 int          mrmsg_load_from_db__             (mrmsg_t*, mrmailbox_t*, uint32_t id);
+int          mrmsg_load_from_sql__            (mrmsg_t*, mrmailbox_t*, mrsqlite3_t*, uint32_t id);
 void         mr_guess_msgtype_from_suffix     (const char* pathNfilename, int* ret_msgtype, char** ret_mime);
 size_t       mrmailbox_get_real_msg_cnt__     (mrmailbox_t*); /* the number of messages assigned to real chat (!=deaddrop, !=trash) */
 size_t       mrmailbox_get_deaddrop_msg_cnt__ (mrmailbox_t*);
@@ -118,11 +119,11 @@ int          mrmailbox_rfc724_mid_exists__    (mrmailbox_t*, const char* rfc724_
 void         mrmailbox_update_server_uid__    (mrmailbox_t*, const char* rfc724_mid, const char* server_folder, uint32_t server_uid);
 void         mrmailbox_update_msg_chat_id__   (mrmailbox_t*, uint32_t msg_id, uint32_t chat_id);
 void         mrmailbox_update_msg_state__     (mrmailbox_t*, uint32_t msg_id, int state);
-void         mrmailbox_delete_msg_on_imap     (mrmailbox_t* mailbox, mrjob_t* job);
+void         mrmailbox_delete_msgs_on_imap    (mrmailbox_t*, mrjob_t** jobs, int job_cnt);
 int          mrmailbox_mdn_from_ext__         (mrmailbox_t*, uint32_t from_id, const char* rfc724_mid, uint32_t* ret_chat_id, uint32_t* ret_msg_id); /* returns 1 if an event should be send */
 void         mrmailbox_send_mdn               (mrmailbox_t*, mrjob_t* job);
-void         mrmailbox_markseen_msg_on_imap   (mrmailbox_t* mailbox, mrjob_t* job);
-void         mrmailbox_markseen_mdn_on_imap   (mrmailbox_t* mailbox, mrjob_t* job);
+void         mrmailbox_markseen_msgs_on_imap  (mrmailbox_t*, mrjob_t** jobs, int job_cnt);
+void         mrmailbox_markseen_mdns_on_imap  (mrmailbox_t*, mrjob_t** jobs, int job_cnt);
 char*        mrmsg_get_summarytext_by_raw     (int type, const char* text, mrparam_t*, int approx_bytes); /* the returned value must be free()'d */
 int          mrmsg_is_increation__            (const mrmsg_t*);
 void         mrmsg_save_param_to_disk__       (mrmsg_t*);
@@ -38,35 +38,73 @@
  ******************************************************************************/
 
 
-static char* find_param(char* ths, int key, char** ret_p2)
+static int is_valid_key(int key)
 {
-	char *p1, *p2;
+	return (key > 0 && key < MRP_KEYS && key != '\n');
+}
 
-	/* let p1 point to the start of the */
-	p1 = ths;
-	while( 1 ) {
-		if( p1 == NULL || *p1 == 0 ) {
-			return NULL;
-		}
-		else if( *p1 == key && p1[1] == '=' ) {
-			break;
+
+static void free_entries(mrparam_t* ths)
+{
+	int i;
+
+	for( i = 0; i < ths->m_entry_cnt; i++ ) {
+		if( ths->m_entries[i].m_owned ) {
+			free(ths->m_entries[i].m_value);
 		}
-		else {
-			p1 = strchr(p1, '\n'); /* if `\r\n` is used, this `\r` is also skipped by this*/
-			if( p1 ) {
-				p1++;
-			}
+	}
+	ths->m_entry_cnt = 0;
+	memset(ths->m_index, 0, sizeof(ths->m_index));
+
+	free(ths->m_buf);
+	ths->m_buf = NULL;
+}
+
+
+static void add_entry(mrparam_t* ths, int key, char* value, int owned)
+{
+	if( ths->m_entry_cnt >= ths->m_entry_alloc ) {
+		ths->m_entry_alloc = ths->m_entry_alloc? ths->m_entry_alloc*2 : 8;
+		if( (ths->m_entries=realloc(ths->m_entries, sizeof(mrparamentry_t)*ths->m_entry_alloc))==NULL ) {
+			exit(55);
 		}
 	}
 
-	/* let p2 point to the character _after_ the value - eiter `\n` or `\0` */
-	p2 = strchr(p1, '\n');
-	if( p2 == NULL ) {
-		p2 = &p1[strlen(p1)];
+	ths->m_entries[ths->m_entry_cnt].m_key   = (char)key;
+	ths->m_entries[ths->m_entry_cnt].m_owned = (char)owned;
+	ths->m_entries[ths->m_entry_cnt].m_value = value;
+	ths->m_entry_cnt++;
+	ths->m_index[key] = (unsigned char)ths->m_entry_cnt;
+}
+
+
+static void parse(mrparam_t* ths)
+{
+	/* decode the packed string once; the values point into a copy of the packed string where the
+	line ends are replaced by null-characters.  Lines not in the format "k=value" are ignored,
+	if a key is used several times, the first one wins. */
+	char *p1, *p2;
+
+	if( ths->m_parsed ) {
+		return;
+	}
+
+	free_entries(ths);
+	ths->m_buf = safe_strdup(ths->m_packed);
+
+	for( p1 = ths->m_buf; p1 && *p1; p1 = p2 )
+	{
+		if( (p2=strchr(p1, '\n')) != NULL ) { /* if `\r\n` is used, this `\r` is trimmed below */
+			*p2++ = 0;
+		}
+
+		if( is_valid_key((unsigned char)p1[0]) && p1[1] == '=' && ths->m_index[(unsigned char)p1[0]] == 0 ) {
+			mr_rtrim(&p1[2]);
+			add_entry(ths, (unsigned char)p1[0], &p1[2], 0);
+		}
 	}
 
-	*ret_p2 = p2;
-	return p1;
+	ths->m_parsed = 1;
 }
 
 
@@ -84,6 +122,7 @@ mrparam_t* mrparam_new()
 	}
 
 	ths->m_packed = calloc(1, 1);
+	ths->m_parsed = 1;
 
     return ths;
 }
@@ -96,6 +135,7 @@ void mrparam_unref(mrparam_t* ths)
 	}
 
 	mrparam_empty(ths);
+	free(ths->m_entries);
 	free(ths->m_packed);
 	free(ths);
 }
@@ -107,7 +147,10 @@ void mrparam_empty(mrparam_t* ths)
 		return;
 	}
 
-	ths->m_packed[0] = 0;
+	free_entries(ths);
+	ths->m_packed[0]      = 0;
+	ths->m_packed_dirty   = 0;
+	ths->m_parsed         = 1;
 }
 
 
@@ -122,123 +165,144 @@ void mrparam_set_packed(mrparam_t* ths, const char* packed)
 	if( packed ) {
 		free(ths->m_packed);
 		ths->m_packed = safe_strdup(packed);
+		ths->m_parsed = 0; /* decoded on first access */
 	}
 }
 
 
-int mrparam_exists(mrparam_t* ths, int key)
+const char* mrparam_get_packed(mrparam_t* ths)
 {
-	char *p2;
+	char* p;
+	int   i;
+	size_t bytes = 1;
 
-	if( ths == NULL || key == 0 ) {
-		return 0;
+	if( ths == NULL ) {
+		return "";
+	}
+
+	if( ths->m_packed_dirty )
+	{
+		for( i = 0; i < ths->m_entry_cnt; i++ ) {
+			bytes += 3 /*key, "=", "\n"*/ + strlen(ths->m_entries[i].m_value);
+		}
+
+		free(ths->m_packed);
+		if( (ths->m_packed=malloc(bytes))==NULL ) {
+			exit(56);
+		}
+
+		p = ths->m_packed;
+		*p = 0;
+		for( i = 0; i < ths->m_entry_cnt; i++ ) {
+			p += sprintf(p, i? "\n%c=%s" : "%c=%s", ths->m_entries[i].m_key, ths->m_entries[i].m_value);
+		}
+
+		ths->m_packed_dirty = 0;
 	}
 
-	return find_param(ths->m_packed, key, &p2)? 1 : 0;
+	return ths->m_packed;
 }
 
-char* mrparam_get(mrparam_t* ths, int key, const char* def)
+
+int mrparam_exists(mrparam_t* ths, int key)
 {
-	char *p1, *p2, bak, *ret;
+	return mrparam_peek(ths, key, NULL)? 1 : 0;
+}
 
-	if( ths == NULL || key == 0 ) {
-		return def? safe_strdup(def) : NULL;
+
+const char* mrparam_peek(mrparam_t* ths, int key, const char* def)
+{
+	int index;
+
+	if( ths == NULL || !is_valid_key(key) ) {
+		return def;
 	}
 
-	p1 = find_param(ths->m_packed, key, &p2);
-	if( p1 == NULL ) {
-		return def? safe_strdup(def) : NULL;
+	parse(ths);
+
+	if( (index=ths->m_index[key]) == 0 ) {
+		return def;
 	}
 
-	p1 += 2; /* skip key and "=" (safe as find_param checks for its existance) */
+	return ths->m_entries[index-1].m_value;
+}
+
 
-	bak = *p2;
-	*p2 = 0;
-	ret = safe_strdup(p1);
-	mr_rtrim(ret); /* to be safe with '\r' characters ... */
-	*p2 = bak;
-	return ret;
+char* mrparam_get(mrparam_t* ths, int key, const char* def)
+{
+	const char* value = mrparam_peek(ths, key, def);
+	return value? safe_strdup(value) : NULL;
 }
 
 
 int32_t mrparam_get_int(mrparam_t* ths, int key, int32_t def)
 {
-	if( ths == NULL || key == 0 ) {
+	const char* value = mrparam_peek(ths, key, NULL);
+	if( value == NULL ) {
 		return def;
 	}
-
-    char* str = mrparam_get(ths, key, NULL);
-    if( str == NULL ) {
-		return def;
-    }
-    int32_t ret = atol(str);
-    free(str);
-    return ret;
+	return atol(value);
 }
 
 
 void mrparam_set(mrparam_t* ths, int key, const char* value)
 {
-	char *old1, *old2, *new1 = NULL;
+	mrparamentry_t* entry;
+	int             index, i;
 
-	if( ths == NULL || key == 0 ) {
+	if( ths == NULL || !is_valid_key(key) ) {
 		return;
 	}
 
-	old1 = ths->m_packed;
-	old2 = NULL;
+	parse(ths);
 
-	/* remove existing parameter from packed string, if any */
-	if( old1 ) {
-		char *p1, *p2;
-		p1 = find_param(old1, key, &p2);
-		if( p1 != NULL ) {
-			*p1 = 0;
-			old2 = p2;
+	index = ths->m_index[key];
+	if( value )
+	{
+		if( index ) {
+			/* overwrite the existing parameter, the position in the packed string is kept */
+			entry = &ths->m_entries[index-1];
+			if( entry->m_owned ) {
+				free(entry->m_value);
+			}
+			entry->m_value = safe_strdup(value);
+			entry->m_owned = 1;
 		}
-		else if( value==NULL ) {
-			return; /* parameter does not exist and should be cleared -> done. */
+		else {
+			add_entry(ths, key, safe_strdup(value), 1);
 		}
 	}
+	else
+	{
+		if( index == 0 ) {
+			return; /* parameter does not exist and should be cleared -> done. */
+		}
 
-	mr_rtrim(old1); /* trim functions are null-pointer-safe */
-	mr_ltrim(old2);
-
-	if( old1 && old1[0]==0 ) { old1 = NULL; }
-	if( old2 && old2[0]==0 ) { old2 = NULL; }
+		entry = &ths->m_entries[index-1];
+		if( entry->m_owned ) {
+			free(entry->m_value);
+		}
 
-	/* create new string */
-	if( value ) {
-		new1 = mr_mprintf("%s%s%c=%s%s%s",
-			old1?  old1 : "",
-			old1?  "\n" : "",
-			key,
-			value,
-			old2?  "\n" : "",
-			old2?  old2 : "");
-	}
-	else {
-		new1 = mr_mprintf("%s%s%s",
-			old1?         old1 : "",
-			(old1&&old2)? "\n" : "",
-			old2?         old2 : "");
+		memmove(entry, entry+1, sizeof(mrparamentry_t)*(ths->m_entry_cnt-index));
+		ths->m_entry_cnt--;
+		ths->m_index[key] = 0;
+		for( i = index-1; i < ths->m_entry_cnt; i++ ) {
+			ths->m_index[(unsigned char)ths->m_entries[i].m_key] = (unsigned char)(i+1);
+		}
 	}
 
-	free(ths->m_packed);
-	ths->m_packed = new1;
+	ths->m_packed_dirty = 1;
 }
 
 
 void mrparam_set_int(mrparam_t* ths, int key, int32_t value)
 {
+	char value_str[16];
+
 	if( ths == NULL || key == 0 ) {
 		return;
 	}
 
-    char* value_str = mr_mprintf("%i", (int)value);
-    if( value_str == NULL ) {
-		return;
-    }
-    mrparam_set(ths, key, value_str);
-    free(value_str);
+	snprintf(value_str, sizeof(value_str), "%i", (int)value);
+	mrparam_set(ths, key, value_str);
 }
@@ -26,6 +26,9 @@
  *          - for efficiency, keys are limited to one character
  *          - we expect the packed string to be well formatted and do not
  *            allow spaces around the key; spaces right of the value are trimmed
+ *          - in memory, the string is decoded on the first access to a table
+ *            indexed by the key; it is packed again only if needed, see
+ *            mrparam_get_packed()
  *
  ******************************************************************************/
 
@@ -38,6 +41,7 @@ extern "C" {
 
 
 #define MRP_FILE              'f'  /* for msgs */
+#define MRP_FILENAME          'F'  /* for msgs: original name of a file in the blob store, see mrblob.h */
 #define MRP_WIDTH             'w'  /* for msgs */
 #define MRP_HEIGHT            'h'  /* for msgs */
 #define MRP_DURATION          'd'  /* for msgs */
@@ -62,9 +66,25 @@ extern "C" {
 #define MRP_DEL_AFTER_SEND    'P'  /* for groups and msgs: physically delete group after message sending if msg-value matches group-value */
 
 
+typedef struct mrparamentry_t
+{
+	char     m_key;
+	char     m_owned;     /* 1=m_value is allocated separately, 0=m_value points to mrparam_t::m_buf */
+	char*    m_value;
+} mrparamentry_t;
+
+
+#define MRP_KEYS 128
 typedef struct mrparam_t
 {
-	char*    m_packed;    /* != NULL */
+	char*           m_packed;         /* != NULL; may be outdated, use mrparam_get_packed() */
+	int             m_packed_dirty;   /* 1=the entries were modified and m_packed must be rebuilt */
+	int             m_parsed;         /* 1=m_packed is decoded to the members below */
+	unsigned char   m_index[MRP_KEYS];/* key -> 1-based index in m_entries, 0=unset */
+	mrparamentry_t* m_entries;        /* in the order of the packed string */
+	int             m_entry_cnt;
+	int             m_entry_alloc;
+	char*           m_buf;            /* decoded copy of m_packed */
 } mrparam_t;
 
 
@@ -73,9 +93,11 @@ void          mrparam_unref        (mrparam_t*);
 
 void          mrparam_empty        (mrparam_t*);
 void          mrparam_set_packed   (mrparam_t*, const char*); /* overwrites all existing parameters */
+const char*   mrparam_get_packed   (mrparam_t*); /* the result is valid until the parameters are modified, must not be free()'d */
 
 int           mrparam_exists       (mrparam_t*, int key);
 char*         mrparam_get          (mrparam_t*, int key, const char* def); /* the value may be an empty string, "def" is returned only if the value unset.  The result must be free()'d in any case. */
+const char*   mrparam_peek         (mrparam_t*, int key, const char* def); /* as mrparam_get(), but the result is borrowed: it is valid until the parameters are modified and must not be free()'d */
 int32_t       mrparam_get_int      (mrparam_t*, int key, int32_t def);
 void          mrparam_set          (mrparam_t*, int key, const char* value);
 void          mrparam_set_int      (mrparam_t*, int key, int32_t value);
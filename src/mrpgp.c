@@ -41,10 +41,12 @@
 
 
 #include <string.h>
+#include <pthread.h>
 #include <openssl/ssl.h>
 #include <openssl/rand.h>
 #include <openssl/rsa.h>
 #include <openssl/evp.h>
+#include <openssl/sha.h>
 #include <netpgp-extra.h>
 #include "mrmailbox.h"
 #include "mrkey.h"
@@ -56,6 +58,27 @@
 static pgp_io_t s_io;
 
 
+typedef struct mrpgpcacheentry_t
+{
+	int            m_refcnt;          /* 1 for being in the cache + 1 for each user */
+	uint8_t        m_hash[SHA256_DIGEST_LENGTH]; /* hash of the raw key, used for lookups */
+	int            m_type;            /* MR_PUBLIC or MR_PRIVATE */
+	pgp_keyring_t* m_keys;            /* the parsed public resp. private keys, not modified after parsing */
+	uint8_t        m_fingerprint[PGP_FINGERPRINT_SIZE];
+	unsigned       m_fingerprint_bytes;
+	unsigned long  m_last_used;
+} mrpgpcacheentry_t;
+
+
+typedef struct mrpgpcache_t
+{
+	pthread_mutex_t    m_critical;
+	pthread_mutex_t    m_netpgp_critical; /* netpgp is not documented to be thread-safe; held while it works on the shared cached keys */
+	mrpgpcacheentry_t* m_entries[MR_PGP_KEY_CACHE_SIZE];
+	unsigned long      m_clock;
+} mrpgpcache_t;
+
+
 void mrpgp_init(mrmailbox_t* mailbox)
 {
 	SSL_library_init(); /* older, but more compatible function, simply defined as OPENSSL_init_ssl().
@@ -68,11 +91,25 @@ void mrpgp_init(mrmailbox_t* mailbox)
 	s_io.outs = stdout;
 	s_io.errs = stderr;
 	s_io.res  = stderr;
+
+	/* setup cache of parsed keys */
+	if( (mailbox->m_pgp_cache=calloc(1, sizeof(mrpgpcache_t)))==NULL ) {
+		exit(48);
+	}
+	pthread_mutex_init(&mailbox->m_pgp_cache->m_critical, NULL);
+	pthread_mutex_init(&mailbox->m_pgp_cache->m_netpgp_critical, NULL);
 }
 
 
 void mrpgp_exit(mrmailbox_t* mailbox)
 {
+	if( mailbox->m_pgp_cache ) {
+		mrpgp_uncache_all_keys(mailbox);
+		pthread_mutex_destroy(&mailbox->m_pgp_cache->m_netpgp_critical);
+		pthread_mutex_destroy(&mailbox->m_pgp_cache->m_critical);
+		free(mailbox->m_pgp_cache);
+		mailbox->m_pgp_cache = NULL;
+	}
 }
 
 
@@ -422,6 +459,350 @@ cleanup:
 }
 
 
+/*******************************************************************************
+ * Cache of parsed keys
+ ******************************************************************************/
+
+
+static void wipe_seckey(pgp_seckey_t* seckey)
+{
+	/* netpgp uses BN_free() and not BN_clear_free(), so wipe the secret numbers before */
+	switch( seckey->pubkey.alg ) {
+		case PGP_PKA_RSA:
+		case PGP_PKA_RSA_ENCRYPT_ONLY:
+		case PGP_PKA_RSA_SIGN_ONLY:
+			if( seckey->key.rsa.d ) { BN_clear(seckey->key.rsa.d); }
+			if( seckey->key.rsa.p ) { BN_clear(seckey->key.rsa.p); }
+			if( seckey->key.rsa.q ) { BN_clear(seckey->key.rsa.q); }
+			if( seckey->key.rsa.u ) { BN_clear(seckey->key.rsa.u); }
+			break;
+
+		case PGP_PKA_DSA:
+			if( seckey->key.dsa.x ) { BN_clear(seckey->key.dsa.x); }
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+static void free_keyring(pgp_keyring_t* keyring)
+{
+	unsigned i, j;
+
+	if( keyring == NULL ) {
+		return;
+	}
+
+	for( i = 0; i < keyring->keyc; i++ ) {
+		pgp_key_t* key = &keyring->keys[i];
+		if( key->type != PGP_PTAG_CT_PUBLIC_KEY ) {
+			wipe_seckey(&key->key.seckey);
+			for( j = 0; j < key->subkeyc; j++ ) {
+				wipe_seckey(&key->subkeys[j].key.seckey);
+			}
+		}
+	}
+
+	pgp_keyring_purge(keyring);
+	free(keyring); /*pgp_keyring_free() frees the content, not the pointer itself*/
+}
+
+
+static void free_cache_entry(mrpgpcacheentry_t* entry)
+{
+	free_keyring(entry->m_keys);
+	free(entry);
+}
+
+
+static mrpgpcacheentry_t* parse_key(const mrkey_t* raw_key, const uint8_t* hash)
+{
+	/* returns a new, not yet cached entry with a reference count of 0 or NULL if the key cannot be parsed */
+	mrpgpcacheentry_t* entry = NULL;
+	pgp_keyring_t*     public_keys = calloc(1, sizeof(pgp_keyring_t));
+	pgp_keyring_t*     private_keys = calloc(1, sizeof(pgp_keyring_t));
+	pgp_memory_t*      keysmem = pgp_memory_new();
+	pgp_pubkey_t*      pubkey0 = NULL;
+	pgp_fingerprint_t  fingerprint;
+
+	if( raw_key==NULL || raw_key->m_binary==NULL || raw_key->m_bytes<=0
+	 || public_keys==NULL || private_keys==NULL || keysmem==NULL ) {
+		goto cleanup;
+	}
+
+	pgp_memory_add(keysmem, raw_key->m_binary, raw_key->m_bytes);
+	pgp_filter_keys_from_mem(&s_io, public_keys, private_keys, NULL, 0, keysmem);
+
+	if( raw_key->m_type == MR_PUBLIC ) {
+		if( public_keys->keyc<=0 || private_keys->keyc!=0 ) {
+			goto cleanup;
+		}
+		pubkey0 = &public_keys->keys[0].key.pubkey;
+	}
+	else {
+		if( private_keys->keyc<=0 ) {
+			goto cleanup;
+		}
+		pubkey0 = &private_keys->keys[0].key.seckey.pubkey;
+	}
+
+	memset(&fingerprint, 0, sizeof(pgp_fingerprint_t));
+	if( !pgp_fingerprint(&fingerprint, pubkey0, 0) ) {
+		goto cleanup;
+	}
+
+	if( (entry=calloc(1, sizeof(mrpgpcacheentry_t)))==NULL ) {
+		exit(49);
+	}
+	memcpy(entry->m_hash, hash, SHA256_DIGEST_LENGTH);
+	entry->m_type = raw_key->m_type;
+	memcpy(entry->m_fingerprint, fingerprint.fingerprint, PGP_FINGERPRINT_SIZE);
+	entry->m_fingerprint_bytes = fingerprint.length;
+	if( raw_key->m_type == MR_PUBLIC ) {
+		entry->m_keys = public_keys;
+		public_keys = NULL;
+	}
+	else {
+		entry->m_keys = private_keys;
+		private_keys = NULL;
+	}
+
+cleanup:
+	if( keysmem ) { pgp_memory_free(keysmem); }
+	free_keyring(public_keys);
+	free_keyring(private_keys);
+	return entry;
+}
+
+
+static mrpgpcacheentry_t* lookup_cache_entry__(mrpgpcache_t* cache, const uint8_t* hash, int type)
+{
+	int i;
+	for( i = 0; i < MR_PGP_KEY_CACHE_SIZE; i++ ) {
+		mrpgpcacheentry_t* entry = cache->m_entries[i];
+		if( entry && entry->m_type == type && memcmp(entry->m_hash, hash, SHA256_DIGEST_LENGTH)==0 ) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+
+static void remove_cache_entry__(mrpgpcache_t* cache, int i)
+{
+	/* the entry is freed as soon as it is no longer in use by other threads */
+	mrpgpcacheentry_t* entry = cache->m_entries[i];
+	cache->m_entries[i] = NULL;
+	entry->m_refcnt--;
+	if( entry->m_refcnt <= 0 ) {
+		free_cache_entry(entry);
+	}
+}
+
+
+static void add_cache_entry__(mrpgpcache_t* cache, mrpgpcacheentry_t* entry)
+{
+	int i, slot = -1;
+
+	for( i = 0; i < MR_PGP_KEY_CACHE_SIZE; i++ ) {
+		if( cache->m_entries[i] == NULL ) {
+			slot = i;
+			break;
+		}
+		if( slot == -1 || cache->m_entries[i]->m_last_used < cache->m_entries[slot]->m_last_used ) {
+			slot = i; /* the least recently used entry so far */
+		}
+	}
+
+	if( cache->m_entries[slot] ) {
+		remove_cache_entry__(cache, slot);
+	}
+
+	entry->m_refcnt++;
+	entry->m_last_used = ++cache->m_clock;
+	cache->m_entries[slot] = entry;
+}
+
+
+static mrpgpcacheentry_t* get_cached_key(mrmailbox_t* mailbox, const mrkey_t* raw_key)
+{
+	/* the returned entry must be released using release_cached_key(), NULL is returned if the key cannot be parsed */
+	mrpgpcache_t*      cache = mailbox->m_pgp_cache;
+	mrpgpcacheentry_t* entry = NULL;
+	mrpgpcacheentry_t* parsed = NULL;
+	uint8_t            hash[SHA256_DIGEST_LENGTH];
+
+	if( raw_key==NULL || raw_key->m_binary==NULL || raw_key->m_bytes<=0 ) {
+		return NULL;
+	}
+
+	SHA256(raw_key->m_binary, raw_key->m_bytes, hash);
+
+	pthread_mutex_lock(&cache->m_critical);
+		if( (entry=lookup_cache_entry__(cache, hash, raw_key->m_type))!=NULL ) {
+			entry->m_refcnt++;
+			entry->m_last_used = ++cache->m_clock;
+		}
+	pthread_mutex_unlock(&cache->m_critical);
+
+	if( entry ) {
+		return entry;
+	}
+
+	/* parse outside the lock; if another thread parses the same key meanwhile, we use its entry */
+	if( (parsed=parse_key(raw_key, hash))==NULL ) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&cache->m_critical);
+		if( (entry=lookup_cache_entry__(cache, hash, raw_key->m_type))==NULL ) {
+			add_cache_entry__(cache, parsed);
+			entry = parsed;
+			parsed = NULL;
+		}
+		entry->m_refcnt++;
+		entry->m_last_used = ++cache->m_clock;
+	pthread_mutex_unlock(&cache->m_critical);
+
+	if( parsed ) {
+		free_cache_entry(parsed);
+	}
+
+	return entry;
+}
+
+
+static void release_cached_key(mrmailbox_t* mailbox, mrpgpcacheentry_t* entry)
+{
+	mrpgpcache_t* cache = mailbox->m_pgp_cache;
+	int           do_free;
+
+	if( entry == NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&cache->m_critical);
+		entry->m_refcnt--;
+		do_free = (entry->m_refcnt <= 0);
+	pthread_mutex_unlock(&cache->m_critical);
+
+	if( do_free ) {
+		free_cache_entry(entry); /* the entry was removed from the cache while in use */
+	}
+}
+
+
+static pgp_keyring_t* new_keyring_view(mrpgpcacheentry_t** entries, int entry_cnt)
+{
+	/* the returned keyring borrows the keys from the given entries and must be freed using
+	free_keyring_view(); the entries must not be released before. */
+	pgp_keyring_t* keyring = NULL;
+	unsigned       key_cnt = 0;
+	int            i;
+
+	if( (keyring=calloc(1, sizeof(pgp_keyring_t)))==NULL ) {
+		exit(49);
+	}
+
+	for( i = 0; i < entry_cnt; i++ ) {
+		if( entries[i] ) {
+			key_cnt += entries[i]->m_keys->keyc;
+		}
+	}
+
+	if( key_cnt > 0 ) {
+		if( (keyring->keys=calloc(key_cnt, sizeof(pgp_key_t)))==NULL ) {
+			exit(49);
+		}
+		keyring->keyvsize = key_cnt;
+
+		for( i = 0; i < entry_cnt; i++ ) {
+			if( entries[i] ) {
+				memcpy(&keyring->keys[keyring->keyc], entries[i]->m_keys->keys, entries[i]->m_keys->keyc*sizeof(pgp_key_t));
+				keyring->keyc += entries[i]->m_keys->keyc;
+			}
+		}
+	}
+
+	return keyring;
+}
+
+
+static void free_keyring_view(pgp_keyring_t* keyring)
+{
+	if( keyring ) {
+		free(keyring->keys); /* only the array, the keys themselves are owned by the cache */
+		free(keyring);
+	}
+}
+
+
+void mrpgp_cache_key(mrmailbox_t* mailbox, const mrkey_t* raw_key)
+{
+	/* Replace all keys with the same fingerprint but different data by the given key, mainly
+	to wipe secrets of replaced keys soon.  As the key will probably be used soon, it is added to the cache. */
+	mrpgpcache_t*      cache = NULL;
+	mrpgpcacheentry_t* parsed = NULL;
+	uint8_t            hash[SHA256_DIGEST_LENGTH];
+	int                i;
+
+	if( mailbox==NULL || (cache=mailbox->m_pgp_cache)==NULL
+	 || raw_key==NULL || raw_key->m_binary==NULL || raw_key->m_bytes<=0 ) {
+		return;
+	}
+
+	SHA256(raw_key->m_binary, raw_key->m_bytes, hash);
+
+	if( (parsed=parse_key(raw_key, hash))==NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&cache->m_critical);
+
+		for( i = 0; i < MR_PGP_KEY_CACHE_SIZE; i++ ) {
+			mrpgpcacheentry_t* entry = cache->m_entries[i];
+			if( entry && entry->m_type == parsed->m_type
+			 && entry->m_fingerprint_bytes == parsed->m_fingerprint_bytes
+			 && memcmp(entry->m_fingerprint, parsed->m_fingerprint, parsed->m_fingerprint_bytes)==0
+			 && memcmp(entry->m_hash, parsed->m_hash, SHA256_DIGEST_LENGTH)!=0 ) {
+				remove_cache_entry__(cache, i);
+			}
+		}
+
+		if( lookup_cache_entry__(cache, hash, parsed->m_type)==NULL ) {
+			add_cache_entry__(cache, parsed);
+			parsed = NULL;
+		}
+
+	pthread_mutex_unlock(&cache->m_critical);
+
+	if( parsed ) {
+		free_cache_entry(parsed);
+	}
+}
+
+
+void mrpgp_uncache_all_keys(mrmailbox_t* mailbox)
+{
+	mrpgpcache_t* cache = NULL;
+	int           i;
+
+	if( mailbox==NULL || (cache=mailbox->m_pgp_cache)==NULL ) {
+		return;
+	}
+
+	pthread_mutex_lock(&cache->m_critical);
+		for( i = 0; i < MR_PGP_KEY_CACHE_SIZE; i++ ) {
+			if( cache->m_entries[i] ) {
+				remove_cache_entry__(cache, i);
+			}
+		}
+	pthread_mutex_unlock(&cache->m_critical);
+}
+
+
 /*******************************************************************************
  * Public key encrypt/decrypt
  ******************************************************************************/
@@ -436,33 +817,35 @@ int mrpgp_pk_encrypt(  mrmailbox_t*       mailbox,
                        void**             ret_ctext,
                        size_t*            ret_ctext_bytes)
 {
-	pgp_keyring_t*  public_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*  private_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*  dummy_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_memory_t*   keysmem = pgp_memory_new();
-	pgp_memory_t*   signedmem = NULL;
-	int             i, success = 0;
+	mrpgpcacheentry_t** public_entries = NULL;
+	mrpgpcacheentry_t*  private_entry = NULL;
+	pgp_keyring_t*      public_keys = NULL;
+	pgp_memory_t*       signedmem = NULL;
+	int                 i, success = 0;
 
 	if( mailbox==NULL || plain_text==NULL || plain_bytes==0 || ret_ctext==NULL || ret_ctext_bytes==NULL
-	 || raw_public_keys_for_encryption==NULL || raw_public_keys_for_encryption->m_count<=0
-	 || keysmem==NULL || public_keys==NULL || private_keys==NULL || dummy_keys==NULL ) {
+	 || raw_public_keys_for_encryption==NULL || raw_public_keys_for_encryption->m_count<=0 ) {
 		goto cleanup;
 	}
 
 	*ret_ctext       = NULL;
 	*ret_ctext_bytes = 0;
 
-	/* setup keys (the keys may come from pgp_filter_keys_fileread(), see also pgp_keyring_add(rcpts, key)) */
-	for( i = 0; i < raw_public_keys_for_encryption->m_count; i++ ) {
-		pgp_memory_add(keysmem, raw_public_keys_for_encryption->m_keys[i]->m_binary, raw_public_keys_for_encryption->m_keys[i]->m_bytes);
+	/* setup keys, parsed keys are taken from the cache if possible */
+	if( (public_entries=calloc(raw_public_keys_for_encryption->m_count, sizeof(mrpgpcacheentry_t*)))==NULL ) {
+		goto cleanup;
 	}
 
-	pgp_filter_keys_from_mem(&s_io, public_keys, private_keys/*should stay empty*/, NULL, 0, keysmem);
-	if( public_keys->keyc <=0 || private_keys->keyc!=0 ) {
-		mrmailbox_log_warning(mailbox, 0, "Encryption-keyring contains unexpected data (%i/%i)", public_keys->keyc, private_keys->keyc);
-		goto cleanup;
+	for( i = 0; i < raw_public_keys_for_encryption->m_count; i++ ) {
+		if( raw_public_keys_for_encryption->m_keys[i]->m_type != MR_PUBLIC
+		 || (public_entries[i]=get_cached_key(mailbox, raw_public_keys_for_encryption->m_keys[i]))==NULL ) {
+			mrmailbox_log_warning(mailbox, 0, "Encryption-keyring contains unexpected data (key #%i).", i);
+			goto cleanup;
+		}
 	}
 
+	public_keys = new_keyring_view(public_entries, raw_public_keys_for_encryption->m_count);
+
 	/* encrypt */
 	{
 		const void* signed_text = NULL;
@@ -470,16 +853,16 @@ int mrpgp_pk_encrypt(  mrmailbox_t*       mailbox,
 		int         encrypt_raw_packet = 0;
 
 		if( raw_private_key_for_signing ) {
-			pgp_memory_clear(keysmem);
-			pgp_memory_add(keysmem, raw_private_key_for_signing->m_binary, raw_private_key_for_signing->m_bytes);
-			pgp_filter_keys_from_mem(&s_io, dummy_keys, private_keys, NULL, 0, keysmem);
-			if( private_keys->keyc <= 0 ) {
+			if( raw_private_key_for_signing->m_type != MR_PRIVATE
+			 || (private_entry=get_cached_key(mailbox, raw_private_key_for_signing))==NULL ) {
 				mrmailbox_log_warning(mailbox, 0, "No key for signing found.");
 				goto cleanup;
 			}
 
-			pgp_key_t* sk0 = &private_keys->keys[0];
-			signedmem = pgp_sign_buf(&s_io, plain_text, plain_bytes, &sk0->key.seckey, time(NULL)/*birthtime*/, 0/*duration*/, "sha1", 0/*armored*/, 0/*cleartext*/);
+			pgp_key_t* sk0 = &private_entry->m_keys->keys[0];
+			pthread_mutex_lock(&mailbox->m_pgp_cache->m_netpgp_critical);
+				signedmem = pgp_sign_buf(&s_io, plain_text, plain_bytes, &sk0->key.seckey, time(NULL)/*birthtime*/, 0/*duration*/, "sha1", 0/*armored*/, 0/*cleartext*/);
+			pthread_mutex_unlock(&mailbox->m_pgp_cache->m_netpgp_critical);
 			if( signedmem == NULL ) {
 				mrmailbox_log_warning(mailbox, 0, "Signing failed.");
 				goto cleanup;
@@ -494,7 +877,10 @@ int mrpgp_pk_encrypt(  mrmailbox_t*       mailbox,
 			encrypt_raw_packet = 0;
 		}
 
-		pgp_memory_t* outmem = pgp_encrypt_buf(&s_io, signed_text, signed_bytes, public_keys, use_armor, NULL/*cipher*/, encrypt_raw_packet);
+		pgp_memory_t* outmem = NULL;
+		pthread_mutex_lock(&mailbox->m_pgp_cache->m_netpgp_critical);
+			outmem = pgp_encrypt_buf(&s_io, signed_text, signed_bytes, public_keys, use_armor, NULL/*cipher*/, encrypt_raw_packet);
+		pthread_mutex_unlock(&mailbox->m_pgp_cache->m_netpgp_critical);
 		if( outmem == NULL ) {
 			mrmailbox_log_warning(mailbox, 0, "Encryption failed.");
 			goto cleanup;
@@ -507,11 +893,15 @@ int mrpgp_pk_encrypt(  mrmailbox_t*       mailbox,
 	success = 1;
 
 cleanup:
-	if( keysmem )      { pgp_memory_free(keysmem); }
 	if( signedmem )    { pgp_memory_free(signedmem); }
-	if( public_keys )  { pgp_keyring_purge(public_keys); free(public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
-	if( private_keys ) { pgp_keyring_purge(private_keys); free(private_keys); }
-	if( dummy_keys )   { pgp_keyring_purge(dummy_keys); free(dummy_keys); }
+	free_keyring_view(public_keys); /* before releasing the entries, the view borrows their keys */
+	if( public_entries ) {
+		for( i = 0; i < raw_public_keys_for_encryption->m_count; i++ ) {
+			release_cached_key(mailbox, public_entries[i]);
+		}
+		free(public_entries);
+	}
+	release_cached_key(mailbox, private_entry);
 	return success;
 }
 
@@ -526,45 +916,53 @@ int mrpgp_pk_decrypt(  mrmailbox_t*       mailbox,
                        size_t*            ret_plain_bytes,
                        int*               ret_validation_errors)
 {
-	pgp_keyring_t*    public_keys = calloc(1, sizeof(pgp_keyring_t)); /*should be 0 after parsing*/
-	pgp_keyring_t*    private_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*    dummy_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_validation_t* vresult = calloc(1, sizeof(pgp_validation_t));
-	key_id_t*         recipients_key_ids = NULL;
-	unsigned          recipients_count = 0;
-	pgp_memory_t*     keysmem = pgp_memory_new();
-	int               i, success = 0;
+	mrpgpcacheentry_t** private_entries = NULL;
+	mrpgpcacheentry_t*  public_entry = NULL;
+	pgp_keyring_t*      public_keys = NULL; /*may be empty*/
+	pgp_keyring_t*      private_keys = NULL;
+	pgp_validation_t*   vresult = calloc(1, sizeof(pgp_validation_t));
+	key_id_t*           recipients_key_ids = NULL;
+	unsigned            recipients_count = 0;
+	int                 i, success = 0;
 
 	if( mailbox==NULL || ctext==NULL || ctext_bytes==0 || ret_plain==NULL || ret_plain_bytes==NULL || ret_validation_errors==NULL
 	 || raw_private_keys_for_decryption==NULL || raw_private_keys_for_decryption->m_count<=0
-	 || vresult==NULL || keysmem==NULL || public_keys==NULL || private_keys==NULL ) {
+	 || vresult==NULL ) {
 		goto cleanup;
 	}
 
 	*ret_plain             = NULL;
 	*ret_plain_bytes       = 0;
 
-	/* setup keys (the keys may come from pgp_filter_keys_fileread(), see also pgp_keyring_add(rcpts, key)) */
+	/* setup keys, parsed keys are taken from the cache if possible; unusable private keys are skipped */
+	if( (private_entries=calloc(raw_private_keys_for_decryption->m_count, sizeof(mrpgpcacheentry_t*)))==NULL ) {
+		goto cleanup;
+	}
+
 	for( i = 0; i < raw_private_keys_for_decryption->m_count; i++ ) {
-		pgp_memory_add(keysmem, raw_private_keys_for_decryption->m_keys[i]->m_binary, raw_private_keys_for_decryption->m_keys[i]->m_bytes);
+		if( raw_private_keys_for_decryption->m_keys[i]->m_type == MR_PRIVATE ) {
+			private_entries[i] = get_cached_key(mailbox, raw_private_keys_for_decryption->m_keys[i]);
+		}
 	}
 
-	pgp_filter_keys_from_mem(&s_io, dummy_keys/*should stay empty*/, private_keys, NULL, 0, keysmem);
+	private_keys = new_keyring_view(private_entries, raw_private_keys_for_decryption->m_count);
 	if( private_keys->keyc<=0 ) {
-		mrmailbox_log_warning(mailbox, 0, "Decryption-keyring contains unexpected data (%i/%i)", public_keys->keyc, private_keys->keyc);
+		mrmailbox_log_warning(mailbox, 0, "Decryption-keyring contains unexpected data.");
 		goto cleanup;
 	}
 
-	if( raw_public_key_for_validation ) {
-		pgp_memory_clear(keysmem);
-		pgp_memory_add(keysmem, raw_public_key_for_validation->m_binary, raw_public_key_for_validation->m_bytes);
-		pgp_filter_keys_from_mem(&s_io, public_keys, dummy_keys/*should stay empty*/, NULL, 0, keysmem);
+	if( raw_public_key_for_validation && raw_public_key_for_validation->m_type == MR_PUBLIC ) {
+		public_entry = get_cached_key(mailbox, raw_public_key_for_validation);
 	}
+	public_keys = new_keyring_view(&public_entry, 1);
 
 	/* decrypt */
 	{
-		pgp_memory_t* outmem = pgp_decrypt_and_validate_buf(&s_io, vresult, ctext, ctext_bytes, private_keys, public_keys,
-			use_armor, &recipients_key_ids, &recipients_count);
+		pgp_memory_t* outmem = NULL;
+		pthread_mutex_lock(&mailbox->m_pgp_cache->m_netpgp_critical);
+			outmem = pgp_decrypt_and_validate_buf(&s_io, vresult, ctext, ctext_bytes, private_keys, public_keys,
+				use_armor, &recipients_key_ids, &recipients_count);
+		pthread_mutex_unlock(&mailbox->m_pgp_cache->m_netpgp_critical);
 		if( outmem == NULL ) {
 			mrmailbox_log_warning(mailbox, 0, "Decryption failed.");
 			goto cleanup;
@@ -600,10 +998,15 @@ int mrpgp_pk_decrypt(  mrmailbox_t*       mailbox,
 	success = 1;
 
 cleanup:
-	if( keysmem )            { pgp_memory_free(keysmem); }
-	if( public_keys )        { pgp_keyring_purge(public_keys); free(public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
-	if( private_keys )       { pgp_keyring_purge(private_keys); free(private_keys); }
-	if( dummy_keys )         { pgp_keyring_purge(dummy_keys); free(dummy_keys); }
+	free_keyring_view(public_keys); /* before releasing the entries, the views borrow their keys */
+	free_keyring_view(private_keys);
+	if( private_entries ) {
+		for( i = 0; i < raw_private_keys_for_decryption->m_count; i++ ) {
+			release_cached_key(mailbox, private_entries[i]);
+		}
+		free(private_entries);
+	}
+	release_cached_key(mailbox, public_entry);
 	if( vresult )            { pgp_validate_result_free(vresult); }
 	if( recipients_key_ids ) { free(recipients_key_ids); }
 	return success;
@@ -59,6 +59,11 @@ int  mrpgp_split_key        (mrmailbox_t*, const mrkey_t* private_in, mrkey_t* p
 int  mrpgp_pk_encrypt       (mrmailbox_t*, const void* plain, size_t plain_bytes, const mrkeyring_t*, const mrkey_t* sign_key, int use_armor, void** ret_ctext, size_t* ret_ctext_bytes);
 int  mrpgp_pk_decrypt       (mrmailbox_t*, const void* ctext, size_t ctext_bytes, const mrkeyring_t*, const mrkey_t* validate_key, int use_armor, void** plain, size_t* plain_bytes, int* ret_validation_errors);
 
+/* cache of parsed keys, used by mrpgp_pk_encrypt() and mrpgp_pk_decrypt() */
+#define MR_PGP_KEY_CACHE_SIZE 32
+void mrpgp_cache_key        (mrmailbox_t*, const mrkey_t*); /* call if a key is saved; replaces cached keys with the same fingerprint */
+void mrpgp_uncache_all_keys (mrmailbox_t*);
+
 
 #ifdef __cplusplus
 } /* /extern "C" */
@@ -42,7 +42,7 @@ static const char* s_ent[] = {
 
 	- The first strings MUST NOT start with `&` and MUST end with `;`.
 	- take care not to miss a comma between the strings.
-	- It's also possible to specify the destination as a character reference as `&#34;` (they are converted in a second pass without a table). */
+	- The destination must not be longer than the source including `&`, see xml_decode(). */
 
 	/* basic XML/HTML */
 	"lt;",      "<",	"gt;",      ">",	"quot;",    "\"",	"apos;",    "'",
@@ -117,89 +117,105 @@ static const char* s_ent[] = {
 };
 
 
-/* Recursively decodes entity and character references and normalizes new lines.
+static size_t reserve_scratch(mrsaxparser_t* ths, size_t bytes) /* returns the offset where the bytes can be written */
+{
+	if( ths->m_scratch_used + bytes > ths->m_scratch_bytes ) {
+		ths->m_scratch_bytes = MR_MAX(ths->m_scratch_used + bytes, ths->m_scratch_bytes*2);
+		if( (ths->m_scratch=realloc(ths->m_scratch, ths->m_scratch_bytes))==NULL ) {
+			exit(71);
+		}
+	}
+	return ths->m_scratch_used;
+}
+
+
+/* Decodes entity and character references and normalizes new lines and writes the result to the scratch buffer of
+the parser, the source is not modified.  The result is never longer than the source and is null-terminated.
 set "type" to ...
 '&' for general entity decoding,
-'%' for parameter entity decoding (currently not needed),
-'c' for cdata sections,
-' ' for attribute normalization, or
-'*' for non-cdata attribute normalization (currently not needed).
-Returns s, or if the decoded string is longer than s, returns a malloced string
-that must be freed.
+'c' for cdata sections or
+' ' for attribute normalization.
+Returns the offset of the decoded string in the scratch buffer.
 Function based upon ezxml_decode() from the "ezxml" parser which is
 Copyright 2004-2006 Aaron Voisine <aaron@voisine.org> */
-static char* xml_decode(char* s, char type)
+static size_t xml_decode(mrsaxparser_t* ths, const char* s, size_t len, char type)
 {
-	char *e, *r = s, *m = s;
-	long b, c, d, l;
-
-	for (; *s; s++) { /* normalize line endings */
-		while (*s == '\r') {
-			*(s++) = '\n';
-			if (*s == '\n') memmove(s, (s + 1), strlen(s));
-		}
-	}
+	size_t   ret = reserve_scratch(ths, len+1), i = 0, amp_i = len, ent_len, e;
+	char*    r = ths->m_scratch + ret;
+	long     b, c;
+	char     ch;
 
-	for (s = r; ; ) {
-		while( *s && *s != '&' /*&& (*s != '%' || type != '%')*/ && !isspace(*s)) s++;
+	while( i < len )
+	{
+		ch = (i==amp_i)? '&' : s[i];
 
-		if( ! *s )
+		if( ch == '\r' )
 		{
-			break;
+			/* normalize line endings */
+			if( i+1 < len && s[i+1] == '\n' ) { i++; }
+			*(r++) = (type == ' ')? ' ' : '\n';
+			i++;
 		}
-		else if( type != 'c' && ! strncmp(s, "&#", 2) )
+		else if( ch == '&' && type != 'c' && i+1 < len && s[i+1] == '#' )
 		{
 			/* character reference */
-			if (s[2] == 'x') c = strtol(s + 3, &e, 16); /* base 16 */
-			else c = strtol(s + 2, &e, 10); /* base 10 */
-			if (! c || *e != ';') { s++; continue; } /* not a character ref */
+			for( c = 0, e = i+2, b = 10; e < len; e++ ) {
+				if( e==i+2 && s[e]=='x' ) { b = 16; continue; }
+				int digit = (s[e]>='0' && s[e]<='9')? s[e]-'0' : ((b==16 && s[e]>='a' && s[e]<='f')? s[e]-'a'+10 : ((b==16 && s[e]>='A' && s[e]<='F')? s[e]-'A'+10 : -1));
+				if( digit < 0 || c > 0x10FFFF ) { break; }
+				c = c*b + digit;
+			}
 
-			if (c < 0x80) *(s++) = c; /* US-ASCII subset */
-			else { /* multi-byte UTF-8 sequence */
-				for (b = 0, d = c; d; d /= 2) b++; /* number of bits in c */
-				b = (b - 2) / 5; /* number of bytes in payload */
-				*(s++) = (0xFF << (7 - b)) | (c >> (6 * b)); /* head */
-				while (b) *(s++) = 0x80 | ((c >> (6 * --b)) & 0x3F); /* payload */
+			if( !c || c > 0x10FFFF || e >= len || s[e] != ';' ) {
+				*(r++) = ch; i++; continue; /* not a character ref */
 			}
 
-			memmove(s, strchr(s, ';') + 1, strlen(strchr(s, ';')));
+			if( c < 0x80 ) { /* US-ASCII subset */
+				*(r++) = c;
+			}
+			else { /* multi-byte UTF-8 sequence */
+				b = c < 0x800? 1 : (c < 0x10000? 2 : 3); /* number of bytes in payload */
+				*(r++) = (0xFF << (7 - b)) | (c >> (6 * b)); /* head */
+				while (b) *(r++) = 0x80 | ((c >> (6 * --b)) & 0x3F); /* payload */
+			}
+			i = e + 1;
 		}
-		else if( (*s == '&' && (type == '&' || type == ' ' /*|| type == '*'*/))
-		    /*|| (*s == '%' && type == '%')*/ )
+		else if( ch == '&' && type != 'c' )
 		{
 			/* entity reference */
-			for (b = 0; s_ent[b] && strncmp(s + 1, s_ent[b], strlen(s_ent[b])); b += 2)
-				; /* find entity in entity list */
-
-			if (s_ent[b++]) { /* found a match */
-				if ((c = strlen(s_ent[b])) - 1 > (e = strchr(s, ';')) - s) {
-					l = (d = (s - r)) + c + strlen(e); /* new length */
-					r = (r == m) ? strcpy(malloc(l), r) : realloc(r, l);
-					e = strchr((s = r + d), ';'); /* fix up pointers */
+			for( b = 0; s_ent[b]; b += 2 ) {
+				if( i+1 < len && s_ent[b][0] == s[i+1] ) { /* compare the first character before getting the length */
+					ent_len = strlen(s_ent[b]);
+					if( i+1+ent_len <= len && strncmp(s+i+1, s_ent[b], ent_len)==0 ) {
+						break;
+					}
 				}
+			}
 
-				memmove(s + c, e + 1, strlen(e)); /* shift rest of string */
-				strncpy(s, s_ent[b], c); /* copy in replacement text */
+			if( s_ent[b] == NULL ) {
+				*(r++) = ch; i++; /* not a known entity */
+			}
+			else if( s_ent[b+1][0] == '&' && s_ent[b+1][1] == 0 ) {
+				amp_i = i + ent_len; /* as before, the `&` of `&amp;` is decoded again, the position of `;` is read as `&` */
+				i = amp_i;
+			}
+			else {
+				c = strlen(s_ent[b+1]);
+				memcpy(r, s_ent[b+1], c); /* copy in replacement text */
+				r += c;
+				i += 1 + ent_len;
 			}
-			else s++; /* not a known entity */
 		}
-		else if ((type == ' ' /*|| type == '*'*/) && isspace(*s))
+		else
 		{
-			*(s++) = ' ';
+			*(r++) = (type == ' ' && isspace((unsigned char)ch))? ' ' : ch;
+			i++;
 		}
-		else s++; /* no decoding needed */
 	}
 
-	/* normalize spaces for non-cdata attributes
-	if (type == '*') {
-		for (s = r; *s; s++) {
-			if ((l = strspn(s, " "))) memmove(s, s + l, strlen(s + l) + 1);
-			while (*s && *s != ' ') s++;
-		}
-		if (--s >= r && *s == ' ') *s = '\0';
-	}*/
-
-	return r;
+	*(r++) = 0;
+	ths->m_scratch_used = r - ths->m_scratch;
+	return ret;
 }
 
 
@@ -216,35 +232,61 @@ static void def_endtag_cb   (void* userdata, const char* tag) { }
 static void def_text_cb     (void* userdata, const char* text, int len) { }
 
 
-static void call_text_cb(mrsaxparser_t* ths, char* text, size_t len, char type)
+static const char* find_str(const char* p, const char* end, const char* needle) /* strstr() for a text that is not null-terminated */
 {
-	if( text && len )
-	{
-		char bak = text[len], *text_new;
+	size_t needle_len = strlen(needle);
+	while( p+needle_len <= end ) {
+		if( (p = memchr(p, needle[0], end-p-needle_len+1)) == NULL ) {
+			return NULL;
+		}
+		if( strncmp(p, needle, needle_len)==0 ) {
+			return p;
+		}
+		p++;
+	}
+	return NULL;
+}
+
 
-		text[len] = '\0';
-		text_new = xml_decode(text, type);
-		ths->m_text_cb(ths->m_userdata, text_new, len);
-		if( text != text_new ) { free(text_new); }
+static int starts_with(const char* p, const char* end, const char* str)
+{
+	size_t str_len = strlen(str);
+	return (p+str_len <= end && strncmp(p, str, str_len)==0);
+}
 
-		text[len] = bak;
+
+static const char* skip_chars(const char* p, const char* end, const char* chars, int skip_if_found) /* strspn() and strcspn() for a text that is not null-terminated */
+{
+	while( p < end && (strchr(chars, *p)!=NULL) == skip_if_found ) {
+		p++;
+	}
+	return p;
+}
+#define SKIP_CHARS(p, end, chars)  skip_chars((p), (end), (chars), 1)
+#define FIND_CHARS(p, end, chars)  skip_chars((p), (end), (chars), 0)
+
+
+static size_t add_to_scratch(mrsaxparser_t* ths, const char* s, size_t len) /* adds a lowercase copy of s, returns the offset in the scratch buffer */
+{
+	size_t ret = reserve_scratch(ths, len+1), i;
+	for( i = 0; i < len; i++ ) {
+		ths->m_scratch[ret+i] = tolower((unsigned char)s[i]);
 	}
+	ths->m_scratch[ret+len] = 0;
+	ths->m_scratch_used = ret+len+1;
+	return ret;
 }
 
 
-static void do_free_attr(char** attr, int* free_attr)
+static void call_text_cb(mrsaxparser_t* ths, const char* text, size_t len, char type)
 {
-	/* "attr" are key/value pairs; the function frees the data if the corresponding bit in "free_attr" is set.
-	(we need this as we try to use the strings from the "main" document instead of allocating small strings) */
-	#define FREE_KEY    0x01
-	#define FREE_VALUE  0x02
-	int i = 0;
-	while( attr[i] ) {
-		if( free_attr[i>>1]&FREE_KEY   && attr[i]   ) { free(attr[i]);   }
-		if( free_attr[i>>1]&FREE_VALUE && attr[i+1] ) { free(attr[i+1]); }
-		i += 2;
+	if( text && len )
+	{
+		size_t offset;
+		ths->m_scratch_used = 0;
+		offset = xml_decode(ths, text, len, type);
+		ths->m_text_cb(ths->m_userdata, &ths->m_scratch[offset], ths->m_scratch_used-offset-1);
 	}
-	attr[0] = NULL; /* set list to zero-length */
 }
 
 
@@ -271,10 +313,13 @@ const char* mrattr_find(char** attr, const char* key)
 
 void mrsaxparser_init(mrsaxparser_t* ths, void* userdata)
 {
-	ths->m_userdata    = userdata;
-	ths->m_starttag_cb = def_starttag_cb;
-	ths->m_endtag_cb   = def_endtag_cb;
-	ths->m_text_cb     = def_text_cb;
+	ths->m_userdata      = userdata;
+	ths->m_starttag_cb   = def_starttag_cb;
+	ths->m_endtag_cb     = def_endtag_cb;
+	ths->m_text_cb       = def_text_cb;
+	ths->m_scratch       = NULL;
+	ths->m_scratch_bytes = 0;
+	ths->m_scratch_used  = 0;
 }
 
 
@@ -299,65 +344,72 @@ void mrsaxparser_set_text_handler (mrsaxparser_t* ths, mrsaxparser_text_cb_t tex
 }
 
 
-void mrsaxparser_parse(mrsaxparser_t* ths, const char* buf_start__)
+void mrsaxparser_parse(mrsaxparser_t* ths, const char* text)
+{
+	mrsaxparser_parse_bytes(ths, text, text? strlen(text) : 0);
+}
+
+
+void mrsaxparser_parse_bytes(mrsaxparser_t* ths, const char* buf_start, size_t buf_bytes)
 {
-	char bak, *buf_start, *last_text_start, *p;
+	const char *last_text_start, *p, *end;
 
 	#define MAX_ATTR 100 /* attributes per tag - a fixed border here is a security feature, not a limit */
 	char*   attr[(MAX_ATTR+1)*2]; /* attributes as key/value pairs, +1 for terminating the list */
-	int     free_attr[MAX_ATTR]; /* free the value at attr[i*2+1]? */
-
-	attr[0] = NULL; /* null-terminate list, this also terminates "free_values" */
+	size_t  attr_offset[MAX_ATTR*2]; /* as the scratch buffer may be reallocated, the pointers in attr are set up after the tag is parsed */
+	int     attr_cnt;
 
-	if( ths == NULL ) {
+	if( ths == NULL || buf_start == NULL ) {
 		return;
 	}
 
-	buf_start = safe_strdup(buf_start__); /* we make a copy as we can easily null-terminate tag names and attributes "in place" */
+	if( (end=memchr(buf_start, 0, buf_bytes)) == NULL ) { /* as for mrsaxparser_parse(), the text ends at a null-character */
+		end = buf_start + buf_bytes;
+	}
 	last_text_start = buf_start;
 	p               = buf_start;
-	while( *p )
+	while( p < end )
 	{
 		if( *p == '<' )
 		{
 			call_text_cb(ths, last_text_start, p - last_text_start, '&'); /* flush pending text */
 
 			p++;
-			if( strncmp(p, "!--", 3) == 0 )
+			if( starts_with(p, end, "!--") )
 			{
 				/* skip <!-- ... --> comment
 				 **************************************************************/
 
-				p = strstr(p, "-->");
+				p = find_str(p, end, "-->");
 				if( p == NULL ) { goto cleanup; }
 				p += 3;
 			}
-			else if( strncmp(p, "![CDATA[", 8) == 0 )
+			else if( starts_with(p, end, "![CDATA[") )
 			{
 				/* process <![CDATA[ ... ]]> text
 				 **************************************************************/
 
-				char* text_beg = p + 8;
-				if( (p = strstr(p, "]]>"))!=NULL ) /* `]]>` itself is not allowed in CDATA and must be escaped by dividing into two CDATA parts  */ {
+				const char* text_beg = p + 8;
+				if( (p = find_str(p, end, "]]>"))!=NULL ) /* `]]>` itself is not allowed in CDATA and must be escaped by dividing into two CDATA parts  */ {
 					call_text_cb(ths, text_beg, p-text_beg, 'c');
 					p += 3;
 				}
 				else {
-					call_text_cb(ths, text_beg, strlen(text_beg), 'c'); /* CDATA not closed, add all remaining text */
+					call_text_cb(ths, text_beg, end-text_beg, 'c'); /* CDATA not closed, add all remaining text */
 					goto cleanup;
 				}
 			}
-			else if( strncmp(p, "!DOCTYPE", 8) == 0 )
+			else if( starts_with(p, end, "!DOCTYPE") )
 			{
 				/* skip <!DOCTYPE ...> or <!DOCTYPE name [ ... ]>
 				 **************************************************************/
 
-				while( *p && *p != '[' && *p != '>'  ) p++; /* search for [ or >, whatever comes first */
-				if( *p == 0 ) {
+				p = FIND_CHARS(p, end, "[>"); /* search for [ or >, whatever comes first */
+				if( p == end ) {
 					goto cleanup; /* unclosed doctype */
 				}
 				else if( *p == '[' ) {
-					p = strstr(p, "]>"); /* search end of inline doctype */
+					p = find_str(p, end, "]>"); /* search end of inline doctype */
 					if( p == NULL ) {
 						goto cleanup; /* unclosed inline doctype */
 					}
@@ -369,34 +421,32 @@ void mrsaxparser_parse(mrsaxparser_t* ths, const char* buf_start__)
 					p++;
 				}
 			}
-			else if( *p == '?' )
+			else if( p < end && *p == '?' )
 			{
 				/* skip <? ... ?> processing instruction
 				 **************************************************************/
 
-				p = strstr(p, "?>");
+				p = find_str(p, end, "?>");
 				if( p == NULL ) { goto cleanup; } /* unclosed processing instruction */
 				p += 2;
 			}
 			else
 			{
-				p += strspn(p, XML_WS); /* skip whitespace between `<` and tagname */
-				if( *p == '/' )
+				p = SKIP_CHARS(p, end, XML_WS); /* skip whitespace between `<` and tagname */
+				ths->m_scratch_used = 0;
+				if( p < end && *p == '/' )
 				{
 					/* process </tag> end tag
 					 **************************************************************/
 
 					p++;
-					p += strspn(p, XML_WS); /* skip whitespace between `/` and tagname */
-					char* beg_tag_name = p;
-					p += strcspn(p, XML_WS "/>"); /* find character after tagname */
+					p = SKIP_CHARS(p, end, XML_WS); /* skip whitespace between `/` and tagname */
+					const char* beg_tag_name = p;
+					p = FIND_CHARS(p, end, XML_WS "/>"); /* find character after tagname */
 					if( p != beg_tag_name )
 					{
-						bak = *p;
-						*p = '\0'; /* null-terminate tag name temporary, eg. a covered `>` may get important downwards */
-						mr_strlower_in_place(beg_tag_name);
-						ths->m_endtag_cb(ths->m_userdata, beg_tag_name);
-						*p = bak;
+						size_t tag_offset = add_to_scratch(ths, beg_tag_name, p-beg_tag_name);
+						ths->m_endtag_cb(ths->m_userdata, &ths->m_scratch[tag_offset]);
 					}
 				}
 				else
@@ -404,111 +454,98 @@ void mrsaxparser_parse(mrsaxparser_t* ths, const char* buf_start__)
 					/* process <tag attr1="val" attr2='val' attr3=val ..>
 					 **************************************************************/
 
-					do_free_attr(attr, free_attr);
-
-					char* beg_tag_name = p;
-					p += strcspn(p, XML_WS "/>"); /* find character after tagname */
+					const char* beg_tag_name = p;
+					p = FIND_CHARS(p, end, XML_WS "/>"); /* find character after tagname */
 					if( p != beg_tag_name )
 					{
-						char* after_tag_name = p;
+						size_t tag_offset = add_to_scratch(ths, beg_tag_name, p-beg_tag_name);
 
 						/* scan for attributes */
 						int attr_index = 0;
-						while( isspace(*p) ) { p++; } /* forward to first attribute name beginning */
-						for( ; *p && *p != '/' && *p != '>'; attr_index += 2 )
+						while( p < end && isspace((unsigned char)*p) ) { p++; } /* forward to first attribute name beginning */
+						for( ; p < end && *p != '/' && *p != '>'; attr_index += 2 )
 						{
-							char *beg_attr_name = p, *beg_attr_value = NULL, *beg_attr_value_new = NULL;
+							const char *beg_attr_name = p, *beg_attr_value;
+							size_t      attr_name_offset = 0, attr_value_offset = 0;
 
-							p += strcspn(p, XML_WS "=/>"); /* get end of attribute name */
+							p = FIND_CHARS(p, end, XML_WS "=/>"); /* get end of attribute name */
 							if( p != beg_attr_name )
 							{
 								/* attribute found */
-								char* after_attr_name = p;
-								p += strspn(p, XML_WS); /* skip whitespace between attribute name and possible `=` */
-								if( *p == '=' )
+								if( attr_index < MAX_ATTR ) {
+									attr_name_offset = add_to_scratch(ths, beg_attr_name, p-beg_attr_name);
+								}
+
+								p = SKIP_CHARS(p, end, XML_WS); /* skip whitespace between attribute name and possible `=` */
+								if( p < end && *p == '=' )
 								{
-									p += strspn(p, XML_WS "="); /* skip spaces and equal signs */
-									char quote = *p;
+									p = SKIP_CHARS(p, end, XML_WS "="); /* skip spaces and equal signs */
+									char quote = p < end? *p : 0;
 									if( quote == '"' || quote == '\'' )
 									{
 										/* quoted attribute value */
 										p++;
 										beg_attr_value = p;
-
-										while( *p && *p != quote ) { p++; }
-										if( *p ) {
-											*p = '\0'; /* null terminate attribute val */
+										while( p < end && *p != quote ) { p++; }
+										if( attr_index < MAX_ATTR ) {
+											attr_value_offset = xml_decode(ths, beg_attr_value, p-beg_attr_value, ' ');
+										}
+										if( p < end ) {
 											p++;
 										}
-
-										beg_attr_value_new = xml_decode(beg_attr_value, ' ');
 									}
 									else
 									{
-										/* unquoted attribute value, as the needed null-terminated may overwrite important characters, we'll create a copy */
+										/* unquoted attribute value */
 										beg_attr_value = p;
-										p += strcspn(p, XML_WS "/>"); /* get end of attribute value */
-										bak = *p;
-										*p = '\0';
-											char* temp = safe_strdup(beg_attr_value);
-											beg_attr_value_new = xml_decode(temp, ' ');
-											if( beg_attr_value_new!=temp ) { free(temp); }
-										*p = bak;
+										p = FIND_CHARS(p, end, XML_WS "/>"); /* get end of attribute value */
+										if( attr_index < MAX_ATTR ) {
+											attr_value_offset = xml_decode(ths, beg_attr_value, p-beg_attr_value, ' ');
+										}
 									}
 								}
-								else
+								else if( attr_index < MAX_ATTR )
 								{
-									beg_attr_value_new = safe_strdup(NULL);
+									attr_value_offset = xml_decode(ths, "", 0, ' ');
 								}
 
 								/* add attribute */
 								if( attr_index < MAX_ATTR )
 								{
-									char* beg_attr_name_new = beg_attr_name;
-									int   free_bits = (beg_attr_value_new != beg_attr_value)? FREE_VALUE : 0;
-									if( after_attr_name == p ) {
-										/* take care not to overwrite the current pointer (happens eg. for `<tag attrWithoutValue>` */
-										bak = *after_attr_name;
-										*after_attr_name = '\0';
-										beg_attr_name_new = safe_strdup(beg_attr_name);
-										*after_attr_name = bak;
-										free_bits |= FREE_KEY;
-									}
-									else {
-										*after_attr_name = '\0';
-									}
-
-									mr_strlower_in_place(beg_attr_name_new);
-									attr[attr_index]         = beg_attr_name_new;
-									attr[attr_index+1]       = beg_attr_value_new;
-									attr[attr_index+2]       = NULL; /* null-terminate list */
-									free_attr[attr_index>>1] = free_bits;
+									attr_offset[attr_index]   = attr_name_offset;
+									attr_offset[attr_index+1] = attr_value_offset;
 								}
 							}
+							else
+							{
+								p++; /* skip eg. a `=` without attribute name */
+								attr_index -= 2;
+							}
 
-							while( isspace(*p) ) { p++; } /* forward to attribute name beginning */
+							while( p < end && isspace((unsigned char)*p) ) { p++; } /* forward to attribute name beginning */
 						}
 
-						char bak = *after_tag_name; /* backup the character as it may be `/` or `>` which gets important downwards */
-						*after_tag_name = 0;
-						mr_strlower_in_place(beg_tag_name);
-						ths->m_starttag_cb(ths->m_userdata, beg_tag_name, attr);
-						*after_tag_name = bak;
+						attr_cnt = MR_MIN(attr_index, MAX_ATTR);
+						for( attr_index = 0; attr_index < attr_cnt; attr_index++ ) {
+							attr[attr_index] = &ths->m_scratch[attr_offset[attr_index]];
+						}
+						attr[attr_cnt] = NULL; /* null-terminate list */
+
+						ths->m_starttag_cb(ths->m_userdata, &ths->m_scratch[tag_offset], attr);
 
 						/* self-closing tag */
-						p += strspn(p, XML_WS); /* skip whitespace before possible `/` */
-						if( *p == '/' )
+						p = SKIP_CHARS(p, end, XML_WS); /* skip whitespace before possible `/` */
+						if( p < end && *p == '/' )
 						{
 							p++;
-							*after_tag_name = 0;
-							ths->m_endtag_cb(ths->m_userdata, beg_tag_name); /* already lowercase from starttag_cb()-call */
+							ths->m_endtag_cb(ths->m_userdata, &ths->m_scratch[tag_offset]);
 						}
 					}
 
 				} /* end of processing start-tag */
 
-				p = strchr(p, '>');
-				if( p == NULL ) { goto cleanup; } /* unclosed start-tag or end-tag */
+				p = FIND_CHARS(p, end, ">");
+				if( p == end ) { goto cleanup; } /* unclosed start-tag or end-tag */
 				p++;
 
 			} /* end of processing start-tag or end-tag */
@@ -524,7 +561,8 @@ void mrsaxparser_parse(mrsaxparser_t* ths, const char* buf_start__)
 	call_text_cb(ths, last_text_start, p - last_text_start, '&'); /* flush pending text */
 
 cleanup:
-	do_free_attr(attr, free_attr);
-	free(buf_start);
+	free(ths->m_scratch);
+	ths->m_scratch       = NULL;
+	ths->m_scratch_bytes = 0;
+	ths->m_scratch_used  = 0;
 }
-
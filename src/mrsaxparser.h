@@ -32,6 +32,9 @@
  *          - Input and output strings must be UTF-8 encoded.
  *          - Tag and attribute names are converted to lower case.
  *          - Parsing does not stop on errors; instead errors are recovered.
+ *          - The document is not copied or modified; decoded text, tag and
+ *            attribute names are passed to the callbacks from a scratch buffer
+ *            that is reused for every token.
  *
  ******************************************************************************/
 
@@ -48,7 +51,7 @@ typedef struct mrsaxparser_t mrsaxparser_t;
 
 typedef void (*mrsaxparser_starttag_cb_t) (void* userdata, const char* tag, char** attr);
 typedef void (*mrsaxparser_endtag_cb_t)   (void* userdata, const char* tag);
-typedef void (*mrsaxparser_text_cb_t)     (void* userdata, const char* text, int len); /* len is only informational, text is already null-terminated */
+typedef void (*mrsaxparser_text_cb_t)     (void* userdata, const char* text, int len); /* len is the length of the decoded text, text is null-terminated */
 
 
 typedef struct mrsaxparser_t
@@ -57,6 +60,10 @@ typedef struct mrsaxparser_t
 	mrsaxparser_endtag_cb_t   m_endtag_cb;
 	mrsaxparser_text_cb_t     m_text_cb;
 	void*                     m_userdata;
+
+	char*                     m_scratch; /* the strings passed to the callbacks are valid only during the callback */
+	size_t                    m_scratch_bytes;
+	size_t                    m_scratch_used;
 } mrsaxparser_t;
 
 
@@ -65,6 +72,7 @@ void           mrsaxparser_set_tag_handler  (mrsaxparser_t*, mrsaxparser_startta
 void           mrsaxparser_set_text_handler (mrsaxparser_t*, mrsaxparser_text_cb_t);
 
 void           mrsaxparser_parse            (mrsaxparser_t*, const char* text);
+void           mrsaxparser_parse_bytes      (mrsaxparser_t*, const char* buf, size_t bytes); /* buf needs not to be null-terminated */
 
 const char*    mrattr_find                  (char** attr, const char* key);
 
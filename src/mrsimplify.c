@@ -39,43 +39,62 @@
  ******************************************************************************/
 
 
-static int mr_is_empty_line(const char* buf)
+typedef struct mrline_t
 {
-	const unsigned char* p1 = (const unsigned char*)buf; /* force unsigned - otherwise the `> ' '` comparison will fail */
-	while( *p1 ) {
-		if( *p1 > ' ' ) {
+	char*  m_text; /* points into the buffer to simplify, not null-terminated */
+	size_t m_len;
+} mrline_t;
+
+
+static int mr_is_empty_line(const mrline_t* line)
+{
+	const unsigned char* p1 = (const unsigned char*)line->m_text; /* force unsigned - otherwise the `> ' '` comparison will fail */
+	size_t               i;
+	for( i = 0; i < line->m_len; i++ ) {
+		if( p1[i] > ' ' ) {
 			return 0; /* at least one character found - buffer is not empty */
 		}
-		p1++;
 	}
 	return 1; /* buffer is empty or contains only spaces, tabs, lineends etc. */
 }
 
 
-static int mr_is_plain_quote(const char* buf)
+static int mr_is_line(const mrline_t* line, const char* str)
+{
+	size_t str_len = strlen(str);
+	return (line->m_len == str_len && strncmp(line->m_text, str, str_len)==0);
+}
+
+
+static int mr_line_starts_with(const mrline_t* line, const char* str)
 {
-	if( buf[0] == '>' ) {
+	size_t str_len = strlen(str);
+	return (line->m_len >= str_len && strncmp(line->m_text, str, str_len)==0);
+}
+
+
+static int mr_is_plain_quote(const mrline_t* line)
+{
+	if( line->m_len > 0 && line->m_text[0] == '>' ) {
 		return 1;
 	}
 	return 0;
 }
 
 
-static int mr_is_quoted_headline(const char* buf)
+static int mr_is_quoted_headline(const mrline_t* line)
 {
 	/* This function may be called for the line _directly_ before a quote.
 	The function checks if the line contains sth. like "On 01.02.2016, xy@z wrote:" in various languages.
 	- Currently, we simply check if the last character is a ':'.
 	- Checking for the existance of an email address may fail (headlines may show the user's name instead of the address) */
 
-	int buf_len = strlen(buf);
-
-	if( buf_len > 80 ) {
+	if( line->m_len > 80 ) {
 		return 0; /* the buffer is too long to be a quoted headline (some mailprograms (eg. "Mail" from Stock Android)
 		          forget to insert a line break between the answer and the quoted headline ...)) */
 	}
 
-	if( buf_len > 0 && buf[buf_len-1] == ':' ) {
+	if( line->m_len > 0 && line->m_text[line->m_len-1] == ':' ) {
 		return 1; /* the buffer is a quoting headline in the meaning described above) */
 	}
 
@@ -83,6 +102,34 @@ static int mr_is_quoted_headline(const char* buf)
 }
 
 
+static mrline_t* mr_split_into_line_ranges(char* buf_terminated, int* ret_cnt)
+{
+	/* unlike mr_split_into_lines(), the lines are not copied; there is only one allocation for all lines */
+	mrline_t* lines;
+	char*     p1;
+	int       cnt = 1, l = 0;
+
+	for( p1 = buf_terminated; (p1=strchr(p1, '\n'))!=NULL; p1++ ) {
+		cnt++;
+	}
+
+	if( (lines=malloc(sizeof(mrline_t)*cnt))==NULL ) {
+		exit(72);
+	}
+
+	lines[0].m_text = buf_terminated;
+	for( p1 = buf_terminated; (p1=strchr(p1, '\n'))!=NULL; p1++ ) {
+		lines[l].m_len = p1 - lines[l].m_text;
+		l++;
+		lines[l].m_text = p1 + 1;
+	}
+	lines[l].m_len = strlen(lines[l].m_text);
+
+	*ret_cnt = cnt;
+	return lines;
+}
+
+
 
 /*******************************************************************************
  * Main interface
@@ -126,21 +173,22 @@ static void mrsimplify_simplify_plain_text(mrsimplify_t* ths, char* buf_terminat
 
 	/* TODO: If we know, the mail is from another Messenger, we could skip most of this stuff */
 
-	/* split the given buffer into lines */
-	carray* lines = mr_split_into_lines(buf_terminated);
-	int l, l_first = 0, l_last = carray_count(lines)-1; /* if l_last is -1, there are no lines */
-	char* line;
+	/* split the given buffer into lines, the lines point into the buffer */
+	int l, l_first = 0, l_last;
+	mrline_t* lines = mr_split_into_line_ranges(buf_terminated, &l_last);
+	mrline_t* line;
+	l_last--; /* if l_last is -1, there are no lines */
 
 	/* search for the line `-- ` and ignore this and all following lines
 	If the line contains more characters, it is _not_ treated as the footer start mark (hi, Thorsten) */
 	for( l = l_first; l <= l_last; l++ )
 	{
-		line = (char*)carray_get(lines, l);
-		if( strcmp(line, "-- ")==0
-		 || strcmp(line, "--  ")==0 /* quoted-printable may encode `-- ` to `-- =20` which is converted back to `--  ` ... */
-		 || strcmp(line, "--")==0   /* this is not documented, but occurs frequently; however, if we get problems with this, skip this HACK */
-		 || strcmp(line, "---")==0  /*       - " -                                                                                          */
-		 || strcmp(line, "----")==0 /*       - " -                                                                                          */ )
+		line = &lines[l];
+		if( mr_is_line(line, "-- ")
+		 || mr_is_line(line, "--  ") /* quoted-printable may encode `-- ` to `-- =20` which is converted back to `--  ` ... */
+		 || mr_is_line(line, "--")   /* this is not documented, but occurs frequently; however, if we get problems with this, skip this HACK */
+		 || mr_is_line(line, "---")  /*       - " -                                                                                          */
+		 || mr_is_line(line, "----") /*       - " -                                                                                          */ )
 		{
 			l_last = l - 1; /* if l_last is -1, there are no lines */
 			break; /* done */
@@ -149,12 +197,9 @@ static void mrsimplify_simplify_plain_text(mrsimplify_t* ths, char* buf_terminat
 
 	/* check for "forwarding header" */
 	if( (l_last-l_first+1) >= 3 ) {
-		char* line0 = (char*)carray_get(lines, l_first);
-		char* line1 = (char*)carray_get(lines, l_first+1);
-		char* line2 = (char*)carray_get(lines, l_first+2);
-		if( strcmp(line0, "---------- Forwarded message ----------")==0 /* do not chage this! sent exactly in this form in mrchat.c! */
-		 && strncmp(line1, "From: ", 6)==0
-		 && line2[0] == 0 )
+		if( mr_is_line(&lines[l_first], "---------- Forwarded message ----------") /* do not chage this! sent exactly in this form in mrchat.c! */
+		 && mr_line_starts_with(&lines[l_first+1], "From: ")
+		 && lines[l_first+2].m_len == 0 )
 		{
             ths->m_is_forwarded = 1;
             l_first += 3;
@@ -165,12 +210,12 @@ static void mrsimplify_simplify_plain_text(mrsimplify_t* ths, char* buf_terminat
 	also loose forwarded messages, however, the user has always the option to show the full mail text. */
 	for( l = l_first; l <= l_last; l++ )
 	{
-		line = (char*)carray_get(lines, l);
-		if( strncmp(line, "-----", 5)==0
-		 || strncmp(line, "_____", 5)==0
-		 || strncmp(line, "=====", 5)==0
-		 || strncmp(line, "*****", 5)==0
-		 || strncmp(line, "~~~~~", 5)==0 )
+		line = &lines[l];
+		if( mr_line_starts_with(line, "-----")
+		 || mr_line_starts_with(line, "_____")
+		 || mr_line_starts_with(line, "=====")
+		 || mr_line_starts_with(line, "*****")
+		 || mr_line_starts_with(line, "~~~~~") )
 		{
 			l_last = l - 1; /* if l_last is -1, there are no lines */
 			break; /* done */
@@ -182,7 +227,7 @@ static void mrsimplify_simplify_plain_text(mrsimplify_t* ths, char* buf_terminat
 		int l_lastQuotedLine = -1;
 
 		for( l = l_last; l >= l_first; l-- ) {
-			line = (char*)carray_get(lines, l);
+			line = &lines[l];
 			if( mr_is_plain_quote(line) ) {
 				l_lastQuotedLine = l;
 			}
@@ -196,14 +241,13 @@ static void mrsimplify_simplify_plain_text(mrsimplify_t* ths, char* buf_terminat
 			l_last = l_lastQuotedLine-1; /* if l_last is -1, there are no lines */
 
 			if( l_last > 0 ) {
-				if( mr_is_empty_line((char*)carray_get(lines, l_last)) ) { /* allow one empty line between quote and quote headline (eg. mails from Jürgen) */
+				if( mr_is_empty_line(&lines[l_last]) ) { /* allow one empty line between quote and quote headline (eg. mails from Jürgen) */
 					l_last--;
 				}
 			}
 
 			if( l_last > 0 ) {
-				line = (char*)carray_get(lines, l_last);
-				if( mr_is_quoted_headline(line) ) {
+				if( mr_is_quoted_headline(&lines[l_last]) ) {
 					l_last--;
 				}
 			}
@@ -216,7 +260,7 @@ static void mrsimplify_simplify_plain_text(mrsimplify_t* ths, char* buf_terminat
 		int hasQuotedHeadline = 0;
 
 		for( l = l_first; l <= l_last; l++ ) {
-			line = (char*)carray_get(lines, l);
+			line = &lines[l];
 			if( mr_is_plain_quote(line) ) {
 				l_lastQuotedLine = l;
 			}
@@ -236,15 +280,15 @@ static void mrsimplify_simplify_plain_text(mrsimplify_t* ths, char* buf_terminat
 		}
 	}
 
-	/* re-create buffer from the remaining lines */
+	/* re-create buffer from the remaining lines; the lines are moved to the front of the buffer, the destination
+	is never behind the source as at most as many lineends are written as skipped */
 	char* p1 = buf_terminated;
-	*p1 = 0; /* make sure, the string is terminated if there are no lines (l_last==-1) */
 
 	int add_nl = 0; /* we write empty lines only in case and non-empty line follows */
 
 	for( l = l_first; l <= l_last; l++ )
 	{
-		line = (char*)carray_get(lines, l);
+		line = &lines[l];
 
 		if( mr_is_empty_line(line) )
 		{
@@ -262,16 +306,16 @@ static void mrsimplify_simplify_plain_text(mrsimplify_t* ths, char* buf_terminat
 				}
 			}
 
-			size_t line_len = strlen(line);
+			memmove(p1, line->m_text, line->m_len);
 
-			strcpy(p1, line);
-
-			p1 = &p1[line_len]; /* points to the current terminating nullcharacters which is overwritten with the next line */
+			p1 = &p1[line->m_len]; /* the next line is written here */
 			add_nl = 1;
 		}
 	}
 
-	mr_free_splitted_lines(lines);
+	*p1 = 0; /* terminate the string, this is also needed if there are no lines (l_last==-1) */
+
+	free(lines);
 }
 
 
@@ -282,33 +326,31 @@ static void mrsimplify_simplify_plain_text(mrsimplify_t* ths, char* buf_terminat
 
 char* mrsimplify_simplify(mrsimplify_t* ths, const char* in_unterminated, int in_bytes, int is_html)
 {
-	/* create a copy of the given buffer */
-	char* out = NULL;
+	/* the result is written to a single buffer: for HTML, this is the buffer created by mr_dehtml() in a single pass over the
+	input, which is not copied before; plain text is copied once.  The buffer is then simplified in place */
+	char*       out = NULL;
+	const char* nullchar;
 
 	if( in_unterminated == NULL || in_bytes <= 0 ) {
 		return safe_strdup("");
 	}
 
-	out = strndup((char*)in_unterminated, in_bytes); /* strndup() makes sure, the string is null-terminated */
-	if( out == NULL ) {
-		return safe_strdup("");
+	if( (nullchar=memchr(in_unterminated, 0, in_bytes)) != NULL ) {
+		in_bytes = nullchar - in_unterminated; /* as before, the text ends at a null-character */
 	}
 
-	/* convert HTML to text, if needed */
 	if( is_html ) {
-		char* temp = mr_dehtml(out); /* mr_dehtml() returns way too much lineends, however they're removed in the simplification below */
-		if( temp ) {
-			free(out);
-			out = temp;
+		out = mr_dehtml(in_unterminated, in_bytes); /* mr_dehtml() returns way too much lineends, however they're removed in the simplification below; `\r` is not returned */
+	}
+	else {
+		out = strndup((char*)in_unterminated, in_bytes); /* strndup() makes sure, the string is null-terminated */
+		if( out == NULL ) {
+			return safe_strdup("");
 		}
+		mr_remove_cr_chars(out); /* make comparisons easier, eg. for line `-- ` */
 	}
 
-	/* simplify the text in the buffer (characters to remove may be marked by `\r`) */
-	mr_remove_cr_chars(out); /* make comparisons easier, eg. for line `-- ` */
 	mrsimplify_simplify_plain_text(ths, out);
 
-	/* remove all `\r` from string */
-	mr_remove_cr_chars(out);
-
 	return out;
 }
@@ -251,7 +251,50 @@ void mrsmtp_disconnect(mrsmtp_t* ths)
  ******************************************************************************/
 
 
-int mrsmtp_send_msg(mrsmtp_t* ths, const clist* recipients, const char* data_not_terminated, size_t data_bytes)
+typedef struct mrsmtpdata_t
+{
+	mailstream* m_stream;
+	int         m_at_line_start;
+	int         m_last_cr;
+} mrsmtpdata_t;
+
+
+static int write_data(void* data, const char* str, size_t length)
+{
+	/* called by mailmime_write_driver() for every chunk of the rendered message: convert lineends to CRLF and escape
+	leading dots (RFC 5321, 4.5.2) - as mailstream_send_data() does for contiguous messages.  Return 0 on errors. */
+	mrsmtpdata_t* d = (mrsmtpdata_t*)data;
+	size_t        i, start = 0;
+
+	for( i = 0; i < length; i++ )
+	{
+		if( d->m_at_line_start && str[i]=='.' ) {
+			if( mailstream_write(d->m_stream, str+start, i-start)==-1 || mailstream_write(d->m_stream, ".", 1)==-1 ) {
+				return 0;
+			}
+			start = i;
+		}
+
+		if( str[i]=='\n' && !d->m_last_cr ) {
+			if( mailstream_write(d->m_stream, str+start, i-start)==-1 || mailstream_write(d->m_stream, "\r", 1)==-1 ) {
+				return 0;
+			}
+			start = i;
+		}
+
+		d->m_at_line_start = (str[i]=='\n');
+		d->m_last_cr       = (str[i]=='\r');
+	}
+
+	if( mailstream_write(d->m_stream, str+start, length-start)==-1 ) {
+		return 0;
+	}
+
+	return length;
+}
+
+
+static int send_msg(mrsmtp_t* ths, const clist* recipients, const char* data_not_terminated, size_t data_bytes, struct mailmime* mime)
 {
 	int           success = 0, r, smtp_locked = 0;
 	clistiter*    iter;
@@ -260,7 +303,7 @@ int mrsmtp_send_msg(mrsmtp_t* ths, const clist* recipients, const char* data_not
 		return 0;
 	}
 
-	if( recipients == NULL || clist_count(recipients)==0 || data_not_terminated == NULL || data_bytes == 0 ) {
+	if( recipients == NULL || clist_count(recipients)==0 || ((data_not_terminated == NULL || data_bytes == 0) && mime == NULL) ) {
 		return 1; /* "null message" send */
 	}
 
@@ -301,6 +344,22 @@ int mrsmtp_send_msg(mrsmtp_t* ths, const clist* recipients, const char* data_not
 			goto cleanup;
 		}
 
+		if( mime ) {
+			/* stream the message: the parts are encoded chunk by chunk while writing to the server;
+			mailsmtp_data_message() with an empty message only sends the final dot and reads the response */
+			mrsmtpdata_t data;
+			int          col = 0;
+			memset(&data, 0, sizeof(mrsmtpdata_t));
+			data.m_stream        = ths->m_hEtpan->stream;
+			data.m_at_line_start = 1;
+			if( (r=mailmime_write_driver(write_data, &data, &col, mime)) != MAILIMF_NO_ERROR ) {
+				fprintf(stderr, "mailmime_write_driver: error #%i\n", r);
+				goto cleanup; /* the connection is in an undefined state now, the caller disconnects */
+			}
+			data_not_terminated = "";
+			data_bytes = 0;
+		}
+
 		if ((r = mailsmtp_data_message(ths->m_hEtpan, data_not_terminated, data_bytes)) != MAILSMTP_NO_ERROR) {
 			fprintf(stderr, "mailsmtp_data_message: %s\n", mailsmtp_strerror(r));
 			goto cleanup;
@@ -315,3 +374,16 @@ cleanup:
 	return success;
 }
 
+
+int mrsmtp_send_msg(mrsmtp_t* ths, const clist* recipients, const char* data_not_terminated, size_t data_bytes)
+{
+	return send_msg(ths, recipients, data_not_terminated, data_bytes, NULL);
+}
+
+
+int mrsmtp_send_mime(mrsmtp_t* ths, const clist* recipients, struct mailmime* mime)
+{
+	/* unlike mrsmtp_send_msg(), the message need not to be rendered to memory before */
+	return send_msg(ths, recipients, NULL, 0, mime);
+}
+
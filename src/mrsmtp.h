@@ -57,6 +57,7 @@ int          mrsmtp_is_connected (const mrsmtp_t*);
 int          mrsmtp_connect      (mrsmtp_t*, const mrloginparam_t*);
 void         mrsmtp_disconnect   (mrsmtp_t*);
 int          mrsmtp_send_msg     (mrsmtp_t*, const clist* recipients, const char* data, size_t data_bytes);
+int          mrsmtp_send_mime    (mrsmtp_t*, const clist* recipients, struct mailmime*);
 
 
 #ifdef __cplusplus
@@ -48,9 +48,13 @@
 #include "mrsqlite3.h"
 #include "mrtools.h"
 #include "mrchat.h"
+#include "mrjob.h"
 #include "mrcontact.h"
 
 
+static void end_config_transaction__(mrsqlite3_t*, int level, int commit);
+
+
 /*******************************************************************************
  * Tools
  ******************************************************************************/
@@ -119,6 +123,55 @@ cleanup:
 }
 
 
+static mrsqlite3config_t* new_config_entry(const char* value)
+{
+	mrsqlite3config_t* entry;
+
+	if( (entry=calloc(1, sizeof(mrsqlite3config_t)))==NULL ) {
+		exit(69);
+	}
+	entry->m_value     = safe_strdup(value);
+	entry->m_value_int = atol(value);
+	return entry;
+}
+
+
+static void free_config_entry(mrsqlite3config_t* entry)
+{
+	if( entry ) {
+		free(entry->m_value);
+		free(entry);
+	}
+}
+
+
+static void free_config_change(mrsqlite3configchange_t* change)
+{
+	if( change ) {
+		free(change->m_key);
+		free_config_entry(change->m_entry);
+		free(change);
+	}
+}
+
+
+static void free_config_cache(chash* cache)
+{
+	chashiter* iter;
+	chashdatum value;
+
+	if( cache == NULL ) {
+		return;
+	}
+
+	for( iter = chash_begin(cache); iter != NULL; iter = chash_next(cache, iter) ) {
+		chash_value(iter, &value);
+		free_config_entry((mrsqlite3config_t*)value.data);
+	}
+	chash_free(cache);
+}
+
+
 /*******************************************************************************
  * Main interface
  ******************************************************************************/
@@ -140,6 +193,7 @@ mrsqlite3_t* mrsqlite3_new(mrmailbox_t* mailbox)
 	}
 
 	pthread_mutex_init(&ths->m_critical_, NULL);
+	pthread_mutex_init(&ths->m_config_critical_, NULL);
 
 	return ths;
 }
@@ -147,6 +201,8 @@ mrsqlite3_t* mrsqlite3_new(mrmailbox_t* mailbox)
 
 void mrsqlite3_unref(mrsqlite3_t* ths)
 {
+	int i;
+
 	if( ths == NULL ) {
 		return;
 	}
@@ -157,11 +213,87 @@ void mrsqlite3_unref(mrsqlite3_t* ths)
 		pthread_mutex_unlock(&ths->m_critical_);
 	}
 
+	for( i = 0; i < MR_SQL_READERS; i++ ) {
+		if( ths->m_readers[i] ) {
+			pthread_mutex_destroy(&ths->m_readers[i]->m_config_critical_);
+			pthread_mutex_destroy(&ths->m_readers[i]->m_critical_);
+			free(ths->m_readers[i]);
+		}
+	}
+
+	if( ths->m_pending_jobs ) {
+		mrjob_end_transaction__(ths, 0, 0); /* normally, there are no pending jobs left */
+		carray_free(ths->m_pending_jobs);
+	}
+	if( ths->m_pending_config ) {
+		carray_free(ths->m_pending_config); /* emptied by mrsqlite3_close__() */
+	}
+
+	pthread_mutex_destroy(&ths->m_config_critical_);
 	pthread_mutex_destroy(&ths->m_critical_);
 	free(ths);
 }
 
 
+static int open_readers__(mrsqlite3_t* ths, const char* dbfile)
+{
+	/* the writer must be opened and switched to WAL before; in WAL mode, readers see the last committed state
+	and neither block the writer nor are blocked by it.  The reader objects stay allocated until mrsqlite3_unref() */
+	int          i;
+	mrsqlite3_t* reader;
+
+	for( i = 0; i < MR_SQL_READERS; i++ )
+	{
+		if( ths->m_readers[i] == NULL ) {
+			ths->m_readers[i] = mrsqlite3_new(ths->m_mailbox);
+			ths->m_readers[i]->m_writer = ths;
+		}
+		reader = ths->m_readers[i];
+
+		pthread_mutex_lock(&reader->m_critical_);
+			if( sqlite3_open_v2(dbfile, &reader->m_cobj, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK ) {
+				mrsqlite3_log_error(reader, "Cannot open reader for \"%s\".", dbfile);
+				if( reader->m_cobj ) {
+					sqlite3_close(reader->m_cobj);
+					reader->m_cobj = NULL;
+				}
+				pthread_mutex_unlock(&reader->m_critical_);
+				return 0;
+			}
+			sqlite3_busy_timeout(reader->m_cobj, MR_SQL_BUSY_TIMEOUT_MS);
+		pthread_mutex_unlock(&reader->m_critical_);
+	}
+
+	return 1;
+}
+
+
+static void close_readers__(mrsqlite3_t* ths)
+{
+	int          i, j;
+	mrsqlite3_t* reader;
+
+	for( i = 0; i < MR_SQL_READERS; i++ )
+	{
+		if( (reader=ths->m_readers[i]) != NULL )
+		{
+			pthread_mutex_lock(&reader->m_critical_); /* wait for running queries */
+				if( reader->m_cobj ) {
+					for( j = 0; j < PREDEFINED_CNT; j++ ) {
+						if( reader->m_pd[j] ) {
+							sqlite3_finalize(reader->m_pd[j]);
+							reader->m_pd[j] = NULL;
+						}
+					}
+					sqlite3_close(reader->m_cobj);
+					reader->m_cobj = NULL;
+				}
+			pthread_mutex_unlock(&reader->m_critical_);
+		}
+	}
+}
+
+
 int mrsqlite3_open__(mrsqlite3_t* ths, const char* dbfile, int flags)
 {
 	if( ths == NULL || dbfile == NULL ) {
@@ -331,6 +463,124 @@ int mrsqlite3_open__(mrsqlite3_t* ths, const char* dbfile, int flags)
 
 		#define NEW_DB_VERSION 13 /* just leave this to make sure version 13 is not used again */
 		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 14
+			if( dbversion < NEW_DB_VERSION )
+			{
+				mrsqlite3_execute__(ths, "CREATE INDEX msgs_index5 ON msgs (from_id);"); /* needed to search for messages by the sender's name without scanning all messages */
+				mrsqlite3_create_search_index__(ths); /* if this fails, eg. because SQLite is compiled without FTS, mrmailbox_search_msgs() falls back to LIKE; the index may be created later using mrmailbox_rebuild_search_index() */
+
+				dbversion = NEW_DB_VERSION;
+				mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 15
+			if( dbversion < NEW_DB_VERSION )
+			{
+				/* the last message and the number of fresh messages are cached in the chats table, so the chatlist can be
+				loaded without touching msgs.  The triggers keep the values in sync with all INSERTs, DELETEs and UPDATEs on msgs. */
+				#define RECALC_LAST_MSG_OF(c) \
+					" UPDATE chats SET last_msg_id=IFNULL((SELECT id FROM msgs WHERE chat_id=" c " ORDER BY timestamp DESC, id DESC LIMIT 1),0)," \
+					                 " last_timestamp=IFNULL((SELECT MAX(timestamp) FROM msgs WHERE chat_id=" c "),0)"
+				#define SET_LAST_MSG_IF_NEWER \
+					" UPDATE chats SET last_msg_id=new.id, last_timestamp=new.timestamp" \
+					  " WHERE id=new.chat_id AND (new.timestamp>last_timestamp OR (new.timestamp=last_timestamp AND new.id>last_msg_id));"
+				mrsqlite3_execute__(ths, "ALTER TABLE chats ADD COLUMN last_msg_id INTEGER DEFAULT 0;");
+				mrsqlite3_execute__(ths, "ALTER TABLE chats ADD COLUMN last_timestamp INTEGER DEFAULT 0;");
+				mrsqlite3_execute__(ths, "ALTER TABLE chats ADD COLUMN fresh_cnt INTEGER DEFAULT 0;");
+				mrsqlite3_execute__(ths, "CREATE TRIGGER chats_last_ai AFTER INSERT ON msgs BEGIN"
+							SET_LAST_MSG_IF_NEWER
+							" UPDATE chats SET fresh_cnt=fresh_cnt+1 WHERE id=new.chat_id AND new.state=" MR_STRINGIFY(MR_IN_FRESH) ";"
+							" END;");
+				mrsqlite3_execute__(ths, "CREATE TRIGGER chats_last_ad AFTER DELETE ON msgs BEGIN"
+							" UPDATE chats SET fresh_cnt=fresh_cnt-1 WHERE id=old.chat_id AND old.state=" MR_STRINGIFY(MR_IN_FRESH) ";"
+							RECALC_LAST_MSG_OF("old.chat_id") " WHERE id=old.chat_id AND last_msg_id=old.id;"
+							" END;");
+				mrsqlite3_execute__(ths, "CREATE TRIGGER chats_last_au AFTER UPDATE OF chat_id, timestamp, state ON msgs BEGIN"
+							" UPDATE chats SET fresh_cnt=fresh_cnt-1 WHERE id=old.chat_id AND old.state=" MR_STRINGIFY(MR_IN_FRESH) ";"
+							" UPDATE chats SET fresh_cnt=fresh_cnt+1 WHERE id=new.chat_id AND new.state=" MR_STRINGIFY(MR_IN_FRESH) ";"
+							RECALC_LAST_MSG_OF("old.chat_id") " WHERE id=old.chat_id AND last_msg_id=old.id AND (old.chat_id!=new.chat_id OR old.timestamp!=new.timestamp);"
+							SET_LAST_MSG_IF_NEWER
+							" END;");
+				mrsqlite3_execute__(ths, RECALC_LAST_MSG_OF("chats.id") ", fresh_cnt=(SELECT COUNT(*) FROM msgs WHERE chat_id=chats.id AND state=" MR_STRINGIFY(MR_IN_FRESH) ");");
+				#undef RECALC_LAST_MSG_OF
+				#undef SET_LAST_MSG_IF_NEWER
+
+				dbversion = NEW_DB_VERSION;
+				mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 16
+			if( dbversion < NEW_DB_VERSION )
+			{
+				mrsqlite3_execute__(ths, "CREATE INDEX msgs_index6 ON msgs (chat_id, timestamp, id);"); /* for reading chats in order and for keyset pagination, see mrmailbox_get_chat_msgs_keyset() */
+
+				dbversion = NEW_DB_VERSION;
+				mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 17
+			if( dbversion < NEW_DB_VERSION )
+			{
+				/* msgs.blob is the store-relative name of a file in the blob store, see mrblob.h; the triggers count the
+				references so that unused files can be found without scanning all messages.  existing files are moved to
+				the store by mrblob_migrate__() as this needs the blobdir. */
+				mrsqlite3_execute__(ths, "ALTER TABLE msgs ADD COLUMN blob TEXT DEFAULT NULL;");
+				mrsqlite3_execute__(ths, "CREATE TABLE blobs (name TEXT PRIMARY KEY, refs INTEGER DEFAULT 0);");
+				mrsqlite3_execute__(ths, "CREATE INDEX blobs_index1 ON blobs (refs);");
+				mrsqlite3_execute__(ths, "CREATE TRIGGER blobs_ai AFTER INSERT ON msgs WHEN new.blob IS NOT NULL BEGIN"
+							" INSERT OR IGNORE INTO blobs (name) VALUES (new.blob);"
+							" UPDATE blobs SET refs=refs+1 WHERE name=new.blob;"
+							" END;");
+				mrsqlite3_execute__(ths, "CREATE TRIGGER blobs_ad AFTER DELETE ON msgs WHEN old.blob IS NOT NULL BEGIN"
+							" UPDATE blobs SET refs=refs-1 WHERE name=old.blob;"
+							" END;");
+				mrsqlite3_execute__(ths, "CREATE TRIGGER blobs_au AFTER UPDATE OF blob ON msgs BEGIN"
+							" UPDATE blobs SET refs=refs-1 WHERE name=old.blob;"
+							" INSERT OR IGNORE INTO blobs (name) SELECT new.blob WHERE new.blob IS NOT NULL;"
+							" UPDATE blobs SET refs=refs+1 WHERE name=new.blob;"
+							" END;");
+
+				dbversion = NEW_DB_VERSION;
+				mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 18
+			if( dbversion < NEW_DB_VERSION )
+			{
+				/* the chatlist is ordered by the newer of the draft and the last message; the value is kept in a column, so
+				that the order can be served by an index.  The triggers also fire for the changes done by the triggers on msgs. */
+				#define SET_SORT_TIMESTAMP \
+					" UPDATE chats SET sort_timestamp=MAX(IFNULL(new.draft_timestamp,0),IFNULL(new.last_timestamp,0)) WHERE id=new.id;"
+				mrsqlite3_execute__(ths, "ALTER TABLE chats ADD COLUMN sort_timestamp INTEGER DEFAULT 0;");
+				mrsqlite3_execute__(ths, "CREATE TRIGGER chats_sort_ai AFTER INSERT ON chats BEGIN" SET_SORT_TIMESTAMP " END;");
+				mrsqlite3_execute__(ths, "CREATE TRIGGER chats_sort_au AFTER UPDATE OF draft_timestamp, last_timestamp ON chats BEGIN" SET_SORT_TIMESTAMP " END;");
+				mrsqlite3_execute__(ths, "UPDATE chats SET sort_timestamp=MAX(IFNULL(draft_timestamp,0),IFNULL(last_timestamp,0));");
+				mrsqlite3_execute__(ths, "CREATE INDEX chats_index2 ON chats (sort_timestamp, last_msg_id);"); /* see mrchatlist_load_from_db__() */
+				#undef SET_SORT_TIMESTAMP
+
+				dbversion = NEW_DB_VERSION;
+				mrsqlite3_set_config_int__(ths, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+	}
+
+	mrsqlite3_reload_config__(ths);
+
+	if( flags&MR_OPEN_WITH_READERS )
+	{
+		/* WAL allows readers and one writer to work concurrently; the journal mode is persistent, the readers are closed
+		together with the writer so that the last connection checkpoints the WAL back to the database file */
+		sqlite3_busy_timeout(ths->m_cobj, MR_SQL_BUSY_TIMEOUT_MS);
+		if( !mrsqlite3_execute__(ths, "PRAGMA journal_mode=WAL;")
+		 || !open_readers__(ths, dbfile) ) {
+			mrmailbox_log_warning(ths->m_mailbox, 0, "Cannot open readers, all queries will use the writer.");
+			close_readers__(ths);
+		}
 	}
 
 	mrmailbox_log_info(ths->m_mailbox, 0, "Opened \"%s\" successfully.", dbfile);
@@ -350,6 +600,8 @@ void mrsqlite3_close__(mrsqlite3_t* ths)
 		return;
 	}
 
+	close_readers__(ths);
+
 	if( ths->m_cobj )
 	{
 		for( i = 0; i < PREDEFINED_CNT; i++ ) {
@@ -363,6 +615,12 @@ void mrsqlite3_close__(mrsqlite3_t* ths)
 		ths->m_cobj = NULL;
 	}
 
+	end_config_transaction__(ths, 0, 0);
+	pthread_mutex_lock(&ths->m_config_critical_);
+		free_config_cache(ths->m_config_cache);
+		ths->m_config_cache = NULL;
+	pthread_mutex_unlock(&ths->m_config_critical_);
+
 	mrmailbox_log_info(ths->m_mailbox, 0, "Database closed."); /* We log the information even if not real closing took place; this is to detect logic errors. */
 }
 
@@ -420,6 +678,29 @@ void mrsqlite3_reset_all_predefinitions(mrsqlite3_t* ths)
 }
 
 
+int mrsqlite3_create_search_index__(mrsqlite3_t* ths)
+{
+	/* msgs_fts is an external content FTS4 table indexing msgs.txt with docid=msgs.id, so the text is not stored twice.
+	The triggers keep the index in sync for all INSERTs, DELETEs and text changes, regardless of the code path. */
+	if( !sqlite3_compileoption_used("ENABLE_FTS4") && !sqlite3_compileoption_used("ENABLE_FTS3") ) {
+		mrmailbox_log_info(ths->m_mailbox, 0, "SQLite compiled without FTS, messages are searched without index.");
+		return 0;
+	}
+
+	if( !mrsqlite3_execute__(ths, "CREATE VIRTUAL TABLE IF NOT EXISTS msgs_fts USING fts4(content=\"msgs\", txt, tokenize=unicode61);")
+	 || !mrsqlite3_execute__(ths, "CREATE TRIGGER IF NOT EXISTS msgs_fts_bd BEFORE DELETE ON msgs BEGIN DELETE FROM msgs_fts WHERE docid=old.id; END;")
+	 || !mrsqlite3_execute__(ths, "CREATE TRIGGER IF NOT EXISTS msgs_fts_bu BEFORE UPDATE OF txt ON msgs BEGIN DELETE FROM msgs_fts WHERE docid=old.id; END;")
+	 || !mrsqlite3_execute__(ths, "CREATE TRIGGER IF NOT EXISTS msgs_fts_au AFTER UPDATE OF txt ON msgs BEGIN INSERT INTO msgs_fts (docid, txt) VALUES (new.id, new.txt); END;")
+	 || !mrsqlite3_execute__(ths, "CREATE TRIGGER IF NOT EXISTS msgs_fts_ai AFTER INSERT ON msgs BEGIN INSERT INTO msgs_fts (docid, txt) VALUES (new.id, new.txt); END;")
+	 || !mrsqlite3_execute__(ths, "INSERT INTO msgs_fts (msgs_fts) VALUES ('rebuild');") ) {
+		return 0;
+	}
+
+	mrsqlite3_set_config_int__(ths, "search_index", 1);
+	return 1;
+}
+
+
 int mrsqlite3_table_exists__(mrsqlite3_t* ths, const char* name)
 {
 	int           ret = 0;
@@ -463,6 +744,135 @@ cleanup:
  ******************************************************************************/
 
 
+static void update_config_cache(mrsqlite3_t* ths, const char* key, mrsqlite3config_t* entry/*NULL=deleted, owned by the function*/)
+{
+	chashdatum k, v, old;
+
+	pthread_mutex_lock(&ths->m_config_critical_);
+
+		if( ths->m_config_cache )
+		{
+			k.data = (void*)key;
+			k.len  = strlen(key);
+			old.data = NULL;
+			if( entry ) {
+				/* chash_set() returns the new value instead of the replaced one, so get the old entry before */
+				if( chash_get(ths->m_config_cache, &k, &old) != 0 ) {
+					old.data = NULL;
+				}
+				v.data = entry;
+				v.len  = 0;
+				entry = NULL;
+				if( chash_set(ths->m_config_cache, &k, &v, NULL) != 0 ) {
+					free_config_entry((mrsqlite3config_t*)v.data);
+					free_config_cache(ths->m_config_cache); /* better no cache than a wrong one */
+					ths->m_config_cache = NULL;
+					old.data = NULL;
+				}
+			}
+			else {
+				chash_delete(ths->m_config_cache, &k, &old);
+			}
+			free_config_entry((mrsqlite3config_t*)old.data);
+		}
+
+	pthread_mutex_unlock(&ths->m_config_critical_);
+
+	free_config_entry(entry);
+}
+
+
+static void end_config_transaction__(mrsqlite3_t* ths, int level, int commit)
+{
+	/* apply the changes to the cache when the outermost transaction is committed, committing a nested transaction passes
+	its changes to the enclosing one.  level=0 drops all pending changes. */
+	mrsqlite3configchange_t* change;
+	unsigned int             i, kept_cnt = 0;
+
+	if( ths->m_pending_config == NULL ) {
+		return;
+	}
+
+	for( i = 0; i < carray_count(ths->m_pending_config); i++ )
+	{
+		change = (mrsqlite3configchange_t*)carray_get(ths->m_pending_config, i);
+		if( change->m_transaction_level < level ) {
+			carray_set(ths->m_pending_config, kept_cnt++, change);
+		}
+		else if( !commit || level == 0 ) {
+			free_config_change(change);
+		}
+		else if( level > 1 ) {
+			change->m_transaction_level = level-1;
+			carray_set(ths->m_pending_config, kept_cnt++, change);
+		}
+		else {
+			update_config_cache(ths, change->m_key, change->m_entry);
+			change->m_entry = NULL;
+			free_config_change(change);
+		}
+	}
+	carray_set_size(ths->m_pending_config, kept_cnt);
+}
+
+
+void mrsqlite3_reload_config__(mrsqlite3_t* ths)
+{
+	chash*        cache = NULL, *old_cache;
+	sqlite3_stmt* stmt = NULL;
+	chashdatum    k, v;
+	const char*   key, *value;
+
+	if( ths == NULL || ths->m_writer ) {
+		return; /* readers use the cache of the writer */
+	}
+
+	if( (stmt=mrsqlite3_prepare_v2_(ths, "SELECT keyname, value FROM config;"))==NULL ) {
+		goto cleanup; /* no cache, the database is queried directly */
+	}
+
+	if( (cache=chash_new(CHASH_DEFAULTSIZE, CHASH_COPYKEY))==NULL ) {
+		exit(70);
+	}
+
+	while( sqlite3_step(stmt) == SQLITE_ROW )
+	{
+		key   = (const char*)sqlite3_column_text(stmt, 0);
+		value = (const char*)sqlite3_column_text(stmt, 1);
+		if( key == NULL || value == NULL ) {
+			continue; /* NULL-values are not returned by mrsqlite3_get_config__() */
+		}
+
+		k.data = (void*)key;
+		k.len  = strlen(key);
+		if( chash_get(cache, &k, &v) == 0 ) {
+			continue; /* if there are duplicates, mrsqlite3_get_config__() returned the first one */
+		}
+
+		v.data = new_config_entry(value);
+		v.len  = 0;
+		if( chash_set(cache, &k, &v, NULL) != 0 ) {
+			free_config_entry((mrsqlite3config_t*)v.data);
+			free_config_cache(cache);
+			cache = NULL;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	pthread_mutex_lock(&ths->m_config_critical_);
+		old_cache = ths->m_config_cache;
+		ths->m_config_cache = cache;
+	pthread_mutex_unlock(&ths->m_config_critical_);
+
+	free_config_cache(old_cache);
+
+	if( stmt ) {
+		sqlite3_finalize(stmt);
+	}
+}
+
+
 int mrsqlite3_set_config__(mrsqlite3_t* ths, const char* key, const char* value)
 {
 	int           state;
@@ -485,6 +895,7 @@ int mrsqlite3_set_config__(mrsqlite3_t* ths, const char* key, const char* value)
 		stmt = mrsqlite3_predefine__(ths, SELECT_v_FROM_config_k, SELECT_v_FROM_config_k_STATEMENT);
 		sqlite3_bind_text (stmt, 1, key, -1, SQLITE_STATIC);
 		state=sqlite3_step(stmt);
+		sqlite3_reset(stmt); /* do not keep the read transaction open, this would prevent eg. switching to WAL */
 		if( state == SQLITE_DONE ) {
 			stmt = mrsqlite3_predefine__(ths, INSERT_INTO_config_kv, "INSERT INTO config (keyname, value) VALUES (?, ?);");
 			sqlite3_bind_text (stmt, 1, key,   -1, SQLITE_STATIC);
@@ -516,18 +927,85 @@ int mrsqlite3_set_config__(mrsqlite3_t* ths, const char* key, const char* value)
 		return 0;
 	}
 
+	if( ths->m_transactionCount > 0 && ths->m_config_cache ) {
+		/* others must not see the value before it is committed, see end_config_transaction__() */
+		mrsqlite3configchange_t* change;
+		if( (change=calloc(1, sizeof(mrsqlite3configchange_t)))==NULL ) {
+			exit(75);
+		}
+		change->m_key               = safe_strdup(key);
+		change->m_entry             = value? new_config_entry(value) : NULL;
+		change->m_transaction_level = ths->m_transactionCount;
+		if( ths->m_pending_config == NULL ) {
+			ths->m_pending_config = carray_new(16);
+		}
+		carray_add(ths->m_pending_config, change, NULL);
+	}
+	else {
+		update_config_cache(ths, key, value? new_config_entry(value) : NULL);
+	}
 	return 1;
 }
 
 
+static int get_cached_config(mrsqlite3_t* ths, const char* key, char** ret_value, int32_t* ret_value_int) /* returns 0 if there is no cache */
+{
+	mrsqlite3_t* owner = ths->m_writer? ths->m_writer : ths;
+	chashdatum   k, v;
+	int          cached = 0, i;
+
+	if( ths->m_pending_config && owner->m_config_cache )
+	{
+		/* the writer sees the changes of its own transaction, the newest change wins */
+		for( i = carray_count(ths->m_pending_config)-1; i >= 0; i-- ) {
+			mrsqlite3configchange_t* change = (mrsqlite3configchange_t*)carray_get(ths->m_pending_config, i);
+			if( strcmp(change->m_key, key)==0 ) {
+				if( change->m_entry == NULL ) {
+					return 1;
+				}
+				if( ret_value )     { *ret_value     = safe_strdup(change->m_entry->m_value); }
+				if( ret_value_int ) { *ret_value_int = change->m_entry->m_value_int; }
+				return 2;
+			}
+		}
+	}
+
+	pthread_mutex_lock(&owner->m_config_critical_);
+
+		if( owner->m_config_cache )
+		{
+			k.data = (void*)key;
+			k.len  = strlen(key);
+			if( chash_get(owner->m_config_cache, &k, &v) == 0 ) {
+				if( ret_value )     { *ret_value     = safe_strdup(((mrsqlite3config_t*)v.data)->m_value); }
+				if( ret_value_int ) { *ret_value_int = ((mrsqlite3config_t*)v.data)->m_value_int; }
+				cached = 2;
+			}
+			else {
+				cached = 1; /* key not set, the caller returns the default */
+			}
+		}
+
+	pthread_mutex_unlock(&owner->m_config_critical_);
+
+	return cached;
+}
+
+
 char* mrsqlite3_get_config__(mrsqlite3_t* ths, const char* key, const char* def) /* the returned string must be free()'d, NULL is only returned if def is NULL */
 {
 	sqlite3_stmt* stmt;
+	char*         value = NULL;
 
 	if( !mrsqlite3_is_open(ths) || key == NULL ) {
 		return strdup_keep_null(def);
 	}
 
+	switch( get_cached_config(ths, key, &value, NULL) ) {
+		case 2: return value;
+		case 1: return strdup_keep_null(def);
+	}
+
 	stmt = mrsqlite3_predefine__(ths, SELECT_v_FROM_config_k, SELECT_v_FROM_config_k_STATEMENT);
 	sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
 	if( sqlite3_step(stmt) == SQLITE_ROW )
@@ -535,10 +1013,12 @@ char* mrsqlite3_get_config__(mrsqlite3_t* ths, const char* key, const char* def)
 		const unsigned char* ptr = sqlite3_column_text(stmt, 0); /* Do not pass the pointers returned from sqlite3_column_text(), etc. into sqlite3_free(). */
 		if( ptr )
 		{
-			/* success, fall through below to free objects */
-			return safe_strdup((const char*)ptr);
+			value = safe_strdup((const char*)ptr);
+			sqlite3_reset(stmt);
+			return value;
 		}
 	}
+	sqlite3_reset(stmt);
 
 	/* return the default value */
 	return strdup_keep_null(def);
@@ -547,6 +1027,17 @@ char* mrsqlite3_get_config__(mrsqlite3_t* ths, const char* key, const char* def)
 
 int32_t mrsqlite3_get_config_int__(mrsqlite3_t* ths, const char* key, int32_t def)
 {
+	int32_t value_int = 0;
+
+	if( !mrsqlite3_is_open(ths) || key == NULL ) {
+		return def;
+	}
+
+	switch( get_cached_config(ths, key, NULL, &value_int) ) {
+		case 2: return value_int;
+		case 1: return def;
+	}
+
     char* str = mrsqlite3_get_config__(ths, key, NULL);
     if( str == NULL ) {
 		return def;
@@ -590,6 +1081,37 @@ void mrsqlite3_unlock(mrsqlite3_t* ths)
 }
 
 
+mrsqlite3_t* mrsqlite3_lock_reader(mrsqlite3_t* ths)
+{
+	int          i;
+	mrsqlite3_t* reader;
+
+	/* first, try to get an idle reader without waiting */
+	for( i = 0; i < MR_SQL_READERS; i++ ) {
+		if( (reader=ths->m_readers[i]) != NULL && pthread_mutex_trylock(&reader->m_critical_) == 0 ) {
+			if( reader->m_cobj ) {
+				mrmailbox_wake_lock(reader->m_mailbox);
+				return reader;
+			}
+			pthread_mutex_unlock(&reader->m_critical_);
+		}
+	}
+
+	/* all readers busy - wait for the first one; readers are used for short SELECTs only, so this should not take long */
+	if( (reader=ths->m_readers[0]) != NULL ) {
+		mrsqlite3_lock(reader);
+		if( reader->m_cobj ) {
+			return reader;
+		}
+		mrsqlite3_unlock(reader);
+	}
+
+	/* no pool opened, fall back to the writer */
+	mrsqlite3_lock(ths);
+	return ths;
+}
+
+
 /*******************************************************************************
  * Transactions
  ******************************************************************************/
@@ -608,6 +1130,14 @@ void mrsqlite3_begin_transaction__(mrsqlite3_t* ths)
 			mrsqlite3_log_error(ths, "Cannot begin transaction.");
 		}
 	}
+	else
+	{
+		/* savepoints with the same name are stacked, ROLLBACK TO and RELEASE always refer to the innermost one */
+		stmt = mrsqlite3_predefine__(ths, SAVEPOINT_nested, "SAVEPOINT nested;");
+		if( sqlite3_step(stmt) != SQLITE_DONE ) {
+			mrsqlite3_log_error(ths, "Cannot begin nested transaction.");
+		}
+	}
 }
 
 
@@ -624,7 +1154,18 @@ void mrsqlite3_rollback__(mrsqlite3_t* ths)
 				mrsqlite3_log_error(ths, "Cannot rollback transaction.");
 			}
 		}
+		else
+		{
+			stmt = mrsqlite3_predefine__(ths, ROLLBACK_TO_nested, "ROLLBACK TO nested;"); /* this does not end the savepoint */
+			if( sqlite3_step(stmt) != SQLITE_DONE ) {
+				mrsqlite3_log_error(ths, "Cannot rollback nested transaction.");
+			}
+			stmt = mrsqlite3_predefine__(ths, RELEASE_nested, "RELEASE nested;");
+			sqlite3_step(stmt);
+		}
 
+		end_config_transaction__(ths, ths->m_transactionCount, 0);
+		mrjob_end_transaction__(ths, ths->m_transactionCount, 0);
 		ths->m_transactionCount--;
 	}
 }
@@ -643,7 +1184,16 @@ void mrsqlite3_commit__(mrsqlite3_t* ths)
 				mrsqlite3_log_error(ths, "Cannot commit transaction.");
 			}
 		}
+		else
+		{
+			stmt = mrsqlite3_predefine__(ths, RELEASE_nested, "RELEASE nested;");
+			if( sqlite3_step(stmt) != SQLITE_DONE ) {
+				mrsqlite3_log_error(ths, "Cannot commit nested transaction.");
+			}
+		}
 
+		end_config_transaction__(ths, ths->m_transactionCount, 1);
+		mrjob_end_transaction__(ths, ths->m_transactionCount, 1);
 		ths->m_transactionCount--;
 	}
 }
@@ -53,6 +53,9 @@ enum
 	 BEGIN_transaction = 0 /* must be first */
 	,ROLLBACK_transaction
 	,COMMIT_transaction
+	,SAVEPOINT_nested
+	,RELEASE_nested
+	,ROLLBACK_TO_nested
 
 	,SELECT_v_FROM_config_k
 	,INSERT_INTO_config_kv
@@ -101,7 +104,7 @@ enum
 
 	,SELECT_COUNT_FROM_msgs_WHERE_assigned
 	,SELECT_COUNT_FROM_msgs_WHERE_unassigned
-	,SELECT_COUNT_FROM_msgs_WHERE_state_AND_chat_id
+	,SELECT_fresh_cnt_FROM_chats_WHERE_id
 	,SELECT_COUNT_FROM_msgs_WHERE_chat_id
 	,SELECT_COUNT_FROM_msgs_WHERE_rfc724_mid
 	,SELECT_COUNT_FROM_msgs_WHERE_ft
@@ -114,8 +117,14 @@ enum
 	,SELECT_ss_FROM_msgs_WHERE_m
 	,SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_c
 	,SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_fresh
+	,SELECT_it_FROM_msgs_LEFT_JOIN_contacts_WHERE_c_before
+	,SELECT_it_FROM_msgs_LEFT_JOIN_contacts_WHERE_c_after
+	,SELECT_t_FROM_msgs_WHERE_ic
+	,SELECT_i_FROM_msgs_LEFT_JOIN_contacts_WHERE_ic_since
 	,SELECT_i_FROM_msgs_WHERE_query
 	,SELECT_i_FROM_msgs_WHERE_chat_id_AND_query
+	,SELECT_i_FROM_msgs_WHERE_fts
+	,SELECT_i_FROM_msgs_WHERE_chat_id_AND_fts
 	,INSERT_INTO_msgs_msscftttsmttpb
 	,INSERT_INTO_msgs_mcftttstpb
 	,UPDATE_msgs_SET_chat_id_WHERE_id
@@ -125,6 +134,8 @@ enum
 	,UPDATE_msgs_SET_state_WHERE_chat_id_AND_state
 	,UPDATE_msgs_SET_ss_WHERE_rfc724_mid
 	,UPDATE_msgs_SET_param_WHERE_id
+	,UPDATE_msgs_SET_param_blob_WHERE_id
+	,SELECT_param_FROM_msgs_WHERE_id
 	,DELETE_FROM_msgs_WHERE_id
 	,DELETE_FROM_msgs_WHERE_rfc724_mid
 
@@ -134,8 +145,6 @@ enum
 	,DELETE_FROM_msgs_mdns_WHERE_m
 
 	,INSERT_INTO_jobs_aafp
-	,SELECT_MIN_d_FROM_jobs
-	,SELECT_iafp_FROM_jobs
 	,DELETE_FROM_jobs_WHERE_id
 	,DELETE_FROM_jobs_WHERE_action
 	,UPDATE_jobs_SET_dp_WHERE_id
@@ -152,6 +161,12 @@ enum
 	,SELECT_private_key_FROM_keypairs_ORDER_BY_default
 	,SELECT_public_key_FROM_keypairs_WHERE_default
 
+	,INSERT_INTO_backup_blobs_fz
+
+	,SELECT_name_FROM_blobs_WHERE_unused
+	,SELECT_name_FROM_blobs_WHERE_name_AND_unused
+	,DELETE_FROM_blobs_WHERE_name_AND_unused
+
 	,PREDEFINED_CNT /* must be last */
 };
 
@@ -166,6 +181,7 @@ typedef struct mrsqlite3_t
 
 	/* helper for MrSqlite3Transaction */
 	int           m_transactionCount;
+	carray*       m_pending_jobs; /* jobs added inside the current transaction, queued on commit, see mrjob_end_transaction__() */
 
 	mrmailbox_t*  m_mailbox; /* used for logging and to acquire wakelocks, there may be N mrsqlite_t objects per mrmailbox! In practise, we use 2 on backup, 1 otherwise. */
 
@@ -173,13 +189,45 @@ typedef struct mrsqlite3_t
 	for this purpose, all calls must be enclosed by a locked m_critical; use mrsqlite3_lock() for this purpose */
 	pthread_mutex_t m_critical_;
 
+	/* read-only connections to the same database file, used by mrsqlite3_lock_reader() so that UI queries
+	are not blocked by the writer; the pool is only set up if the database is opened using MR_OPEN_WITH_READERS */
+	#define       MR_SQL_READERS 3
+	struct mrsqlite3_t* m_readers[MR_SQL_READERS];
+	struct mrsqlite3_t* m_writer; /* set for the readers only, they use the config cache of the writer */
+
+	/* the table `config` is loaded to m_config_cache when the database is opened; mrsqlite3_set_config__() keeps the cache
+	up to date and mrsqlite3_get_config__() does not query the database.  The readers use the cache of the writer without
+	locking the writer, so the cache has its own lock.  Until the cache is loaded, eg. during the database updates, the
+	database is queried directly.  Changes done inside a transaction are applied to the cache on commit, until then
+	they are only seen by the writer itself */
+	chash*        m_config_cache; /* key -> mrsqlite3config_t* */
+	pthread_mutex_t m_config_critical_;
+	carray*       m_pending_config; /* mrsqlite3configchange_t objects of the current transaction, guarded by the sql-lock */
+
 } mrsqlite3_t;
 
 
+typedef struct mrsqlite3config_t
+{
+	char*         m_value;
+	int32_t       m_value_int; /* the value as read by mrsqlite3_get_config_int__(), parsed once */
+} mrsqlite3config_t;
+
+
+typedef struct mrsqlite3configchange_t
+{
+	char*              m_key;
+	mrsqlite3config_t* m_entry; /* NULL if the key is deleted */
+	int                m_transaction_level;
+} mrsqlite3configchange_t;
+
+
 mrsqlite3_t*  mrsqlite3_new              (mrmailbox_t*);
 void          mrsqlite3_unref            (mrsqlite3_t*);
 
 #define       MR_OPEN_READONLY           0x01
+#define       MR_OPEN_WITH_READERS       0x02 /* switch to WAL and open a pool of read-only connections, see mrsqlite3_lock_reader() */
+#define       MR_SQL_BUSY_TIMEOUT_MS     10000
 int           mrsqlite3_open__           (mrsqlite3_t*, const char* dbfile, int flags);
 
 void          mrsqlite3_close__          (mrsqlite3_t*);
@@ -190,12 +238,14 @@ int           mrsqlite3_set_config__     (mrsqlite3_t*, const char* key, const c
 int           mrsqlite3_set_config_int__ (mrsqlite3_t*, const char* key, int32_t value);
 char*         mrsqlite3_get_config__     (mrsqlite3_t*, const char* key, const char* def); /* the returned string must be free()'d, returns NULL on errors */
 int32_t       mrsqlite3_get_config_int__ (mrsqlite3_t*, const char* key, int32_t def);
+void          mrsqlite3_reload_config__  (mrsqlite3_t*); /* must be called if the table `config` is modified without mrsqlite3_set_config__() */
 
 /* tools, these functions are compatible to the corresponding sqlite3_* functions */
 sqlite3_stmt* mrsqlite3_predefine__      (mrsqlite3_t*, size_t idx, const char* sql); /*the result is resetted as needed and must not be freed. CAVE: you must not call this function with different strings for the same index!*/
 sqlite3_stmt* mrsqlite3_prepare_v2_      (mrsqlite3_t*, const char* sql); /* the result mus be freed using sqlite3_finalize() */
 int           mrsqlite3_execute__        (mrsqlite3_t*, const char* sql);
 int           mrsqlite3_table_exists__   (mrsqlite3_t*, const char* name);
+int           mrsqlite3_create_search_index__(mrsqlite3_t*); /* create or rebuild the full-text index msgs_fts, sets the config-key `search_index` on success */
 void          mrsqlite3_log_error        (mrsqlite3_t*, const char* msg, ...);
 
 /* reset all predefined statements, this is needed only in very rare cases, eg. when dropping a table and there are pending statements */
@@ -208,7 +258,12 @@ Low-level-functions, eg. the MrSqlite3-methods, do not lock. */
 void          mrsqlite3_lock             (mrsqlite3_t*); /* lock or wait; these calls must not be nested in a single thread */
 void          mrsqlite3_unlock           (mrsqlite3_t*);
 
-/* nestable transactions, only the outest is really used */
+/* lock a free read-only connection from the pool and return it; if there is no pool, the writer itself is locked and returned.
+in any case, the returned object must be released using mrsqlite3_unlock().
+The returned connection must be used for SELECT-statements only and the caller must not lock the writer while holding the reader. */
+mrsqlite3_t*  mrsqlite3_lock_reader      (mrsqlite3_t*);
+
+/* nestable transactions, the outest is a real transaction, the inner ones are savepoints that can be rolled back independently */
 void          mrsqlite3_begin_transaction__(mrsqlite3_t*);
 void          mrsqlite3_commit__           (mrsqlite3_t*);
 void          mrsqlite3_rollback__         (mrsqlite3_t*);
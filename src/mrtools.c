@@ -29,10 +29,13 @@
 #include <string.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sqlite3.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
 #include <sys/types.h> /* for getpid() */
 #include <unistd.h>    /* for getpid() */
 #include <libetpan/libetpan.h>
@@ -464,12 +467,65 @@ char* mr_arr_to_string(const uint32_t* arr, int cnt)
 	if( ret == NULL ) { exit(35); }
 	ret[0] = 0;
 
-	int i;
+	int   i;
+	char* p = ret; /* append at the end instead of strcat() which would be quadratic for long arrays */
 	for( i=0; i<cnt; i++ ) {
-		if( i ) {
-			strcat(ret, ",");
+		p += sprintf(p, i? ",%lu" : "%lu", (unsigned long)arr[i]);
+	}
+
+	return ret;
+}
+
+
+static int compare_idpos(const void* p1, const void* p2)
+{
+	const mridpos_t* a = (const mridpos_t*)p1;
+	const mridpos_t* b = (const mridpos_t*)p2;
+	if( a->m_id != b->m_id ) {
+		return a->m_id < b->m_id? -1 : 1;
+	}
+	return a->m_pos - b->m_pos;
+}
+
+
+mridpos_t* mr_sort_ids(const uint32_t* ids, int cnt)
+{
+	/* return the IDs together with their original positions, sorted by ID; used to join the
+	results of a "WHERE id IN(...) ORDER BY id" query with an unsorted ID-array */
+	mridpos_t* ret;
+	int        i;
+
+	if( (ret=malloc(sizeof(mridpos_t)*(cnt>0? cnt : 1)))==NULL ) {
+		exit(36);
+	}
+
+	for( i=0; i<cnt; i++ ) {
+		ret[i].m_id  = ids[i];
+		ret[i].m_pos = i;
+	}
+
+	qsort(ret, cnt, sizeof(mridpos_t), compare_idpos);
+	return ret;
+}
+
+
+char* mr_idpos_to_string(const mridpos_t* arr, int cnt)
+{
+	/* return comma-separated value-string from the sorted IDs, duplicates are skipped */
+	if( arr==NULL || cnt <= 0 ) {
+		return safe_strdup("");
+	}
+
+	char* ret = malloc(cnt*12+1);
+	if( ret == NULL ) { exit(35); }
+	ret[0] = 0;
+
+	int   i;
+	char* p = ret;
+	for( i=0; i<cnt; i++ ) {
+		if( i==0 || arr[i].m_id!=arr[i-1].m_id ) {
+			p += sprintf(p, p!=ret? ",%lu" : "%lu", (unsigned long)arr[i].m_id);
 		}
-		sprintf(&ret[strlen(ret)], "%lu", (unsigned long)arr[i]);
 	}
 
 	return ret;
@@ -1264,6 +1320,15 @@ time_t mr_timestamp_from_date(struct mailimf_date_time * date_time) /* from mail
 }
 
 
+double mr_now_ms(void)
+{
+	/* wall-clock time in milliseconds, used to measure durations for logging and statistics */
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec*1000.0 + (double)tv.tv_usec/1000.0;
+}
+
+
 long mr_gm2local_offset(void)
 {
 	/* returns the offset that must be _added_ to an UTC/GMT-time to create the localtime.
@@ -1333,43 +1398,42 @@ struct mailimap_date_time* mr_timestamp_to_mailimap_date_time(time_t timeval)
  ******************************************************************************/
 
 
-static time_t s_last_smeared_timestamp = 0;
-#define MR_MAX_SECONDS_TO_LEND_FROM_FUTURE   5
+#define MR_MAX_SECONDS_TO_LEND_FROM_FUTURE   5 /* the last timestamp handed out is kept per mailbox and guarded by its sql-lock */
 
 
-time_t mr_create_smeared_timestamp__(void)
+time_t mr_create_smeared_timestamp__(mrmailbox_t* mailbox)
 {
 	time_t now = time(NULL);
 	time_t ret = now;
-	if( ret <= s_last_smeared_timestamp ) {
-		ret = s_last_smeared_timestamp+1;
+	if( ret <= mailbox->m_last_smeared_timestamp ) {
+		ret = mailbox->m_last_smeared_timestamp+1;
 		if( (ret-now) > MR_MAX_SECONDS_TO_LEND_FROM_FUTURE ) {
 			ret = now + MR_MAX_SECONDS_TO_LEND_FROM_FUTURE;
 		}
 	}
-	s_last_smeared_timestamp = ret;
+	mailbox->m_last_smeared_timestamp = ret;
 	return ret;
 }
 
 
-time_t mr_create_smeared_timestamps__(int count)
+time_t mr_create_smeared_timestamps__(mrmailbox_t* mailbox, int count)
 {
 	/* get a range to timestamps that can be used uniquely */
 	time_t now = time(NULL);
 	time_t start = now + MR_MIN(count, MR_MAX_SECONDS_TO_LEND_FROM_FUTURE) - count;
-	start = MR_MAX(s_last_smeared_timestamp+1, start);
+	start = MR_MAX(mailbox->m_last_smeared_timestamp+1, start);
 
-	s_last_smeared_timestamp = start+(count-1);
+	mailbox->m_last_smeared_timestamp = start+(count-1);
 	return start;
 }
 
 
-time_t mr_smeared_time__(void)
+time_t mr_smeared_time__(mrmailbox_t* mailbox)
 {
 	/* function returns a corrected time(NULL) */
 	time_t now = time(NULL);
-	if( s_last_smeared_timestamp >= now ) {
-		now = s_last_smeared_timestamp+1;
+	if( mailbox->m_last_smeared_timestamp >= now ) {
+		now = mailbox->m_last_smeared_timestamp+1;
 	}
 	return now;
 }
@@ -1702,8 +1766,7 @@ char* mr_get_fine_pathNfilename(const char* folder, const char* desired_filename
 {
 	char*       ret = NULL, *filenameNsuffix, *basename = NULL, *dotNSuffix = NULL;
 	time_t      now = time(NULL);
-	struct stat st;
-	int         i;
+	int         i, fd;
 
 	filenameNsuffix = safe_strdup(desired_filenameNsuffix__);
 	mr_validate_filename(filenameNsuffix);
@@ -1717,8 +1780,12 @@ char* mr_get_fine_pathNfilename(const char* folder, const char* desired_filename
 		else {
 			ret = mr_mprintf("%s/%s%s", folder, basename, dotNSuffix);
 		}
-		if (stat(ret, &st) == -1) {
-			goto cleanup; /* fine filename found */
+		if( (fd=open(ret, O_WRONLY|O_CREAT|O_EXCL, 0666)) >= 0 ) {
+			close(fd); /* fine filename found; the empty file reserves it, so several threads never get the same name */
+			goto cleanup;
+		}
+		else if( errno != EEXIST ) {
+			goto cleanup; /* the error is reported when the caller writes the file */
 		}
 		free(ret); /* try over with the next index */
 		ret = NULL;
@@ -1795,6 +1862,52 @@ cleanup:
 }
 
 
+int mr_mmap_file(const char* pathNfilename, void** buf, size_t* buf_bytes, mrmailbox_t* log)
+{
+	/* unlike mr_read_file(), the data are not copied to the heap; the pages are loaded on demand and can be
+	dropped by the system at any time, so this is the way to go for large files. The data are _not_ null-terminated. */
+	int         fd = -1;
+	struct stat st;
+	void*       mapped;
+
+	if( pathNfilename==NULL || buf==NULL || buf_bytes==NULL ) {
+		return 0;
+	}
+
+	*buf = NULL;
+	*buf_bytes = 0;
+
+	if( (fd=open(pathNfilename, O_RDONLY))<0 ) {
+		mrmailbox_log_warning(log, 0, "Cannot open \"%s\" for mapping.", pathNfilename);
+		return 0;
+	}
+
+	if( fstat(fd, &st)!=0 || st.st_size<=0 ) {
+		close(fd);
+		return 0;
+	}
+
+	mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); /* the mapping stays valid */
+	if( mapped==MAP_FAILED ) {
+		mrmailbox_log_warning(log, 0, "Cannot map \"%s\".", pathNfilename);
+		return 0;
+	}
+
+	*buf = mapped;
+	*buf_bytes = (size_t)st.st_size;
+	return 1;
+}
+
+
+void mr_munmap_file(void* buf, size_t buf_bytes)
+{
+	if( buf ) {
+		munmap(buf, buf_bytes);
+	}
+}
+
+
 int mr_get_filemeta(const void* buf_start, size_t buf_bytes, uint32_t* ret_width, uint32_t *ret_height)
 {
 	/* Strategy:
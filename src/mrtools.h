@@ -57,6 +57,10 @@ carray* mr_split_into_lines        (const char* buf_terminated); /* split string
 void    mr_free_splitted_lines     (carray* lines);
 char*   mr_insert_breaks           (const char*, int break_every, const char* break_chars); /* insert a break every n characters, the return must be free()'d */
 char*   mr_arr_to_string           (const uint32_t*, int cnt);
+typedef struct mridpos_t { uint32_t m_id; int m_pos; } mridpos_t;
+#define MR_BULK_LOAD_CHUNK         500 /* max. number of IDs in a single "WHERE id IN(...)" query */
+mridpos_t* mr_sort_ids             (const uint32_t*, int cnt); /* the result must be free()'d */
+char*   mr_idpos_to_string         (const mridpos_t*, int cnt); /* like mr_arr_to_string() for sorted IDs, duplicates are skipped */
 char*   mr_decode_header_string    (const char*); /* the result must be free()'d */
 char*   mr_encode_header_string    (const char*); /* the result must be free()'d */
 char*   imap_modified_utf7_to_utf8 (const char *mbox, int change_spaces);
@@ -88,11 +92,12 @@ time_t                     mr_timestamp_from_date             (struct mailimf_da
 char*                      mr_timestamp_to_str                (time_t); /* the return value must be free()'d */
 struct mailimap_date_time* mr_timestamp_to_mailimap_date_time (time_t);
 long                       mr_gm2local_offset                 (void);
+double                     mr_now_ms                          (void);
 
 /* timesmearing */
-time_t mr_smeared_time__             (void);
-time_t mr_create_smeared_timestamp__ (void);
-time_t mr_create_smeared_timestamps__(int count);
+time_t mr_smeared_time__             (mrmailbox_t*);
+time_t mr_create_smeared_timestamp__ (mrmailbox_t*);
+time_t mr_create_smeared_timestamps__(mrmailbox_t*, int count);
 
 /* Message-ID tools */
 #define MR_VALID_ID_LEN 11
@@ -113,10 +118,13 @@ int     mr_copy_file               (const char* src_pathNFilename, const char* d
 int     mr_create_folder           (const char* pathNfilename, mrmailbox_t* log);
 int     mr_write_file              (const char* pathNfilename, const void* buf, size_t buf_bytes, mrmailbox_t* log);
 int     mr_read_file               (const char* pathNfilename, void** buf, size_t* buf_bytes, mrmailbox_t* log);
+int     mr_mmap_file               (const char* pathNfilename, void** buf, size_t* buf_bytes, mrmailbox_t* log); /* read-only mapping, must be released using mr_munmap_file() */
+void    mr_munmap_file             (void* buf, size_t buf_bytes);
 char*   mr_get_filesuffix_lc       (const char* pathNfilename); /* the returned suffix is lower-case */
 void    mr_split_filename          (const char* pathNfilename, char** ret_basename, char** ret_all_suffixes_incl_dot); /* the case of the suffix is preserved! */
 int     mr_get_filemeta            (const void* buf, size_t buf_bytes, uint32_t* ret_width, uint32_t *ret_height);
-char*   mr_get_fine_pathNfilename  (const char* folder, const char* desired_name);
+char*   mr_get_fine_pathNfilename  (const char* folder, const char* desired_name); /* creates an empty file with a unique name and returns its path */
+void    mr_validate_filename       (char* filename); /* replaces characters not valid in filenames by `-` */
 
 /* macros */
 #define MR_QUOTEHELPER(name) #name
@@ -74,6 +74,16 @@ void stress_functions(mrmailbox_t* mailbox)
 		assert( strcmp(plain, "<>\"'& äÄöÖüÜß fooÆçÇ ♦&noent;")==0 );
 		free(plain);
 
+		html = "<a =x href=url>text</a>"; /* check attribute without name */
+		plain = mrsimplify_simplify(simplify, html, strlen(html), 1);
+		assert( strcmp(plain, "[text](url)")==0 );
+		free(plain);
+
+		html = "<b>bold</b>&#65;&#x263a;"; /* check that the text is not read beyond the given bytes */
+		plain = mrsimplify_simplify(simplify, html, 11, 1);
+		assert( strcmp(plain, "*bold*")==0 );
+		free(plain);
+
 		mrsimplify_unref(simplify);
 	}
 
@@ -194,6 +204,31 @@ void stress_functions(mrmailbox_t* mailbox)
         free(buf1); free(buf2);
 
         mr_replace_bad_utf8_chars(NULL); /* should do nothing */
+
+		uint32_t   ids[] = { 7, 3, 0xFFFFFFFF, 3, 1 };
+		mridpos_t* sorted = mr_sort_ids(ids, 5);
+		assert( sorted[0].m_id==1          && sorted[0].m_pos==4 );
+		assert( sorted[1].m_id==3          && sorted[1].m_pos==1 ); /* equal IDs keep their order */
+		assert( sorted[2].m_id==3          && sorted[2].m_pos==3 );
+		assert( sorted[3].m_id==7          && sorted[3].m_pos==0 );
+		assert( sorted[4].m_id==0xFFFFFFFF && sorted[4].m_pos==2 ); /* unsigned, not sorted as -1 */
+
+		str = mr_idpos_to_string(sorted, 5);
+		assert( strcmp(str, "1,3,7,4294967295")==0 ); /* duplicates are skipped */
+		free(str);
+
+		str = mr_idpos_to_string(&sorted[1], 2);
+		assert( strcmp(str, "3")==0 );
+		free(str);
+
+		str = mr_idpos_to_string(sorted, 0);
+		assert( strcmp(str, "")==0 );
+		free(str);
+		free(sorted);
+
+		sorted = mr_sort_ids(ids, 0); /* must not return NULL */
+		assert( sorted != NULL );
+		free(sorted);
 	}
 
 	/* test mrparam
@@ -217,14 +252,58 @@ void stress_functions(mrmailbox_t* mailbox)
 		mrparam_set_int(p1, 'b', 2);
 		mrparam_set    (p1, 'c', NULL);
 		mrparam_set_int(p1, 'd', 4);
-		assert( strcmp(p1->m_packed, "a=foo\nb=2\nd=4")==0 );
+		assert( strcmp(mrparam_get_packed(p1), "a=foo\nb=2\nd=4")==0 );
 
 		mrparam_set    (p1, 'b', NULL);
-		assert( strcmp(p1->m_packed, "a=foo\nd=4")==0 );
+		assert( strcmp(mrparam_get_packed(p1), "a=foo\nd=4")==0 );
 
 		mrparam_set    (p1, 'a', NULL);
 		mrparam_set    (p1, 'd', NULL);
-		assert( strcmp(p1->m_packed, "")==0 );
+		assert( strcmp(mrparam_get_packed(p1), "")==0 );
+
+		mrparam_unref(p1);
+	}
+
+	{
+		mrparam_t* p1 = mrparam_new();
+
+		/* duplicate keys: the first one wins, the others are dropped when the string is packed again */
+		mrparam_set_packed(p1, "a=1\nb=2\na=3");
+		assert( mrparam_get_int(p1, 'a', 0)==1 );
+		assert( strcmp(mrparam_get_packed(p1), "a=1\nb=2\na=3")==0 ); /* unchanged as long as nothing is set */
+		mrparam_set_int(p1, 'b', 5);
+		assert( strcmp(mrparam_get_packed(p1), "a=1\nb=5")==0 );
+
+		/* malformed lines are ignored, empty values and values containing "=" are fine */
+		mrparam_set_packed(p1, "x\n=1\nab=2\n a=3\nb=\r\nc=d=e\r\n\n");
+		assert( mrparam_exists (p1, 'x')==0 );
+		assert( mrparam_exists (p1, 'a')==0 );
+		assert( mrparam_exists (p1, 'b')==1 );
+		assert( strcmp(mrparam_peek(p1, 'b', "def"), "")==0 );
+		assert( strcmp(mrparam_peek(p1, 'c', NULL), "d=e")==0 ); /* `\r` is trimmed */
+		assert( mrparam_peek(p1, 'd', NULL)==NULL );
+		assert( mrparam_peek(p1, 0, NULL)==NULL );
+		assert( mrparam_peek(p1, '\n', NULL)==NULL );
+
+		/* peek after set: overwritten, added and removed keys; the remaining keys are still found */
+		mrparam_set_packed(p1, "a=1\nb=2\nc=3");
+		assert( strcmp(mrparam_peek(p1, 'b', NULL), "2")==0 );
+		mrparam_set(p1, 'b', "two");
+		assert( strcmp(mrparam_peek(p1, 'b', NULL), "two")==0 );
+		mrparam_set(p1, 'd', "4");
+		assert( strcmp(mrparam_peek(p1, 'd', NULL), "4")==0 );
+		mrparam_set(p1, 'a', NULL);
+		assert( mrparam_peek(p1, 'a', NULL)==NULL );
+		assert( strcmp(mrparam_peek(p1, 'b', NULL), "two")==0 );
+		assert( strcmp(mrparam_peek(p1, 'c', NULL), "3")==0 );
+		assert( strcmp(mrparam_peek(p1, 'd', NULL), "4")==0 );
+		assert( strcmp(mrparam_get_packed(p1), "b=two\nc=3\nd=4")==0 );
+		mrparam_set(p1, 'a', "1"); /* appended, the position of the other keys is kept */
+		assert( strcmp(mrparam_get_packed(p1), "b=two\nc=3\nd=4\na=1")==0 );
+
+		/* set_packed(NULL) and empty() drop everything */
+		mrparam_set_packed(p1, NULL);
+		assert( mrparam_exists(p1, 'a')==0 && strcmp(mrparam_get_packed(p1), "")==0 );
 
 		mrparam_unref(p1);
 	}